@@ -0,0 +1,455 @@
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "chatclient.h"
+
+#define NO_BATCH ((size_t) -1)
+#define READ_CHUNK 65536
+
+enum {
+    STATE_IDLE = 0,
+    STATE_CONNECTING, // connect() laeuft, der LoginRequest wartet im Puffer
+    STATE_LOGIN, // Verbunden, Antwort steht aus
+    STATE_READY,
+    STATE_CLOSED
+};
+
+struct ChatClient {
+    int fd;
+    int state;
+    uint8_t version;
+    char name[32];
+    ChatClientCallbacks callbacks;
+    void *user;
+
+    //- Ausgang: [outSent, outLen) wartet; ein offener Batch liegt immer am Ende -//
+    unsigned char *out;
+    size_t outLen;
+    size_t outSent;
+    size_t outCapacity;
+    size_t batchStart; // Offset des offenen BatchHeader oder NO_BATCH
+    unsigned int batchFrames;
+
+    //- Eingang: unvollstaendige Frames bleiben bis zum naechsten recv() liegen -//
+    unsigned char *in;
+    size_t inLen;
+    size_t inCapacity;
+
+    //- Fortsetzbare Sitzung: Token und naechste Nummer aus MT_SESSION bzw. MT_SEQUENCE -//
+    int session;
+    unsigned char token[16];
+    uint64_t seq;
+
+    ChatClientStats stats;
+};
+
+static uint64_t read_be64(const unsigned char *p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value = value << 8 | p[i];
+    return value;
+}
+
+static uint16_t read_be16(const unsigned char *p) {
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static uint32_t read_be32(const unsigned char *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static int reserve(unsigned char **buffer, size_t *capacity, const size_t need) {
+    if (need <= *capacity) return 0;
+    size_t grown = *capacity ? *capacity : 4096;
+    while (grown < need) grown *= 2;
+    unsigned char *p = realloc(*buffer, grown);
+    if (p == NULL) return -1;
+    *buffer = p;
+    *capacity = grown;
+    return 0;
+}
+
+//- Feste Namensfelder sind nicht immer nullterminiert -//
+static void copy_name(char *dest, const unsigned char *src, const size_t len) {
+    const size_t n = strnlen((const char *) src, len > 31 ? 31 : len);
+    memcpy(dest, src, n);
+    dest[n] = '\0';
+}
+
+static void client_close(ChatClient *client, const int error) {
+    if (client->state == STATE_CLOSED) return;
+    if (client->fd != -1) close(client->fd);
+    client->fd = -1;
+    client->state = STATE_CLOSED;
+    client->outLen = client->outSent = 0;
+    client->batchStart = NO_BATCH;
+    if (client->callbacks.closed != NULL) client->callbacks.closed(client, error, client->user);
+}
+
+ChatClient *chatClientCreate(const ChatClientCallbacks *callbacks, void *user) {
+    ChatClient *client = calloc(1, sizeof(ChatClient));
+    if (client == NULL) return NULL;
+    client->fd = -1;
+    client->batchStart = NO_BATCH;
+    if (callbacks != NULL) client->callbacks = *callbacks;
+    client->user = user;
+    return client;
+}
+
+void chatClientDestroy(ChatClient *client) {
+    if (client == NULL) return;
+    if (client->fd != -1) close(client->fd);
+    free(client->out);
+    free(client->in);
+    free(client);
+}
+
+//--- Nicht blockierender Socket zum Ziel; getaddrinfo selbst kann bei DNS Namen warten ---//
+static int open_socket(const char *host, const char *port) {
+    if (strncmp(host, "unix:", 5) == 0) {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        if (strlen(host + 5) >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(addr.sun_path, host + 5);
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) return -1;
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 && errno != EINPROGRESS) {
+            const int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        return fd;
+    }
+
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *result;
+    if (getaddrinfo(host, port, &hints, &result) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    int fd = -1;
+    for (const struct addrinfo *ai = result; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd == -1) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS) {
+            const int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); //- Gebuendelt wird im Puffer, nicht vom Kernel -//
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+int chatClientConnect(ChatClient *client, const char *host, const char *port, const char *name,
+                      const uint8_t version) {
+    const size_t nameLen = strnlen(name, 32);
+    if (client->state != STATE_IDLE || nameLen == 0 || nameLen > 31 || (version & ~PROT_FLAG_SESSION) > PROT_VERSION) {
+        errno = EINVAL;
+        return -1;
+    }
+    client->fd = open_socket(host, port);
+    if (client->fd == -1) return -1;
+    client->state = STATE_CONNECTING;
+    client->version = (uint8_t) (version & ~PROT_FLAG_SESSION);
+    memcpy(client->name, name, nameLen);
+    client->name[nameLen] = '\0';
+
+    //- RFC: Header + Magic(4) + Version(1) + Name(var); geht raus, sobald connect fertig ist -//
+    if (reserve(&client->out, &client->outCapacity, sizeof(Header) + 5 + nameLen) == -1) {
+        client_close(client, ENOMEM);
+        return -1;
+    }
+    unsigned char *p = client->out;
+    const uint16_t length = htons((uint16_t) (5 + nameLen));
+    const uint32_t magic = htonl(MAGIC_REQUEST);
+    p[0] = MT_LOGIN_REQUEST;
+    memcpy(p + 1, &length, 2);
+    memcpy(p + 3, &magic, 4);
+    p[7] = version;
+    memcpy(p + 8, name, nameLen);
+    client->outLen = sizeof(Header) + 5 + nameLen;
+    return 0;
+}
+
+//--- Wie chatClientConnect, aber mit LoginResumeBody: Name, Token und die naechste erwartete Nummer ---//
+int chatClientResume(ChatClient *client, const char *host, const char *port) {
+    if (client->state != STATE_CLOSED || !client->session) {
+        errno = EINVAL;
+        return -1;
+    }
+    client->fd = open_socket(host, port);
+    if (client->fd == -1) return -1;
+    client->state = STATE_CONNECTING;
+    client->inLen = 0;
+
+    LoginResumeBody body = {0};
+    const Header hdr = {.type = MT_LOGIN_REQUEST, .length = htons(sizeof(body))};
+    body.magic = htonl(MAGIC_REQUEST);
+    body.version = (uint8_t) (client->version | PROT_FLAG_SESSION);
+    memcpy(body.name, client->name, sizeof(body.name));
+    memcpy(body.token, client->token, sizeof(body.token));
+    for (int i = 0; i < 8; i++) ((unsigned char *) &body.seq)[i] = (unsigned char) (client->seq >> (56 - 8 * i));
+    if (reserve(&client->out, &client->outCapacity, sizeof(hdr) + sizeof(body)) == -1) {
+        client_close(client, ENOMEM);
+        return -1;
+    }
+    memcpy(client->out, &hdr, sizeof(hdr));
+    memcpy(client->out + sizeof(hdr), &body, sizeof(body));
+    client->outLen = sizeof(hdr) + sizeof(body);
+    return 0;
+}
+
+uint64_t chatClientSequence(const ChatClient *client) {
+    return client->session ? client->seq : 0;
+}
+
+int chatClientFd(const ChatClient *client) {
+    return client->fd;
+}
+
+int chatClientReady(const ChatClient *client) {
+    if (client->state == STATE_CLOSED) return -1;
+    return client->state == STATE_READY;
+}
+
+int chatClientWantWrite(const ChatClient *client) {
+    return client->state == STATE_CONNECTING || client->outSent < client->outLen;
+}
+
+size_t chatClientPending(const ChatClient *client) {
+    return client->outLen - client->outSent;
+}
+
+void chatClientGetStats(const ChatClient *client, ChatClientStats *stats) {
+    *stats = client->stats;
+}
+
+//- Ein Container mit nur einem Frame waere fuenf Bytes laenger als der Frame selbst -//
+static void close_batch(ChatClient *client) {
+    if (client->batchStart == NO_BATCH) return;
+    if (client->batchFrames == 1) {
+        unsigned char *start = client->out + client->batchStart;
+        memmove(start, start + sizeof(BatchHeader), client->outLen - client->batchStart - sizeof(BatchHeader));
+        client->outLen -= sizeof(BatchHeader);
+    } else {
+        client->stats.batchesSent++;
+    }
+    client->batchStart = NO_BATCH;
+}
+
+//--- Version 1: aufeinanderfolgende Nachrichten landen im selben Container, bis der Flush ihn abschliesst ---//
+int chatClientSend(ChatClient *client, const char *text, const size_t len) {
+    if (client->state == STATE_IDLE || client->state == STATE_CLOSED || len > 512) {
+        errno = client->state == STATE_CLOSED ? ENOTCONN : EINVAL;
+        return -1;
+    }
+    const int batched = client->version >= PROT_VERSION_BATCH;
+    if (batched && client->batchStart != NO_BATCH
+        && client->outLen - client->batchStart - sizeof(BatchHeader) + sizeof(Header) + len > BATCH_MAX_BYTES) {
+        close_batch(client); //- Der Server nimmt keinen groesseren Container an -//
+    }
+    const int openBatch = batched && client->batchStart == NO_BATCH;
+    const size_t need = client->outLen + (openBatch ? sizeof(BatchHeader) : 0) + sizeof(Header) + len;
+    if (reserve(&client->out, &client->outCapacity, need) == -1) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (openBatch) {
+        client->batchStart = client->outLen;
+        client->batchFrames = 0;
+        client->out[client->outLen] = MT_BATCH;
+        client->outLen += sizeof(BatchHeader);
+    }
+
+    unsigned char *p = client->out + client->outLen;
+    const uint16_t length = htons((uint16_t) len);
+    p[0] = MT_CLIENT_TO_SERVER;
+    memcpy(p + 1, &length, 2);
+    memcpy(p + sizeof(Header), text, len);
+    client->outLen += sizeof(Header) + len;
+    client->stats.framesSent++;
+
+    if (batched) {
+        const uint32_t batchLen = htonl((uint32_t) (client->outLen - client->batchStart - sizeof(BatchHeader)));
+        memcpy(client->out + client->batchStart + 1, &batchLen, 4);
+        client->batchFrames++;
+    }
+    return 0;
+}
+
+int chatClientFlush(ChatClient *client) {
+    if (client->state == STATE_CLOSED) return -1;
+    if (client->state == STATE_CONNECTING || client->state == STATE_IDLE) return 0; //- Erst nach connect -//
+    close_batch(client);
+
+    while (client->outSent < client->outLen) {
+        const ssize_t res = send(client->fd, client->out + client->outSent, client->outLen - client->outSent,
+                                 MSG_NOSIGNAL);
+        if (res == -1 && errno == EINTR) continue;
+        if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (res <= 0) {
+            client_close(client, errno);
+            return -1;
+        }
+        client->outSent += (size_t) res;
+        client->stats.bytesSent += (uint64_t) res;
+        client->stats.writes++;
+    }
+    if (client->outSent == client->outLen) client->outSent = client->outLen = 0;
+    return 0;
+}
+
+//--- Ein Frame, auch aus einem Container; die Callbacks bekommen nullterminierte Kopien ---//
+static void dispatch(ChatClient *client, const uint8_t type, const unsigned char *body, const size_t len) {
+    client->stats.framesReceived++;
+    char name[32];
+    switch (type) {
+        case MT_LOGIN_RESPONSE: {
+            if (len < 5 || read_be32(body) != MAGIC_RESPONSE) {
+                client_close(client, EPROTO); //- Kompression wird nie angefragt -//
+                return;
+            }
+            const uint8_t code = body[4];
+            copy_name(name, body + 5, len - 5);
+            if (code == LC_SUCCESS) client->state = STATE_READY;
+            if (client->callbacks.loginResult != NULL) client->callbacks.loginResult(client, code, name, client->user);
+            break;
+        }
+        case MT_SERVER_TO_CLIENT: {
+            if (len < 40 || client->callbacks.message == NULL) return;
+            char text[513];
+            const size_t textLen = len - 40 > 512 ? 512 : len - 40;
+            memcpy(text, body + 40, textLen);
+            text[textLen] = '\0';
+            copy_name(name, body + 8, 32);
+            client->callbacks.message(client, read_be64(body), name, text, textLen, client->user);
+            break;
+        }
+        case MT_USER_ADDED:
+            if (len < 8 || client->callbacks.userAdded == NULL) return;
+            copy_name(name, body + 8, len - 8);
+            client->callbacks.userAdded(client, read_be64(body), name, client->user);
+            break;
+        case MT_USER_REMOVED:
+            if (len < 9 || client->callbacks.userRemoved == NULL) return;
+            copy_name(name, body + 9, len - 9);
+            client->callbacks.userRemoved(client, read_be64(body), body[8], name, client->user);
+            break;
+        case MT_SESSION:
+            if (len < 24) return;
+            memcpy(client->token, body, sizeof(client->token));
+            client->seq = read_be64(body + 16);
+            client->session = 1;
+            break;
+        case MT_SEQUENCE:
+            if (len >= 8) client->seq = read_be64(body);
+            break;
+        default:
+            break; //- Unbekannte Typen ueberspringen, die Laenge stimmt trotzdem -//
+    }
+}
+
+static void parse(ChatClient *client) {
+    size_t offset = 0;
+    while (client->state != STATE_CLOSED && client->inLen - offset >= sizeof(Header)) {
+        const unsigned char *p = client->in + offset;
+        if (p[0] == MT_BATCH) {
+            if (client->inLen - offset < sizeof(BatchHeader)) break;
+            const uint32_t batchLen = read_be32(p + 1);
+            if (client->inLen - offset < sizeof(BatchHeader) + batchLen) break;
+            size_t inner = sizeof(BatchHeader);
+            while (client->state != STATE_CLOSED && inner + sizeof(Header) <= sizeof(BatchHeader) + batchLen) {
+                const uint16_t frameLen = read_be16(p + inner + 1);
+                if (inner + sizeof(Header) + frameLen > sizeof(BatchHeader) + batchLen) break;
+                dispatch(client, p[inner], p + inner + sizeof(Header), frameLen);
+                inner += sizeof(Header) + frameLen;
+            }
+            offset += sizeof(BatchHeader) + batchLen;
+            continue;
+        }
+        const uint16_t frameLen = read_be16(p + 1);
+        if (client->inLen - offset < sizeof(Header) + frameLen) break;
+        dispatch(client, p[0], p + sizeof(Header), frameLen);
+        offset += sizeof(Header) + frameLen;
+    }
+    if (client->state == STATE_CLOSED) {
+        client->inLen = 0;
+        return;
+    }
+    memmove(client->in, client->in + offset, client->inLen - offset);
+    client->inLen -= offset;
+}
+
+int chatClientProcess(ChatClient *client, const short revents) {
+    if (client->state == STATE_CLOSED) return -1;
+
+    if (client->state == STATE_CONNECTING && (revents & (POLLOUT | POLLERR | POLLHUP))) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1) error = errno;
+        if (error != 0) {
+            client_close(client, error);
+            return -1;
+        }
+        client->state = STATE_LOGIN;
+    }
+
+    if (revents & (POLLIN | POLLHUP | POLLERR)) {
+        while (1) {
+            if (reserve(&client->in, &client->inCapacity, client->inLen + READ_CHUNK) == -1) break;
+            const ssize_t res = recv(client->fd, client->in + client->inLen, client->inCapacity - client->inLen, 0);
+            if (res == -1 && errno == EINTR) continue;
+            if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (res <= 0) {
+                parse(client); //- Was vor dem Schliessen kam, zB die Ablehnung des Logins -//
+                client_close(client, res == 0 ? 0 : errno);
+                return -1;
+            }
+            client->inLen += (size_t) res;
+            client->stats.bytesReceived += (uint64_t) res;
+            client->stats.reads++;
+            if ((size_t) res < READ_CHUNK) break; //- Socket ist leer, ein weiteres recv() liefe nur in EAGAIN -//
+        }
+        parse(client);
+    }
+    return chatClientFlush(client);
+}
+
+int chatClientPoll(ChatClient *const *clients, const size_t count, const int timeoutMs) {
+    struct pollfd stackFds[64];
+    struct pollfd *fds = count <= 64 ? stackFds : malloc(count * sizeof(struct pollfd));
+    if (fds == NULL) return -1;
+
+    for (size_t i = 0; i < count; i++) {
+        chatClientFlush(clients[i]);
+        fds[i].fd = clients[i]->fd; //- -1 wird von poll() uebersprungen -//
+        fds[i].events = (short) (POLLIN | (chatClientWantWrite(clients[i]) ? POLLOUT : 0));
+        fds[i].revents = 0;
+    }
+    int open = 0;
+    if (poll(fds, count, timeoutMs) >= 0) {
+        for (size_t i = 0; i < count; i++) {
+            if (fds[i].revents != 0) chatClientProcess(clients[i], fds[i].revents);
+            if (clients[i]->state != STATE_CLOSED && clients[i]->state != STATE_IDLE) open++;
+        }
+    }
+    if (fds != stackFds) free(fds);
+    return open;
+}
@@ -0,0 +1,82 @@
+#ifndef CHATCLIENT_H
+#define CHATCLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "network.h"
+
+// Client Bibliothek fuer Bots und Lastwerkzeuge (libchatclient.a / libchatclient.so).
+// Alles ist nicht blockierend: Senden haengt nur an einen Puffer, chatClientProcess liest, zerlegt und schreibt.
+// Ein ChatClient gehoert einem Thread; Callbacks duerfen senden, aber nicht chatClientDestroy aufrufen.
+
+#if defined(__GNUC__)
+#define CHATCLIENT_API __attribute__((visibility("default")))
+#else
+#define CHATCLIENT_API
+#endif
+
+typedef struct ChatClient ChatClient;
+
+// Alle Eintraege duerfen NULL sein; Namen sind nullterminiert, Text zusaetzlich mit Laenge
+typedef struct {
+    void (*loginResult)(ChatClient *client, uint8_t code, const char *serverName, void *user);
+    void (*message)(ChatClient *client, uint64_t timestamp, const char *sender, const char *text, size_t len,
+                    void *user); // sender "" = Servernachricht
+    void (*userAdded)(ChatClient *client, uint64_t timestamp, const char *name, void *user);
+    void (*userRemoved)(ChatClient *client, uint64_t timestamp, uint8_t code, const char *name, void *user);
+    void (*closed)(ChatClient *client, int error, void *user); // error = errno, 0 = vom Server geschlossen
+} ChatClientCallbacks;
+
+typedef struct {
+    uint64_t framesSent;
+    uint64_t batchesSent; // MT_BATCH Container, jeder zaehlt dazu einmal je enthaltenem Frame in framesSent
+    uint64_t bytesSent;
+    uint64_t framesReceived;
+    uint64_t bytesReceived;
+    uint64_t writes; // send() Aufrufe
+    uint64_t reads; // recv() Aufrufe mit Daten
+} ChatClientStats;
+
+CHATCLIENT_API ChatClient *chatClientCreate(const ChatClientCallbacks *callbacks, void *user);
+
+CHATCLIENT_API void chatClientDestroy(ChatClient *client);
+
+// host "unix:PATH" (port wird ignoriert) oder Name/Adresse; kehrt sofort zurueck, der LoginRequest ist schon
+// vorgemerkt. version 1 fasst vorgemerkte Nachrichten zu Batch Frames zusammen, 1 | PROT_FLAG_SESSION bittet
+// zusaetzlich um eine fortsetzbare Sitzung (Server mit --session-grace). -1 bei Fehler (errno)
+CHATCLIENT_API int chatClientConnect(ChatClient *client, const char *host, const char *port, const char *name,
+                                     uint8_t version);
+
+// Nach dem closed Callback: dieselbe Sitzung neu verbinden, es kommen nur die verpassten Nachrichten. Lehnt der
+// Server ab (Frist abgelaufen), braucht es einen neuen ChatClient. -1 ohne Sitzung oder bei Fehler (errno)
+CHATCLIENT_API int chatClientResume(ChatClient *client, const char *host, const char *port);
+
+// Naechste erwartete Nummer der Sitzung, 0 = keine Sitzung
+CHATCLIENT_API uint64_t chatClientSequence(const ChatClient *client);
+
+CHATCLIENT_API int chatClientFd(const ChatClient *client);
+
+// 1 = eingeloggt, 0 = noch nicht, -1 = geschlossen oder abgelehnt
+CHATCLIENT_API int chatClientReady(const ChatClient *client);
+
+// Fuer poll(): POLLOUT wird gebraucht, solange connect laeuft oder Daten warten
+CHATCLIENT_API int chatClientWantWrite(const ChatClient *client);
+
+// Merkt eine Chatnachricht (max. 512 Bytes) vor, schon vor der Login Antwort moeglich; gesendet wird erst beim Flush
+CHATCLIENT_API int chatClientSend(ChatClient *client, const char *text, size_t len);
+
+// Schreibt, was der Socket nimmt; 0 = ok (evtl. bleibt ein Rest), -1 = Verbindung verloren
+CHATCLIENT_API int chatClientFlush(ChatClient *client);
+
+// Nach poll(): revents des Sockets; liest alles Verfuegbare, ruft die Callbacks und schreibt. -1 = geschlossen
+CHATCLIENT_API int chatClientProcess(ChatClient *client, short revents);
+
+// Bequemer Loop fuer viele Clients in einem Thread: Flush, poll und Process; liefert die Zahl offener Clients
+CHATCLIENT_API int chatClientPoll(ChatClient *const *clients, size_t count, int timeoutMs);
+
+CHATCLIENT_API size_t chatClientPending(const ChatClient *client);
+
+CHATCLIENT_API void chatClientGetStats(const ChatClient *client, ChatClientStats *stats);
+
+#endif
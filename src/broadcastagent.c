@@ -6,61 +6,268 @@
 #include <sys/stat.h>
 #include <semaphore.h>
 #include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 
 #include "broadcastagent.h"
+#include "compress.h"
+#include "federation.h"
+#include "firehose.h"
+#include "latency.h"
+#include "lockprof.h"
+#include "overload.h"
 
 #include <string.h>
 
 #include "util.h"
 #include "user.h"
+#include "workers.h"
+#include "msglog.h"
+#include "names.h"
 #include "network.h"
+#include "room.h"
+#include "trace.h"
+#include "zerocopy.h"
 
-#define QUEUE_NAME "/chat-group27-proto-v2"
+#define QUEUE_PREFIX "/chat-group27-proto-v2"
+#define BATCH_MAX 64 // So viele Nachrichten nimmt der Agent am Stueck aus der Queue, ein Fan-out fuer alle
 
+static char queueName[64]; // Mit PID, damit mehrere Instanzen (Federation) auf einem Host laufen koennen
 static mqd_t messageQueue;
 static pthread_t threadId; // Hier Nachricht speichern, die gerade an alle verteilt wird
-static InternalMessage g_current_msg;
 static sem_t pauseSem;
+static int paused; // Per /pause angehalten; gedrosselte Sender warten dann nicht unbegrenzt
+static sem_t fenceSem; // MT_FENCE erreicht, die Queue davor ist verteilt
+
+//- Eine Nachricht des laufenden Batches: einmal kodiert, von allen Empfaengern geteilt -//
+typedef struct {
+    InternalMessage msg;
+    Frame *frame;
+    char name[32];
+    TraceRecord trace; // Nur mit --trace
+} BatchEntry;
+
+//- Nur der Agent Thread greift auf den Batch zu -//
+static BatchEntry batch[BATCH_MAX];
+static size_t batchCount;
+static Frame *roomBatches[ROOM_MAX]; // Container fuer v1 Empfaenger je Raum, erst bei Bedarf gebaut
+static Frame *roomPacked[ROOM_MAX]; // Derselbe Container einmal komprimiert, fuer alle komprimierten v1 Empfaenger
+static Frame *roomSession[ROOM_MAX]; // Derselbe Container mit MT_SEQUENCE am Ende, fuer alle Sitzungen (session.h)
+static uint64_t batchSeq; // Nummer des ersten Eintrags im Firehose Puffer, 0 = ohne Puffer
+static uint64_t queueSent; // Von broadcastQueueSend nach jedem mq_timedsend erhoeht, fuer --spin
+static uint64_t queueTaken; // Nur der Agent schreibt: bisher empfangene Nachrichten
+static uint64_t batchStarted; // Monotone ns, als der erste Eintrag des laufenden Batches ankam; 0 = kein Batch
+static uint64_t statMessages;
+static uint64_t statFlushes;
+static uint64_t statContainers; // Gemeinsam genutzte Container Frames
+static uint64_t statPrivateContainers; // Eigener Container wegen Ignorieren oder eigener Abmeldung
+static uint64_t statContainerSends;
+
+static int entry_applies(const BatchEntry *entry, const int room) {
+    return entry->msg.room == room || entry->msg.room == ROOM_ALL;
+}
+
+//- Der Aufrufer haelt user->sendLock (ignored) -//
+static int entry_excluded(const BatchEntry *entry, const User *user) {
+    //- Wenn User gekickt wird, darf er Nachricht nicht selber erhalten! -//
+    if (entry->msg.type == MT_USER_REMOVED && entry->msg.userId == user->id) return 1;
+    //- Ignorierte Absender: ein Bittest statt Namensvergleich -//
+    return entry->msg.type == MT_SERVER_TO_CLIENT && user_ignores(user, entry->msg.userId);
+}
+
+//--- Container Frame (Protokoll Version 1) aus allen Eintraegen fuer den Raum; user != NULL filtert fuer ihn ---//
+//- seqEnd != 0 haengt MT_SEQUENCE an: der Client kennt damit die Nummer fuer eine Wiederaufnahme -//
+static Frame *batch_build(const int room, const User *user, const uint64_t seqEnd) {
+    size_t len = sizeof(BatchHeader) + (seqEnd ? sizeof(Header) + sizeof(uint64_t) : 0);
+    for (size_t i = 0; i < batchCount; i++) {
+        if (entry_applies(&batch[i], room) && (user == NULL || !entry_excluded(&batch[i], user))) {
+            len += batch[i].frame->len;
+        }
+    }
+
+    Frame *container = malloc(sizeof(Frame) + len);
+    if (container == NULL) return NULL;
+    container->refs = 1;
+    container->len = len;
+    BatchHeader header = {.type = MT_BATCH, .length = htonl((uint32_t) (len - sizeof(BatchHeader)))};
+    memcpy(container->data, &header, sizeof(header));
+
+    unsigned char *p = container->data + sizeof(header);
+    for (size_t i = 0; i < batchCount; i++) {
+        if (entry_applies(&batch[i], room) && (user == NULL || !entry_excluded(&batch[i], user))) {
+            memcpy(p, batch[i].frame->data, batch[i].frame->len);
+            p += batch[i].frame->len;
+        }
+    }
+    if (seqEnd) {
+        const Header marker = {.type = MT_SEQUENCE, .length = htons(sizeof(uint64_t))};
+        const uint64_t seq = hton64u(seqEnd);
+        memcpy(p, &marker, sizeof(marker));
+        memcpy(p + sizeof(marker), &seq, sizeof(seq));
+    }
+    return container;
+}
 
-//--- Verschiedene Nachrichtentypen an den Client uebermitteln ---//
+//--- Alle Nachrichten des Batches fuer seinen Raum an einen User ---//
 static void send_to_user(User *user) {
+    const int room = user->room;
 
-    //- User ohne Namen (Zb Netcat-lauscher) erhalten keine Nachricht -//
-    if (strlen(user->name) == 0) {
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    //- Getrennte Sitzung, oder ihre Wiederaufnahme hat diesen Batch schon aus dem Puffer geholt; nach einem Hot -//
+    //- Restart schreibt nur noch der Nachfolger, sonst zerbraeche sein fortgesetzter komprimierter Strom -//
+    if (user->handedOver || user->session.parked || (batchSeq != 0 && batchSeq < user->session.replayedTo)) {
+        pthread_mutex_unlock(&user->sendLock);
+        return;
+    }
+    const uint64_t seqEnd = user->session.enabled && batchSeq != 0 ? batchSeq + batchCount : 0;
+    size_t applicable = 0;
+    size_t excluded = 0;
+    for (size_t i = 0; i < batchCount; i++) {
+        if (!entry_applies(&batch[i], room)) continue;
+        applicable++;
+        if (entry_excluded(&batch[i], user)) excluded++;
+    }
+    if (applicable == excluded) {
+        pthread_mutex_unlock(&user->sendLock);
+        return;
+    }
+    if (user->replaying) {
+        //- Sein Verlauf geht noch raus: eine gefilterte Kopie kommt danach, damit nichts Neues vor Aelterem steht -//
+        if (user->version >= PROT_VERSION_BATCH && (applicable - excluded >= 2 || seqEnd != 0)) {
+            Frame *container = batch_build(room, user, seqEnd);
+            if (container != NULL) user_defer_frame(user, container);
+        } else {
+            for (size_t i = 0; i < batchCount; i++) {
+                if (!entry_applies(&batch[i], room) || entry_excluded(&batch[i], user)) continue;
+                frameRetain(batch[i].frame);
+                user_defer_frame(user, batch[i].frame);
+            }
+        }
+        pthread_mutex_unlock(&user->sendLock);
         return;
     }
 
-    //- Wenn User gekickt wird, darf er Nachricht nicht selber erhalten! -//
-    if (g_current_msg.type == MT_USER_REMOVED) {
-        if (strncmp(g_current_msg.data.urm.name, user->name, 32) == 0) {
-            return;
+    //- Haengt der Empfaenger (volles Sendefenster), trennt der Timer die Verbindung; unter sendLock wie bei /msg -//
+    user_arm_stall_timeout(user);
+    if (user->version >= PROT_VERSION_BATCH && (applicable - excluded >= 2 || seqEnd != 0)) {
+        //- v1: ein Frame fuer alles; ohne Ausnahmen der gemeinsame Container des Raums -//
+        //- Sitzungen bekommen immer einen Container, die Nummer steckt als letzter Eintrag darin -//
+        Frame *container;
+        if (excluded == 0) {
+            Frame **shared = seqEnd ? &roomSession[room] : &roomBatches[room];
+            if (*shared == NULL) {
+                *shared = batch_build(room, NULL, seqEnd);
+                if (*shared != NULL) statContainers++;
+            }
+            container = *shared;
+            if (container != NULL) frameRetain(container);
+        } else {
+            container = batch_build(room, user, seqEnd);
+            if (container != NULL) statPrivateContainers++;
+        }
+        if (container != NULL && excluded == 0 && !seqEnd && compressActive(user->sock)) {
+            //- Kompressionsgruppe: alle komprimierten Empfaenger des Raums teilen einen Block -//
+            if (roomPacked[room] == NULL) roomPacked[room] = compressShared(container);
+            if (roomPacked[room] != NULL) compressSendShared(user->sock, roomPacked[room], container);
+            else sendFrame(user->sock, container);
+            frameRelease(container);
+            statContainerSends++;
+        } else if (container != NULL) {
+            //- Grosse Frames per MSG_ZEROCOPY, kleine kopierend (siehe zerocopy.c); komprimiert ueber den eigenen Strom -//
+            zerocopySend(&user->zc, user->sock, container);
+            frameRelease(container);
+            statContainerSends++;
+        }
+    } else if (compressActive(user->sock)) {
+        //- Komprimiert: alle Frames in den Strom, ein Flush fuer den ganzen Batch -//
+        for (size_t i = 0; i < batchCount; i++) {
+            if (!entry_applies(&batch[i], room) || entry_excluded(&batch[i], user)) continue;
+            if (compressSend(user->sock, batch[i].frame->data, batch[i].frame->len, 0) == -1) break;
+        }
+        compressSend(user->sock, NULL, 0, 1);
+    } else {
+        //- v0 (oder nur eine Nachricht): jeder Frame einzeln, wie bisher -//
+        for (size_t i = 0; i < batchCount; i++) {
+            if (!entry_applies(&batch[i], room) || entry_excluded(&batch[i], user)) continue;
+            if (zerocopySend(&user->zc, user->sock, batch[i].frame) == -1) break;
         }
     }
+    user_cancel_stall_timeout(user);
 
-    switch (g_current_msg.type) {
-        case MT_SERVER_TO_CLIENT:
-            //- Parameter: File Descriptor, Sender, Textnachricht, Timestamp -//
-            sendServer2Client(user->sock,
-                              g_current_msg.data.s2c.original_sender,
-                              g_current_msg.data.s2c.text,
-                              g_current_msg.data.s2c.timestamp);
-            break;
+    for (size_t i = 0; i < batchCount; i++) {
+        if (!entry_applies(&batch[i], room) || entry_excluded(&batch[i], user)) continue;
+        batch[i].trace.recipients++;
+        if (batch[i].trace.firstSent == 0) batch[i].trace.firstSent = traceNow();
+    }
+    pthread_mutex_unlock(&user->sendLock);
+}
+
+//--- Batch an alle betroffenen Raeume verteilen, dann weiterreichen und freigeben ---//
+static void batch_flush(void) {
+    if (batchCount == 0) return;
+
+    //- Vor dem Fan-out in den Puffer: eine Wiederaufnahme sieht jeden Batch entweder dort oder im Versand -//
+    batchSeq = 0;
+    if (firehoseEnabled()) {
+        FirehoseItem items[BATCH_MAX];
+        for (size_t i = 0; i < batchCount; i++) {
+            items[i].room = batch[i].msg.room;
+            items[i].frame = batch[i].frame;
+        }
+        batchSeq = firehosePublish(items, batchCount);
+    }
 
-        case MT_USER_ADDED:
-            //- Parameter: File Descriptor, Name des Benutzers, Timestamp -//
-            sendUserAdded(user->sock,
-                          g_current_msg.data.uad.name,
-                          g_current_msg.data.uad.timestamp);
+    //- Nur die Mitglieder der Zielraeume, nicht alle User; jeder Raum genau einmal -//
+    int rooms[BATCH_MAX];
+    size_t roomCount = 0;
+    int all = 0;
+    for (size_t i = 0; i < batchCount && !all; i++) {
+        if (batch[i].msg.room == ROOM_ALL) {
+            all = 1;
             break;
+        }
+        size_t r = 0;
+        while (r < roomCount && rooms[r] != batch[i].msg.room) r++;
+        if (r == roomCount) rooms[roomCount++] = batch[i].msg.room;
+    }
+    if (all) {
+        room_iterate(ROOM_ALL, send_to_user);
+    } else {
+        for (size_t r = 0; r < roomCount; r++) {
+            room_iterate(rooms[r], send_to_user);
+        }
+    }
 
-        case MT_USER_REMOVED:
-            //- Parameter: File Descriptor, Name des Benutzers, Grund des Entfernens, Timestamp -//
-            sendUserRemoved(user->sock,
-                            g_current_msg.data.urm.name,
-                            g_current_msg.data.urm.code,
-                            g_current_msg.data.urm.timestamp);
-        default: ;
+    const uint64_t lastSent = traceNow();
+    for (size_t i = 0; i < batchCount; i++) {
+        BatchEntry *entry = &batch[i];
+        if (traceEnabled()) {
+            entry->trace.received = entry->msg.traceReceived;
+            entry->trace.enqueued = entry->msg.traceEnqueued;
+            entry->trace.lastSent = lastSent;
+            entry->trace.type = entry->msg.type;
+            traceRecord(&entry->trace);
+        }
+        //- Lobby Nachrichten an die anderen Knoten, gebuendelt je Link -//
+        federationForward(&entry->msg, entry->frame);
+        workersPublish(&entry->msg, entry->name); //- Und an die anderen Worker Prozesse -//
+        frameRelease(entry->frame); //- Ausstehende Zerocopy Sends halten eigene Referenzen -//
+        nameRelease(entry->msg.userId); //- Referenz aus broadcastQueueSend -//
+    }
+    for (int room = 0; room < ROOM_MAX; room++) {
+        if (roomBatches[room] == NULL && roomSession[room] == NULL) continue;
+        frameRelease(roomBatches[room]);
+        roomBatches[room] = NULL;
+        frameRelease(roomPacked[room]);
+        roomPacked[room] = NULL;
+        frameRelease(roomSession[room]);
+        roomSession[room] = NULL;
     }
+    statMessages += batchCount;
+    statFlushes++;
+    batchCount = 0;
+    __atomic_store_n(&batchStarted, 0, __ATOMIC_RELAXED);
+    overloadSample(); //- Hier endet eine Ueberlast, die gedrosselten Client Threads lesen weiter -//
 }
 
 //--- Wartet auf neue Nachrichten und verteilt diese anschliessend ---//
@@ -68,16 +275,31 @@ static void send_to_user(User *user) {
 static void *broadcastAgent(void *arg) {
     (void) arg; //- Argumente werden nicht benoetigt, in void casten um Compiler zufrieden zustellen -//
     debugPrint("BroadcastAgent thread started\n");
+    latencyPinSelf(LATENCY_AGENT);
 
     while (1) {
         InternalMessage msg;
-        ssize_t bytes_read = mq_receive(messageQueue, (char *) &msg, sizeof(InternalMessage), NULL);
+        ssize_t bytes_read;
+        if (batchCount == 0 && !latencySpin(&queueSent, queueTaken)) {
+            bytes_read = mq_receive(messageQueue, (char *) &msg, sizeof(InternalMessage), NULL);
+        } else {
+            //- Was schon in der Queue wartet, kommt in denselben Batch; eine Frist in der Vergangenheit blockiert nie -//
+            const struct timespec past = {0, 0};
+            bytes_read = mq_timedreceive(messageQueue, (char *) &msg, sizeof(InternalMessage), NULL, &past);
+        }
 
         if (bytes_read < 0) {
+            if (errno == ETIMEDOUT) { //- Queue leer: Batch verteilen -//
+                batch_flush();
+                continue;
+            }
             if (errno == EINTR) continue; //- System hat Thread kurz angestupst durch ein Signal zb, kein echter Fehler -//
             errnoPrint("mq_receive failed");
             break; //- Thread beenden -//
         }
+        __atomic_store_n(&queueTaken, queueTaken + 1, __ATOMIC_RELAXED);
+        TraceRecord trace = {0};
+        trace.dequeued = traceNow();
 
         //- Wenn ein nicht vollstaendiges Paket empfangen wird, Paket verwerfen und weitermachen -//
         if (bytes_read != sizeof(InternalMessage)) {
@@ -85,10 +307,16 @@ static void *broadcastAgent(void *arg) {
             continue;
         }
 
+        if (msg.type == MT_FENCE) {
+            batch_flush();
+            sem_post(&fenceSem);
+            continue;
+        }
+
         //- Falls Systemnachricht -> muss direkt gesendet werden -//
         int is_system_msg = 0;
         if (msg.type == MT_SERVER_TO_CLIENT) {
-            if (msg.data.s2c.original_sender[0] == '\0') { //- Systemnachrichten haben keinen Absender, also nix drin -//
+            if (msg.userId == NAME_ID_NONE) { //- Systemnachrichten haben keinen Absender -//
                 is_system_msg = 1;
             }
         }
@@ -99,19 +327,66 @@ static void *broadcastAgent(void *arg) {
 
         if (is_system_msg) {
             //- Semaphor nicht pruefen ob Server pausiert ist -//
+        } else if (sem_trywait(&pauseSem) == 0) {
+            sem_post(&pauseSem);
         } else {
-            //- Versuchen den Semaphor zu sperren. Falls Server pausiert ist, klemmen hier die Nachrichten fest. -//
+            //- Server pausiert: bisherigen Batch noch verteilen, dann klemmen hier die Nachrichten fest -//
+            batch_flush();
             sem_wait(&pauseSem);
             sem_post(&pauseSem);
         }
-
-        //- Nachrichten Verteilung durchfuehren -//
-        g_current_msg = msg;
-        user_iterate(send_to_user);
+        trace.unpaused = traceNow();
+
+        //- Nachrichten Verteilung vorbereiten -//
+        //- Der einzige Ort, an dem die ID wieder zum Namen wird -//
+        BatchEntry *entry = &batch[batchCount];
+        nameCopy(msg.userId, entry->name);
+        entry->frame = frameEncode(&msg, entry->name);
+        if (entry->frame == NULL) {
+            errorPrint("Unable to encode message of type %d", msg.type);
+            nameRelease(msg.userId);
+            continue;
+        }
+        entry->msg = msg;
+        entry->trace = trace;
+        if (batchCount == 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            __atomic_store_n(&batchStarted, (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec,
+                             __ATOMIC_RELAXED);
+        }
+        //- Chatnachrichten der Lobby vor der Verteilung ins Log, damit room_join die Grenze fuer den Verlauf kennt -//
+        if (msg.type == MT_SERVER_TO_CLIENT && (msg.room == ROOM_LOBBY || msg.room == ROOM_ALL)) {
+            msglogAppend(entry->frame);
+        }
+        if (++batchCount == BATCH_MAX) batch_flush();
     }
     return NULL;
 }
 
+size_t broadcastQueueDepth(void) {
+    const int64_t depth = (int64_t) (__atomic_load_n(&queueSent, __ATOMIC_RELAXED)
+                                     - __atomic_load_n(&queueTaken, __ATOMIC_RELAXED));
+    return depth > 0 ? (size_t) depth : 0; //- Der Agent zaehlt eine Nachricht evtl. vor dem Absender -//
+}
+
+uint64_t broadcastLagNs(void) {
+    const uint64_t started = __atomic_load_n(&batchStarted, __ATOMIC_RELAXED);
+    if (started == 0) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const uint64_t nowNs = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+    return nowNs > started ? nowNs - started : 0;
+}
+
+void broadcastStatsFormat(char *buf, const size_t size) {
+    //- Grobe Momentaufnahme ohne Sperre, die Zaehler schreibt nur der Agent -//
+    snprintf(buf, size, "broadcast: messages=%ju flushes=%ju avg_batch=%.2f v1_containers=%ju shared/%ju private sends=%ju",
+             (uintmax_t) statMessages, (uintmax_t) statFlushes,
+             statFlushes ? (double) statMessages / (double) statFlushes : 0.0, (uintmax_t) statContainers,
+             (uintmax_t) statPrivateContainers, (uintmax_t) statContainerSends);
+}
+
 //--- Bereitet die Queue, Semaphore und den Thread vor ---//
 int broadcastAgentInit(void) {
     struct mq_attr attr;
@@ -121,8 +396,9 @@ int broadcastAgentInit(void) {
     attr.mq_curmsgs = 0; //- 0 Nachrichen bei Start in der Queue, mq_open ignoriert das -//
 
     //- Sauberes starten der Queue -//
-    mq_unlink(QUEUE_NAME);
-    messageQueue = mq_open(QUEUE_NAME, O_CREAT | O_RDWR, 0644, &attr);
+    snprintf(queueName, sizeof(queueName), "%s-%ld", QUEUE_PREFIX, (long) getpid());
+    mq_unlink(queueName);
+    messageQueue = mq_open(queueName, O_CREAT | O_RDWR, 0644, &attr);
 
     if (messageQueue == -1) {
         errnoPrint("Failed to create message queue");
@@ -130,7 +406,7 @@ int broadcastAgentInit(void) {
     }
 
     //- Parameter: PauseSem wird nicht geteilt mit anderen Prozessen (=0) und ist standardmaessig aktiv -//
-    if (sem_init(&pauseSem, 0, 1) == -1) {
+    if (sem_init(&pauseSem, 0, 1) == -1 || sem_init(&fenceSem, 0, 0) == -1) {
         errnoPrint("Failed to init semaphore");
         return -1;
     }
@@ -139,7 +415,7 @@ int broadcastAgentInit(void) {
     if (pthread_create(&threadId, NULL, broadcastAgent, NULL) != 0) {
         errnoPrint("Failed to start broadcast agent thread");
         mq_close(messageQueue);
-        mq_unlink(QUEUE_NAME);
+        mq_unlink(queueName);
         return -1;
     }
     return 0;
@@ -150,13 +426,36 @@ void broadcastAgentCleanup(void) {
     pthread_cancel(threadId);
     pthread_join(threadId, NULL); //- join laesst den aktuellen Prozess immer auf den darin angegebenen warten, hier also warten bis er wirklich tot ist -//
     mq_close(messageQueue);
-    mq_unlink(QUEUE_NAME);
+    mq_unlink(queueName);
     sem_destroy(&pauseSem);
+    sem_destroy(&fenceSem);
+}
+
+//--- Wartet bis alles, was bis jetzt in der Queue steht, verteilt ist (auch waehrend einer Pause nicht ewig) ---//
+int broadcastQueueFence(const unsigned int timeoutMs) {
+    InternalMessage fence = {0};
+    fence.type = MT_FENCE;
+    fence.userId = NAME_ID_NONE;
+    if (broadcastQueueSend(&fence) == -1) return -1;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (long) (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (sem_timedwait(&fenceSem, &deadline) == -1) {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
 }
 
 int broadcastStop(void) {
     //- Versuche den Semaphor auf 0 zu setzen -//
     if (sem_trywait(&pauseSem) == 0) {
+        __atomic_store_n(&paused, 1, __ATOMIC_RELAXED);
         infoPrint("Server is now paused.");
         return 0;
     }
@@ -180,6 +479,7 @@ int broadcastResume(void) {
     }
 
     if (val == 0) {
+        __atomic_store_n(&paused, 0, __ATOMIC_RELAXED);
         if (sem_post(&pauseSem) != 0) {
             errorPrint("Resuming chat caused error");
             return -1;
@@ -190,13 +490,31 @@ int broadcastResume(void) {
 }
 
 //--- Verteilt die Nachrichten an alle Clients ---//
-int broadcastQueueSend(const InternalMessage *msg) {
+static int queue_send(const InternalMessage *msg, const int throttled) {
     struct timespec tm;
     clock_gettime(CLOCK_REALTIME, &tm);
     //- Eine Sekunde bei einer vollen Queue warten. Wenn immer noch voll -> verwerfen
     tm.tv_sec += 1;
 
-    if (mq_timedsend(messageQueue, (const char *) msg, sizeof(InternalMessage), 0, &tm) == -1) {
+    //- Mit --trace eine gestempelte Kopie in die Queue -//
+    InternalMessage stamped;
+    if (traceEnabled()) {
+        stamped = *msg;
+        stamped.traceEnqueued = traceNow();
+        msg = &stamped;
+    }
+
+    //- Die Nachricht haelt den Namen, bis der Broadcast Agent sie verteilt hat -//
+    nameRetain(msg->userId);
+    while (mq_timedsend(messageQueue, (const char *) msg, sizeof(InternalMessage), 0, &tm) == -1) {
+        //- Mit Ueberlastschutz wartet ein gedrosselter Leser weiter statt zu verwerfen. Waehrend einer Pause und fuer -//
+        //- alle anderen (Admin, Links, Fence) bleibt es bei einer Sekunde, sonst kaeme zB /resume nie an -//
+        if (errno == ETIMEDOUT && throttled && overloadEnabled() && !__atomic_load_n(&paused, __ATOMIC_RELAXED)) {
+            overloadQueueWaited();
+            tm.tv_sec += 1;
+            continue;
+        }
+        nameRelease(msg->userId);
         if (errno == ETIMEDOUT) {
             errorPrint("Broadcast queue full, message dropped.");
             return -1;
@@ -204,5 +522,14 @@ int broadcastQueueSend(const InternalMessage *msg) {
         errnoPrint("mq_send failed");
         return -1;
     }
+    __atomic_add_fetch(&queueSent, 1, __ATOMIC_RELEASE); //- Erst jetzt liegt sie sicher in der Queue -//
     return 0;
+}
+
+int broadcastQueueSend(const InternalMessage *msg) {
+    return queue_send(msg, 0);
+}
+
+int broadcastQueueSendThrottled(const InternalMessage *msg) {
+    return queue_send(msg, 1);
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #ifndef BROADCASTAGENT_H
 #define BROADCASTAGENT_H
+#include <stddef.h>
+#include <stdint.h>
+
 #include "network.h" // Daher kommt InternalMessage
 
 int broadcastAgentInit(void);
@@ -8,8 +11,21 @@ void broadcastAgentCleanup(void);
 // Es wird jetzt InternalMessage übergeben
 int broadcastQueueSend(const InternalMessage *msg);
 
+// Client Thread eines gedrosselten Users (overload.h): bei voller Queue ohne Frist warten, ausser waehrend /pause
+int broadcastQueueSendThrottled(const InternalMessage *msg);
+
+// Wartet, bis alle bisher eingereihten Nachrichten verteilt sind; -1 nach timeoutMs
+int broadcastQueueFence(unsigned int timeoutMs);
+
+// Fuer den Ueberlastschutz: Nachrichten in der Queue bzw. Alter des laufenden Fan-outs (0 = keiner)
+size_t broadcastQueueDepth(void);
+
+uint64_t broadcastLagNs(void);
+
 int broadcastStop(void);
 
 int broadcastResume(void);
 
+void broadcastStatsFormat(char *buf, size_t size);
+
 #endif
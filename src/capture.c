@@ -0,0 +1,233 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "capture.h"
+#include "util.h"
+
+#define CAPTURE_SLOTS_MAX (1024 * 1024)
+
+//- Wie bei den Federation Links: alles, was sich waehrend eines write() ansammelt, geht im naechsten raus -//
+static pthread_mutex_t captureLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t captureReady = PTHREAD_COND_INITIALIZER;
+static int enabled = 0;
+static int stopping = 0;
+static int fileFd = -1;
+static pthread_t writerThread;
+static unsigned char *out;
+static size_t outLen;
+static size_t outCapacity;
+static char capturePath[4096];
+static uint64_t startNs;
+
+//- Nummer der Verbindung je Deskriptor, 0 = nicht mitgeschnitten; nur der Thread des Sockets greift zu -//
+static uint32_t *connIds;
+static size_t connSlots;
+static uint32_t nextConn = 1;
+
+static uint64_t statRecords;
+static uint64_t statBytes;
+static uint64_t statDropped;
+static uint64_t statWrites;
+static uint64_t statConnections;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+//--- Haengt einen Datensatz an; die Zeit wird unter der Sperre genommen, damit die Datei geordnet bleibt ---//
+static void capture_append(const uint8_t kind, const uint32_t conn, const void *head, const size_t headLen,
+                           const void *body, const size_t bodyLen) {
+    pthread_mutex_lock(&captureLock);
+    if (!enabled || stopping) {
+        pthread_mutex_unlock(&captureLock);
+        return;
+    }
+    const size_t need = outLen + sizeof(CaptureRecord) + headLen + bodyLen;
+    if (need > CAPTURE_BUFFER_MAX) {
+        //- Die Platte kommt nicht nach: lieber eine Luecke im Mitschnitt als ein wartender Client Thread -//
+        statDropped++;
+        pthread_mutex_unlock(&captureLock);
+        return;
+    }
+    if (need > outCapacity) {
+        size_t capacity = outCapacity ? outCapacity : 64 * 1024;
+        while (capacity < need) capacity *= 2;
+        unsigned char *grown = realloc(out, capacity);
+        if (grown == NULL) {
+            statDropped++;
+            pthread_mutex_unlock(&captureLock);
+            return;
+        }
+        out = grown;
+        outCapacity = capacity;
+    }
+
+    CaptureRecord record;
+    record.kind = kind;
+    record.conn = conn;
+    record.time = now_ns() - startNs;
+    record.length = (uint32_t) (headLen + bodyLen);
+    unsigned char *p = out + outLen;
+    memcpy(p, &record, sizeof(record));
+    if (headLen > 0) memcpy(p + sizeof(record), head, headLen);
+    if (bodyLen > 0) memcpy(p + sizeof(record) + headLen, body, bodyLen);
+    outLen = need;
+    statRecords++;
+    statBytes += sizeof(record) + headLen + bodyLen;
+    pthread_cond_signal(&captureReady);
+    pthread_mutex_unlock(&captureLock);
+}
+
+static int write_all(const unsigned char *data, const size_t len) {
+    size_t written = 0;
+    while (written < len) {
+        const ssize_t res = write(fileFd, data + written, len - written);
+        if (res == -1 && errno == EINTR) continue;
+        if (res <= 0) return -1;
+        written += (size_t) res;
+    }
+    return 0;
+}
+
+//--- Tauscht den vollen Puffer gegen einen leeren und schreibt ihn ohne Sperre ---//
+static void *captureWriter(void *arg) {
+    (void) arg;
+    unsigned char *spare = NULL;
+    size_t spareCapacity = 0;
+
+    pthread_mutex_lock(&captureLock);
+    while (1) {
+        while (outLen == 0 && !stopping) pthread_cond_wait(&captureReady, &captureLock);
+        if (outLen == 0) break; //- Beim Beenden erst den Rest schreiben -//
+
+        unsigned char *batch = out;
+        const size_t batchLen = outLen;
+        const size_t batchCapacity = outCapacity;
+        out = spare;
+        outCapacity = spareCapacity;
+        outLen = 0;
+        pthread_mutex_unlock(&captureLock);
+
+        const int res = write_all(batch, batchLen);
+        spare = batch;
+        spareCapacity = batchCapacity;
+
+        pthread_mutex_lock(&captureLock);
+        statWrites++;
+        if (res == -1) {
+            errnoPrint("write %s, capture stopped", capturePath);
+            enabled = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&captureLock);
+    free(spare);
+    return NULL;
+}
+
+int captureInit(const char *path) {
+    if (path == NULL) return 0;
+
+    struct rlimit limit;
+    connSlots = 65536;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur > connSlots) {
+        connSlots = limit.rlim_cur < CAPTURE_SLOTS_MAX ? (size_t) limit.rlim_cur : CAPTURE_SLOTS_MAX;
+    }
+    connIds = calloc(connSlots, sizeof(uint32_t));
+    if (connIds == NULL) {
+        errnoPrint("calloc (capture connections)");
+        return -1;
+    }
+
+    snprintf(capturePath, sizeof(capturePath), "%s", path);
+    fileFd = open(capturePath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fileFd == -1) {
+        errnoPrint("open %s", capturePath);
+        free(connIds);
+        connIds = NULL;
+        return -1;
+    }
+
+    CaptureFileHeader header = {0};
+    header.magic = CAPTURE_MAGIC;
+    header.recordSize = sizeof(CaptureRecord);
+    header.started = (uint64_t) time(NULL);
+    if (write_all((const unsigned char *) &header, sizeof(header)) == -1) {
+        errnoPrint("write %s", capturePath);
+        close(fileFd);
+        free(connIds);
+        connIds = NULL;
+        return -1;
+    }
+
+    startNs = now_ns();
+    enabled = 1;
+    if (pthread_create(&writerThread, NULL, captureWriter, NULL) != 0) {
+        errorPrint("Failed to start capture writer thread");
+        enabled = 0;
+        close(fileFd);
+        fileFd = -1;
+        return -1;
+    }
+    infoPrint("Capturing inbound traffic to %s", capturePath);
+    return 0;
+}
+
+//- Nach der Login Stufe und dem Broadcast Agent; Client Threads duerfen danach noch aufrufen, es passiert nichts -//
+void captureCleanup(void) {
+    if (fileFd == -1) return;
+    pthread_mutex_lock(&captureLock);
+    stopping = 1;
+    pthread_cond_signal(&captureReady);
+    pthread_mutex_unlock(&captureLock);
+    pthread_join(writerThread, NULL);
+
+    if (close(fileFd) == -1) errnoPrint("close %s", capturePath);
+    fileFd = -1;
+    free(out);
+    out = NULL;
+    outLen = outCapacity = 0;
+}
+
+void captureOpen(const int fd, const void *login, const size_t len) {
+    if (!enabled || fd < 0 || (size_t) fd >= connSlots) return;
+    pthread_mutex_lock(&captureLock);
+    const uint32_t conn = nextConn++;
+    statConnections++;
+    pthread_mutex_unlock(&captureLock);
+    connIds[fd] = conn;
+    capture_append(CAPTURE_OPEN, conn, login, len, NULL, 0);
+}
+
+void captureData(const int fd, const void *head, const size_t headLen, const void *body, const size_t bodyLen) {
+    if (!enabled || fd < 0 || (size_t) fd >= connSlots || connIds[fd] == 0) return;
+    capture_append(CAPTURE_DATA, connIds[fd], head, headLen, body, bodyLen);
+}
+
+void captureClose(const int fd) {
+    if (connIds == NULL || fd < 0 || (size_t) fd >= connSlots || connIds[fd] == 0) return;
+    const uint32_t conn = connIds[fd];
+    connIds[fd] = 0; //- Vor close, sonst erbt eine neue Verbindung die Nummer -//
+    capture_append(CAPTURE_CLOSE, conn, NULL, 0, NULL, 0);
+}
+
+void captureStatsFormat(char *buf, const size_t size) {
+    if (fileFd == -1) {
+        snprintf(buf, size, "capture: disabled");
+        return;
+    }
+    pthread_mutex_lock(&captureLock);
+    snprintf(buf, size, "capture: connections=%ju records=%ju bytes=%ju writes=%ju pending=%zu dropped=%ju%s file=%s",
+             (uintmax_t) statConnections, (uintmax_t) statRecords, (uintmax_t) statBytes, (uintmax_t) statWrites,
+             outLen, (uintmax_t) statDropped, enabled ? "" : " (stopped)", capturePath);
+    pthread_mutex_unlock(&captureLock);
+}
@@ -0,0 +1,47 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAPTURE_MAGIC 0x43435031 // "CCP1", Kopf einer Mitschnitt Datei
+#define CAPTURE_BUFFER_MAX (64 * 1024 * 1024) // Mehr wartet nicht auf die Platte, danach wird verworfen
+
+// Mitschnitt aller eingehenden Frames je Verbindung (--capture FILE), fuer capture_replay in tools/
+enum CaptureKind {
+    CAPTURE_OPEN = 1, // Daten: der vollstaendige LoginRequest (Header + Body)
+    CAPTURE_DATA = 2, // Daten: ein Frame so, wie er gelesen wurde (Header + Body bzw. Batch)
+    CAPTURE_CLOSE = 3 // Keine Daten
+};
+
+// Dateikopf; danach Datensaetze bis zum Dateiende, zeitlich geordnet
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t recordSize; // sizeof(CaptureRecord)
+    uint64_t started; // Unix Zeit des Starts, nur zur Anzeige
+} CaptureFileHeader;
+
+typedef struct __attribute__((packed)) {
+    uint8_t kind;
+    uint32_t conn; // Laufende Nummer der Verbindung ab 1
+    uint64_t time; // ns seit Beginn des Mitschnitts
+    uint32_t length; // So viele Bytes folgen
+} CaptureRecord;
+
+// path = NULL schaltet den Mitschnitt ab; startet den Schreibthread
+int captureInit(const char *path);
+
+void captureCleanup(void);
+
+// Nach dem vollstaendigen LoginRequest, vor der Antwort; vergibt die Nummer der Verbindung
+void captureOpen(int fd, const void *login, size_t len);
+
+// Ein eingehender Frame in zwei Teilen (Header und Rest), damit der Aufrufer nicht kopieren muss
+void captureData(int fd, const void *head, size_t headLen, const void *body, size_t bodyLen);
+
+// Vor close(); mehrfach aufrufbar, fuer nicht mitgeschnittene Sockets wirkungslos
+void captureClose(int fd);
+
+void captureStatsFormat(char *buf, size_t size);
+
+#endif
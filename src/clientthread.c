@@ -4,218 +4,541 @@
 #include <string.h>
 #include <time.h>       // Für Zeitstempel (time())
 #include <arpa/inet.h>  // Für ntohl/ntohs
+#include <errno.h>
+#include <poll.h>
 #include <sys/socket.h>
 
 #include "clientthread.h"
 #include "user.h"
 #include "util.h"
+#include "workers.h"
 #include "network.h"
 #include "broadcastagent.h"
-//- Verwaltet die Threads; Jeder Thread hat eigenen File Descriptor -//
-static __thread int g_new_client_fd;
+#include "capture.h"
+#include "compress.h"
+#include "federation.h"
+#include "lockprof.h"
+#include "handoff.h"
+#include "latency.h"
+#include "memory.h"
+#include "msglog.h"
+#include "names.h"
+#include "overload.h"
+#include "room.h"
+#include "searchindex.h"
+#include "session.h"
+#include "stats.h"
+#include "trace.h"
+#include "validate.h"
+//--- In die Broadcast Queue; nur gedrosselte User warten bei Ueberlast ohne Frist, der Admin muss /resume lesen koennen ---//
+static int queue_send(const User *self, const InternalMessage *msg) {
+    if (strcmp(self->name, "Admin") == 0) return broadcastQueueSend(msg);
+    return broadcastQueueSendThrottled(msg);
+}
 
-//--- Adapter der sendUserAdded aufruft. Wird in userIterate aufgerufen um alle Benutzer zu informieren ---//
-static void send_existing_user(User *existing_user) {
-    // Timestamp 0 signalisiert, User war schon vorher da
-    if (existing_user->sock == g_new_client_fd) {
+//--- Raum wechseln: die Mitglieder beider Raeume kopiert room_join im selben Moment unter roomLock ---//
+static void changeRoom(User *self, const char *name, uint64_t timestamp) {
+    const int oldRoom = self->room;
+    RoomNames departed;
+    RoomNames present;
+    const int newRoom = room_join(self, name, &departed, &present);
+    if (newRoom == -1) {
+        user_send_text(self, NULL, "Error: Invalid room name or too many rooms.", timestamp);
+        return;
+    }
+    if (newRoom == oldRoom) {
+        user_send_text(self, NULL, "You are already in this room.", timestamp);
         return;
     }
 
-    if (strlen(existing_user->name) == 0) return; //- Netcatlauscher ausschliessen -//
-    sendUserAdded(g_new_client_fd, existing_user->name, 0);
-}
+    //- Der alte Raum sieht den User gehen -//
+    InternalMessage urmMsg = {0};
+    urmMsg.type = MT_USER_REMOVED;
+    urmMsg.room = oldRoom;
+    urmMsg.userId = self->id;
+    urmMsg.timestamp = timestamp;
+    urmMsg.code = 0;
+    queue_send(self, &urmMsg);
+
+    //- Die eigene Liste auf den neuen Raum umstellen; gesendet ohne roomLock, ein langsamer Client haelt nur sich auf -//
+    user_send_names(self, departed.names, departed.count, 0);
+    user_send_names(self, present.names, present.count, 1);
+    room_names_free(&departed);
+    room_names_free(&present);
+    //- Die Lobby reicht ueber alle federierten Knoten -//
+    if (oldRoom == ROOM_LOBBY) {
+        federationSendRoster(self, 0);
+        workersSendRoster(self, 0);
+    }
+    if (newRoom == ROOM_LOBBY) {
+        federationSendRoster(self, 1);
+        workersSendRoster(self, 1);
+    }
 
-void *clientthread(void *arg) {
-    User *self = arg; //- Impliziter Cast, explizit nicht noetig in C -//
-    Header hdr;
+    //- Der neue Raum sieht den User kommen -//
+    InternalMessage uadMsg = {0};
+    uadMsg.type = MT_USER_ADDED;
+    uadMsg.room = newRoom;
+    uadMsg.userId = self->id;
+    uadMsg.timestamp = timestamp;
+    queue_send(self, &uadMsg);
+
+    char line[64];
+    snprintf(line, sizeof(line), "Joined room %s.", name);
+    user_send_text(self, NULL, line, timestamp);
+}
 
-    debugPrint("New connection handling started on socket %d", self->sock);
+//--- Suchanfrage des Admins: Treffer aus dem Index, Texte aus dem Nachrichtenlog ---//
+static void searchHistory(User *self, const char *query, uint64_t timestamp) {
+    if (!searchIndexEnabled()) {
+        user_send_text(self, NULL, "Search is disabled (needs --log-dir).", timestamp);
+        return;
+    }
 
-    //--- Handshake starten ---//
-    //- Header lesen und pruefen ob Login Anfrage -//
-    if (networkReceive(self->sock, &hdr, sizeof(Header)) < 0) goto cleanup;
+    uint64_t results[SEARCH_MAX_RESULTS];
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const size_t hits = searchIndexQuery(query, results, SEARCH_MAX_RESULTS);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    char line[512];
+    snprintf(line, sizeof(line), "%zu hits for \"%s\" (%.2f ms)", hits, query,
+             (double) (end.tv_sec - start.tv_sec) * 1e3 + (double) (end.tv_nsec - start.tv_nsec) / 1e6);
+    user_send_text(self, NULL, line, timestamp);
+
+    for (size_t i = 0; i < hits && i < SEARCH_MAX_RESULTS; i++) {
+        char sender[32];
+        char text[400];
+        uint64_t sentAt;
+        if (msglogLookup(results[i], sender, text, sizeof(text), &sentAt) == 0) {
+            snprintf(line, sizeof(line), "#%ju <%s> %s", (uintmax_t) results[i], sender[0] ? sender : "server", text);
+        } else {
+            snprintf(line, sizeof(line), "#%ju (no longer in the log)", (uintmax_t) results[i]);
+        }
+        user_send_text(self, NULL, line, timestamp);
+    }
+}
 
-    if (hdr.type != MT_LOGIN_REQUEST) {
-        errorPrint("Client sent msg type %d instead of LoginRequest!", hdr.type);
-        goto cleanup;
+//--- Private Nachricht: direkt in den Socket des Empfaengers, ohne Broadcast Queue und Fan-out ---//
+static void sendDirect(User *self, char *args, uint64_t timestamp) {
+    char *text = strchr(args, ' ');
+    if (text == NULL || text[1] == '\0') {
+        user_send_text(self, NULL, "Usage: /msg <user> <text>", timestamp);
+        return;
     }
+    *text++ = '\0';
 
-    //- Body lesen, maximal so gross wie in LoginRequestBody passt -//
-    LoginRequestBody loginReq;
-    uint16_t bodyLen = ntohs(hdr.length);
+    User *recipient = user_find(args);
+    if (recipient == NULL) {
+        user_send_text(self, NULL, "User not found.", timestamp);
+        return;
+    }
 
-    if (bodyLen > sizeof(LoginRequestBody)) bodyLen = sizeof(LoginRequestBody);
+    //- Beide Seiten sehen die Nachricht, markiert als privat -//
+    char line[513];
+    snprintf(line, sizeof(line), "(private) %s", text);
+    //- Ignoriert der Empfaenger den Absender, faellt sie weg; der Absender erfaehrt davon nichts, wie im Chat -//
+    const int delivered = user_send_private(recipient, self, line, timestamp);
+    user_put(recipient);
+
+    if (delivered == -1) {
+        user_send_text(self, NULL, "Error: Message could not be delivered.", timestamp);
+    } else if (recipient != self) {
+        snprintf(line, sizeof(line), "(to %s) %s", args, text);
+        user_send_text(self, self->name, line, timestamp);
+    }
+}
 
-    if (networkReceive(self->sock, &loginReq, bodyLen) <= 0) goto cleanup;
+//--- /ignore und /unignore: setzt nur ein Bit, gefiltert wird beim Fan-out ---//
+static void changeIgnore(User *self, const char *name, const int ignore, uint64_t timestamp) {
+    User *target = user_find(name);
+    if (target == NULL) {
+        user_send_text(self, NULL, "User not found.", timestamp);
+        return;
+    }
+    if (target == self) {
+        user_put(target);
+        user_send_text(self, NULL, "Error: You cannot ignore yourself.", timestamp);
+        return;
+    }
 
-    //- Validierung (Magic Number, Version, Name frei?) -//
-    uint8_t respCode = LC_SUCCESS;
+    //- Die Referenz haelt die ID und ihre Generation fest, bis das Bit gesetzt ist (siehe nameGeneration) -//
+    const int result = user_ignore(self, target->id, ignore);
+    user_put(target);
+    if (result == -1) {
+        user_send_text(self, NULL, "Error: Out of memory.", timestamp);
+        return;
+    }
 
-    if (ntohl(loginReq.magic) != MAGIC_REQUEST) {
-        respCode = LC_ERROR; //- Protokoll nicht eingehalten / Falsche Magic Number -//
-    } else if (loginReq.version != PROT_VERSION) {
-        respCode = LC_VERSION_MISMATCH; //- Client veraltet -//
-    } else {
-        char tempName[32] = {0};
+    char line[64];
+    snprintf(line, sizeof(line), ignore ? "Ignoring %s." : "No longer ignoring %s.", name);
+    user_send_text(self, NULL, line, timestamp);
+}
 
-        //- Name beginnt nach Magic(4) und Version (1) -//
-        if (bodyLen > 5) {
-            size_t nameLen = bodyLen - 5;
-            if (nameLen > 31) nameLen = 31;
-            memcpy(tempName, loginReq.name, nameLen); //- Maximal ist der Name 32Byte land -//
+//--- Eine Nachricht des Clients verarbeiten, einzeln oder aus einem Batch (Protokoll Version 1) ---//
+static void handleMessage(User *self, const uint8_t type, char *textBuffer, const uint64_t receivedAt) {
+    if (type == MT_CLIENT_TO_SERVER) {
+        uint64_t timestamp = (uint64_t) time(NULL);
+        //- Keine Steuerzeichen (zB Terminal Escapes) an die Empfaenger; der Text endet ohnehin am ersten NUL -//
+        const size_t textLen = strlen(textBuffer);
+        if (validateText(textBuffer, textLen) != textLen) {
+            user_send_text(self, NULL, "Error: Message contains control characters and was dropped.", timestamp);
+            return;
         }
+        //- Auf Admin Nachricht pruefen -//
+        if (textBuffer[0] == '/') {
+            //- Raeume darf jeder wechseln -//
+            if (strncmp(textBuffer, "/join ", 6) == 0) {
+                changeRoom(self, textBuffer + 6, timestamp);
+                return;
+            }
+            if (strcmp(textBuffer, "/leave") == 0) {
+                changeRoom(self, "lobby", timestamp);
+                return;
+            }
+            if (strncmp(textBuffer, "/msg ", 5) == 0) {
+                sendDirect(self, textBuffer + 5, timestamp);
+                return;
+            }
+            if (strncmp(textBuffer, "/ignore ", 8) == 0) {
+                changeIgnore(self, textBuffer + 8, 1, timestamp);
+                return;
+            }
+            if (strncmp(textBuffer, "/unignore ", 10) == 0) {
+                changeIgnore(self, textBuffer + 10, 0, timestamp);
+                return;
+            }
 
-        //- Gueltigkeit des Namens ueberpruefen -//
-        int name_is_valid = 1;
-        int namelen = (int) strlen(tempName);
-        for (int i = 0; i < namelen; i++) {
-            unsigned char c = (unsigned char) tempName[i];
-            if (c == 34 || c == 39 || c == 96 || c < 32 || c > 126) { //- ASCII Codierung -//
-                name_is_valid = 0;
-                break;
+            //- Falls nicht vom Admin, keine Befehle durchsetzen -//
+            if (strcmp(self->name, "Admin") != 0) {
+                user_send_text(self, NULL, "Permission denied!", timestamp);
+                return;
             }
-        }
 
-        if (!name_is_valid) {
-            respCode = LC_NAME_INVALID;
+            //- Pause -//
+            if (strcmp(textBuffer, "/pause") == 0) {
+                if (broadcastStop() == 0) {
+                    InternalMessage msg = {0};
+                    msg.type = MT_SERVER_TO_CLIENT;
+                    msg.room = ROOM_ALL;
+                    msg.userId = NAME_ID_NONE; // Kein Absender = Servernachricht
+                    msg.timestamp = timestamp;
+                    strncpy(msg.text, "Server paused.", 512);
+                    broadcastQueueSend(&msg);
+                } else {
+                    user_send_text(self, NULL, "Error: Server already paused.", timestamp);
+                }
+            }
+            //- Resume -//
+            else if (strcmp(textBuffer, "/resume") == 0) {
+                if (broadcastResume() == 0) {
+                    InternalMessage msg = {0};
+                    msg.type = MT_SERVER_TO_CLIENT;
+                    msg.room = ROOM_ALL;
+                    msg.userId = NAME_ID_NONE; // Kein Absender
+                    msg.timestamp = timestamp;
+                    strncpy(msg.text, "Server resumed.", 512);
+                    broadcastQueueSend(&msg);
+                } else {
+                    user_send_text(self, NULL, "Error: Server not paused.", timestamp);
+                }
+            }
+            //- Kick -//
+            else if (strncmp(textBuffer, "/kick ", 6) == 0) {
+                char *victimName = textBuffer + 6;
+                User *victim = user_find(victimName);
+
+                if (victim) {
+                    //- Nur shutdown: Schliessen und Freigeben uebernimmt der Thread des Opfers (user_remove) -//
+                    //- Unter sendLock, damit auch eine wartende Sitzung (session.h) endet -//
+                    lockprofAcquire(&victim->sendLock, &lockStatsSend);
+                    victim->closeReason=1;
+                    sessionEnd(victim);
+                    shutdown(victim->sock, SHUT_RDWR);
+                    pthread_mutex_unlock(&victim->sendLock);
+                    user_put(victim);
+                } else {
+                    user_send_text(self, NULL, "User not found.", timestamp);
+                }
+            }
+            //- Volltextsuche im Verlauf -//
+            else if (strncmp(textBuffer, "/search ", 8) == 0) {
+                searchHistory(self, textBuffer + 8, timestamp);
+            }
+            //- Statistiken -//
+            else if (strcmp(textBuffer, "/stats") == 0) {
+                statsReport(self);
+            }
+            //- Sperren Profil zur Laufzeit schalten, Ausgabe ueber /stats -//
+            else if (strncmp(textBuffer, "/lockprof ", 10) == 0) {
+                const char *arg = textBuffer + 10;
+                if (strcmp(arg, "on") == 0) lockprofEnable(1);
+                else if (strcmp(arg, "off") == 0) lockprofEnable(0);
+                else if (strcmp(arg, "reset") == 0) lockprofReset();
+                else {
+                    user_send_text(self, NULL, "Usage: /lockprof on|off|reset", timestamp);
+                    return;
+                }
+                user_send_text(self, NULL, "Lock profiling updated.", timestamp);
+            }
+            //- Latenz Trace in die Datei von --trace schreiben -//
+            else if (strcmp(textBuffer, "/trace") == 0) {
+                const int64_t records = traceDump();
+                char line[64];
+                if (records == -1) snprintf(line, sizeof(line), "Error: Tracing disabled or dump failed.");
+                else snprintf(line, sizeof(line), "Trace dumped (%jd records).", (intmax_t) records);
+                user_send_text(self, NULL, line, timestamp);
+            } else {
+                user_send_text(self, NULL, "Unknown command.", timestamp);
+            }
         }
-
-        //- Pruefen ob Name schon vergeben -//
-        else if (user_find(tempName) != NULL) {
-            respCode = LC_NAME_TAKEN;
-        } else {
-            strncpy(self->name, tempName, 31);
+        //- Normale Nachricht -//
+        else {
+            InternalMessage bcast = {0};
+            bcast.type = MT_SERVER_TO_CLIENT;
+            bcast.room = self->room;
+            bcast.userId = self->id;
+            bcast.timestamp = (uint64_t) time(NULL);
+            bcast.traceReceived = receivedAt;
+            memcpy(bcast.text, textBuffer, textLen); //- Ohne NUL bei 512 Zeichen, die Leser nehmen strnlen -//
+
+            if (queue_send(self, &bcast) == -1) {
+                user_send_text(self, NULL, "Error: Server is busy (Queue full). Message dropped.", bcast.timestamp);
+            }
         }
     }
+}
+
+//--- Empfangspuffer erst bei Bedarf; im Leerlauf gibt ihn der Chatloop wieder frei (--idle-release) ---//
+static unsigned char *rx_reserve(User *self, const size_t size) {
+    if (size <= self->rxCapacity) return self->rxBuffer;
+    unsigned char *grown = realloc(self->rxBuffer, size);
+    if (grown == NULL) {
+        errnoPrint("realloc (receive buffer)");
+        return NULL;
+    }
+    memoryAdd(MEM_BUFFER, (int64_t) (size - self->rxCapacity));
+    self->rxBuffer = grown;
+    self->rxCapacity = size;
+    return grown;
+}
+
+static void rx_release(User *self) {
+    memoryAdd(MEM_BUFFER, -(int64_t) self->rxCapacity);
+    free(self->rxBuffer);
+    self->rxBuffer = NULL;
+    self->rxCapacity = 0;
+}
+
+//- Ergebnis von receive_header -//
+#define RX_CLOSED 0
+#define RX_FRAME 1
+#define RX_ERROR (-1)
+#define RX_RETRY 2 //- EINTR -//
+#define RX_IDLE 3 //- --idle-release abgelaufen -//
+#define RX_PARK 4 //- Hot Restart -//
+
+//--- Naechsten Header lesen; gewartet wird mit poll nur, wenn Leerlauf oder Hot Restart es brauchen ---//
+static int receive_header(User *self, Header *hdr, const int wakeFd, const unsigned int idleMs) {
+    if (wakeFd == -1 && idleMs == 0) return networkReceive(self->sock, hdr, sizeof(Header));
+
+    //- Unter Last liegt der naechste Frame meist schon an, dann kostet der Leerlauf kein poll -//
+    //- Mit --handoff wird immer gepollt: nur zwischen zwei Nachrichten anhalten, Ungelesenes bleibt im Socket -//
+    if (wakeFd == -1) {
+        const ssize_t got = recv(self->sock, hdr, sizeof(Header), MSG_DONTWAIT);
+        if (got == 0) return RX_CLOSED;
+        if (got > 0) return networkReceive(self->sock, (char *) hdr + got, sizeof(Header) - (size_t) got);
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return errno == EINTR ? RX_RETRY : RX_ERROR;
+    }
+    struct pollfd fds[2] = {{.fd = self->sock, .events = POLLIN}, {.fd = wakeFd, .events = POLLIN}};
+    const int ready = poll(fds, 2, idleMs > 0 ? (int) idleMs : -1);
+    if (ready == -1) return errno == EINTR ? RX_RETRY : RX_ERROR;
+    if (ready == 0) return RX_IDLE;
+    if (fds[1].revents & POLLIN) return RX_PARK;
+    return networkReceive(self->sock, hdr, sizeof(Header));
+}
 
-    //- Login Response senden; Falls ein Fehler vorliegt, Cleanup starten -//
-    if (sendLoginResponse(self->sock, respCode) == -1) goto cleanup;
-    if (respCode != LC_SUCCESS) {
-        infoPrint("Login failed (Code: %d)", respCode);
-        goto cleanup;
+//--- Batch Frame eines v1 Clients: 32 Bit Laenge, danach gewoehnliche Frames hintereinander ---//
+static int receiveBatch(User *self, const Header *hdr, const uint64_t receivedAt) {
+    //- Die ersten beiden Bytes der Laenge stecken schon im gelesenen Header -//
+    unsigned char lengthBytes[4];
+    memcpy(lengthBytes, &hdr->length, 2);
+    if (networkReceive(self->sock, lengthBytes + 2, 2) <= 0) return -1;
+    uint32_t length;
+    memcpy(&length, lengthBytes, 4);
+    length = ntohl(length);
+    if (length > BATCH_MAX_BYTES) {
+        errorPrint("Batch of %u bytes from %s exceeds the limit", length, self->name);
+        return -1;
     }
 
+    //- Ein Byte mehr: jeder Eintrag wird fuer handleMessage an Ort und Stelle nullterminiert -//
+    unsigned char *batch = rx_reserve(self, (size_t) length + 1);
+    if (batch == NULL) return -1;
+    if (length > 0 && networkReceive(self->sock, batch, length) <= 0) return -1;
+    //- Wie gelesen: Typ und 32 Bit Laenge, dann der Inhalt -//
+    unsigned char batchHead[sizeof(BatchHeader)];
+    batchHead[0] = hdr->type;
+    memcpy(batchHead + 1, lengthBytes, 4);
+    captureData(self->sock, batchHead, sizeof(batchHead), batch, length);
+
+    size_t offset = 0;
+    while (offset + sizeof(Header) <= length) {
+        const uint8_t type = batch[offset];
+        uint16_t len;
+        memcpy(&len, batch + offset + 1, 2);
+        len = ntohs(len);
+        offset += sizeof(Header);
+        if (offset + len > length) break; //- Abgeschnittener letzter Eintrag -//
+
+        char *text = (char *) batch + offset;
+        const size_t textLen = len > 512 ? 512 : len;
+        const char saved = text[textLen]; //- Typ des naechsten Eintrags bzw. das Reservebyte -//
+        text[textLen] = '\0';
+        if (type != MT_BATCH) handleMessage(self, type, text, receivedAt); //- Keine verschachtelten Batches -//
+        text[textLen] = saved;
+        offset += len;
+    }
+    return offset == length ? 0 : -1;
+}
+
+void *clientthread(void *arg) {
+    User *self = arg; //- Impliziter Cast, explizit nicht noetig in C -//
+    Header hdr;
+
+    debugPrint("New connection handling started on socket %d", self->sock);
+    latencyPinSelf(LATENCY_IO);
+    memoryAdd(MEM_STACK, (int64_t) memoryThreadStack());
+
+    //- Der Login ist bereits in loginstage erfolgt, der User steht mit Namen in der Liste -//
     infoPrint("User logged in: %s", self->name);
+    user_arm_idle_timeout(self);
 
-    //- User ist eingeloggt; Dem neuen User die alten anzeigen -//
-    g_new_client_fd = self->sock;
-    user_iterate(send_existing_user);
+    //- Die letzten Nachrichten aus dem Log nachholen (--history), ein writev aus den Segmenten; danach erst -//
+    //- was seit dem Beitritt zur Lobby zurueckgehalten wurde (nach einem Hot Restart nur das) -//
+    if (user_replay_history(self) == -1) goto cleanup;
 
-    //- Alle alten User den neuen uebergeben -//
-    InternalMessage uadMsg;
-    uadMsg.type = MT_USER_ADDED;
-    uadMsg.data.uad.timestamp = (uint64_t) time(NULL);
-    strncpy(uadMsg.data.uad.name, self->name, 31);
+    //- Nach einem Hot Restart kennt der Client Verlauf und Userliste bereits, die anderen kennen ihn -//
+    if (!self->resumed) {
+
+        //- User ist eingeloggt (in der Lobby); Dem neuen User die alten anzeigen (Timestamp 0 = war schon da) -//
+        RoomNames present;
+        if (room_members(self->room, self, &present) == 0) {
+            user_send_names(self, present.names, present.count, 1);
+            room_names_free(&present);
+        }
+        federationSendRoster(self, 1); //- Auch die User der anderen Knoten und Worker -//
+        workersSendRoster(self, 1);
 
-    broadcastQueueSend(&uadMsg);
+        //- Alle alten User den neuen uebergeben -//
+        InternalMessage uadMsg = {0};
+        uadMsg.type = MT_USER_ADDED;
+        uadMsg.room = self->room;
+        uadMsg.userId = self->id;
+        uadMsg.timestamp = (uint64_t) time(NULL);
+
+        queue_send(self, &uadMsg);
+    }
 
     //- Chatloop -//
+    const int wakeFd = handoffWakeFd();
+    const unsigned int idleMs = memoryIdleMs();
+    const int isAdmin = strcmp(self->name, "Admin") == 0;
+chatloop:
     while (1) {
+        //- Ueberlast: erst weiterlesen, wenn der Fan-out aufgeholt hat; der Admin bleibt fuer /resume erreichbar -//
+        if (!isAdmin) overloadThrottle();
+
         //- Header und Body (max 512Byte) lesen -//
-        if (networkReceive(self->sock, &hdr, sizeof(Header)) <= 0) break;
+        int res = receive_header(self, &hdr, wakeFd, idleMs);
+        if (res == RX_RETRY) continue;
+        if (res == RX_IDLE) {
+            //- Leerlauf: Empfangspuffer weg, der komprimierte Strom behaelt nur sein Fenster -//
+            if (self->rxBuffer != NULL) rx_release(self);
+            compressPark(self->sock);
+            continue;
+        }
+        if (res == RX_PARK) {
+            if (handoffPark(self)) {
+                memoryAdd(MEM_STACK, -(int64_t) memoryThreadStack());
+                return NULL; //- Socket und User gehoeren jetzt dem neuen Prozess -//
+            }
+            continue;
+        }
+        if (res <= 0) {
+            if (res < 0 && self->closeReason == 0) self->closeReason = 2; //- zB Keepalive fehlgeschlagen -//
+            break;
+        }
+        const uint64_t receivedAt = traceNow(); //- 0 ohne --trace -//
+
+        //- Mehrere Nachrichten in einem Frame, nur nach Login mit Version 1 -//
+        if (hdr.type == MT_BATCH && self->version >= PROT_VERSION_BATCH) {
+            if (receiveBatch(self, &hdr, receivedAt) == -1) {
+                if (self->closeReason == 0) self->closeReason = 2;
+                break;
+            }
+            user_arm_idle_timeout(self);
+            continue;
+        }
 
         uint16_t len = ntohs(hdr.length);
-        char textBuffer[513];
         if (len > 512) len = 512;
+        char *textBuffer = (char *) rx_reserve(self, 513);
+        if (textBuffer == NULL) {
+            if (self->closeReason == 0) self->closeReason = 2;
+            break;
+        }
 
-        if (networkReceive(self->sock, textBuffer, len) <= 0) break;
+        res = networkReceive(self->sock, textBuffer, len);
+        if (res <= 0) {
+            if (res < 0 && self->closeReason == 0) self->closeReason = 2;
+            break;
+        }
         textBuffer[len] = '\0';
+        user_arm_idle_timeout(self);
+        captureData(self->sock, &hdr, sizeof(Header), textBuffer, len); //- Ohne --capture sofort zurueck -//
 
         //- Verarbeiten -//
-        if (hdr.type == MT_CLIENT_TO_SERVER) {
-            uint64_t timestamp = (uint64_t) time(NULL);
-            //- Auf Admin Nachricht pruefen -//
-            if (textBuffer[0] == '/') {
-                //- Falls nicht vom Admin, keine Befehle durchsetzen -//
-                if (strcmp(self->name, "Admin") != 0) {
-                    sendServer2Client(self->sock, NULL, "Permission denied!", timestamp);
-                    continue;
-                }
-
-                //- Pause -//
-                if (strcmp(textBuffer, "/pause") == 0) {
-                    if (broadcastStop() == 0) {
-                        InternalMessage msg;
-                        msg.type = MT_SERVER_TO_CLIENT;
-                        msg.data.s2c.timestamp = timestamp;
-                        memset(msg.data.s2c.original_sender, 0, 32); // Absender leer = Servernachricht
-                        strncpy(msg.data.s2c.text, "Server paused.", 512);
-                        broadcastQueueSend(&msg);
-                    } else {
-                        sendServer2Client(self->sock, NULL, "Error: Server already paused.", timestamp);
-                    }
-                }
-                //- Resume -//
-                else if (strcmp(textBuffer, "/resume") == 0) {
-                    if (broadcastResume() == 0) {
-                        InternalMessage msg;
-                        msg.type = MT_SERVER_TO_CLIENT;
-                        msg.data.s2c.timestamp = timestamp;
-                        memset(msg.data.s2c.original_sender, 0, 32); // Absender leer
-                        strncpy(msg.data.s2c.text, "Server resumed.", 512);
-                        broadcastQueueSend(&msg);
-                    } else {
-                        sendServer2Client(self->sock, NULL, "Error: Server not paused.", timestamp);
-                    }
-                }
-                //- Kick -//
-                else if (strncmp(textBuffer, "/kick ", 6) == 0) {
-                    char *victimName = textBuffer + 6;
-                    User *victim = user_find(victimName);
-
-                    if (victim) {
-                        victim->closeReason=1;
-                        shutdown(victim->sock, SHUT_RDWR);
-                        close(victim->sock);
-                    } else {
-                        sendServer2Client(self->sock, NULL, "User not found.", timestamp);
-                    }
-                } else {
-                    sendServer2Client(self->sock, NULL, "Unknown command.", timestamp);
-                }
-            }
-            //- Normale Nachricht -//
-            else {
-                InternalMessage bcast;
-                bcast.type = MT_SERVER_TO_CLIENT;
-                bcast.data.s2c.timestamp = (uint64_t) time(NULL);
-                strncpy(bcast.data.s2c.original_sender, self->name, 31);
-                strncpy(bcast.data.s2c.text, textBuffer, 512);
-
-                if (broadcastQueueSend(&bcast) == -1) {
-                    sendServer2Client(self->sock, NULL, "Error: Server is busy (Queue full). Message dropped.", bcast.data.s2c.timestamp);
-                }
-            }
-        }
+        handleMessage(self, hdr.type, textBuffer, receivedAt);
     }
 
-    //- Cleanup Goto -//
+    //- Fortsetzbare Sitzung: bis zur Frist warten, niemand sieht den User gehen; danach weiter auf dem neuen Socket -//
+    if (sessionPark(self)) goto chatloop;
+
+    //- Cleanup -//
 cleanup:
     debugPrint("Client thread stopping for %s.", self->name);
+    captureClose(self->sock); //- Zeitpunkt, zu dem der Client ging; der Socket bleibt bis user_put offen -//
 
-    char savedName[32];
-    strncpy(savedName, self->name, 32);
     int savedIsKicked = self->closeReason;
-    int hasName = (strlen(savedName) > 0);
+    int savedRoom = self->room;
+    const uint32_t savedId = self->id;
+    const int savedAdmin = strcmp(self->name, "Admin") == 0; //- self ist nach user_remove evtl. schon frei -//
+    char savedName[32];
+    memcpy(savedName, self->name, sizeof(savedName));
+    nameRetain(savedId); //- Name muss die Abmeldung ueberleben -//
 
     user_remove(self);
 
-    if (hasName) {
-        InternalMessage urmMsg;
-        urmMsg.type = MT_USER_REMOVED;
-        urmMsg.data.urm.timestamp = (uint64_t) time(NULL);
-
-        switch (savedIsKicked) {
-            case 0: urmMsg.data.urm.code = 0; break; //- 0 = Connection closed by client -//
-            case 1: urmMsg.data.urm.code = 1; break; //- 1 = Kicked by Admin -//
-            case 2: urmMsg.data.urm.code = 2; break; //- 2 = Communication Error -//
-            default: urmMsg.data.urm.code = 0; break;
-        }
-
-        strncpy(urmMsg.data.urm.name, savedName, 32);
-
-        broadcastQueueSend(&urmMsg);
+    InternalMessage urmMsg = {0};
+    urmMsg.type = MT_USER_REMOVED;
+    urmMsg.room = savedRoom;
+    urmMsg.userId = savedId;
+    urmMsg.timestamp = (uint64_t) time(NULL);
+    urmMsg.releaseName = 1; //- Ein anderer Worker darf den Namen erst nach diesem UserRemoved vergeben (workers.h) -//
+
+    switch (savedIsKicked) {
+        case 0: urmMsg.code = 0; break; //- 0 = Connection closed by client -//
+        case 1: urmMsg.code = 1; break; //- 1 = Kicked by Admin -//
+        case 2: urmMsg.code = 2; break; //- 2 = Communication Error -//
+        default: urmMsg.code = 0; break;
     }
 
+    const int queued = savedAdmin ? broadcastQueueSend(&urmMsg) : broadcastQueueSendThrottled(&urmMsg);
+    if (queued == -1) workersReleaseName(savedName); //- Verworfen: der Agent gibt ihn nicht mehr frei -//
+    nameRelease(savedId);
+    memoryAdd(MEM_STACK, -(int64_t) memoryThreadStack());
+
     return NULL;
 }
@@ -0,0 +1,430 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "compress.h"
+#include "memory.h"
+#include "util.h"
+
+#ifdef HAVE_ZLIB
+#define ZLIB_CONST
+#include <zlib.h>
+
+#define COMPRESS_MEM_LEVEL 6
+#define COMPRESS_CHUNK 16384
+#define COMPRESS_SLOTS_MAX (1u << 22)
+
+//- Ein Strom je Verbindung; der Client haelt genau einen Inflate Strom dagegen -//
+typedef struct {
+    pthread_mutex_t lock; // Client Thread, Broadcast Agent und /msg schreiben an denselben Socket
+    int pending; // Eingabe ohne Flush im Strom
+    int used; // Seit dem letzten compressPark gesendet
+    int parked; // Nur das Fenster liegt in dict, stream ist beendet
+    unsigned char *dict;
+    uInt dictLen;
+    z_stream stream;
+} Stream;
+
+static Stream **streams; // Nach Deskriptor; geschrieben nur bei Attach/Detach, wenn sonst niemand an fd sendet
+static size_t streamSlots;
+static int level;
+static int streamLevel = Z_DEFAULT_COMPRESSION;
+
+//- Nur der Broadcast Agent: eigener Strom fuer die gemeinsamen Bloecke -//
+static z_stream sharedStream;
+static int sharedReady = 0;
+
+static unsigned int statActive;
+static uint64_t statOpened;
+static uint64_t statIn; // Klartext, der bei Clients ankommt
+static uint64_t statOut; // Dafuer gesendete Bytes
+static uint64_t statCpuNs; // Thread CPU Zeit in deflate, deflateSetDictionary und den gemeinsamen Bloecken
+static uint64_t statShared; // Einmal komprimierte Bloecke
+static uint64_t statSharedSends; // ... und so oft gesendet
+static unsigned int statParked;
+static uint64_t statUnparked;
+
+static uint64_t cpu_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+static void stat_add(uint64_t *counter, const uint64_t value) {
+    __atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+}
+
+int compressInit(const int compressionLevel) {
+    //- Jeder moegliche Deskriptor bekommt einen Platz, auch ohne --compress fuer uebernommene Verbindungen -//
+    struct rlimit limit;
+    streamSlots = 65536;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur > streamSlots) {
+        streamSlots = limit.rlim_cur < COMPRESS_SLOTS_MAX ? (size_t) limit.rlim_cur : COMPRESS_SLOTS_MAX;
+    }
+    streams = calloc(streamSlots, sizeof(Stream *));
+    if (streams == NULL) {
+        errnoPrint("calloc (compression streams)");
+        return -1;
+    }
+
+    level = compressionLevel;
+    if (level > 0) streamLevel = level;
+    if (deflateInit2(&sharedStream, streamLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        errorPrint("deflateInit2 failed, shared compression disabled");
+    } else {
+        sharedReady = 1;
+    }
+    if (level > 0) infoPrint("Compression: zlib %s level %d, window %d bytes", zlibVersion(), level, COMPRESS_DICT_MAX);
+    return 0;
+}
+
+//- Nach broadcastAgentCleanup; die Tabelle bleibt, Client Threads koennen bis zum Exit noch senden -//
+void compressCleanup(void) {
+    if (sharedReady) deflateEnd(&sharedStream);
+    sharedReady = 0;
+}
+
+int compressAvailable(void) {
+    return level > 0 && streams != NULL;
+}
+
+static Stream *stream_get(const int fd) {
+    if (streams == NULL || fd < 0 || (size_t) fd >= streamSlots) return NULL;
+    return __atomic_load_n(&streams[fd], __ATOMIC_ACQUIRE);
+}
+
+//--- Zaehlender Allokator fuer die Stroeme der Verbindungen: ihr zlib Speicher erscheint in /stats (memory.h) ---//
+#define ALLOC_HEADER 16 // Haelt die Groesse, ohne die Ausrichtung von malloc zu verlieren
+
+static voidpf stream_alloc(voidpf opaque, const uInt items, const uInt size) {
+    (void) opaque;
+    const size_t bytes = (size_t) items * size;
+    unsigned char *p = malloc(ALLOC_HEADER + bytes);
+    if (p == NULL) return Z_NULL;
+    memcpy(p, &bytes, sizeof(bytes));
+    memoryAdd(MEM_COMPRESS, (int64_t) bytes);
+    return p + ALLOC_HEADER;
+}
+
+static void stream_free(voidpf opaque, voidpf address) {
+    (void) opaque;
+    unsigned char *p = (unsigned char *) address - ALLOC_HEADER;
+    size_t bytes;
+    memcpy(&bytes, p, sizeof(bytes));
+    memoryAdd(MEM_COMPRESS, -(int64_t) bytes);
+    free(p);
+}
+
+static int stream_init(Stream *s) {
+    s->stream.zalloc = stream_alloc;
+    s->stream.zfree = stream_free;
+    s->stream.opaque = Z_NULL;
+    //- Negative Fensterbits: raw deflate ohne zlib Kopf und Pruefsumme, der Strom endet nie -//
+    return deflateInit2(&s->stream, streamLevel, Z_DEFLATED, -COMPRESS_WINDOW_BITS, COMPRESS_MEM_LEVEL,
+                        Z_DEFAULT_STRATEGY) == Z_OK ? 0 : -1;
+}
+
+//--- Geparkter Strom: neu anlegen und mit dem Fenster fortsetzen, wie nach einem Hot Restart; haelt s->lock ---//
+static int stream_unpark(Stream *s) {
+    s->used = 1;
+    if (!s->parked) return 0;
+    if (stream_init(s) == -1) return -1;
+    const int res = s->dictLen > 0 ? deflateSetDictionary(&s->stream, s->dict, s->dictLen) : Z_OK;
+    free(s->dict);
+    memoryAdd(MEM_COMPRESS, -(int64_t) COMPRESS_DICT_MAX);
+    s->dict = NULL;
+    s->dictLen = 0;
+    s->parked = 0;
+    __atomic_sub_fetch(&statParked, 1, __ATOMIC_RELAXED);
+    stat_add(&statUnparked, 1);
+    return res == Z_OK ? 0 : -1;
+}
+
+int compressAttach(const int fd) {
+    if (streams == NULL || fd < 0 || (size_t) fd >= streamSlots) return -1;
+
+    Stream *s = calloc(1, sizeof(Stream));
+    if (s == NULL) {
+        errnoPrint("calloc (compression stream)");
+        return -1;
+    }
+    if (stream_init(s) == -1) {
+        errorPrint("deflateInit2 failed");
+        free(s);
+        return -1;
+    }
+    memoryAdd(MEM_COMPRESS, sizeof(Stream));
+    pthread_mutex_init(&s->lock, NULL);
+    __atomic_store_n(&streams[fd], s, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&statActive, 1, __ATOMIC_RELAXED);
+    stat_add(&statOpened, 1);
+    return 0;
+}
+
+void compressDetach(const int fd) {
+    if (streams == NULL || fd < 0 || (size_t) fd >= streamSlots) return;
+    Stream *s = __atomic_exchange_n(&streams[fd], NULL, __ATOMIC_ACQ_REL);
+    if (s == NULL) return;
+    if (s->parked) {
+        free(s->dict);
+        memoryAdd(MEM_COMPRESS, -(int64_t) COMPRESS_DICT_MAX);
+        __atomic_sub_fetch(&statParked, 1, __ATOMIC_RELAXED);
+    } else {
+        deflateEnd(&s->stream);
+    }
+    memoryAdd(MEM_COMPRESS, -(int64_t) sizeof(Stream));
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    __atomic_sub_fetch(&statActive, 1, __ATOMIC_RELAXED);
+}
+
+int compressActive(const int fd) {
+    return stream_get(fd) != NULL;
+}
+
+//--- Eingabe des Stroms durch deflate und alles Fertige senden; der Aufrufer haelt s->lock ---//
+static int stream_write(const int fd, Stream *s, const int flush) {
+    unsigned char out[COMPRESS_CHUNK];
+    uint64_t cpu = 0;
+    int result = 0;
+    do {
+        s->stream.next_out = out;
+        s->stream.avail_out = sizeof(out);
+        const uint64_t start = cpu_ns();
+        const int res = deflate(&s->stream, flush);
+        cpu += cpu_ns() - start;
+        if (res == Z_STREAM_ERROR) {
+            result = -1;
+            break;
+        }
+        const size_t have = sizeof(out) - s->stream.avail_out;
+        if (have > 0 && networkSendRaw(fd, out, have) == -1) {
+            result = -1;
+            break;
+        }
+        stat_add(&statOut, have);
+    } while (s->stream.avail_out == 0);
+    s->pending = flush == Z_NO_FLUSH;
+    stat_add(&statCpuNs, cpu);
+    return result;
+}
+
+int compressSend(const int fd, const void *data, const size_t len, const int flush) {
+    Stream *s = stream_get(fd);
+    if (s == NULL) return networkSendRaw(fd, data, len);
+
+    pthread_mutex_lock(&s->lock);
+    int result = stream_unpark(s);
+    if (result == 0) {
+        s->stream.next_in = data;
+        s->stream.avail_in = (uInt) len;
+        result = stream_write(fd, s, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+    }
+    pthread_mutex_unlock(&s->lock);
+    stat_add(&statIn, len);
+    return result;
+}
+
+//--- Unabhaengiger Block: frischer Strom, Z_SYNC_FLUSH endet auf einer Bytegrenze ohne Endblock ---//
+Frame *compressShared(const Frame *plain) {
+    if (!sharedReady) return NULL;
+
+    //- deflateBound rechnet mit Z_FINISH; der Sync Flush braucht ein paar Bytes mehr -//
+    const size_t bound = deflateBound(&sharedStream, (uLong) plain->len) + 16;
+    Frame *packed = malloc(sizeof(Frame) + bound);
+    if (packed == NULL) return NULL;
+
+    const uint64_t start = cpu_ns();
+    deflateReset(&sharedStream);
+    sharedStream.next_in = plain->data;
+    sharedStream.avail_in = (uInt) plain->len;
+    sharedStream.next_out = packed->data;
+    sharedStream.avail_out = (uInt) bound;
+    const int res = deflate(&sharedStream, Z_SYNC_FLUSH);
+    stat_add(&statCpuNs, cpu_ns() - start);
+    if (res != Z_OK || sharedStream.avail_in != 0 || sharedStream.avail_out == 0) {
+        free(packed); //- Jeder Empfaenger komprimiert dann selbst -//
+        return NULL;
+    }
+    packed->refs = 1;
+    packed->len = bound - sharedStream.avail_out;
+    stat_add(&statShared, 1);
+    return packed;
+}
+
+int compressSendShared(const int fd, const Frame *packed, const Frame *plain) {
+    Stream *s = stream_get(fd);
+    if (s == NULL) return networkSendRaw(fd, plain->data, plain->len);
+
+    pthread_mutex_lock(&s->lock);
+    int result = stream_unpark(s);
+    //- Der Block muss an einer Blockgrenze des Stroms beginnen -//
+    if (result == 0 && s->pending) {
+        s->stream.avail_in = 0;
+        result = stream_write(fd, s, Z_SYNC_FLUSH);
+    }
+    if (result == 0) result = networkSendRaw(fd, packed->data, packed->len);
+    if (result == 0) {
+        //- Der Client hat plain jetzt im Fenster; der eigene Strom muss dieselbe Vorgeschichte kennen -//
+        const uint64_t start = cpu_ns();
+        if (deflateSetDictionary(&s->stream, plain->data, (uInt) plain->len) != Z_OK) result = -1;
+        stat_add(&statCpuNs, cpu_ns() - start);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    stat_add(&statIn, plain->len);
+    stat_add(&statOut, packed->len);
+    stat_add(&statSharedSends, 1);
+    return result;
+}
+
+int compressGetHistory(const int fd, unsigned char *dict, const size_t size) {
+    Stream *s = stream_get(fd);
+    if (s == NULL || size < COMPRESS_DICT_MAX) return -1;
+
+    pthread_mutex_lock(&s->lock);
+    int result = 0;
+    uInt len = 0;
+    if (s->parked) {
+        memcpy(dict, s->dict, s->dictLen);
+        len = s->dictLen;
+    } else {
+        if (s->pending) {
+            s->stream.avail_in = 0;
+            result = stream_write(fd, s, Z_SYNC_FLUSH);
+        }
+        if (result == 0 && deflateGetDictionary(&s->stream, dict, &len) != Z_OK) result = -1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return result == 0 ? (int) len : -1;
+}
+
+//--- Leerlauf: zlib Zustand (~64 KiB) gegen eine Kopie des Fensters (8 KiB) tauschen ---//
+int compressPark(const int fd) {
+    Stream *s = stream_get(fd);
+    if (s == NULL) return 0;
+
+    pthread_mutex_lock(&s->lock);
+    //- Wie beim Clock Verfahren: erst ein ganzer Abstand ohne Senden parkt den Strom -//
+    if (s->parked || s->used) {
+        s->used = 0;
+        pthread_mutex_unlock(&s->lock);
+        return 0;
+    }
+    int result = 0;
+    if (s->pending) {
+        s->stream.avail_in = 0;
+        result = stream_write(fd, s, Z_SYNC_FLUSH);
+    }
+    unsigned char *dict = result == 0 ? malloc(COMPRESS_DICT_MAX) : NULL;
+    uInt len = 0;
+    if (dict == NULL || deflateGetDictionary(&s->stream, dict, &len) != Z_OK) {
+        free(dict);
+        pthread_mutex_unlock(&s->lock);
+        return 0;
+    }
+    deflateEnd(&s->stream);
+    memoryAdd(MEM_COMPRESS, COMPRESS_DICT_MAX);
+    s->dict = dict;
+    s->dictLen = len;
+    s->parked = 1;
+    pthread_mutex_unlock(&s->lock);
+    __atomic_add_fetch(&statParked, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+int compressSetHistory(const int fd, const unsigned char *dict, const size_t len) {
+    Stream *s = stream_get(fd);
+    if (s == NULL) return -1;
+    if (len == 0) return 0;
+
+    pthread_mutex_lock(&s->lock);
+    const int res = stream_unpark(s) == 0 ? deflateSetDictionary(&s->stream, dict, (uInt) len) : Z_STREAM_ERROR;
+    pthread_mutex_unlock(&s->lock);
+    return res == Z_OK ? 0 : -1;
+}
+
+void compressStatsFormat(char *buf, const size_t size) {
+    const uint64_t in = __atomic_load_n(&statIn, __ATOMIC_RELAXED);
+    const uint64_t out = __atomic_load_n(&statOut, __ATOMIC_RELAXED);
+    const uint64_t cpu = __atomic_load_n(&statCpuNs, __ATOMIC_RELAXED);
+    snprintf(buf, size,
+             "compress: level=%d streams=%u opened=%ju in=%ju out=%ju ratio=%.2f cpu=%.3fms (%.1fns/byte) "
+             "shared=%ju blocks %ju sends parked=%u unparked=%ju",
+             level, __atomic_load_n(&statActive, __ATOMIC_RELAXED), (uintmax_t) statOpened, (uintmax_t) in,
+             (uintmax_t) out, out ? (double) in / (double) out : 0.0, (double) cpu / 1e6,
+             in ? (double) cpu / (double) in : 0.0, (uintmax_t) statShared, (uintmax_t) statSharedSends,
+             __atomic_load_n(&statParked, __ATOMIC_RELAXED), (uintmax_t) statUnparked);
+}
+
+#else
+//--- Ohne zlib gebaut: kein Login bekommt einen komprimierten Strom ---//
+
+int compressInit(const int compressionLevel) {
+    if (compressionLevel > 0) errorPrint("Built without zlib, --compress is ignored");
+    return 0;
+}
+
+void compressCleanup(void) {
+}
+
+int compressAvailable(void) {
+    return 0;
+}
+
+int compressAttach(const int fd) {
+    (void) fd;
+    return -1;
+}
+
+void compressDetach(const int fd) {
+    (void) fd;
+}
+
+int compressActive(const int fd) {
+    (void) fd;
+    return 0;
+}
+
+int compressSend(const int fd, const void *data, const size_t len, const int flush) {
+    (void) flush;
+    return networkSendRaw(fd, data, len);
+}
+
+Frame *compressShared(const Frame *plain) {
+    (void) plain;
+    return NULL;
+}
+
+int compressSendShared(const int fd, const Frame *packed, const Frame *plain) {
+    (void) packed;
+    return networkSendRaw(fd, plain->data, plain->len);
+}
+
+int compressGetHistory(const int fd, unsigned char *dict, const size_t size) {
+    (void) fd;
+    (void) dict;
+    (void) size;
+    return -1;
+}
+
+int compressSetHistory(const int fd, const unsigned char *dict, const size_t len) {
+    (void) fd;
+    (void) dict;
+    (void) len;
+    return -1;
+}
+
+int compressPark(const int fd) {
+    (void) fd;
+    return 0;
+}
+
+void compressStatsFormat(char *buf, const size_t size) {
+    snprintf(buf, size, "compress: unavailable (built without zlib)");
+}
+#endif
@@ -0,0 +1,46 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+
+#include "network.h"
+
+#define COMPRESS_WINDOW_BITS 13 // 8 KiB Fenster: ~64 KiB zlib Speicher je Verbindung statt ~260 KiB
+#define COMPRESS_DICT_MAX (1 << COMPRESS_WINDOW_BITS)
+
+// Legt die Tabelle der Stroeme an; level 0 = keine neuen komprimierten Logins (uebernommene bleiben es)
+int compressInit(int level);
+
+void compressCleanup(void);
+
+// Darf ein Login mit PROT_FLAG_COMPRESS einen komprimierten Strom bekommen?
+int compressAvailable(void);
+
+// Ab jetzt geht alles an fd durch einen eigenen Deflate Strom (raw deflate, ein Inflate beim Client)
+int compressAttach(int fd);
+
+// Vor close(fd), danach sendet niemand mehr an fd
+void compressDetach(int fd);
+
+int compressActive(int fd);
+
+// Fuer network.c; flush = 1 schliesst mit Z_SYNC_FLUSH ab, der Client kann dann alles bis hier entpacken
+int compressSend(int fd, const void *data, size_t len, int flush);
+
+// Gemeinsame Kompression einer Gruppe: ein unabhaengiger Block, den jeder Strom der Gruppe unveraendert senden kann
+Frame *compressShared(const Frame *plain);
+
+// Sendet den Block aus compressShared und gleicht das Fenster des Stroms an plain an
+int compressSendShared(int fd, const Frame *packed, const Frame *plain);
+
+// Hot Restart: Fenster des Stroms auslesen bzw. im Nachfolger wieder einsetzen; Laenge oder -1
+int compressGetHistory(int fd, unsigned char *dict, size_t size);
+
+int compressSetHistory(int fd, const unsigned char *dict, size_t len);
+
+// Leerlauf: ohne Senden seit dem letzten Aufruf wird der Strom auf sein Fenster reduziert; 1 = geparkt
+int compressPark(int fd);
+
+void compressStatsFormat(char *buf, size_t size);
+
+#endif
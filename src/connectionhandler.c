@@ -1,93 +1,267 @@
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
 
 #include "connectionhandler.h"
 
 #include <signal.h>
 #include <stdbool.h>
 
-#include "clientthread.h"
-#include "user.h"
+#include "latency.h"
+#include "loginstage.h"
+#include "memory.h"
 #include "util.h"
 
 //- Variable von main.c -//
 extern volatile sig_atomic_t serverRunning;
 
-//--- Erstellt den Socket und Filedesriptor ---//
-static int createPassiveSocket(const in_port_t port) {
-    //- Parameter: IPv4, TCP, Standard -//
-    const int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd == -1) {
-        errnoPrint("socket");
+#define MAX_LISTENERS 8
+
+//- Alle Listener speisen denselben Accept Loop und damit dieselbe Login Stufe -//
+typedef struct {
+    int fd;
+    int tcp; // Keepalive nur fuer TCP, Unix Sockets kennen keine TCP Optionen
+} Listener;
+
+static Listener listeners[MAX_LISTENERS]; // Bleiben ueber einen abgebrochenen Hot Restart hinweg offen
+static unsigned int listenerCount = 0;
+static const char *listenSpecs[MAX_LISTENERS];
+static unsigned int listenSpecCount = 0;
+static int reusePort = 0; // Mehrere Worker Prozesse teilen sich den Port, der Kernel verteilt die Verbindungen
+
+void connectionHandlerSetReusePort(const int enable) {
+    reusePort = enable;
+}
+
+//--- Aus --listen ADDR, vor connectionHandler aufrufen ---//
+int connectionHandlerAddListen(const char *spec) {
+    if (listenSpecCount == MAX_LISTENERS) {
+        fprintf(stderr, "Too many listeners (max %d)\n", MAX_LISTENERS);
         return -1;
     }
+    if (strncmp(spec, "unix:", 5) != 0 && strrchr(spec, ':') == NULL) {
+        fprintf(stderr, "Invalid listen address %s (HOST:PORT, [ADDR]:PORT, *:PORT or unix:PATH)\n", spec);
+        return -1;
+    }
+    listenSpecs[listenSpecCount++] = spec;
+    return 0;
+}
+
+static int listener_is_tcp(const int fd) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *) &addr, &len) == -1) return 0;
+    return addr.ss_family == AF_INET || addr.ss_family == AF_INET6;
+}
+
+//--- Vom Vorgaenger uebernommener Listener (--takeover) ---//
+int connectionHandlerAdoptListener(const int fd) {
+    if (listenerCount == MAX_LISTENERS) return -1;
+    listeners[listenerCount].fd = fd;
+    listeners[listenerCount].tcp = listener_is_tcp(fd);
+    listenerCount++;
+    return 0;
+}
+
+size_t connectionHandlerListenSockets(int *fds, const size_t max) {
+    size_t count = 0;
+    for (unsigned int i = 0; i < listenerCount && count < max; i++) {
+        fds[count++] = listeners[i].fd;
+    }
+    return count;
+}
 
+//--- Setzt die Optionen, bindet und lauscht; schliesst den Socket bei Fehler ---//
+static int bindPassiveSocket(const int fd, const struct sockaddr *addr, const socklen_t len, const char *spec) {
     //- Parameter: File Descriptor, Level = Socket, Reuse Address: Adresse sofort wiederverwenden, Option = anschalten
     const int opt = 1;
-    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        errnoPrint("setsockopt");
+    if (addr->sa_family != AF_UNIX) {
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+            errnoPrint("setsockopt");
+            close(fd);
+            return -1;
+        }
+        if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+            errnoPrint("setsockopt SO_REUSEPORT");
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (bind(fd, addr, len) == -1) {
+        errnoPrint("bind %s", spec);
+        close(fd);
+        return -1;
+    }
+
+    //- Der Accept Loop ist kurz (Login laeuft in loginstage), die Warteschlange darf daher voll ausgenutzt werden -//
+    if (listen(fd, SOMAXCONN) == -1) {
+        errnoPrint("listen");
         close(fd);
         return -1;
     }
+    //- Der Accept Loop wartet per poll() auf alle Listener, accept() darf dann nicht mehr haengen -//
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+//--- Ohne --listen wie bisher: IPv4 Loopback ---//
+static int createPassiveSocket(const in_port_t port) {
+    //- Parameter: IPv4, TCP, Standard -//
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        errnoPrint("socket");
+        return -1;
+    }
 
     //- Socket Adresse initialisieren und binden --/
     struct sockaddr_in server_addr = {0};
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(port);
     server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    if (bind(fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) == -1) {
-        errnoPrint("bind");
-        close(fd);
+    //- File Descriptor zurueckgeben fuer den ConnectionHandler -//
+    return bindPassiveSocket(fd, (struct sockaddr *) &server_addr, sizeof(server_addr), "127.0.0.1");
+}
+
+//--- unix:PATH, [ADDR]:PORT, HOST:PORT oder *:PORT (alle Adressen, IPv6 und IPv4 ueber einen Socket) ---//
+static int createListenSocket(const char *spec) {
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        if (strlen(spec + 5) == 0 || strlen(spec + 5) >= sizeof(addr.sun_path)) {
+            errorPrint("Invalid unix socket path: %s", spec + 5);
+            return -1;
+        }
+        strcpy(addr.sun_path, spec + 5);
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1) {
+            errnoPrint("socket (unix)");
+            return -1;
+        }
+        unlink(addr.sun_path); //- Verwaister Socket eines frueheren Laufs -//
+        return bindPassiveSocket(fd, (struct sockaddr *) &addr, sizeof(addr), spec);
+    }
+
+    //- Host und Port trennen, IPv6 Adressen stehen in eckigen Klammern -//
+    char host[256];
+    const char *colon = strrchr(spec, ':');
+    size_t hostLen = (size_t) (colon - spec);
+    const char *hostStart = spec;
+    if (hostLen >= 2 && spec[0] == '[' && spec[hostLen - 1] == ']') {
+        hostStart++;
+        hostLen -= 2;
+    }
+    if (hostLen >= sizeof(host)) {
+        errorPrint("Invalid listen address: %s", spec);
         return -1;
     }
+    memcpy(host, hostStart, hostLen);
+    host[hostLen] = '\0';
+    const int wildcard = hostLen == 0 || strcmp(host, "*") == 0;
 
-    //- Maximal 10 User duerfen warten um reingelassen zu werden -//
-    if (listen(fd, 10) == -1) {
-        errnoPrint("listen");
-        close(fd);
+    struct addrinfo hints = {0};
+    hints.ai_family = wildcard ? AF_INET6 : AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    struct addrinfo *result;
+    const int rc = getaddrinfo(wildcard ? NULL : host, colon + 1, &hints, &result);
+    if (rc != 0) {
+        errorPrint("Unable to resolve listen address %s: %s", spec, gai_strerror(rc));
         return -1;
     }
-    //- File Descriptor zurueckgeben fuer den ConnectionHandler -//
-    return fd;
+
+    const int fd = socket(result->ai_family, SOCK_STREAM, 0);
+    if (fd == -1) {
+        errnoPrint("socket");
+        freeaddrinfo(result);
+        return -1;
+    }
+    //- Dual Stack: IPv4 Clients kommen als ::ffff:a.b.c.d auf demselben Socket an -//
+    if (wildcard) {
+        const int off = 0;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    }
+    const int bound = bindPassiveSocket(fd, result->ai_addr, result->ai_addrlen, spec);
+    freeaddrinfo(result);
+    return bound;
+}
+
+static int openListeners(const in_port_t port) {
+    if (listenSpecCount == 0) {
+        const int fd = createPassiveSocket(port);
+        if (fd == -1) return -1;
+        connectionHandlerAdoptListener(fd);
+        return 0;
+    }
+    for (unsigned int i = 0; i < listenSpecCount; i++) {
+        const int fd = createListenSocket(listenSpecs[i]);
+        if (fd == -1) return -1;
+        connectionHandlerAdoptListener(fd);
+        infoPrint("Listening on %s", listenSpecs[i]);
+    }
+    return 0;
+}
+
+//--- TCP Keepalive als Heartbeat: abgestuerzte Clients ohne FIN fallen so nach ca. 60s auf ---//
+static void enableHeartbeat(const int fd) {
+    const int on = 1;
+    const int idle = 30; //- Sekunden Stille bis zur ersten Probe -//
+    const int interval = 10;
+    const int count = 3;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) == -1
+        || setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) == -1
+        || setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) == -1
+        || setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) == -1) {
+        errnoPrint("setsockopt keepalive");
+    }
 }
 
 int connectionHandler(const in_port_t port) {
-    const int fd = createPassiveSocket(port);
-    if (fd == -1) {
+    if (listenerCount == 0 && openListeners(port) == -1) {
         errnoPrint("Unable to create server socket");
         return -1;
     }
+
+    struct pollfd fds[MAX_LISTENERS];
+    for (unsigned int i = 0; i < listenerCount; i++) {
+        fds[i].fd = listeners[i].fd;
+        fds[i].events = POLLIN;
+    }
     while (serverRunning) {
-        //- mit accept koennte die IP des Nutzers abgefragt werden, aber kein Interrese -//
-        int client_fd = accept(fd, NULL, NULL);
-        if (client_fd == -1) {
+        if (poll(fds, listenerCount, -1) == -1) {
             if (errno == EINTR) { //- Nur Signal? -//
                 continue;
             }
-            errnoPrint("accept");
-            continue;;
-        }
-        fprintf(stderr, "Accepted new connection (fd=%d)\n", client_fd);
-
-        //- User erstellen und den Filedescriptor abspeichern darin -//
-        User *newUser = user_add(client_fd);
-        if (newUser == NULL) {
-            fprintf(stderr, "Unable to add new user\n");
-            close(client_fd);
+            errnoPrint("poll");
             continue;
         }
 
-        //- Thread erstellen und an clientthread die Arbeit abgeben -//
-        pthread_t thread;
-        if (pthread_create(&thread, NULL, clientthread, newUser) != 0) {
-            fprintf(stderr, "Failed to create client thread\n");
-            user_remove(newUser); //Clean up
-            close(client_fd);
-            continue;
+        for (unsigned int i = 0; i < listenerCount; i++) {
+            if (!(fds[i].revents & POLLIN)) continue;
+
+            //- mit accept koennte die IP des Nutzers abgefragt werden, aber kein Interrese -//
+            int client_fd = accept(listeners[i].fd, NULL, NULL);
+            if (client_fd == -1) {
+                if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) errnoPrint("accept");
+                continue;
+            }
+            fprintf(stderr, "Accepted new connection (fd=%d)\n", client_fd);
+            if (listeners[i].tcp) {
+                enableHeartbeat(client_fd);
+                latencySocket(client_fd); //- Nur mit --busy-poll -//
+            }
+            memorySocket(client_fd); //- Nur mit --sndbuf/--rcvbuf -//
+
+            //- Bis zum erfolgreichen Login bleibt der Socket in der Login Stufe, erst dann gibt es User und Thread -//
+            loginStageAdd(client_fd);
         }
-        pthread_detach(thread);
     }
-    return 0; //- never reached -//
+    return 0; //- Strg+C oder Hot Restart -//
 }
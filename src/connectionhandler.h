@@ -1,8 +1,19 @@
 #ifndef CONNECTIONHANDLER_H
 #define CONNECTIONHANDLER_H
 
+#include <stddef.h>
 #include <netinet/in.h>
 
+void connectionHandlerSetReusePort(int enable);
+
+// Aus --listen ADDR (mehrfach angebbar); ohne Angabe lauscht der Server auf 127.0.0.1:PORT
+int connectionHandlerAddListen(const char *spec);
+
+// Vom Vorgaenger uebernommener Listener (--takeover)
+int connectionHandlerAdoptListener(int fd);
+
+size_t connectionHandlerListenSockets(int *fds, size_t max);
+
 int connectionHandler(in_port_t port);
 
 #endif
@@ -0,0 +1,811 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "federation.h"
+#include "broadcastagent.h"
+#include "lockprof.h"
+#include "names.h"
+#include "room.h"
+#include "util.h"
+#include "validate.h"
+#include "workers.h"
+
+#define FED_MAGIC 0x46454432 // "FED2", steht im seq Feld des Hello
+#define FED_MAX_LINKS 16
+#define FED_MAX_PEERS 8
+#define FED_MAX_ORIGINS 64
+#define FED_BUFFER_MAX (4 * 1024 * 1024) // Ausstehende Bytes pro Link, darueber wird der Link getrennt
+#define FED_RETRY_SEC 2
+#define FED_SEEN_WINDOW 1024 // So weit darf eine Nachricht auf einem Umweg hinter der neuesten ihres Ursprungs liegen
+#define FED_TOMBSTONES 256 // Zuletzt abgemeldete entfernte User, gegen verspaetete UserAdded
+#define FED_SECRET_MAX 64
+
+enum LinkKind {
+    LINK_HELLO = 0, // Danach ein Byte Laenge und das gemeinsame Geheimnis (Laenge 0 ohne --link-secret)
+    LINK_FRAME = 1, // Danach folgt ein Frame im Chat Wire Format
+    LINK_ROSTER = 2 // UserAdded der Bestandsliste beim Verbinden: anwesend mit Stand seq, kein eigenes Ereignis
+};
+
+//- Vor jedem Frame: Ursprungsknoten und dessen laufende Nummer (Chat und Praesenz), damit Schleifen enden -//
+//- und eine verspaetete Anmeldung keine schon verarbeitete Abmeldung ueberholt -//
+typedef struct __attribute__((packed)) {
+    uint8_t kind;
+    uint32_t origin;
+    uint64_t seq;
+} LinkHeader;
+
+typedef struct {
+    int inUse;
+    int closing;
+    int fd;
+    uint32_t node; // Knoten der Gegenseite, 0 bis zum Hello
+    pthread_t writer;
+    pthread_mutex_t lock; // Schuetzt den Ausgangspuffer
+    pthread_cond_t ready;
+    unsigned char *out; // Alles was sich waehrend eines write() ansammelt, geht im naechsten als ein Block raus
+    size_t outLen;
+    size_t outCapacity;
+} Link;
+
+//- Ein User auf einem anderen Knoten; die ID haelt den Namen in names.c fest -//
+typedef struct {
+    uint32_t origin;
+    uint32_t id;
+    int link; // Ueber diesen Link gelernt; faellt er weg, verschwindet der User
+    uint64_t seq; // Nummer des UserAdded bzw. Stand der Bestandsliste, 0 = nur aus einer Chatnachricht bekannt
+    size_t hashNext; // Index + 1 des naechsten Users im selben Bucket, 0 = Ende
+    char name[32];
+} RemoteUser;
+
+typedef struct {
+    char host[256];
+    char port[16];
+} Peer;
+
+static pthread_mutex_t fedLock = PTHREAD_MUTEX_INITIALIZER;
+static int enabled = 0;
+static volatile int running = 0;
+static uint32_t nodeId;
+static uint64_t localSeq;
+static Link links[FED_MAX_LINKS];
+static RemoteUser *remote;
+static size_t remoteCount;
+static size_t remoteCapacity;
+//- Namensindex ueber remote: Buckets halten Index + 1, verkettet ueber hashNext, geschuetzt durch fedLock -//
+#define REMOTE_INDEX_SIZE 4096
+static size_t remoteIndex[REMOTE_INDEX_SIZE];
+static struct {
+    uint32_t node;
+    uint64_t seq; // Hoechste angenommene Nummer
+    uint64_t window[FED_SEEN_WINDOW / 64]; // Bit k: seq - k angenommen
+} seen[FED_MAX_ORIGINS];
+static unsigned int seenNext;
+static struct {
+    uint32_t origin;
+    uint64_t seq; // Nummer des UserRemoved
+    char name[32];
+} tombstones[FED_TOMBSTONES];
+static unsigned int tombstoneNext;
+
+static Peer peers[FED_MAX_PEERS];
+static unsigned int peerCount;
+static int listenFd = -1;
+static struct in_addr bindAddr = {0}; // Vor federationInit auf Loopback gesetzt, wenn --link-bind fehlt
+static int bindSet = 0;
+static char secret[FED_SECRET_MAX];
+static size_t secretLen;
+
+static unsigned long statForwarded;
+static unsigned long statReceived;
+static unsigned long statDuplicates;
+static unsigned long statBatches;
+static unsigned long statOverflows;
+static unsigned long statInvalid;
+static unsigned long statRejected;
+
+static __thread Link *g_snapshot_link;
+
+//--- Haengt einen Datensatz an den Ausgangspuffer, der Writer Thread schickt ihn ab ---//
+static void link_append(Link *link, const LinkHeader *hdr, const void *data, const size_t len) {
+    pthread_mutex_lock(&link->lock);
+    const size_t need = link->outLen + sizeof(LinkHeader) + len;
+    if (!link->closing && need > FED_BUFFER_MAX) {
+        //- Gegenseite liest nicht mehr: trennen statt den Broadcast Agent aufzuhalten -//
+        statOverflows++;
+        link->closing = 1;
+        shutdown(link->fd, SHUT_RDWR);
+    }
+    if (link->closing) {
+        pthread_mutex_unlock(&link->lock);
+        return;
+    }
+    if (need > link->outCapacity) {
+        size_t capacity = link->outCapacity ? link->outCapacity : 4096;
+        while (capacity < need) capacity *= 2;
+        unsigned char *grown = realloc(link->out, capacity);
+        if (grown == NULL) {
+            pthread_mutex_unlock(&link->lock);
+            return;
+        }
+        link->out = grown;
+        link->outCapacity = capacity;
+    }
+    memcpy(link->out + link->outLen, hdr, sizeof(LinkHeader));
+    memcpy(link->out + link->outLen + sizeof(LinkHeader), data, len);
+    link->outLen = need;
+    pthread_cond_signal(&link->ready);
+    pthread_mutex_unlock(&link->lock);
+}
+
+//--- Tauscht den vollen Puffer gegen einen leeren und schreibt ihn ohne Lock ---//
+static void *linkWriter(void *arg) {
+    Link *link = arg;
+    unsigned char *spare = NULL;
+    size_t spareCapacity = 0;
+
+    pthread_mutex_lock(&link->lock);
+    while (1) {
+        while (link->outLen == 0 && !link->closing) pthread_cond_wait(&link->ready, &link->lock);
+        if (link->closing) break;
+
+        unsigned char *batch = link->out;
+        const size_t batchLen = link->outLen;
+        const size_t batchCapacity = link->outCapacity;
+        link->out = spare;
+        link->outCapacity = spareCapacity;
+        link->outLen = 0;
+        pthread_mutex_unlock(&link->lock);
+
+        size_t sent = 0;
+        while (sent < batchLen) {
+            const ssize_t res = send(link->fd, batch + sent, batchLen - sent, MSG_NOSIGNAL);
+            if (res == -1 && errno == EINTR) continue;
+            if (res <= 0) break;
+            sent += (size_t) res;
+        }
+        spare = batch;
+        spareCapacity = batchCapacity;
+
+        pthread_mutex_lock(&link->lock);
+        statBatches++;
+        if (sent < batchLen) {
+            link->closing = 1;
+            shutdown(link->fd, SHUT_RDWR); //- Der Leser sieht EOF und raeumt auf -//
+            break;
+        }
+    }
+    pthread_mutex_unlock(&link->lock);
+    free(spare);
+    return NULL;
+}
+
+static Link *link_open(const int fd) {
+    pthread_mutex_lock(&fedLock);
+    Link *link = NULL;
+    for (int i = 0; i < FED_MAX_LINKS; i++) {
+        if (!links[i].inUse) {
+            link = &links[i];
+            break;
+        }
+    }
+    if (link == NULL) {
+        pthread_mutex_unlock(&fedLock);
+        errorPrint("Too many federation links");
+        return NULL;
+    }
+    link->inUse = 1;
+    link->closing = 0;
+    link->fd = fd;
+    link->node = 0;
+    link->out = NULL;
+    link->outLen = 0;
+    link->outCapacity = 0;
+    pthread_mutex_init(&link->lock, NULL);
+    pthread_cond_init(&link->ready, NULL);
+    if (pthread_create(&link->writer, NULL, linkWriter, link) != 0) {
+        errorPrint("Failed to start federation writer thread");
+        link->inUse = 0;
+        pthread_mutex_unlock(&fedLock);
+        return NULL;
+    }
+    pthread_mutex_unlock(&fedLock);
+
+    //- Eigene Datensaetze werden vom Writer gebuendelt, Nagle wuerde nur verzoegern -//
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    unsigned char proof[1 + FED_SECRET_MAX];
+    proof[0] = (unsigned char) secretLen;
+    memcpy(proof + 1, secret, secretLen);
+    LinkHeader hello = {LINK_HELLO, htonl(nodeId), hton64u(FED_MAGIC)};
+    link_append(link, &hello, proof, 1 + secretLen);
+    return link;
+}
+
+static int name_valid(const char *name) {
+    const size_t n = strlen(name);
+    return n > 0 && validateName(name, n) == n;
+}
+
+//--- Liest den Rest des Hello; 0 wenn das Geheimnis nicht zu unserem passt ---//
+static int hello_check(const int fd) {
+    uint8_t n;
+    char proof[255];
+    if (networkReceive(fd, &n, 1) <= 0 || (n > 0 && networkReceive(fd, proof, n) <= 0)) return 0;
+    //- Ohne fruehen Abbruch vergleichen, die Laufzeit verraet nicht, wie viele Bytes stimmen -//
+    unsigned char diff = (unsigned char) (n != secretLen);
+    for (size_t i = 0; i < n && i < secretLen; i++) diff |= (unsigned char) (proof[i] ^ secret[i]);
+    return diff == 0;
+}
+
+static size_t remote_bucket(const char *name) {
+    uint32_t hash = 2166136261U; //- FNV-1a -//
+    for (const unsigned char *p = (const unsigned char *) name; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619U;
+    }
+    return hash & (REMOTE_INDEX_SIZE - 1);
+}
+
+static void remote_link(const size_t i) {
+    size_t *bucket = &remoteIndex[remote_bucket(remote[i].name)];
+    remote[i].hashNext = *bucket;
+    *bucket = i + 1;
+}
+
+static void remote_unlink(const size_t i) {
+    size_t *link = &remoteIndex[remote_bucket(remote[i].name)];
+    while (*link != i + 1) link = &remote[*link - 1].hashNext;
+    *link = remote[i].hashNext;
+}
+
+//--- Unter fedLock: Eintrag i entfernen, der letzte rueckt an seine Stelle ---//
+static void remote_remove(const size_t i) {
+    remote_unlink(i);
+    const size_t last = --remoteCount;
+    if (i == last) return;
+    remote_unlink(last);
+    remote[i] = remote[last];
+    remote_link(i);
+}
+
+//--- Unter fedLock: User name von Knoten origin oder NULL ---//
+static RemoteUser *remote_find(const uint32_t origin, const char *name) {
+    for (size_t next = remoteIndex[remote_bucket(name)]; next != 0; next = remote[next - 1].hashNext) {
+        RemoteUser *entry = &remote[next - 1];
+        if (entry->origin == origin && strcmp(entry->name, name) == 0) return entry;
+    }
+    return NULL;
+}
+
+//--- Unter fedLock: neuen entfernten User eintragen, liefert seine ID oder NAME_ID_NONE ---//
+static uint32_t remote_add(const uint32_t origin, const char *name, const int link, const uint64_t seq) {
+    if (remoteCount == remoteCapacity) {
+        const size_t capacity = remoteCapacity ? remoteCapacity * 2 : 64;
+        RemoteUser *grown = realloc(remote, capacity * sizeof(RemoteUser));
+        if (grown == NULL) return NAME_ID_NONE;
+        remote = grown;
+        remoteCapacity = capacity;
+    }
+    const uint32_t id = nameIntern(name);
+    if (id == NAME_ID_NONE) return NAME_ID_NONE;
+
+    RemoteUser *entry = &remote[remoteCount++];
+    entry->origin = origin;
+    entry->id = id;
+    entry->link = link;
+    entry->seq = seq;
+    memset(entry->name, 0, sizeof(entry->name));
+    strncpy(entry->name, name, 31);
+    remote_link(remoteCount - 1);
+    return id;
+}
+
+//--- Fenster um shift Nummern weiterschieben: Bit k wandert nach k + shift ---//
+static void window_shift(uint64_t *window, const uint64_t shift) {
+    const size_t words = FED_SEEN_WINDOW / 64;
+    if (shift >= FED_SEEN_WINDOW) {
+        memset(window, 0, words * sizeof(uint64_t));
+        return;
+    }
+    const size_t wordShift = (size_t) (shift / 64);
+    const unsigned int bitShift = (unsigned int) (shift % 64);
+    for (size_t w = words; w-- > 0;) {
+        uint64_t value = 0;
+        if (w >= wordShift) {
+            value = window[w - wordShift] << bitShift;
+            if (bitShift != 0 && w > wordShift) value |= window[w - wordShift - 1] >> (64 - bitShift);
+        }
+        window[w] = value;
+    }
+}
+
+//--- Nur Chatnachrichten sind nummeriert; ein Bitfenster je Ursprung erkennt Duplikate, auch auf Umwegen ---//
+//- Ueberholte Nachrichten innerhalb des Fensters kommen noch durch, aeltere gelten als Duplikat -//
+static int seen_check(const uint32_t origin, const uint64_t seq) {
+    for (unsigned int i = 0; i < FED_MAX_ORIGINS; i++) {
+        if (seen[i].node != origin) continue;
+        if (seq > seen[i].seq) {
+            window_shift(seen[i].window, seq - seen[i].seq);
+            seen[i].seq = seq;
+            seen[i].window[0] |= 1;
+            return 1;
+        }
+        const uint64_t back = seen[i].seq - seq;
+        if (back >= FED_SEEN_WINDOW) return 0;
+        uint64_t *word = &seen[i].window[back / 64];
+        const uint64_t bit = UINT64_C(1) << (back % 64);
+        if (*word & bit) return 0;
+        *word |= bit;
+        return 1;
+    }
+    //- Unbekannter Ursprung: reihum den aeltesten Platz ueberschreiben -//
+    seen[seenNext].node = origin;
+    seen[seenNext].seq = seq;
+    memset(seen[seenNext].window, 0, sizeof(seen[seenNext].window));
+    seen[seenNext].window[0] = 1;
+    seenNext = (seenNext + 1) % FED_MAX_ORIGINS;
+    return 1;
+}
+
+//--- Unter fedLock: Nummer der letzten Abmeldung von name, 0 = keine bekannt ---//
+static uint64_t tombstone_seq(const uint32_t origin, const char *name) {
+    for (unsigned int i = 0; i < FED_TOMBSTONES; i++) {
+        if (tombstones[i].seq != 0 && tombstones[i].origin == origin && strcmp(tombstones[i].name, name) == 0) {
+            return tombstones[i].seq;
+        }
+    }
+    return 0;
+}
+
+static void tombstone_set(const uint32_t origin, const char *name, const uint64_t seq) {
+    for (unsigned int i = 0; i < FED_TOMBSTONES; i++) {
+        if (tombstones[i].seq != 0 && tombstones[i].origin == origin && strcmp(tombstones[i].name, name) == 0) {
+            if (seq > tombstones[i].seq) tombstones[i].seq = seq;
+            return;
+        }
+    }
+    tombstones[tombstoneNext].origin = origin;
+    tombstones[tombstoneNext].seq = seq;
+    snprintf(tombstones[tombstoneNext].name, sizeof(tombstones[tombstoneNext].name), "%s", name);
+    tombstoneNext = (tombstoneNext + 1) % FED_TOMBSTONES;
+}
+
+static __thread uint64_t g_snapshot_seq;
+
+//--- Lokale Lobby User als UserAdded mit Timestamp 0 an einen neuen Link ---//
+static void snapshot_local_user(User *user) {
+    InternalMessage msg = {0};
+    msg.type = MT_USER_ADDED;
+    Frame *frame = frameEncode(&msg, user->name);
+    if (frame == NULL) return;
+    const LinkHeader hdr = {LINK_ROSTER, htonl(nodeId), hton64u(g_snapshot_seq)};
+    link_append(g_snapshot_link, &hdr, frame->data, frame->len);
+    frameRelease(frame);
+}
+
+static void link_snapshot(Link *link) {
+    g_snapshot_link = link;
+    //- Stand vor der Liste: eine Abmeldung, die waehrenddessen weitergereicht wird, hat eine groessere Nummer -//
+    pthread_mutex_lock(&fedLock);
+    g_snapshot_seq = localSeq;
+    pthread_mutex_unlock(&fedLock);
+    room_iterate(ROOM_LOBBY, snapshot_local_user);
+
+    //- Ueber andere Links gelernte User weiterreichen, so kennen auch Knoten hinter uns alle -//
+    pthread_mutex_lock(&fedLock);
+    for (size_t i = 0; i < remoteCount; i++) {
+        if (&links[remote[i].link] == link) continue;
+        InternalMessage msg = {0};
+        msg.type = MT_USER_ADDED;
+        Frame *frame = frameEncode(&msg, remote[i].name);
+        if (frame == NULL) continue;
+        const LinkHeader hdr = {LINK_ROSTER, htonl(remote[i].origin), hton64u(remote[i].seq)};
+        link_append(link, &hdr, frame->data, frame->len);
+        frameRelease(frame);
+    }
+    pthread_mutex_unlock(&fedLock);
+}
+
+//--- Ein Frame von einem anderen Knoten in die eigene Broadcast Queue geben ---//
+static void link_receive(Link *link, const LinkHeader *lh, const Header *hdr, const unsigned char *body, const size_t len) {
+    const uint32_t origin = ntohl(lh->origin);
+    const uint64_t seq = ntoh64u(lh->seq);
+    const int roster = lh->kind == LINK_ROSTER;
+    if (origin == nodeId || len < 8) return; //- Eigene Nachricht kam ueber einen Umweg zurueck -//
+
+    InternalMessage msg = {0};
+    msg.type = hdr->type;
+    msg.room = ROOM_LOBBY;
+    msg.origin = origin;
+    msg.originSeq = seq;
+    msg.via = (uint8_t) (link - links + 1);
+    uint64_t timestamp;
+    memcpy(&timestamp, body, 8);
+    msg.timestamp = ntoh64u(timestamp);
+
+    char name[32] = {0};
+    uint32_t dropId = NAME_ID_NONE;
+    pthread_mutex_lock(&fedLock);
+    switch (hdr->type) {
+        case MT_SERVER_TO_CLIENT: {
+            if (len < 40 || roster) goto drop;
+            if (!seen_check(origin, seq)) {
+                statDuplicates++;
+                goto drop;
+            }
+            memcpy(name, body + 8, 31);
+            //- Wie Eingaben von Clients: keine ungueltigen Namen und keine Steuerzeichen an die eigenen User -//
+            const size_t textLen = strnlen((const char *) body + 40, len - 40);
+            if (!name_valid(name) || validateText((const char *) body + 40, textLen) != textLen) goto invalid;
+            const RemoteUser *sender = remote_find(origin, name);
+            msg.userId = sender != NULL ? sender->id : remote_add(origin, name, (int) (link - links), 0);
+            memcpy(msg.text, body + 40, len - 40);
+            break;
+        }
+        case MT_USER_ADDED: {
+            //- Praesenz ist idempotent: nur Aenderungen werden verteilt und weitergereicht -//
+            memcpy(name, body + 8, len - 8 < 31 ? len - 8 : 31);
+            if (!name_valid(name)) goto invalid;
+            if (!roster && seq != 0 && !seen_check(origin, seq)) goto drop;
+            //- Schon spaeter abgemeldet (die Anmeldung kam auf einem Umweg oder mit einer alten Liste) -//
+            if (seq != 0 && tombstone_seq(origin, name) > seq) goto drop;
+            RemoteUser *entry = remote_find(origin, name);
+            if (entry != NULL) {
+                if (seq > entry->seq) entry->seq = seq;
+                goto drop;
+            }
+            msg.userId = remote_add(origin, name, (int) (link - links), seq);
+            break;
+        }
+        case MT_USER_REMOVED: {
+            if (len < 9 || roster) goto drop;
+            msg.code = body[8];
+            memcpy(name, body + 9, len - 9 < 31 ? len - 9 : 31);
+            if (!name_valid(name)) goto invalid;
+            if (seq != 0 && !seen_check(origin, seq)) goto drop;
+            if (seq != 0) tombstone_set(origin, name, seq);
+            RemoteUser *entry = remote_find(origin, name);
+            //- Ohne Eintrag merkt sich der Grabstein die Abmeldung; eine neuere Anmeldung bleibt bestehen -//
+            if (entry == NULL || (seq != 0 && entry->seq > seq)) goto drop;
+            msg.userId = entry->id;
+            dropId = entry->id; //- Referenz der Liste, die Queue haelt ihre eigene -//
+            remote_remove((size_t) (entry - remote));
+            break;
+        }
+        default:
+            goto drop;
+    }
+    if (msg.userId == NAME_ID_NONE) goto drop;
+    nameRetain(msg.userId); //- Bis broadcastQueueSend eine eigene Referenz genommen hat -//
+    statReceived++;
+    pthread_mutex_unlock(&fedLock);
+
+    broadcastQueueSend(&msg);
+    nameRelease(msg.userId);
+    nameRelease(dropId);
+    return;
+
+invalid:
+    statInvalid++;
+drop:
+    pthread_mutex_unlock(&fedLock);
+}
+
+//--- Liest bis der Link abbricht und raeumt ihn dann ab ---//
+static void link_run(Link *link) {
+    LinkHeader lh;
+    Header hdr;
+    unsigned char body[sizeof(Server2ClientBody)];
+
+    while (networkReceive(link->fd, &lh, sizeof(lh)) > 0) {
+        if (lh.kind == LINK_HELLO) {
+            const uint32_t node = ntohl(lh.origin);
+            if (ntoh64u(lh.seq) != FED_MAGIC || node == nodeId || link->node != 0) break; //- Falscher Partner oder wir selbst -//
+            if (!hello_check(link->fd)) {
+                pthread_mutex_lock(&fedLock);
+                statRejected++;
+                pthread_mutex_unlock(&fedLock);
+                errorPrint("Federation link from node %08x rejected: wrong --link-secret", node);
+                break;
+            }
+            link->node = node;
+            infoPrint("Federation link to node %08x established", node);
+            link_snapshot(link);
+            continue;
+        }
+        if ((lh.kind != LINK_FRAME && lh.kind != LINK_ROSTER) || link->node == 0) break;
+
+        if (networkReceive(link->fd, &hdr, sizeof(hdr)) <= 0) break;
+        const size_t len = ntohs(hdr.length);
+        if (len > sizeof(body) || networkReceive(link->fd, body, len) <= 0) break;
+        link_receive(link, &lh, &hdr, body, len);
+    }
+
+    if (link->node != 0) infoPrint("Federation link to node %08x lost", link->node);
+
+    pthread_mutex_lock(&link->lock);
+    link->closing = 1;
+    shutdown(link->fd, SHUT_RDWR);
+    pthread_cond_signal(&link->ready);
+    pthread_mutex_unlock(&link->lock);
+    pthread_join(link->writer, NULL);
+
+    //- Alle ueber diesen Link gelernten User verschwinden (und werden an die anderen Links gemeldet) -//
+    const int index = (int) (link - links);
+    RemoteUser *gone = NULL;
+    size_t goneCount = 0;
+    pthread_mutex_lock(&fedLock);
+    for (size_t i = 0; i < remoteCount;) {
+        if (remote[i].link != index) {
+            i++;
+            continue;
+        }
+        RemoteUser *grown = realloc(gone, (goneCount + 1) * sizeof(RemoteUser));
+        if (grown != NULL) {
+            gone = grown;
+            gone[goneCount++] = remote[i];
+        }
+        remote_remove(i);
+    }
+    free(link->out);
+    close(link->fd);
+    pthread_mutex_destroy(&link->lock);
+    pthread_cond_destroy(&link->ready);
+    link->inUse = 0;
+    pthread_mutex_unlock(&fedLock);
+
+    for (size_t i = 0; i < goneCount; i++) {
+        InternalMessage msg = {0};
+        msg.type = MT_USER_REMOVED;
+        msg.room = ROOM_LOBBY;
+        msg.code = 2; //- Communication Error -//
+        msg.userId = gone[i].id;
+        msg.timestamp = (uint64_t) time(NULL);
+        msg.origin = gone[i].origin;
+        msg.via = (uint8_t) (index + 1);
+        broadcastQueueSend(&msg);
+        nameRelease(gone[i].id);
+    }
+    free(gone);
+}
+
+static void *inboundLink(void *arg) {
+    Link *link = arg;
+    link_run(link);
+    return NULL;
+}
+
+static void *linkListener(void *arg) {
+    (void) arg;
+    while (running) {
+        const int fd = accept(listenFd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            if (!running) break;
+            errnoPrint("accept (federation)");
+            continue;
+        }
+        Link *link = link_open(fd);
+        pthread_t thread;
+        if (link == NULL) {
+            close(fd);
+        } else if (pthread_create(&thread, NULL, inboundLink, link) != 0) {
+            errorPrint("Failed to start federation link thread");
+            shutdown(fd, SHUT_RDWR);
+        } else {
+            pthread_detach(thread);
+        }
+    }
+    return NULL;
+}
+
+static int peer_connect(const Peer *peer) {
+    struct addrinfo hints = {0};
+    struct addrinfo *result;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(peer->host, peer->port, &hints, &result) != 0) return -1;
+
+    int fd = -1;
+    for (const struct addrinfo *ai = result; ai != NULL && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+//--- Ausgehender Link: verbinden, bis zum Abbruch lesen, nach kurzer Pause neu verbinden ---//
+static void *peerThread(void *arg) {
+    const Peer *peer = arg;
+    while (running) {
+        const int fd = peer_connect(peer);
+        if (fd != -1) {
+            Link *link = link_open(fd);
+            if (link != NULL) link_run(link);
+            else close(fd);
+        }
+        sleep(FED_RETRY_SEC);
+    }
+    return NULL;
+}
+
+int federationAddPeer(const char *hostPort) {
+    const char *colon = strrchr(hostPort, ':');
+    if (colon == NULL || colon == hostPort || peerCount == FED_MAX_PEERS
+        || (size_t) (colon - hostPort) >= sizeof(peers[0].host) || strlen(colon + 1) >= sizeof(peers[0].port)) {
+        errorPrint("Invalid or too many peers: %s", hostPort);
+        return -1;
+    }
+    Peer *peer = &peers[peerCount++];
+    memcpy(peer->host, hostPort, (size_t) (colon - hostPort));
+    peer->host[colon - hostPort] = '\0';
+    strcpy(peer->port, colon + 1);
+    return 0;
+}
+
+int federationSetBind(const char *address) {
+    if (inet_pton(AF_INET, address, &bindAddr) != 1) {
+        errorPrint("Invalid --link-bind address: %s", address);
+        return -1;
+    }
+    bindSet = 1;
+    return 0;
+}
+
+int federationSetSecret(const char *text) {
+    secretLen = strlen(text);
+    if (secretLen == 0 || secretLen > FED_SECRET_MAX) {
+        errorPrint("--link-secret expects 1-%d characters", FED_SECRET_MAX);
+        return -1;
+    }
+    memcpy(secret, text, secretLen);
+    return 0;
+}
+
+int federationInit(const in_port_t linkPort) {
+    if (linkPort == 0 && peerCount == 0) return 0;
+    if (!bindSet) bindAddr.s_addr = htonl(INADDR_LOOPBACK);
+    //- Fremde Hosts duerfen nur mit Geheimnis Links aufbauen, sonst koennte jeder User und Nachrichten einspeisen -//
+    if (linkPort != 0 && (ntohl(bindAddr.s_addr) >> 24) != 127 && secretLen == 0) {
+        errorPrint("--link-bind to a non-loopback address requires --link-secret");
+        return -1;
+    }
+
+    //- Zufaellige Knoten ID je Start, ein neu gestarteter Knoten beginnt so mit frischen Nummern -//
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    nodeId = ((uint32_t) getpid() * 2654435761U) ^ (uint32_t) now.tv_nsec ^ (uint32_t) now.tv_sec;
+    if (nodeId == 0) nodeId = 1;
+    running = 1;
+    enabled = 1;
+
+    if (linkPort != 0) {
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd == -1) {
+            errnoPrint("socket (federation)");
+            return -1;
+        }
+        const int opt = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(linkPort);
+        addr.sin_addr = bindAddr;
+        if (bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(listenFd, FED_MAX_LINKS) == -1) {
+            errnoPrint("bind/listen (federation)");
+            close(listenFd);
+            return -1;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, linkListener, NULL) != 0) {
+            errorPrint("Failed to start federation listener");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+
+    for (unsigned int i = 0; i < peerCount; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, peerThread, &peers[i]) != 0) {
+            errorPrint("Failed to start federation peer thread");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    char bindText[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &bindAddr, bindText, sizeof(bindText));
+    infoPrint("Federation node %08x: link port %s:%u, %u peers%s", nodeId, bindText, linkPort, peerCount,
+              secretLen > 0 ? ", secret required" : "");
+    return 0;
+}
+
+//--- Links nur abschalten; die Threads sind losgeloest und enden mit dem Prozess ---//
+void federationCleanup(void) {
+    if (!enabled) return;
+    running = 0;
+    if (listenFd != -1) shutdown(listenFd, SHUT_RDWR);
+
+    pthread_mutex_lock(&fedLock);
+    for (int i = 0; i < FED_MAX_LINKS; i++) {
+        if (links[i].inUse) shutdown(links[i].fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&fedLock);
+}
+
+void federationForward(InternalMessage *msg, const Frame *frame) {
+    if (!enabled || msg->room != ROOM_LOBBY || msg->userId == NAME_ID_NONE || msg->via == VIA_WORKERS) return;
+
+    pthread_mutex_lock(&fedLock);
+    LinkHeader hdr = {LINK_FRAME, 0, 0};
+    if (msg->origin == 0) {
+        msg->origin = nodeId;
+        msg->originSeq = ++localSeq; //- Chat und Praesenz teilen sich die Nummern -//
+    }
+    hdr.origin = htonl(msg->origin);
+    hdr.seq = hton64u(msg->originSeq);
+
+    for (int i = 0; i < FED_MAX_LINKS; i++) {
+        if (!links[i].inUse || links[i].node == 0 || i + 1 == msg->via) continue;
+        link_append(&links[i], &hdr, frame->data, frame->len);
+        statForwarded++;
+    }
+    pthread_mutex_unlock(&fedLock);
+}
+
+int federationNameTaken(const char *name) {
+    int taken = 0;
+    pthread_mutex_lock(&fedLock);
+    for (size_t next = remoteIndex[remote_bucket(name)]; next != 0 && !taken; next = remote[next - 1].hashNext) {
+        taken = strcmp(remote[next - 1].name, name) == 0;
+    }
+    pthread_mutex_unlock(&fedLock);
+    return taken;
+}
+
+void federationSendRoster(User *user, const int added) {
+    if (!enabled) return;
+
+    //- Namen kopieren, damit ein langsamer Client nicht fedLock (und damit den Broadcast Agent) aufhaelt -//
+    pthread_mutex_lock(&fedLock);
+    const size_t count = remoteCount;
+    char (*names)[32] = count > 0 ? malloc(count * 32) : NULL;
+    for (size_t i = 0; names != NULL && i < count; i++) {
+        memcpy(names[i], remote[i].name, 32);
+    }
+    pthread_mutex_unlock(&fedLock);
+    if (names == NULL) return;
+
+    user_send_names(user, names, count, added);
+    free(names);
+}
+
+void federationStatsFormat(char *buf, const size_t size) {
+    if (!enabled) {
+        snprintf(buf, size, "federation: disabled");
+        return;
+    }
+    unsigned int active = 0;
+    pthread_mutex_lock(&fedLock);
+    for (int i = 0; i < FED_MAX_LINKS; i++) {
+        if (links[i].inUse && links[i].node != 0) active++;
+    }
+    snprintf(buf, size, "federation: node=%08x links=%u remote_users=%zu forwarded=%lu received=%lu duplicates=%lu batches=%lu overflows=%lu invalid=%lu rejected=%lu",
+             nodeId, active, remoteCount, statForwarded, statReceived, statDuplicates, statBatches, statOverflows,
+             statInvalid, statRejected);
+    pthread_mutex_unlock(&fedLock);
+}
@@ -0,0 +1,35 @@
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "network.h"
+#include "user.h"
+
+// Aus --peer HOST:PORT, vor federationInit aufrufen
+int federationAddPeer(const char *hostPort);
+
+// Aus --link-bind ADDR (IPv4), ohne nur Loopback; eine andere Adresse braucht ein Geheimnis
+int federationSetBind(const char *address);
+
+// Aus --link-secret TEXT: beide Seiten eines Links muessen dasselbe angeben
+int federationSetSecret(const char *text);
+
+// linkPort 0 = keine eingehenden Links annehmen
+int federationInit(in_port_t linkPort);
+
+void federationCleanup(void);
+
+// Vom Broadcast Agent nach der Verteilung: Lobby Nachrichten an alle Links ausser dem, von dem sie kamen
+void federationForward(InternalMessage *msg, const Frame *frame);
+
+int federationNameTaken(const char *name);
+
+// Die entfernten Lobby User dem User melden (added = 1) oder wieder aus seiner Liste nehmen (added = 0)
+void federationSendRoster(User *user, int added);
+
+void federationStatsFormat(char *buf, size_t size);
+
+#endif
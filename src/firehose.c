@@ -0,0 +1,396 @@
+#define _GNU_SOURCE // POLLRDHUP
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "firehose.h"
+#include "room.h"
+#include "util.h"
+
+#define RING_BLOCKS 4096 // Hoechstens so viele Bloecke im Rueckblick, unabhaengig von --firehose-buffer
+#define SUBSCRIBE_TIMEOUT_MS 10000 // Frist fuer den Abo Frame nach der LoginResponse
+#define SEND_BLOCKS_MAX 64 // Ein sendmsg fasst so viele aufgelaufene Bloecke zusammen
+
+typedef struct {
+    Frame *block; // Fertig fuer das Netz: FirehoseHeader und Eintraege
+    uint64_t firstSeq;
+    uint32_t count;
+} RingBlock;
+
+typedef struct {
+    int fd;
+    char name[32];
+    uint64_t sentBlocks;
+    uint64_t sentBytes;
+} Subscriber;
+
+static char allowed[FIREHOSE_MAX_NAMES][32];
+static unsigned int allowedCount;
+static size_t bufferBytes = FIREHOSE_DEFAULT_BUFFER_MIB * 1024 * 1024;
+static int required; // Fuer Sitzungen, auch ohne Abos
+
+//- Ring der letzten Bloecke; der Agent haengt an, die Sende Threads lesen mit eigenen Referenzen auf die Frames -//
+static pthread_mutex_t ringLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ringGrown = PTHREAD_COND_INITIALIZER; // Neuer Block oder Ende
+static RingBlock *ring;
+static size_t ringOldest;
+static size_t ringCount;
+static size_t ringBytes;
+static uint64_t nextSeq; // Nummer der naechsten Nachricht
+static int stopping;
+static Subscriber *subscribers[FIREHOSE_MAX_SUBSCRIBERS];
+static unsigned int subscriberCount;
+
+static uint64_t statBlocks;
+static uint64_t statMessages;
+static uint64_t statBytes;
+static uint64_t statEvicted;
+static uint64_t statSubscribed;
+static uint64_t statGaps; // Abo oder langsamer Leser hinter dem Puffer: Nachrichten uebersprungen
+static uint64_t statSentBlocks; // Aller beendeten Abos; die laufenden zaehlen ihre selbst
+static uint64_t statSentBytes;
+
+int firehoseAllow(const char *name) {
+    const size_t len = strlen(name);
+    if (allowedCount == FIREHOSE_MAX_NAMES || len == 0 || len > 31) return -1;
+    memcpy(allowed[allowedCount++], name, len + 1);
+    return 0;
+}
+
+void firehoseSetBuffer(const size_t bytes) {
+    bufferBytes = bytes;
+}
+
+void firehoseRequire(void) {
+    required = 1;
+}
+
+int firehoseEnabled(void) {
+    return ring != NULL;
+}
+
+int firehoseAllowed(const char *name) {
+    for (unsigned int i = 0; i < allowedCount; i++) {
+        if (strcmp(allowed[i], name) == 0) return ring != NULL;
+    }
+    return 0;
+}
+
+int firehoseInit(void) {
+    if (allowedCount == 0 && !required) return 0;
+    ring = calloc(RING_BLOCKS, sizeof(RingBlock));
+    if (ring == NULL) {
+        errnoPrint("calloc (firehose ring)");
+        return -1;
+    }
+    //- Nummern steigen ueber Neustarts: Startwert aus der Uhr, Platz fuer 2^20 Nachrichten je Sekunde Laufzeit -//
+    nextSeq = (uint64_t) time(NULL) << 20;
+    infoPrint("Firehose: %u allowed name(s), %zu KiB replay buffer", allowedCount, bufferBytes / 1024);
+    return 0;
+}
+
+//- Raeumt erst, wenn alle Sende Threads weg sind; die schliessen ihre Sockets selbst -//
+void firehoseCleanup(void) {
+    if (ring == NULL) return;
+    pthread_mutex_lock(&ringLock);
+    stopping = 1;
+    for (unsigned int i = 0; i < subscriberCount; i++) shutdown(subscribers[i]->fd, SHUT_RDWR);
+    pthread_cond_broadcast(&ringGrown);
+    while (subscriberCount > 0) pthread_cond_wait(&ringGrown, &ringLock);
+    for (size_t i = 0; i < ringCount; i++) frameRelease(ring[(ringOldest + i) % RING_BLOCKS].block);
+    ringCount = 0;
+    pthread_mutex_unlock(&ringLock);
+    free(ring);
+    ring = NULL;
+}
+
+uint64_t firehosePublish(const FirehoseItem *items, const size_t count) {
+    if (ring == NULL || count == 0) return 0;
+
+    //- Obergrenze: jeder Raumname hat hoechstens 31 Zeichen; die echte Laenge steht danach im Frame -//
+    size_t bound = sizeof(FirehoseHeader);
+    for (size_t i = 0; i < count; i++) bound += 1 + 31 + items[i].frame->len;
+    Frame *block = malloc(sizeof(Frame) + bound);
+    if (block == NULL) {
+        errorPrint("Firehose block of %zu bytes could not be allocated", bound);
+        return 0;
+    }
+
+    unsigned char *p = block->data + sizeof(FirehoseHeader);
+    int cachedRoom = ROOM_NONE;
+    char roomName[32] = "";
+    size_t roomLen = 0;
+    for (size_t i = 0; i < count; i++) {
+        const int room = items[i].room;
+        if (room != cachedRoom) {
+            //- Ein Batch trifft meist wenige Raeume; der Name wird je Wechsel einmal unter roomLock geholt -//
+            cachedRoom = room;
+            if (room == ROOM_ALL) roomName[0] = '\0';
+            else if (room_name(room, roomName) == -1) snprintf(roomName, sizeof(roomName), "#%d", room);
+            roomLen = strlen(roomName);
+        }
+        *p++ = (uint8_t) roomLen;
+        memcpy(p, roomName, roomLen);
+        p += roomLen;
+        memcpy(p, items[i].frame->data, items[i].frame->len);
+        p += items[i].frame->len;
+    }
+    block->refs = 1;
+    block->len = (size_t) (p - block->data);
+
+    pthread_mutex_lock(&ringLock);
+    FirehoseHeader header = {.type = MT_FIREHOSE};
+    header.length = htonl((uint32_t) (block->len - sizeof(FirehoseHeader)));
+    header.firstSeq = hton64u(nextSeq);
+    header.count = htonl((uint32_t) count);
+    memcpy(block->data, &header, sizeof(header));
+
+    //- Aelteste Bloecke verdraengen; der neueste bleibt immer, auch wenn er allein groesser als der Puffer ist -//
+    while (ringCount > 0 && (ringCount == RING_BLOCKS || ringBytes + block->len > bufferBytes)) {
+        RingBlock *oldest = &ring[ringOldest];
+        ringBytes -= oldest->block->len;
+        frameRelease(oldest->block);
+        ringOldest = (ringOldest + 1) % RING_BLOCKS;
+        ringCount--;
+        statEvicted++;
+    }
+    RingBlock *slot = &ring[(ringOldest + ringCount) % RING_BLOCKS];
+    slot->block = block;
+    slot->firstSeq = nextSeq;
+    slot->count = (uint32_t) count;
+    ringCount++;
+    ringBytes += block->len;
+    const uint64_t firstSeq = nextSeq;
+    nextSeq += count;
+    statBlocks++;
+    statMessages += count;
+    statBytes += block->len;
+    pthread_cond_broadcast(&ringGrown);
+    pthread_mutex_unlock(&ringLock);
+    return firstSeq;
+}
+
+//- Haelt ringLock; Index (relativ zum aeltesten) des Blocks mit seq, der Aufrufer stellt seq im Ring sicher -//
+static size_t ring_find(const uint64_t seq) {
+    size_t low = 0;
+    size_t high = ringCount - 1;
+    while (low < high) {
+        const size_t mid = (low + high + 1) / 2;
+        if (ring[(ringOldest + mid) % RING_BLOCKS].firstSeq <= seq) low = mid;
+        else high = mid - 1;
+    }
+    return low;
+}
+
+uint64_t firehoseNextSeq(void) {
+    pthread_mutex_lock(&ringLock);
+    const uint64_t seq = nextSeq;
+    pthread_mutex_unlock(&ringLock);
+    return seq;
+}
+
+//--- Verpasste Nachrichten eines Raums; emit kopiert nur, gesendet wird erst nach der Sperre ---//
+uint64_t firehoseReplay(const uint64_t from, const char *room,
+                        void (*emit)(uint64_t seq, const unsigned char *frame, size_t len, void *arg), void *arg,
+                        uint64_t *missing) {
+    *missing = 0;
+    if (ring == NULL) return 0;
+    const size_t roomLen = strlen(room);
+
+    pthread_mutex_lock(&ringLock);
+    uint64_t seq = from;
+    if (seq > nextSeq) seq = nextSeq; //- Nummer aus der Zukunft: nichts nachzuholen -//
+    if (ringCount == 0 || ring[ringOldest].firstSeq > seq) {
+        const uint64_t oldest = ringCount ? ring[ringOldest].firstSeq : nextSeq;
+        *missing = oldest - seq;
+        seq = oldest;
+    }
+    for (size_t i = ringCount ? ring_find(seq) : 0; i < ringCount; i++) {
+        const RingBlock *slot = &ring[(ringOldest + i) % RING_BLOCKS];
+        const unsigned char *p = slot->block->data + sizeof(FirehoseHeader);
+        for (uint32_t n = 0; n < slot->count; n++) {
+            const size_t len = *p;
+            const unsigned char *frame = p + 1 + len;
+            const size_t frameLen = sizeof(Header) + (size_t) (frame[1] << 8 | frame[2]);
+            const uint64_t entrySeq = slot->firstSeq + n;
+            if (entrySeq >= seq && (len == 0 || (len == roomLen && memcmp(p + 1, room, len) == 0))) {
+                emit(entrySeq, frame, frameLen, arg);
+            }
+            p = frame + frameLen;
+        }
+    }
+    seq = nextSeq;
+    pthread_mutex_unlock(&ringLock);
+    return seq;
+}
+
+static int peer_closed(const int fd) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN | POLLRDHUP};
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR));
+}
+
+//--- Abo Frame lesen: MT_FIREHOSE mit der Startnummer; 0 = ab dem naechsten Block ---//
+static int read_subscription(const int fd, uint64_t *from) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (poll(&pfd, 1, SUBSCRIBE_TIMEOUT_MS) != 1) return -1;
+    Header hdr;
+    uint64_t seq;
+    if (networkReceive(fd, &hdr, sizeof(hdr)) <= 0) return -1;
+    if (hdr.type != MT_FIREHOSE || ntohs(hdr.length) != sizeof(seq)) return -1;
+    if (networkReceive(fd, &seq, sizeof(seq)) <= 0) return -1;
+    *from = ntoh64u(seq);
+    return 0;
+}
+
+static void *firehoseThread(void *arg) {
+    Subscriber *sub = arg;
+    uint64_t cursor = 0;
+
+    if (read_subscription(sub->fd, &cursor) == -1) {
+        errorPrint("Firehose %s: no valid subscription frame", sub->name);
+    } else {
+        pthread_mutex_lock(&ringLock);
+        if (cursor == 0 || cursor > nextSeq) cursor = nextSeq; //- Live, oder Nummer aus der Zukunft (Uhr verstellt) -//
+        infoPrint("Firehose %s subscribed at %ju", sub->name, (uintmax_t) cursor);
+
+        while (!stopping) {
+            if (cursor >= nextSeq) {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += 1;
+                if (pthread_cond_timedwait(&ringGrown, &ringLock, &deadline) == ETIMEDOUT && peer_closed(sub->fd)) {
+                    break; //- Ohne Verkehr merkt nur poll, dass der Leser weg ist -//
+                }
+                continue;
+            }
+            const RingBlock *oldest = &ring[ringOldest];
+            if (ringCount == 0 || oldest->firstSeq > cursor) {
+                statGaps += (ringCount ? oldest->firstSeq : nextSeq) - cursor;
+                cursor = ringCount ? oldest->firstSeq : nextSeq;
+                if (ringCount == 0) continue;
+            }
+
+            //- Alles Aufgelaufene mit einem sendmsg; die Referenzen halten die Bloecke ohne Sperre am Leben -//
+            Frame *blocks[SEND_BLOCKS_MAX];
+            struct iovec iov[SEND_BLOCKS_MAX];
+            size_t n = 0;
+            size_t bytes = 0;
+            for (size_t i = ring_find(cursor); i < ringCount && n < SEND_BLOCKS_MAX; i++, n++) {
+                const RingBlock *slot = &ring[(ringOldest + i) % RING_BLOCKS];
+                frameRetain(slot->block);
+                blocks[n] = slot->block;
+                iov[n].iov_base = slot->block->data;
+                iov[n].iov_len = slot->block->len;
+                bytes += slot->block->len;
+                cursor = slot->firstSeq + slot->count;
+            }
+            pthread_mutex_unlock(&ringLock);
+
+            int failed = 0;
+            struct iovec *pos = iov;
+            size_t left = n;
+            while (left > 0 && !failed) {
+                struct msghdr msg = {.msg_iov = pos, .msg_iovlen = left > IOV_MAX ? IOV_MAX : left};
+                const ssize_t res = sendmsg(sub->fd, &msg, MSG_NOSIGNAL); //- writev wuerde bei getrenntem Leser SIGPIPE ausloesen -//
+                if (res == -1) {
+                    if (errno != EINTR) failed = 1;
+                    continue;
+                }
+                size_t done = (size_t) res;
+                while (left > 0 && done >= pos->iov_len) {
+                    done -= pos->iov_len;
+                    pos++;
+                    left--;
+                }
+                if (left > 0) {
+                    pos->iov_base = (unsigned char *) pos->iov_base + done;
+                    pos->iov_len -= done;
+                }
+            }
+            for (size_t i = 0; i < n; i++) frameRelease(blocks[i]);
+
+            pthread_mutex_lock(&ringLock);
+            if (failed) break;
+            sub->sentBlocks += n;
+            sub->sentBytes += bytes;
+        }
+        pthread_mutex_unlock(&ringLock);
+    }
+
+    infoPrint("Firehose %s disconnected", sub->name);
+    //- Erst austragen, dann schliessen: firehoseCleanup ruft shutdown() auf alle eingetragenen fds, -//
+    //- ein schon geschlossener koennte inzwischen einer neuen Verbindung gehoeren -//
+    pthread_mutex_lock(&ringLock);
+    for (unsigned int i = 0; i < subscriberCount; i++) {
+        if (subscribers[i] == sub) subscribers[i] = subscribers[--subscriberCount];
+    }
+    statSentBlocks += sub->sentBlocks;
+    statSentBytes += sub->sentBytes;
+    pthread_cond_broadcast(&ringGrown); //- firehoseCleanup wartet darauf -//
+    pthread_mutex_unlock(&ringLock);
+    close(sub->fd);
+    free(sub);
+    return NULL;
+}
+
+int firehoseAttach(const int fd, const char *name) {
+    Subscriber *sub = calloc(1, sizeof(Subscriber));
+    if (sub == NULL) return -1;
+    sub->fd = fd;
+    snprintf(sub->name, sizeof(sub->name), "%s", name);
+
+    pthread_mutex_lock(&ringLock);
+    if (stopping || subscriberCount == FIREHOSE_MAX_SUBSCRIBERS) {
+        pthread_mutex_unlock(&ringLock);
+        free(sub);
+        return -1;
+    }
+    subscribers[subscriberCount++] = sub;
+    statSubscribed++;
+    pthread_mutex_unlock(&ringLock);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, firehoseThread, sub) != 0) {
+        errorPrint("Failed to create firehose thread");
+        pthread_mutex_lock(&ringLock);
+        for (unsigned int i = 0; i < subscriberCount; i++) {
+            if (subscribers[i] == sub) subscribers[i] = subscribers[--subscriberCount];
+        }
+        pthread_mutex_unlock(&ringLock);
+        free(sub);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+void firehoseStatsFormat(char *buf, const size_t size) {
+    if (ring == NULL) {
+        snprintf(buf, size, "firehose: disabled");
+        return;
+    }
+    pthread_mutex_lock(&ringLock);
+    uint64_t sentBlocks = statSentBlocks;
+    uint64_t sentBytes = statSentBytes;
+    for (unsigned int i = 0; i < subscriberCount; i++) {
+        sentBlocks += subscribers[i]->sentBlocks;
+        sentBytes += subscribers[i]->sentBytes;
+    }
+    const uint64_t oldest = ringCount ? ring[ringOldest].firstSeq : nextSeq;
+    snprintf(buf, size, "firehose: subscribers=%u (%ju total) blocks=%ju messages=%ju (%.1f/block) bytes=%ju "
+             "buffer=%zu blocks %.1f/%zu MiB seq=%ju..%ju evicted=%ju gaps=%ju sent=%ju blocks %ju bytes",
+             subscriberCount, (uintmax_t) statSubscribed, (uintmax_t) statBlocks, (uintmax_t) statMessages,
+             statBlocks ? (double) statMessages / (double) statBlocks : 0.0, (uintmax_t) statBytes, ringCount,
+             (double) ringBytes / (1024.0 * 1024.0), bufferBytes / (1024 * 1024), (uintmax_t) oldest,
+             (uintmax_t) nextSeq, (uintmax_t) statEvicted, (uintmax_t) statGaps, (uintmax_t) sentBlocks,
+             (uintmax_t) sentBytes);
+    pthread_mutex_unlock(&ringLock);
+}
@@ -0,0 +1,71 @@
+#ifndef FIREHOSE_H
+#define FIREHOSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "network.h"
+
+#define FIREHOSE_DEFAULT_BUFFER_MIB 16 // Rueckblick fuer Wiederaufnahmen
+#define FIREHOSE_MAX_NAMES 8
+#define FIREHOSE_MAX_SUBSCRIBERS 64
+
+// Firehose: privilegierte Verbindungen fuer Archiv und Moderation, die den ganzen Broadcast Strom (Chat aller Raeume,
+// UserAdded/UserRemoved, Servernachrichten) als grosse Bloecke bekommen, einen je Fan-out des Broadcast Agents.
+// Login mit PROT_FLAG_FIREHOSE und einem per --firehose freigegebenen Namen; der Name wird kein User.
+// Danach schickt der Client einen Abo Frame (MT_FIREHOSE, Laenge 8, Startnummer in Netzwerk Byte Order; 0 = live).
+// Jede Nachricht hat eine Nummer; die Nummern eines Blocks sind fortlaufend und steigen auch ueber Neustarts.
+// Liegt die Startnummer nicht mehr im Puffer, beginnt der erste Block spaeter: die Luecke ist an firstSeq zu sehen.
+// Ein Block kann Nachrichten vor der Startnummer enthalten, der Client ueberspringt sie anhand der Nummer.
+
+// Kopf eines Blocks; length zaehlt alles nach dem Kopf
+typedef struct __attribute__((packed)) {
+    uint8_t type; // MT_FIREHOSE
+    uint32_t length;
+    uint64_t firstSeq;
+    uint32_t count;
+} FirehoseHeader;
+
+// Je Nachricht: uint8_t roomLen, Raumname (0 = an alle Raeume), dann der Frame wie ihn Clients bekommen (Header + Body)
+
+// Ein Eintrag des Batches, den der Broadcast Agent gerade verteilt hat
+typedef struct {
+    int room; // ROOM_ALL oder Raum (room.h)
+    const Frame *frame;
+} FirehoseItem;
+
+// --firehose NAME, mehrfach; -1 bei zu vielen oder ungueltigen Namen
+int firehoseAllow(const char *name);
+
+void firehoseSetBuffer(size_t bytes);
+
+// Sitzungen (session.h) holen verpasste Nachrichten aus demselben Puffer, auch ohne freigegebene Namen
+void firehoseRequire(void);
+
+// Nach den Optionen und vor dem Broadcast Agent; ohne freigegebene Namen und Sitzungen bleibt alles aus
+int firehoseInit(void);
+
+void firehoseCleanup(void);
+
+int firehoseEnabled(void);
+
+int firehoseAllowed(const char *name);
+
+// Login Stufe nach der LoginResponse: der Socket gehoert danach einem eigenen Sende Thread; -1 = voll oder Fehler
+int firehoseAttach(int fd, const char *name);
+
+// Nur der Broadcast Agent, einmal je Fan-out und vor dem Verteilen; liefert die Nummer des ersten Eintrags, 0 = aus
+uint64_t firehosePublish(const FirehoseItem *items, size_t count);
+
+// Nummer der naechsten Nachricht
+uint64_t firehoseNextSeq(void);
+
+// Ruft emit fuer jede Nachricht ab from, die an room (Name) oder alle Raeume ging, unter der Sperre des Puffers;
+// missing zaehlt die schon verdraengten. Liefert die Nummer hinter der letzten geprueften Nachricht
+uint64_t firehoseReplay(uint64_t from, const char *room,
+                        void (*emit)(uint64_t seq, const unsigned char *frame, size_t len, void *arg), void *arg,
+                        uint64_t *missing);
+
+void firehoseStatsFormat(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,540 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "handoff.h"
+#include "broadcastagent.h"
+#include "clientthread.h"
+#include "compress.h"
+#include "connectionhandler.h"
+#include "lockprof.h"
+#include "memory.h"
+#include "msglog.h"
+#include "room.h"
+#include "util.h"
+
+//- Variable von main.c -//
+extern volatile sig_atomic_t serverRunning;
+
+#define HANDOFF_MAGIC 0x484f4646 // "HOFF"
+#define HANDOFF_PARK_MS 5000 // So lange duerfen die Client Threads zum Anhalten brauchen
+#define HANDOFF_FENCE_MS 2000
+
+//- Ein Datensatz je Socket; der Deskriptor selbst reist als SCM_RIGHTS mit -//
+enum RecordKind {
+    RECORD_LISTEN = 0,
+    RECORD_USER = 1,
+    RECORD_END = 2 // Ohne Socket; erst danach darf der Nachfolger das Nachrichtenlog oeffnen
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t kind;
+    uint32_t version; // Protokoll Version des Users
+    uint32_t dictLength; // Komprimierter Strom: so viele Bytes Fenster folgen dem Datensatz (compress.h)
+    uint32_t compressed;
+    char name[32];
+    char room[32];
+} HandoffRecord;
+
+enum HandoffState {
+    HANDOFF_IDLE = 0,
+    HANDOFF_REQUESTED, // Client Threads halten an
+    HANDOFF_DONE // Alle Sockets gehoeren dem Nachfolger
+};
+
+//- Alter Prozess -//
+static pthread_mutex_t handoffLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t handoffCond = PTHREAD_COND_INITIALIZER;
+static enum HandoffState state = HANDOFF_IDLE;
+static int wakePipe[2] = {-1, -1};
+static int listenFd = -1;
+static pthread_t mainThread;
+static int mainStopped = 0; // main wartet in handoffWait statt in accept()
+static User **collected;
+static size_t collectedCount;
+static size_t collectedCapacity;
+static size_t unparked;
+
+//- Neuer Prozess: bis handoffResume zwischengelagert -//
+static HandoffRecord *takenUsers;
+static int *takenFds;
+static unsigned char **takenDicts; // Fenster der komprimierten Stroeme, sonst NULL
+static size_t takenCount;
+
+static void wakeHandler(int sig) {
+    (void) sig; //- Nur damit accept() mit EINTR zurueckkehrt -//
+}
+
+static void count_unparked(User *user) {
+    if (user->handoffState == 0) unparked++;
+}
+
+static void collect_user(User *user) {
+    if (collectedCount == collectedCapacity) {
+        const size_t capacity = collectedCapacity ? collectedCapacity * 2 : 64;
+        User **grown = realloc(collected, capacity * sizeof(User *));
+        if (grown == NULL) return; //- Dieser User verliert dann mit dem alten Prozess die Verbindung -//
+        collected = grown;
+        collectedCapacity = capacity;
+    }
+    user_get(user);
+    collected[collectedCount++] = user;
+}
+
+//- Unter sendLock: danach schreibt der Broadcast Agent nicht mehr, auch nicht fuer Nachrichten von Links -//
+static void mark_handed_over(User *user, const int handedOver) {
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    user->handedOver = handedOver;
+    pthread_mutex_unlock(&user->sendLock);
+}
+
+static void release_collected(void) {
+    for (size_t i = 0; i < collectedCount; i++) {
+        if (collected[i]->handedOver) mark_handed_over(collected[i], 0);
+        user_put(collected[i]);
+    }
+    collectedCount = 0;
+}
+
+//--- Ein Datensatz, optional mit Socket ---//
+static int send_record(const int conn, const enum RecordKind kind, const int fd, const User *user, const char *room) {
+    HandoffRecord record = {0};
+    record.magic = HANDOFF_MAGIC;
+    record.kind = kind;
+    const char *name = user != NULL ? user->name : NULL;
+    if (user != NULL) record.version = user->version;
+    //- Der Datensatz ist genullt: die Laenge begrenzen genuegt, das NUL steht schon da -//
+    if (name != NULL) memcpy(record.name, name, strnlen(name, sizeof(record.name) - 1));
+    if (room != NULL) memcpy(record.room, room, strnlen(room, sizeof(record.room) - 1));
+
+    //- Ein komprimierter Strom laesst sich nicht uebergeben, aber sein Fenster: damit setzt der Nachfolger ihn fort -//
+    unsigned char dict[COMPRESS_DICT_MAX];
+    if (user != NULL && compressActive(user->sock)) {
+        const int dictLength = compressGetHistory(user->sock, dict, sizeof(dict));
+        if (dictLength == -1) return -1;
+        record.compressed = 1;
+        record.dictLength = (uint32_t) dictLength;
+    }
+
+    struct iovec iov[2] = {{.iov_base = &record, .iov_len = sizeof(record)}, {.iov_base = dict, .iov_len = record.dictLength}};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = record.dictLength ? 2 : 1;
+    if (fd != -1) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    while (sendmsg(conn, &msg, MSG_NOSIGNAL) == -1) {
+        if (errno == EINTR) continue;
+        errnoPrint("sendmsg (handoff)");
+        return -1;
+    }
+    return 0;
+}
+
+//--- Client Threads weiterlaufen lassen; main nimmt, falls schon angehalten, wieder Verbindungen an ---//
+static void handoff_abort(const int restartMain) {
+    char drain[16];
+    while (read(wakePipe[0], drain, sizeof(drain)) > 0) {
+    }
+
+    pthread_mutex_lock(&handoffLock);
+    release_collected();
+    state = HANDOFF_IDLE;
+    if (restartMain) serverRunning = 1;
+    pthread_cond_broadcast(&handoffCond);
+    pthread_mutex_unlock(&handoffLock);
+    errorPrint("Hot restart aborted, continuing to serve");
+}
+
+//--- Die eigentliche Uebergabe an den verbundenen Nachfolger ---//
+static int handoff_transfer(const int conn) {
+    //- 1. Alle Client Threads anhalten; sie lassen ungelesene Daten im Socket -//
+    pthread_mutex_lock(&handoffLock);
+    state = HANDOFF_REQUESTED;
+    pthread_mutex_unlock(&handoffLock);
+    if (write(wakePipe[1], "h", 1) != 1) {
+        errnoPrint("write (handoff wake)");
+        handoff_abort(0);
+        return -1;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += HANDOFF_PARK_MS / 1000;
+
+    pthread_mutex_lock(&handoffLock);
+    while (1) {
+        //- Wer gerade geht, verschwindet von selbst aus der Liste -//
+        unparked = 0;
+        user_iterate(count_unparked);
+        if (unparked == 0) break;
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) break;
+        struct timespec step = now;
+        step.tv_nsec += 50 * 1000000L;
+        if (step.tv_nsec >= 1000000000L) {
+            step.tv_sec++;
+            step.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&handoffCond, &handoffLock, &step);
+    }
+    user_iterate(collect_user);
+    pthread_mutex_unlock(&handoffLock);
+    if (unparked != 0) {
+        errorPrint("Hot restart: %zu client threads did not stop in time", unparked);
+        handoff_abort(0);
+        return -1;
+    }
+
+    //- 2. Alles was schon in der Queue steht noch verteilen -//
+    if (broadcastQueueFence(HANDOFF_FENCE_MS) == -1) {
+        errorPrint("Hot restart: broadcast queue did not drain (server paused?)");
+        handoff_abort(0);
+        return -1;
+    }
+
+    //- 3. main aus accept() holen; das Signal kann zwischen Pruefung und accept() verloren gehen, daher wiederholen -//
+    serverRunning = 0;
+    pthread_mutex_lock(&handoffLock);
+    while (!mainStopped) {
+        pthread_kill(mainThread, SIGUSR1);
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 10 * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&handoffCond, &handoffLock, &deadline);
+    }
+    pthread_mutex_unlock(&handoffLock);
+
+    //- 4. Listener und Verbindungen uebergeben -//
+    int listenFds[8];
+    const size_t listenCount = connectionHandlerListenSockets(listenFds, 8);
+    for (size_t i = 0; i < listenCount; i++) {
+        if (send_record(conn, RECORD_LISTEN, listenFds[i], NULL, NULL) == -1) {
+            handoff_abort(1);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < collectedCount; i++) {
+        char room[32];
+        if (room_name(collected[i]->room, room) == -1) strcpy(room, "lobby");
+        mark_handed_over(collected[i], 1); //- Vor dem Fenster des komprimierten Stroms -//
+        if (send_record(conn, RECORD_USER, collected[i]->sock, collected[i], room) == -1) {
+            handoff_abort(1);
+            return -1;
+        }
+    }
+
+    //- 5. Das Log ist erst nach dem Schliessen konsistent fuer den Nachfolger -//
+    msglogFlush();
+    msglogCleanup();
+    if (send_record(conn, RECORD_END, -1, NULL, NULL) == -1) {
+        //- Das Log ist schon zu, ab hier laeuft der Server ohne weiter -//
+        handoff_abort(1);
+        return -1;
+    }
+
+    pthread_mutex_lock(&handoffLock);
+    infoPrint("Hot restart: handed %zu connections to the new process", collectedCount);
+    state = HANDOFF_DONE;
+    pthread_cond_broadcast(&handoffCond);
+    pthread_mutex_unlock(&handoffLock);
+    return 0;
+}
+
+static void *handoffListener(void *arg) {
+    (void) arg;
+    while (1) {
+        const int conn = accept(listenFd, NULL, NULL);
+        if (conn == -1) {
+            if (errno == EINTR) continue;
+            errnoPrint("accept (handoff)");
+            return NULL;
+        }
+        infoPrint("Hot restart: successor connected");
+        const int result = handoff_transfer(conn);
+        close(conn);
+        if (result == 0) break;
+    }
+    close(listenFd);
+    listenFd = -1;
+    return NULL;
+}
+
+int handoffInit(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errorPrint("Handoff path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    if (pipe(wakePipe) == -1) {
+        errnoPrint("pipe (handoff)");
+        return -1;
+    }
+    fcntl(wakePipe[0], F_SETFL, fcntl(wakePipe[0], F_GETFL) | O_NONBLOCK);
+
+    //- SEQPACKET haelt die Datensaetze getrennt, die Deskriptoren bleiben so ihrem Datensatz zugeordnet -//
+    listenFd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (listenFd == -1) {
+        errnoPrint("socket (handoff)");
+        return -1;
+    }
+    unlink(path); //- Der Vorgaenger hinterlaesst seinen Socket -//
+    if (bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(listenFd, 1) == -1) {
+        errnoPrint("bind/listen (handoff)");
+        close(listenFd);
+        listenFd = -1;
+        return -1;
+    }
+
+    //- Ohne SA_RESTART, damit accept() in main unterbrochen wird -//
+    struct sigaction sa = {0};
+    sa.sa_handler = wakeHandler;
+    sigaction(SIGUSR1, &sa, NULL);
+    mainThread = pthread_self();
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, handoffListener, NULL) != 0) {
+        errorPrint("Failed to start handoff listener");
+        return -1;
+    }
+    pthread_detach(thread);
+    infoPrint("Hot restart: waiting for a successor on %s", path);
+    return 0;
+}
+
+void handoffCleanup(void) {
+    for (size_t i = 0; i < takenCount; i++) {
+        if (takenFds[i] != -1) close(takenFds[i]);
+    }
+    for (size_t i = 0; i < takenCount; i++) {
+        free(takenDicts[i]);
+    }
+    free(takenUsers);
+    free(takenFds);
+    free(takenDicts);
+    takenUsers = NULL;
+    takenFds = NULL;
+    takenDicts = NULL;
+    takenCount = 0;
+}
+
+int handoffTakeover(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errorPrint("Takeover path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    const int conn = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (conn == -1) {
+        errnoPrint("socket (takeover)");
+        return -1;
+    }
+    if (connect(conn, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        errnoPrint("connect (takeover)");
+        close(conn);
+        return -1;
+    }
+
+    int listenFds[8];
+    size_t listenCount = 0;
+    size_t capacity = 0;
+    while (1) {
+        HandoffRecord record;
+        unsigned char dict[COMPRESS_DICT_MAX];
+        int fd = -1;
+        struct iovec iov[2] = {{.iov_base = &record, .iov_len = sizeof(record)}, {.iov_base = dict, .iov_len = sizeof(dict)}};
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        const ssize_t res = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+        if (res == -1 && errno == EINTR) continue;
+        if (res < (ssize_t) sizeof(record) || record.magic != HANDOFF_MAGIC || record.dictLength > sizeof(dict)
+            || (size_t) res != sizeof(record) + record.dictLength) {
+            errorPrint("Takeover: predecessor closed the handoff early");
+            break;
+        }
+        const struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+            //- Nur der Client Thread bzw. connectionHandler soll ihn spaeter behalten -//
+            fcntl(fd, F_SETFD, 0);
+        }
+
+        if (record.kind == RECORD_END) {
+            close(conn);
+            for (size_t i = 0; i < listenCount; i++) {
+                connectionHandlerAdoptListener(listenFds[i]);
+            }
+            infoPrint("Takeover: received %zu listeners and %zu connections", listenCount, takenCount);
+            return 0;
+        }
+        if (fd == -1) continue;
+        if (record.kind == RECORD_LISTEN) {
+            if (listenCount < 8) listenFds[listenCount++] = fd;
+            else close(fd);
+            continue;
+        }
+
+        if (takenCount == capacity) {
+            const size_t grownCapacity = capacity ? capacity * 2 : 64;
+            HandoffRecord *grownUsers = realloc(takenUsers, grownCapacity * sizeof(HandoffRecord));
+            if (grownUsers != NULL) takenUsers = grownUsers;
+            int *grownFds = realloc(takenFds, grownCapacity * sizeof(int));
+            if (grownFds != NULL) takenFds = grownFds;
+            unsigned char **grownDicts = realloc(takenDicts, grownCapacity * sizeof(unsigned char *));
+            if (grownDicts != NULL) takenDicts = grownDicts;
+            if (grownUsers == NULL || grownFds == NULL || grownDicts == NULL) {
+                close(fd);
+                continue;
+            }
+            capacity = grownCapacity;
+        }
+        record.name[sizeof(record.name) - 1] = '\0';
+        record.room[sizeof(record.room) - 1] = '\0';
+        takenUsers[takenCount] = record;
+        takenFds[takenCount] = fd;
+        takenDicts[takenCount] = NULL;
+        if (record.dictLength > 0) {
+            takenDicts[takenCount] = malloc(record.dictLength);
+            if (takenDicts[takenCount] == NULL) {
+                close(fd); //- Ohne Fenster kann der Strom nicht weiterlaufen -//
+                continue;
+            }
+            memcpy(takenDicts[takenCount], dict, record.dictLength);
+        }
+        takenCount++;
+    }
+
+    //- Ohne Endmarke gehoeren die Sockets noch dem Vorgaenger -//
+    close(conn);
+    for (size_t i = 0; i < listenCount; i++) {
+        close(listenFds[i]);
+    }
+    handoffCleanup();
+    return -1;
+}
+
+int handoffResume(void) {
+    size_t resumed = 0;
+    for (size_t i = 0; i < takenCount; i++) {
+        const int fd = takenFds[i];
+        takenFds[i] = -1;
+        //- Den Strom vor user_add fortsetzen, der Client erwartet ab dem ersten Byte komprimierte Daten -//
+        if (takenUsers[i].compressed
+            && (compressAttach(fd) == -1 || compressSetHistory(fd, takenDicts[i], takenUsers[i].dictLength) == -1)) {
+            errorPrint("Takeover: cannot continue the compressed stream of %s", takenUsers[i].name);
+            compressDetach(fd);
+            close(fd);
+            continue;
+        }
+        User *user = user_add(fd, takenUsers[i].name);
+        if (user == NULL) {
+            compressDetach(fd);
+            close(fd);
+            continue;
+        }
+        if (strcmp(takenUsers[i].room, "lobby") != 0 && room_join(user, takenUsers[i].room, NULL, NULL) == -1) {
+            errorPrint("Takeover: %s stays in the lobby, room %s unavailable", user->name, takenUsers[i].room);
+        }
+        //- Der Client kennt Verlauf und Userliste schon -//
+        user->resumed = 1;
+        user->version = (uint8_t) takenUsers[i].version;
+
+        pthread_t thread;
+        if (pthread_create(&thread, memoryThreadAttr(), clientthread, user) != 0) {
+            errorPrint("Failed to create client thread");
+            user_remove(user);
+            continue;
+        }
+        pthread_detach(thread);
+        resumed++;
+    }
+    infoPrint("Takeover: resumed %zu of %zu connections", resumed, takenCount);
+    handoffCleanup();
+    return 0;
+}
+
+int handoffWakeFd(void) {
+    return wakePipe[0];
+}
+
+int handoffInProgress(void) {
+    pthread_mutex_lock(&handoffLock);
+    const int busy = state != HANDOFF_IDLE;
+    pthread_mutex_unlock(&handoffLock);
+    return busy;
+}
+
+int handoffPark(User *user) {
+    //- Der Leerlauf Timer wuerde sonst den Socket schliessen, der gleich dem Nachfolger gehoert -//
+    user_cancel_idle_timeout(user);
+
+    pthread_mutex_lock(&handoffLock);
+    user->handoffState = 1;
+    pthread_cond_broadcast(&handoffCond);
+    while (state == HANDOFF_REQUESTED) {
+        pthread_cond_wait(&handoffCond, &handoffLock);
+    }
+    const int handedOver = state == HANDOFF_DONE;
+    user->handoffState = 0;
+    pthread_mutex_unlock(&handoffLock);
+
+    if (!handedOver) user_arm_idle_timeout(user);
+    return handedOver;
+}
+
+int handoffWait(void) {
+    pthread_mutex_lock(&handoffLock);
+    if (state == HANDOFF_IDLE) {
+        pthread_mutex_unlock(&handoffLock);
+        return 0;
+    }
+    mainStopped = 1;
+    pthread_cond_broadcast(&handoffCond);
+    while (state == HANDOFF_REQUESTED) {
+        pthread_cond_wait(&handoffCond, &handoffLock);
+    }
+    mainStopped = 0;
+    const int restart = state == HANDOFF_IDLE && serverRunning; //- Ein Strg+C bleibt ein Strg+C -//
+    pthread_mutex_unlock(&handoffLock);
+    return restart;
+}
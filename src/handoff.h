@@ -0,0 +1,29 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "user.h"
+
+// Alter Prozess (--handoff PATH): wartet auf dem Unix Socket auf den Nachfolger und uebergibt ihm alle Sockets
+int handoffInit(const char *path);
+
+void handoffCleanup(void);
+
+// Neuer Prozess (--takeover PATH): holt Listener und Verbindungen ab, vor msglogInit aufrufen.
+// Die Listener gehen direkt an den connectionHandler
+int handoffTakeover(const char *path);
+
+// Nach broadcastAgentInit: fuer jede uebernommene Verbindung User und Client Thread anlegen
+int handoffResume(void);
+
+// Wird lesbar, sobald die Client Threads anhalten sollen; -1 ohne --handoff
+int handoffWakeFd(void);
+
+int handoffInProgress(void);
+
+// Vom Client Thread: anhalten bis zum Ende der Uebergabe; 1 = Socket gehoert jetzt dem Nachfolger
+int handoffPark(User *user);
+
+// Von main nach dem Ende des Accept Loops; 1 = Uebergabe abgebrochen, weiter annehmen
+int handoffWait(void);
+
+#endif
@@ -0,0 +1,141 @@
+#define _GNU_SOURCE // CPU_SET, pthread_setaffinity_np
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "latency.h"
+#include "util.h"
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+static const char *const roleNames[LATENCY_ROLES] = {"agent", "accept", "io"};
+
+static cpu_set_t roleCpus[LATENCY_ROLES];
+static int rolePinned[LATENCY_ROLES];
+static char roleLists[LATENCY_ROLES][64]; // Fuer /stats so wie angegeben
+static uint64_t spinNs;
+static int busyPoll;
+
+//- Schreibt nur der Broadcast Agent -//
+static uint64_t statSpinHits; // Nachricht kam waehrend des Spinnens
+static uint64_t statSpinSleeps; // Frist abgelaufen, danach im Kernel geschlafen
+static int busyPollFailed;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause(); //- Schont den Geschwisterthread und die Speicherreihenfolge beim Spinnen -//
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+int latencySetCpus(const LatencyRole role, const char *list) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    const long online = sysconf(_SC_NPROCESSORS_CONF);
+
+    const char *p = list;
+    while (*p != '\0') {
+        char *end;
+        const unsigned long first = strtoul(p, &end, 10);
+        unsigned long last = first;
+        if (end == p) break;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+            if (end == p) break;
+        }
+        if (last < first || last >= CPU_SETSIZE || (online > 0 && last >= (unsigned long) online)) {
+            errorPrint("--pin-%s: CPU %lu-%lu not available (%ld CPUs)", roleNames[role], first, last, online);
+            return -1;
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) CPU_SET(cpu, &set);
+        p = end;
+        if (*p == ',') p++;
+        else if (*p != '\0') break;
+    }
+    if (*p != '\0' || CPU_COUNT(&set) == 0) {
+        errorPrint("--pin-%s: invalid CPU list \"%s\"", roleNames[role], list);
+        return -1;
+    }
+
+    roleCpus[role] = set;
+    rolePinned[role] = 1;
+    snprintf(roleLists[role], sizeof(roleLists[role]), "%s", list);
+    return 0;
+}
+
+void latencySetSpin(const unsigned int usec) {
+    spinNs = (uint64_t) usec * 1000;
+}
+
+void latencySetBusyPoll(const unsigned int usec) {
+    busyPoll = (int) usec;
+}
+
+void latencyPinSelf(const LatencyRole role) {
+    if (!rolePinned[role]) return;
+    const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &roleCpus[role]);
+    if (err != 0) errorPrint("pthread_setaffinity_np (%s): %s", roleNames[role], strerror(err));
+}
+
+//--- Busy Polling: recv() fragt die Netzwerkkarte selbst ab, statt auf den Interrupt zu warten ---//
+void latencySocket(const int fd) {
+    if (busyPoll == 0) return;
+    //- Nagle wuerde kleine Frames zurueckhalten, bis das vorige ACK da ist -//
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busyPoll, sizeof(busyPoll)) == -1 && !busyPollFailed) {
+        busyPollFailed = 1; //- Meist fehlt CAP_NET_ADMIN; einmal melden reicht -//
+        errnoPrint("setsockopt SO_BUSY_POLL");
+    }
+}
+
+//--- Erst ohne Systemaufruf auf den Zaehler der Sender schauen; nur eine Uhrzeit je 64 Runden ---//
+int latencySpin(const uint64_t *counter, const uint64_t seen) {
+    if (spinNs == 0) return 0;
+    //- Der Agent kann den Zaehler kurz ueberholen (Empfang vor dem Erhoehen), nur echter Vorsprung zaehlt -//
+    if ((int64_t) (__atomic_load_n(counter, __ATOMIC_ACQUIRE) - seen) > 0) {
+        statSpinHits++;
+        return 1;
+    }
+
+    const uint64_t deadline = now_ns() + spinNs;
+    while (1) {
+        for (int i = 0; i < 64; i++) {
+            cpu_relax();
+            if ((int64_t) (__atomic_load_n(counter, __ATOMIC_ACQUIRE) - seen) > 0) {
+                statSpinHits++;
+                return 1;
+            }
+        }
+        if (now_ns() >= deadline) break;
+    }
+    statSpinSleeps++;
+    return 0;
+}
+
+void latencyStatsFormat(char *buf, const size_t size) {
+    int len = snprintf(buf, size, "latency: spin=%juus hits=%ju sleeps=%ju busy_poll=%dus%s",
+                       (uintmax_t) (spinNs / 1000), (uintmax_t) statSpinHits, (uintmax_t) statSpinSleeps, busyPoll,
+                       busyPollFailed ? " (failed)" : "");
+    for (int role = 0; role < LATENCY_ROLES && len > 0 && (size_t) len < size; role++) {
+        len += snprintf(buf + len, size - (size_t) len, " %s=%s", roleNames[role],
+                        rolePinned[role] ? roleLists[role] : "-");
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Low-Latency Betrieb: Threads auf feste Kerne, Spinnen vor dem Schlafen, Busy Polling der Sockets.
+// Ohne Optionen ist alles aus und kostet nichts.
+typedef enum {
+    LATENCY_AGENT = 0, // Broadcast Agent
+    LATENCY_ACCEPT, // Main Thread mit dem Accept Loop
+    LATENCY_IO, // Login Stufe und Client Threads
+    LATENCY_ROLES
+} LatencyRole;
+
+// Liste wie bei taskset: "3", "4-7", "1,3,8-11"; -1 bei ungueltigen Kernen
+int latencySetCpus(LatencyRole role, const char *list);
+
+void latencySetSpin(unsigned int usec);
+
+void latencySetBusyPoll(unsigned int usec);
+
+// Den aufrufenden Thread auf die Kerne seiner Rolle setzen; ohne Liste nichts
+void latencyPinSelf(LatencyRole role);
+
+// Fuer jeden angenommenen Client Socket
+void latencySocket(int fd);
+
+// Nur vom Broadcast Agent: bis zu --spin Mikrosekunden warten, dass *counter ueber seen steigt; 1 = ja
+int latencySpin(const uint64_t *counter, uint64_t seen);
+
+void latencyStatsFormat(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "lockprof.h"
+
+LockStats lockStatsUser = {.name = "userLock"};
+LockStats lockStatsRoom = {.name = "roomLock"};
+LockStats lockStatsName = {.name = "nameLock"};
+LockStats lockStatsSend = {.name = "sendLock"};
+LockStats lockStatsPrint = {.name = "print"};
+
+static LockStats *const classes[] = {&lockStatsUser, &lockStatsRoom, &lockStatsName, &lockStatsSend, &lockStatsPrint};
+
+volatile int lockprofOn = 0;
+
+//- Nur fuer die Tabelle der Aufrufstellen, die nur bei Konkurrenz beschrieben wird -//
+static pthread_mutex_t siteLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+static void record_wait(LockStats *stats, const uint64_t waitNs, const char *file, const int line) {
+    __atomic_add_fetch(&stats->contended, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->waitNs, waitNs, __ATOMIC_RELAXED);
+    unsigned int bucket = waitNs ? 64 - (unsigned int) __builtin_clzll(waitNs) : 0;
+    if (bucket >= LOCKPROF_BUCKETS) bucket = LOCKPROF_BUCKETS - 1;
+    __atomic_add_fetch(&stats->histogram[bucket], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&stats->maxWaitNs, __ATOMIC_RELAXED);
+    while (waitNs > max && !__atomic_compare_exchange_n(&stats->maxWaitNs, &max, waitNs, 0, __ATOMIC_RELAXED,
+                                                        __ATOMIC_RELAXED)) {
+    }
+
+    //- Offene Adressierung ueber die Zeilennummer; ist die Tabelle voll, zaehlt die Stelle nur in den Summen -//
+    pthread_mutex_lock(&siteLock);
+    for (unsigned int i = 0; i < LOCKPROF_SITES; i++) {
+        LockSite *site = &stats->sites[((unsigned int) line + i) % LOCKPROF_SITES];
+        if (site->file == NULL) {
+            site->file = file;
+            site->line = line;
+        }
+        if (site->file == file && site->line == line) {
+            site->contended++;
+            site->waitNs += waitNs;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&siteLock);
+}
+
+//--- Erst ohne Warten versuchen; nur wer warten muss, kostet zwei Uhrzeiten und einen Eintrag ---//
+void lockprofSlowAcquire(pthread_mutex_t *mutex, LockStats *stats, const char *file, const int line) {
+    __atomic_add_fetch(&stats->acquired, 1, __ATOMIC_RELAXED);
+    if (pthread_mutex_trylock(mutex) == 0) return;
+
+    const uint64_t start = now_ns();
+    pthread_mutex_lock(mutex);
+    record_wait(stats, now_ns() - start, file, line);
+}
+
+void lockprofSlowLockFile(FILE *stream, LockStats *stats, const char *file, const int line) {
+    __atomic_add_fetch(&stats->acquired, 1, __ATOMIC_RELAXED);
+    if (ftrylockfile(stream) == 0) return;
+
+    const uint64_t start = now_ns();
+    flockfile(stream);
+    record_wait(stats, now_ns() - start, file, line);
+}
+
+void lockprofEnable(const int enable) {
+    lockprofOn = enable;
+}
+
+//- Die Zaehler laufen ohne siteLock weiter, daher einzeln atomar nullen; nur die Stellen gehoeren siteLock -//
+void lockprofReset(void) {
+    pthread_mutex_lock(&siteLock);
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        LockStats *stats = classes[i];
+        __atomic_store_n(&stats->acquired, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->contended, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->waitNs, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->maxWaitNs, 0, __ATOMIC_RELAXED);
+        for (unsigned int b = 0; b < LOCKPROF_BUCKETS; b++) __atomic_store_n(&stats->histogram[b], 0, __ATOMIC_RELAXED);
+        memset(stats->sites, 0, sizeof(stats->sites));
+    }
+    pthread_mutex_unlock(&siteLock);
+}
+
+//- Obergrenze des Buckets, in dem der Anteil p der Wartenden erreicht ist -//
+static uint64_t bucket_percentile(const LockStats *stats, const uint64_t total, const double p) {
+    const uint64_t target = (uint64_t) ((double) total * p + 0.999);
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < LOCKPROF_BUCKETS; i++) {
+        seen += stats->histogram[i];
+        if (seen >= target) {
+            const uint64_t bound = i == 0 ? 0 : 1ULL << i;
+            return bound < stats->maxWaitNs ? bound : stats->maxWaitNs;
+        }
+    }
+    return stats->maxWaitNs;
+}
+
+int lockprofStatsFormat(const unsigned int index, char *buf, const size_t size) {
+    if (index >= sizeof(classes) / sizeof(classes[0])) return -1;
+
+    pthread_mutex_lock(&siteLock);
+    const LockStats *stats = classes[index];
+    const uint64_t contended = stats->contended;
+    int len = snprintf(buf, size, "lock %s%s: acquired=%ju contended=%ju wait=%.3fms p50<=%.1fus p99<=%.1fus max=%.1fus",
+                       stats->name, lockprofOn ? "" : " (off)", (uintmax_t) stats->acquired, (uintmax_t) contended,
+                       (double) stats->waitNs / 1e6,
+                       contended ? (double) bucket_percentile(stats, contended, 0.5) / 1e3 : 0.0,
+                       contended ? (double) bucket_percentile(stats, contended, 0.99) / 1e3 : 0.0,
+                       (double) stats->maxWaitNs / 1e3);
+
+    //- Die drei Stellen mit der laengsten Wartezeit -//
+    int used[3] = {-1, -1, -1};
+    for (int rank = 0; rank < 3 && len > 0 && (size_t) len < size; rank++) {
+        int best = -1;
+        for (int i = 0; i < LOCKPROF_SITES; i++) {
+            if (stats->sites[i].file == NULL || i == used[0] || i == used[1]) continue;
+            if (best == -1 || stats->sites[i].waitNs > stats->sites[best].waitNs) best = i;
+        }
+        if (best == -1) break;
+        used[rank] = best;
+        const char *base = strrchr(stats->sites[best].file, '/');
+        len += snprintf(buf + len, size - (size_t) len, "%s %s:%d n=%ju %.3fms", rank == 0 ? " top:" : ",",
+                        base ? base + 1 : stats->sites[best].file, stats->sites[best].line,
+                        (uintmax_t) stats->sites[best].contended, (double) stats->sites[best].waitNs / 1e6);
+    }
+    pthread_mutex_unlock(&siteLock);
+    return 0;
+}
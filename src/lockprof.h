@@ -0,0 +1,70 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOCKPROF_BUCKETS 32 // Wartezeit in ns, Bucket i = [2^(i-1), 2^i)
+#define LOCKPROF_SITES 32
+
+typedef struct {
+    const char *file;
+    int line;
+    uint64_t contended;
+    uint64_t waitNs;
+} LockSite;
+
+// Eine Klasse je Sperre bzw. je Art von Sperre (alle sendLocks zusammen)
+typedef struct {
+    const char *name;
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t waitNs;
+    uint64_t maxWaitNs;
+    uint64_t histogram[LOCKPROF_BUCKETS];
+    LockSite sites[LOCKPROF_SITES];
+} LockStats;
+
+extern LockStats lockStatsUser;
+extern LockStats lockStatsRoom;
+extern LockStats lockStatsName;
+extern LockStats lockStatsSend;
+extern LockStats lockStatsPrint;
+
+extern volatile int lockprofOn;
+
+void lockprofSlowAcquire(pthread_mutex_t *mutex, LockStats *stats, const char *file, int line);
+
+void lockprofSlowLockFile(FILE *stream, LockStats *stats, const char *file, int line);
+
+//- Ausgeschaltet bleibt nur ein Test vor dem normalen Lock -//
+static inline void lockprofAcquireAt(pthread_mutex_t *mutex, LockStats *stats, const char *file, const int line) {
+    if (__builtin_expect(!lockprofOn, 1)) {
+        pthread_mutex_lock(mutex);
+        return;
+    }
+    lockprofSlowAcquire(mutex, stats, file, line);
+}
+
+static inline void lockprofLockFileAt(FILE *stream, LockStats *stats, const char *file, const int line) {
+    if (__builtin_expect(!lockprofOn, 1)) {
+        flockfile(stream);
+        return;
+    }
+    lockprofSlowLockFile(stream, stats, file, line);
+}
+
+// Statt pthread_mutex_lock bzw. flockfile; merkt sich die Aufrufstelle
+#define lockprofAcquire(mutex, stats) lockprofAcquireAt((mutex), (stats), __FILE__, __LINE__)
+#define lockprofLockFile(stream, stats) lockprofLockFileAt((stream), (stats), __FILE__, __LINE__)
+
+void lockprofEnable(int enable);
+
+void lockprofReset(void);
+
+// Eine Zeile je Klasse; liefert -1, wenn index ueber die letzte Klasse hinaus geht
+int lockprofStatsFormat(unsigned int index, char *buf, size_t size);
+
+#endif
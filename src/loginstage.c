@@ -0,0 +1,366 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "loginstage.h"
+#include "capture.h"
+#include "clientthread.h"
+#include "compress.h"
+#include "federation.h"
+#include "firehose.h"
+#include "handoff.h"
+#include "latency.h"
+#include "memory.h"
+#include "network.h"
+#include "overload.h"
+#include "session.h"
+#include "timerwheel.h"
+#include "user.h"
+#include "util.h"
+#include "validate.h"
+#include "workers.h"
+
+#define LOGIN_EVENTS 64
+
+//- Ein noch nicht eingeloggter Socket kostet nur diesen Eintrag, keinen Thread und keinen User -//
+typedef struct {
+    int fd;
+    int inUse;
+    Timer deadline;
+    size_t received;
+    unsigned char buffer[sizeof(Header) + sizeof(LoginResumeBody)];
+} PendingLogin;
+
+static pthread_mutex_t pendingLock = PTHREAD_MUTEX_INITIALIZER;
+static PendingLogin *pending = NULL;
+static unsigned int *freeSlots = NULL; // Stapel freier Indizes
+static unsigned int freeCount;
+static unsigned int pendingMax;
+static unsigned int deadlineMs;
+static int epollFd = -1;
+static pthread_t threadId;
+
+static unsigned long statAccepted;
+static unsigned long statRejected;
+static unsigned long statExpired;
+static unsigned long statFailed;
+static unsigned long statPromoted;
+
+//--- Frist abgelaufen: Socket abschalten, der Login Thread sieht dann EOF und gibt den Eintrag frei ---//
+static void deadline_expired(void *arg) {
+    PendingLogin *entry = arg;
+    statExpired++;
+    shutdown(entry->fd, SHUT_RDWR);
+}
+
+static void pending_release(PendingLogin *entry, const int closeSocket) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, entry->fd, NULL);
+    timerCancel(&entry->deadline);
+    if (closeSocket) close(entry->fd);
+
+    pthread_mutex_lock(&pendingLock);
+    entry->inUse = 0;
+    entry->fd = -1;
+    freeSlots[freeCount++] = (unsigned int) (entry - pending);
+    pthread_mutex_unlock(&pendingLock);
+}
+
+//--- Magic Number, Version und Namen pruefen; resume ist die wartende Sitzung einer Wiederaufnahme ---//
+static uint8_t login_validate(const LoginRequestBody *loginReq, const size_t bodyLen, char *name, User **resume) {
+    *resume = NULL;
+    if (bodyLen < 5 || ntohl(loginReq->magic) != MAGIC_REQUEST) {
+        return LC_ERROR; //- Protokoll nicht eingehalten / Falsche Magic Number -//
+    }
+    if ((loginReq->version & ~PROT_FLAGS) > PROT_VERSION) {
+        return LC_VERSION_MISMATCH; //- Client veraltet -//
+    }
+
+    //- Name beginnt nach Magic(4) und Version (1) -//
+    memset(name, 0, 32);
+    size_t nameLen = bodyLen - 5;
+    if (nameLen > 31) nameLen = 31;
+    memcpy(name, loginReq->name, nameLen); //- Maximal ist der Name 32Byte lang -//
+
+    //- Gueltigkeit des Namens ueberpruefen -//
+    const size_t namelen = strlen(name);
+    if (namelen == 0 || validateName(name, namelen) != namelen) return LC_NAME_INVALID; //- ASCII 33-126 ohne " ' ` -//
+
+    //- Waehrend eines Hot Restarts keine neuen User, der Nachfolger nimmt sie gleich wieder an -//
+    if (handoffInProgress()) return LC_ERROR;
+
+    //- Sitzungen nur mit Batch Version: erst dort traegt jeder Container seine Nummer -//
+    if ((loginReq->version & PROT_FLAG_SESSION) && (loginReq->version & ~PROT_FLAGS) < PROT_VERSION_BATCH) {
+        return LC_VERSION_MISMATCH;
+    }
+    //- Wiederaufnahme: der Name gehoert noch dem wartenden User, Token statt Namenspruefung -//
+    if ((loginReq->version & PROT_FLAG_SESSION) && bodyLen == sizeof(LoginResumeBody)) {
+        *resume = sessionFind(name, ((const LoginResumeBody *) loginReq)->token);
+        if (*resume != NULL) return LC_SUCCESS;
+    }
+
+    //- Firehose: kein User, daher weder Namenskonflikte noch Ueberlast; nur freigegebene Namen und mit Batch Version -//
+    if (loginReq->version & PROT_FLAG_FIREHOSE) {
+        if ((loginReq->version & ~PROT_FLAGS) < PROT_VERSION_BATCH) return LC_VERSION_MISMATCH;
+        return firehoseAllowed(name) ? LC_SUCCESS : LC_ERROR;
+    }
+
+    //- Ueberlast: wer schon da ist, geht vor; nur der Admin kommt noch herein -//
+    if (strcmp(name, "Admin") != 0 && overloadShedLogin()) return LC_ERROR;
+
+    //- Pruefen ob Name schon vergeben; nur dieser Thread fuegt User hinzu, daher kein Wettlauf -//
+    User *existing = user_find(name);
+    if (existing != NULL) {
+        user_put(existing);
+        return LC_NAME_TAKEN;
+    }
+    if (federationNameTaken(name)) return LC_NAME_TAKEN; //- Auf einem anderen Knoten eingeloggt -//
+    if (workersClaimName(name) == -1) return LC_NAME_TAKEN; //- Bei einem anderen Worker eingeloggt -//
+
+    return LC_SUCCESS;
+}
+
+//--- LoginRequest ist vollstaendig: antworten und bei Erfolg in die Userliste befoerdern ---//
+static void pending_complete(PendingLogin *entry) {
+    LoginResumeBody loginReq; //- Beginnt wie LoginRequestBody -//
+    const size_t bodyLen = entry->received - sizeof(Header);
+    char name[32];
+    User *resume;
+
+    memset(&loginReq, 0, sizeof(loginReq));
+    memcpy(&loginReq, entry->buffer + sizeof(Header), bodyLen);
+
+    const int fd = entry->fd;
+    captureOpen(fd, entry->buffer, entry->received); //- Vor der Freigabe, danach kann der Accept Loop den Eintrag belegen -//
+    pending_release(entry, 0);
+
+    const uint8_t respCode = login_validate((const LoginRequestBody *) &loginReq, bodyLen, name, &resume);
+
+    //- Wiederaufnahme: der wartende Client Thread antwortet selbst und schickt nur das Verpasste -//
+    if (resume != NULL) {
+        const int flags = fcntl(fd, F_GETFL);
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+        captureClose(fd);
+        if (sessionResume(resume, fd, loginReq.version, ntoh64u(loginReq.seq)) == -1) {
+            sendLoginResponse(fd, LC_ERROR, 0); //- Frist gerade abgelaufen -//
+            statFailed++;
+            close(fd);
+        } else {
+            statPromoted++;
+        }
+        user_put(resume);
+        return;
+    }
+
+    const int firehose = respCode == LC_SUCCESS && (loginReq.version & PROT_FLAG_FIREHOSE);
+
+    //- Bloecke sind schon fertig kodiert und werden geteilt, daher nie komprimiert -//
+    if (firehose) {
+        if (sendLoginResponse(fd, respCode, 0) == -1) {
+            captureClose(fd);
+            statFailed++;
+            close(fd);
+            return;
+        }
+        const int flags = fcntl(fd, F_GETFL);
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+        captureClose(fd); //- Danach kommt nur noch der Abo Frame, kein Chatverkehr -//
+        if (firehoseAttach(fd, name) == -1) {
+            errorPrint("Firehose %s rejected: too many subscribers", name);
+            statFailed++;
+            close(fd);
+            return;
+        }
+        statPromoted++;
+        return;
+    }
+
+    //- Kompression nur auf Wunsch und wenn moeglich; sonst bekommt der Client die gewohnte Magic und liest unkomprimiert -//
+    const int compressed = respCode == LC_SUCCESS && (loginReq.version & PROT_FLAG_COMPRESS) && compressAvailable()
+                           && compressAttach(fd) == 0;
+
+    //- Die Antwort passt immer in den leeren Sendepuffer, der Socket darf dafuer noch nicht blockierend sein -//
+    if (sendLoginResponse(fd, respCode, compressed) == -1 || respCode != LC_SUCCESS) {
+        if (respCode == LC_SUCCESS) workersReleaseName(name);
+        if (compressed) compressDetach(fd);
+        captureClose(fd);
+        infoPrint("Login failed (Code: %d)", respCode);
+        statFailed++;
+        close(fd);
+        return;
+    }
+
+    const int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+
+    User *newUser = user_add(fd, name);
+    if (newUser == NULL) {
+        workersReleaseName(name);
+        compressDetach(fd);
+        captureClose(fd);
+        close(fd);
+        return;
+    }
+    newUser->version = (uint8_t) (loginReq.version & ~PROT_FLAGS); //- Bis hier bekommt er Einzelframes, die auch v1 versteht -//
+    if ((loginReq.version & PROT_FLAG_SESSION) && sessionEnabled()) sessionStart(newUser);
+
+    //- Thread erstellen und an clientthread die Arbeit abgeben -//
+    pthread_t thread;
+    if (pthread_create(&thread, memoryThreadAttr(), clientthread, newUser) != 0) {
+        errorPrint("Failed to create client thread");
+        user_remove(newUser);
+        workersReleaseName(name); //- Kein UserAdded veroeffentlicht, also auch kein UserRemoved abwarten -//
+        return;
+    }
+    pthread_detach(thread);
+    statPromoted++;
+}
+
+//--- Liest so viel wie gerade da ist; Header zuerst, dann den Body bis maximal LoginRequestBody (LoginResumeBody) ---//
+static void pending_read(PendingLogin *entry) {
+    while (1) {
+        size_t need = sizeof(Header);
+        if (entry->received >= sizeof(Header)) {
+            const Header *hdr = (const Header *) entry->buffer;
+            size_t bodyLen = ntohs(hdr->length);
+            //- Erst das Versionsbyte zeigt, ob ein laengerer Body eine Wiederaufnahme ist -//
+            const int session = entry->received > sizeof(Header) + 4 && (entry->buffer[sizeof(Header) + 4] & PROT_FLAG_SESSION);
+            const size_t max = session ? sizeof(LoginResumeBody) : sizeof(LoginRequestBody);
+            if (bodyLen > max) bodyLen = max;
+            need += bodyLen;
+        }
+
+        if (entry->received == need) {
+            pending_complete(entry);
+            return;
+        }
+
+        const ssize_t res = recv(entry->fd, entry->buffer + entry->received, need - entry->received, 0);
+        if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (res == -1 && errno == EINTR) continue;
+        if (res <= 0) {
+            pending_release(entry, 1);
+            return;
+        }
+        entry->received += (size_t) res;
+
+        if (entry->received == sizeof(Header) && entry->buffer[0] != MT_LOGIN_REQUEST) {
+            errorPrint("Client sent msg type %d instead of LoginRequest!", entry->buffer[0]);
+            statFailed++;
+            pending_release(entry, 1);
+            return;
+        }
+    }
+}
+
+static void *loginThread(void *arg) {
+    (void) arg;
+    struct epoll_event events[LOGIN_EVENTS];
+    debugPrint("Login thread started");
+    latencyPinSelf(LATENCY_IO);
+
+    while (1) {
+        const int n = epoll_wait(epollFd, events, LOGIN_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            errnoPrint("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            pending_read(events[i].data.ptr);
+        }
+    }
+    return NULL;
+}
+
+int loginStageInit(const unsigned int maxPending, const unsigned int timeoutMs) {
+    pendingMax = maxPending > 0 ? maxPending : 1;
+    deadlineMs = timeoutMs;
+
+    pending = calloc(pendingMax, sizeof(PendingLogin));
+    freeSlots = calloc(pendingMax, sizeof(unsigned int));
+    if (pending == NULL || freeSlots == NULL) {
+        errorPrint("Memory allocation failed for pending login table");
+        return -1;
+    }
+    //- Kleinste Indizes oben auf den Stapel -//
+    for (unsigned int i = 0; i < pendingMax; i++) {
+        pending[i].fd = -1;
+        timerInit(&pending[i].deadline, deadline_expired, &pending[i]);
+        freeSlots[i] = pendingMax - 1 - i;
+    }
+    freeCount = pendingMax;
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1) {
+        errnoPrint("epoll_create1");
+        return -1;
+    }
+
+    if (pthread_create(&threadId, NULL, loginThread, NULL) != 0) {
+        errnoPrint("Failed to start login thread");
+        close(epollFd);
+        return -1;
+    }
+    return 0;
+}
+
+void loginStageCleanup(void) {
+    pthread_cancel(threadId);
+    pthread_join(threadId, NULL);
+
+    for (unsigned int i = 0; i < pendingMax; i++) {
+        if (pending[i].inUse) {
+            timerCancel(&pending[i].deadline);
+            close(pending[i].fd);
+        }
+    }
+    close(epollFd);
+    free(pending);
+    free(freeSlots);
+}
+
+int loginStageAdd(const int client_fd) {
+    pthread_mutex_lock(&pendingLock);
+    if (freeCount == 0) {
+        //- Zu viele gleichzeitige Handshakes: sofort ablehnen statt Ressourcen zu binden -//
+        statRejected++;
+        pthread_mutex_unlock(&pendingLock);
+        close(client_fd);
+        return -1;
+    }
+    PendingLogin *entry = &pending[freeSlots[--freeCount]];
+    entry->inUse = 1;
+    entry->fd = client_fd;
+    entry->received = 0;
+    statAccepted++;
+    pthread_mutex_unlock(&pendingLock);
+
+    const int flags = fcntl(client_fd, F_GETFL);
+    fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
+
+    if (deadlineMs > 0) timerArm(&entry->deadline, deadlineMs);
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = entry;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+        errnoPrint("epoll_ctl");
+        pending_release(entry, 1);
+        return -1;
+    }
+    return 0;
+}
+
+void loginStageStatsFormat(char *buf, const size_t size) {
+    pthread_mutex_lock(&pendingLock);
+    snprintf(buf, size, "logins: pending=%u/%u accepted=%lu promoted=%lu failed=%lu expired=%lu rejected=%lu",
+             pendingMax - freeCount, pendingMax, statAccepted, statPromoted, statFailed, statExpired, statRejected);
+    pthread_mutex_unlock(&pendingLock);
+}
@@ -0,0 +1,15 @@
+#ifndef LOGINSTAGE_H
+#define LOGINSTAGE_H
+
+#include <stddef.h>
+
+int loginStageInit(unsigned int maxPending, unsigned int timeoutMs);
+
+void loginStageCleanup(void);
+
+// Uebernimmt den Socket; bei voller Tabelle wird er sofort geschlossen
+int loginStageAdd(int client_fd);
+
+void loginStageStatsFormat(char *buf, size_t size);
+
+#endif
@@ -2,10 +2,32 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include "connectionhandler.h"
 #include "util.h"
 #include "broadcastagent.h"
+#include "capture.h"
+#include "compress.h"
+#include "federation.h"
+#include "firehose.h"
+#include "handoff.h"
+#include "latency.h"
+#include "lockprof.h"
+#include "loginstage.h"
+#include "memory.h"
+#include "msglog.h"
+#include "overload.h"
+#include "searchindex.h"
+#include "session.h"
+#include "timerwheel.h"
+#include "trace.h"
+#include "user.h"
+#include "validate.h"
+#include "workers.h"
+#include "zerocopy.h"
 
 #define DEFAULT_PORT 8111
 
@@ -26,39 +48,301 @@ int main(const int argc, char **argv) {
     debugEnable();
     infoPrint("Chat server, group 27");
 
-    in_port_t port = DEFAULT_PORT;
-    if (argc == 2) {
-        //--- Infos anfragen ---//
-        if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
-            infoPrint("Usage: %s [PORT]", argv[0]);
-            return EXIT_SUCCESS;
+    //--- Optionen auswerten, Zeitlimits in Sekunden (0 = aus) ---//
+    static const struct option longOptions[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"login-timeout", required_argument, NULL, 'L'},
+        {"idle-timeout", required_argument, NULL, 'I'},
+        {"stall-timeout", required_argument, NULL, 'S'},
+        {"max-pending", required_argument, NULL, 'P'},
+        {"zerocopy", required_argument, NULL, 'Z'},
+        {"log-dir", required_argument, NULL, 'D'},
+        {"segment-size", required_argument, NULL, 'G'},
+        {"history", required_argument, NULL, 'H'},
+        {"search-memory", required_argument, NULL, 'M'},
+        {"link-port", required_argument, NULL, 'K'},
+        {"peer", required_argument, NULL, 'R'},
+        {"link-bind", required_argument, NULL, 'J'},
+        {"link-secret", required_argument, NULL, 'Q'},
+        {"workers", required_argument, NULL, 'W'},
+        {"handoff", required_argument, NULL, 'O'},
+        {"takeover", required_argument, NULL, 'T'},
+        {"listen", required_argument, NULL, 'A'},
+        {"trace", required_argument, NULL, 'E'},
+        {"trace-records", required_argument, NULL, 'N'},
+        {"lock-profile", no_argument, NULL, 'C'},
+        {"compress", required_argument, NULL, 'X'},
+        {"pin-agent", required_argument, NULL, 'g'},
+        {"pin-accept", required_argument, NULL, 'c'},
+        {"pin-io", required_argument, NULL, 'i'},
+        {"spin", required_argument, NULL, 's'},
+        {"busy-poll", required_argument, NULL, 'b'},
+        {"capture", required_argument, NULL, 'F'},
+        {"thread-stack", required_argument, NULL, 'k'},
+        {"sndbuf", required_argument, NULL, 'o'},
+        {"rcvbuf", required_argument, NULL, 'r'},
+        {"idle-release", required_argument, NULL, 'l'},
+        {"overload-queue", required_argument, NULL, 'q'},
+        {"overload-lag", required_argument, NULL, 'y'},
+        {"firehose", required_argument, NULL, 'f'},
+        {"firehose-buffer", required_argument, NULL, 'B'},
+        {"session-grace", required_argument, NULL, 'e'},
+        {NULL, 0, NULL, 0}
+    };
+    unsigned int loginTimeout = 10;
+    unsigned int idleTimeout = 0;
+    unsigned int stallTimeout = 5;
+    unsigned int maxPending = 1024; //- Gleichzeitige Handshakes -//
+    const char *logDir = NULL; //- Ohne Verzeichnis kein Nachrichtenlog -//
+    size_t segmentSize = 4 * 1024 * 1024;
+    unsigned int history = 20;
+    size_t searchMemory = 64; //- MiB fuer den Suchindex, 0 = keine Suche -//
+    in_port_t linkPort = 0; //- Port fuer eingehende Federation Links, 0 = keine -//
+    unsigned int peerCount = 0;
+    unsigned int unixListeners = 0;
+    const char *traceFile = NULL; //- Ziel fuer den Latenz Trace, ohne kein Tracing -//
+    size_t traceRecords = TRACE_DEFAULT_RECORDS;
+    unsigned int workers = 1; //- Prozesse mit eigenem Listener (SO_REUSEPORT) und gemeinsamem Ring -//
+    const char *handoffPath = NULL; //- Hier wartet der Server auf seinen Nachfolger -//
+    const char *takeoverPath = NULL; //- Hier wartet der Vorgaenger -//
+    int compressLevel = 0; //- zlib Level fuer Clients mit PROT_FLAG_COMPRESS, 0 = keine Kompression -//
+    const char *captureFile = NULL; //- Mitschnitt der eingehenden Frames fuer capture_replay -//
+    int sndbuf = 0; //- Socket Puffer je Verbindung in Bytes, 0 = Kernel Standard mit Autotuning -//
+    int rcvbuf = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 'L': loginTimeout = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'I': idleTimeout = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'S': stallTimeout = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'P': maxPending = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'Z': zerocopySetThreshold(strtoul(optarg, NULL, 10)); break; //- Ab dieser Framegroesse -//
+            case 'D': logDir = optarg; break;
+            case 'G': segmentSize = strtoul(optarg, NULL, 10); break;
+            case 'H': history = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'M': searchMemory = strtoul(optarg, NULL, 10); break;
+            case 'K': linkPort = (in_port_t) strtoul(optarg, NULL, 10); break;
+            case 'R':
+                if (federationAddPeer(optarg) == -1) return EXIT_FAILURE; //- Mehrfach angebbar -//
+                peerCount++;
+                break;
+            case 'J': if (federationSetBind(optarg) == -1) return EXIT_FAILURE; break;
+            case 'Q': if (federationSetSecret(optarg) == -1) return EXIT_FAILURE; break;
+            case 'W': workers = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'O': handoffPath = optarg; break;
+            case 'T': takeoverPath = optarg; break;
+            case 'E': traceFile = optarg; break;
+            case 'F': captureFile = optarg; break;
+            case 'N': traceRecords = strtoul(optarg, NULL, 10); break;
+            case 'C': lockprofEnable(1); break; //- Sonst erst mit /lockprof on -//
+            case 'g': if (latencySetCpus(LATENCY_AGENT, optarg) == -1) return EXIT_FAILURE; break;
+            case 'c': if (latencySetCpus(LATENCY_ACCEPT, optarg) == -1) return EXIT_FAILURE; break;
+            case 'i': if (latencySetCpus(LATENCY_IO, optarg) == -1) return EXIT_FAILURE; break;
+            case 's': latencySetSpin((unsigned int) strtoul(optarg, NULL, 10)); break; //- Mikrosekunden -//
+            case 'b': latencySetBusyPoll((unsigned int) strtoul(optarg, NULL, 10)); break;
+            case 'k': memorySetThreadStack(strtoul(optarg, NULL, 10)); break; //- KiB, 0 = glibc Standard -//
+            case 'o': sndbuf = atoi(optarg); break;
+            case 'r': rcvbuf = atoi(optarg); break;
+            case 'l': memorySetIdleRelease((unsigned int) strtoul(optarg, NULL, 10) * 1000); break;
+            case 'q': overloadSetQueue((unsigned int) strtoul(optarg, NULL, 10)); break; //- 0 = Fuellstand egal -//
+            case 'y': overloadSetLag((unsigned int) strtoul(optarg, NULL, 10)); break; //- Millisekunden, 0 = egal -//
+            case 'f':
+                if (firehoseAllow(optarg) == -1) { //- Mehrfach angebbar -//
+                    fprintf(stderr, "--firehose expects a name of 1-31 characters, at most %d times\n", FIREHOSE_MAX_NAMES);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'B': firehoseSetBuffer(strtoul(optarg, NULL, 10) * 1024 * 1024); break; //- MiB Rueckblick -//
+            case 'e': sessionSetGrace((unsigned int) strtoul(optarg, NULL, 10)); break; //- 0 = aus -//
+            case 'X':
+                compressLevel = atoi(optarg);
+                if (compressLevel < 0 || compressLevel > 9) {
+                    fprintf(stderr, "--compress expects a zlib level 0-9\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'A':
+                if (connectionHandlerAddListen(optarg) == -1) return EXIT_FAILURE; //- Mehrfach angebbar -//
+                if (strncmp(optarg, "unix:", 5) == 0) unixListeners++;
+                break;
+            case 'h':
+                //--- Infos anfragen ---//
+                infoPrint("Usage: %s [--login-timeout SEC] [--idle-timeout SEC] [--stall-timeout SEC] [--max-pending N] [--zerocopy MIN_BYTES] [--log-dir DIR [--segment-size BYTES] [--history N] [--search-memory MIB]] [--link-port PORT [--link-bind ADDR]] [--peer HOST:PORT]... [--link-secret TEXT] [--workers N] [--handoff PATH] [--takeover PATH] [--listen ADDR]... [--trace FILE [--trace-records N]] [--lock-profile] [--compress LEVEL] [--pin-agent CPUS] [--pin-accept CPUS] [--pin-io CPUS] [--spin USEC] [--busy-poll USEC] [--capture FILE] [--thread-stack KIB] [--sndbuf BYTES] [--rcvbuf BYTES] [--idle-release SEC] [--overload-queue N] [--overload-lag MS] [--firehose NAME [--firehose-buffer MIB]]... [--session-grace SEC] [PORT]", argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                return EXIT_FAILURE; //Fehlercode 1
         }
-        //Todo
+    }
+    user_set_timeouts(idleTimeout * 1000, stallTimeout * 1000);
+    if (sndbuf < 0 || rcvbuf < 0) {
+        fprintf(stderr, "--sndbuf/--rcvbuf expect a size in bytes\n");
+        return EXIT_FAILURE;
+    }
+    memorySetSocketBuffers(sndbuf, rcvbuf);
+
+    //- Stackgroesse der Client Threads; vor dem ersten, auch denen einer Uebernahme -//
+    memoryInit();
+
+    //- Pruefung von Namen und Texten: AVX2/SSE2 Variante, falls die CPU sie kann -//
+    validateInit();
+    debugPrint("Input validation: %s", validateImplementation());
+
+    in_port_t port = DEFAULT_PORT;
+    if (optind + 1 == argc) {
         //--- Port überprüfen und setzen ---//
-        if (atoi(argv[1]) >= 65536 || atoi(argv[1]) <= 1023) {
+        if (atoi(argv[optind]) >= 65536 || atoi(argv[optind]) <= 1023) {
             port = 8111;
             fprintf(stderr, "Port must be <65536 and >1023, using standard port\n");
-        } else port = (in_port_t) atoi(argv[1]);
+        } else port = (in_port_t) atoi(argv[optind]);
         if (port == 0) {
-            fprintf(stderr, "Invalid port number: %s\n", argv[1]);
+            fprintf(stderr, "Invalid port number: %s\n", argv[optind]);
             return EXIT_FAILURE; //Fehlercode 1
         }
 
     //--- Zu viele Argumente? ---//
-    } else if (argc > 2) {
-        fprintf(stderr, "Usage: %s [PORT]\n", argv[0]);
+    } else if (optind + 1 < argc) {
+        fprintf(stderr, "Usage: %s [OPTIONS] [PORT]\n", argv[0]);
         return EXIT_FAILURE; //Fehlercode 1
     }
 
+    //--- Worker Prozesse vor allen Threads starten; der Supervisor kehrt erst am Ende zurueck ---//
+    char workerLogDir[4096];
+    char workerCaptureFile[4096];
+    if (workers > 1) {
+        if (linkPort != 0 || peerCount > 0) {
+            fprintf(stderr, "--workers cannot be combined with federation links\n");
+            return EXIT_FAILURE;
+        }
+        if (unixListeners > 0) {
+            fprintf(stderr, "--workers cannot share a unix socket listener\n");
+            return EXIT_FAILURE;
+        }
+        if (handoffPath != NULL || takeoverPath != NULL) {
+            fprintf(stderr, "--workers cannot be combined with --handoff/--takeover\n");
+            return EXIT_FAILURE;
+        }
+        if (logDir != NULL && mkdir(logDir, 0755) == -1 && errno != EEXIST) {
+            perror("mkdir");
+            return EXIT_FAILURE;
+        }
+        connectionHandlerSetReusePort(1);
+        const int worker = workersStart(workers);
+        if (worker == -1) return EXIT_FAILURE;
+        if (worker == -2) return EXIT_SUCCESS;
+
+        //- Jeder Worker fuehrt ein eigenes Nachrichtenlog und einen eigenen Mitschnitt -//
+        if (logDir != NULL) {
+            snprintf(workerLogDir, sizeof(workerLogDir), "%s/worker-%d", logDir, worker);
+            logDir = workerLogDir;
+        }
+        if (captureFile != NULL) {
+            snprintf(workerCaptureFile, sizeof(workerCaptureFile), "%s.worker-%d", captureFile, worker);
+            captureFile = workerCaptureFile;
+        }
+    }
+
+    //--- Startet das Timer Rad fuer Login-, Leerlauf- und Sendezeitlimits ---//
+    if (timerWheelInit() == -1) {
+        fprintf(stderr, "timerWheelInit() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //--- Komprimierte Stroeme; vor der Uebernahme, die bringt womoeglich schon welche mit ---//
+    if (compressInit(compressLevel) == -1) {
+        fprintf(stderr, "compressInit() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //--- Hot Restart: Sockets vom laufenden Vorgaenger holen; der schliesst dabei sein Nachrichtenlog ---//
+    if (takeoverPath != NULL && handoffTakeover(takeoverPath) == -1) {
+        fprintf(stderr, "handoffTakeover() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //--- Latenz Trace, muss vor dem ersten Client Thread stehen ---//
+    if (traceFile != NULL && traceInit(traceRecords, traceFile) == -1) {
+        fprintf(stderr, "traceInit() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //--- Mitschnitt, ebenfalls vor dem ersten Login ---//
+    if (captureInit(captureFile) == -1) {
+        fprintf(stderr, "captureInit() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //--- Firehose Puffer, bevor Login Stufe und Broadcast Agent ihn benutzen; Sitzungen holen daraus nach ---//
+    sessionInit();
+    if (firehoseInit() == -1) {
+        fprintf(stderr, "firehoseInit() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //--- Suchindex wird vom Nachrichtenlog befuellt, ohne Log gibt es keine Suche ---//
+    if (logDir != NULL && searchIndexInit(searchMemory * 1024 * 1024) == -1) {
+        fprintf(stderr, "searchIndexInit() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //--- Nachrichtenlog oeffnen bzw. fortsetzen ---//
+    if (msglogInit(logDir, segmentSize, history) == -1) {
+        fprintf(stderr, "msglogInit() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //--- Startet die Login Stufe fuer noch nicht eingeloggte Verbindungen ---//
+    if (loginStageInit(maxPending, loginTimeout * 1000) == -1) {
+        fprintf(stderr, "loginStageInit() failed\n");
+        return EXIT_FAILURE;
+    }
+
     //--- Startet den Broadcasts Agent ---//
     if (broadcastAgentInit() == -1) {
         fprintf(stderr, "broadcastAgentInit() failed\n");
         return EXIT_FAILURE;
     }
 
+    //--- Ring der anderen Worker lesen, ebenfalls in die Broadcast Queue ---//
+    if (workersAttach() == -1) {
+        fprintf(stderr, "workersAttach() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //--- Links zu anderen Chat Servern, braucht die laufende Broadcast Queue ---//
+    if (federationInit(linkPort) == -1) {
+        fprintf(stderr, "federationInit() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //--- Uebernommene Verbindungen bekommen wieder User und Client Thread ---//
+    if (takeoverPath != NULL && handoffResume() == -1) {
+        fprintf(stderr, "handoffResume() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //--- Auf den naechsten Nachfolger warten; braucht den Main Thread fuer das Signal an accept() ---//
+    if (handoffPath != NULL && handoffInit(handoffPath) == -1) {
+        fprintf(stderr, "handoffInit() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    //- Erst jetzt: alle Hilfsthreads sind gestartet und erben die Kerne des Accept Loops nicht -//
+    latencyPinSelf(LATENCY_ACCEPT);
     fprintf(stderr, "Starting server on port %u\n", port);
-    const int result = connectionHandler(port);
+    int result;
+    do {
+        result = connectionHandler(port);
+    } while (result != -1 && handoffWait() == 1); //- Abgebrochene Uebergabe: derselbe Listener nimmt weiter an -//
+    federationCleanup();
+    loginStageCleanup();
     broadcastAgentCleanup();
+    firehoseCleanup(); //- Erst ohne Agent: es kommen keine Bloecke mehr -//
+    compressCleanup();
+    captureCleanup(); //- Schreibt den Rest des Puffers -//
+    traceCleanup(); //- Letzter Dump beim Beenden -//
+    msglogCleanup();
+    searchIndexCleanup();
+    timerWheelCleanup();
 
     //Für Linux übersetzt:
     //Kein Fehler? != -1 ? -> gib 0 zurück
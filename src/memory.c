@@ -0,0 +1,128 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "memory.h"
+#include "util.h"
+
+int64_t memoryBytes[MEM_CATEGORIES];
+
+static const char *const categoryNames[MEM_CATEGORIES] = {"user", "stack", "socket", "buffer", "compress", "zerocopy"};
+
+static size_t stackBytes = MEMORY_DEFAULT_STACK_KIB * 1024;
+static pthread_attr_t threadAttr;
+static int threadAttrReady = 0;
+static int sndbuf = 0;
+static int rcvbuf = 0;
+static unsigned int idleMs = MEMORY_DEFAULT_IDLE_MS;
+static int64_t connections;
+static uint64_t rssBaseline;
+
+static uint64_t rss_bytes(void) {
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == NULL) return 0;
+    unsigned long pages = 0;
+    unsigned long resident = 0;
+    const int ok = fscanf(file, "%lu %lu", &pages, &resident) == 2;
+    fclose(file);
+    return ok ? (uint64_t) resident * (uint64_t) sysconf(_SC_PAGESIZE) : 0;
+}
+
+void memorySetThreadStack(const size_t kib) {
+    stackBytes = kib * 1024;
+}
+
+void memorySetSocketBuffers(const int sendBytes, const int receiveBytes) {
+    sndbuf = sendBytes;
+    rcvbuf = receiveBytes;
+}
+
+void memorySetIdleRelease(const unsigned int ms) {
+    idleMs = ms;
+}
+
+unsigned int memoryIdleMs(void) {
+    return idleMs;
+}
+
+void memoryInit(void) {
+    pthread_attr_init(&threadAttr);
+    if (stackBytes > 0) {
+        //- Kleiner als PTHREAD_STACK_MIN lehnt glibc ab; dann bleibt der Standard -//
+        const int err = pthread_attr_setstacksize(&threadAttr, stackBytes);
+        if (err != 0) {
+            errorPrint("--thread-stack %zu KiB rejected, using the default stack size", stackBytes / 1024);
+            stackBytes = 0;
+        }
+    }
+    if (stackBytes == 0) pthread_attr_getstacksize(&threadAttr, &stackBytes);
+    threadAttrReady = 1;
+}
+
+const pthread_attr_t *memoryThreadAttr(void) {
+    return threadAttrReady ? &threadAttr : NULL;
+}
+
+size_t memoryThreadStack(void) {
+    return stackBytes;
+}
+
+void memorySocket(const int fd) {
+    if (sndbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == -1) {
+        errnoPrint("setsockopt SO_SNDBUF");
+    }
+    if (rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == -1) {
+        errnoPrint("setsockopt SO_RCVBUF");
+    }
+}
+
+//- Der Kernel verdoppelt den gesetzten Wert fuer seine Verwaltung; gerechnet wird, was er meldet -//
+static int64_t socket_bytes(const int fd) {
+    int send = 0;
+    int receive = 0;
+    socklen_t len = sizeof(int);
+    getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send, &len);
+    len = sizeof(int);
+    getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive, &len);
+    return (int64_t) send + receive;
+}
+
+int64_t memoryConnectionOpen(const int fd) {
+    //- Basis fuer die RSS je Verbindung: alles, was vor dem ersten Login schon belegt war -//
+    if (__atomic_load_n(&rssBaseline, __ATOMIC_RELAXED) == 0) {
+        __atomic_store_n(&rssBaseline, rss_bytes(), __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&connections, 1, __ATOMIC_RELAXED);
+    const int64_t bytes = socket_bytes(fd);
+    memoryAdd(MEM_SOCKET, bytes);
+    return bytes;
+}
+
+//- Mit dem Wert vom Login: das Autotuning kann die Puffer inzwischen vergroessert haben -//
+void memoryConnectionClose(const int64_t socketBytes) {
+    __atomic_sub_fetch(&connections, 1, __ATOMIC_RELAXED);
+    memoryAdd(MEM_SOCKET, -socketBytes);
+}
+
+void memoryStatsFormat(char *buf, const size_t size) {
+    const int64_t conns = __atomic_load_n(&connections, __ATOMIC_RELAXED);
+    const uint64_t rss = rss_bytes();
+    int len = snprintf(buf, size, "memory: conns=%jd per-conn", (intmax_t) conns);
+    int64_t heap = 0;
+    for (int i = 0; i < MEM_CATEGORIES && len > 0 && (size_t) len < size; i++) {
+        const int64_t bytes = __atomic_load_n(&memoryBytes[i], __ATOMIC_RELAXED);
+        //- Stack ist nur reserviert und Socket Puffer sind eine Obergrenze des Kernels: beide nicht im heap -//
+        if (i != MEM_STACK && i != MEM_SOCKET) heap += bytes;
+        len += snprintf(buf + len, size - (size_t) len, " %s=%jd", categoryNames[i],
+                        (intmax_t) (conns > 0 ? bytes / conns : 0));
+    }
+    if (len > 0 && (size_t) len < size) {
+        //- Der Stack ist reserviert, nicht belegt; die RSS Differenz zeigt, was wirklich anfaellt -//
+        const int64_t grown = rss > rssBaseline ? (int64_t) (rss - rssBaseline) : 0;
+        snprintf(buf + len, size - (size_t) len,
+                 " heap=%jd rss=%.1fMiB (+%jd/conn since the first login) stack_size=%zuKiB idle_release=%us",
+                 (intmax_t) (conns > 0 ? heap / conns : 0), (double) rss / (1024.0 * 1024.0),
+                 (intmax_t) (conns > 0 ? grown / conns : 0), stackBytes / 1024, idleMs / 1000);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEMORY_DEFAULT_STACK_KIB 256 // Client Threads; der glibc Standard waere RLIMIT_STACK (meist 8 MiB)
+#define MEMORY_DEFAULT_IDLE_MS 30000 // So lange ohne Eingang: Puffer der Verbindung freigeben
+
+// Was eine Verbindung kostet, nach Art; /stats teilt durch die Zahl der Verbindungen
+typedef enum {
+    MEM_USER = 0, // User Struktur und Ignorierliste
+    MEM_STACK, // Reservierter Stack der Client Threads (virtuell, belegt wird nur das Benutzte)
+    MEM_SOCKET, // SO_SNDBUF + SO_RCVBUF, die Obergrenze des Kernels je Socket
+    MEM_BUFFER, // Empfangspuffer der Client Threads, bei Leerlauf freigegeben
+    MEM_COMPRESS, // zlib Zustand bzw. geparktes Fenster
+    MEM_ZEROCOPY, // Ring der ausstehenden Zerocopy Sends
+    MEM_CATEGORIES
+} MemCategory;
+
+void memorySetThreadStack(size_t kib);
+
+// 0 = Kernel Standard (mit Autotuning); ein fester Wert schaltet das Autotuning fuer diese Richtung ab
+void memorySetSocketBuffers(int sndbuf, int rcvbuf);
+
+// 0 = nie freigeben
+void memorySetIdleRelease(unsigned int ms);
+
+unsigned int memoryIdleMs(void);
+
+// Nach den Optionen, vor dem ersten Client Thread (auch denen einer Uebernahme)
+void memoryInit(void);
+
+// Attribute fuer Client Threads mit der eingestellten Stackgroesse
+const pthread_attr_t *memoryThreadAttr(void);
+
+size_t memoryThreadStack(void);
+
+// Nach accept: Puffergroessen setzen
+void memorySocket(int fd);
+
+// Eine Verbindung mit User kommt hinzu; liefert die gerechneten Socket Puffer fuer memoryConnectionClose
+int64_t memoryConnectionOpen(int fd);
+
+void memoryConnectionClose(int64_t socketBytes);
+
+static inline void memoryAdd(const MemCategory category, const int64_t bytes) {
+    extern int64_t memoryBytes[MEM_CATEGORIES];
+    __atomic_add_fetch(&memoryBytes[category], bytes, __ATOMIC_RELAXED);
+}
+
+void memoryStatsFormat(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,578 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "msglog.h"
+#include "compress.h"
+#include "searchindex.h"
+#include "util.h"
+
+#define SEGMENT_MAGIC "CHATLOG1"
+#define SEGMENT_HEADER_SIZE 64
+#define MSGLOG_MAPPED_SEGMENTS 4 // So viele Segmente bleiben fuer Replay eingeblendet
+#define MSGLOG_QUEUE_SIZE 4096 // Nachrichten zwischen Broadcast Agent und Schreiber
+#define MSGLOG_MIN_SEGMENT (64 * 1024)
+
+//- Ein Segment enthaelt die Frames genau so, wie sie auf dem Draht stehen, direkt hintereinander -//
+typedef struct __attribute__((packed)) {
+    char magic[8];
+    uint64_t baseSeq; // Nummer des ersten Frames, Host Byte Order
+    unsigned char reserved[SEGMENT_HEADER_SIZE - 16];
+} SegmentHeader;
+
+typedef struct Segment {
+    struct Segment *next; // aelter -> neuer
+    unsigned long index;
+    uint64_t baseSeq;
+    unsigned char *map;
+    size_t size;
+    size_t used;
+    uint32_t *offsets; // Offset jedes Frames im Segment
+    size_t count;
+    size_t capacity;
+    unsigned int refs; // Replays, die gerade daraus senden
+    int retired;
+} Segment;
+
+typedef struct {
+    Frame *frame;
+    uint64_t seq;
+} LogEntry;
+
+//- Alle Segmentdateien (auch ausgeblendete), um alte Nachrichten fuer die Suche wiederzufinden -//
+typedef struct {
+    unsigned long index;
+    uint64_t baseSeq;
+} SegmentRef;
+
+static pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writtenCond = PTHREAD_COND_INITIALIZER;
+static pthread_t threadId;
+
+static int enabled = 0;
+static char logDir[256];
+static size_t segmentSize;
+static unsigned int replayCount;
+
+static Segment *oldest = NULL;
+static Segment *newest = NULL;
+static unsigned int mappedSegments;
+static SegmentRef *segmentTable = NULL;
+static size_t segmentTableLen;
+static size_t segmentTableCapacity;
+
+static LogEntry queue[MSGLOG_QUEUE_SIZE];
+static unsigned int queueHead;
+static unsigned int queueLen;
+
+static uint64_t nextSeq; // Naechste zu vergebende Nummer (Broadcast Agent)
+static uint64_t written; // Alle Nummern darunter liegen im Segment
+
+static unsigned long statDropped;
+static unsigned long statReplays;
+static unsigned long statReplayedFrames;
+
+static void segment_path(char *buf, const size_t size, const unsigned long index) {
+    snprintf(buf, size, "%s/chat-%08lu.log", logDir, index);
+}
+
+static int offsets_push(Segment *seg, const uint32_t offset) {
+    if (seg->count == seg->capacity) {
+        const size_t capacity = seg->capacity ? seg->capacity * 2 : 1024;
+        uint32_t *grown = realloc(seg->offsets, capacity * sizeof(uint32_t));
+        if (grown == NULL) return -1;
+        seg->offsets = grown;
+        seg->capacity = capacity;
+    }
+    seg->offsets[seg->count++] = offset;
+    return 0;
+}
+
+static void segment_free(Segment *seg) {
+    munmap(seg->map, seg->size);
+    free(seg->offsets);
+    free(seg);
+}
+
+//--- Segment oeffnen bzw. anlegen und einblenden; bestehende Frames werden fuer den Index durchlaufen ---//
+static Segment *segment_open(const unsigned long index, const uint64_t baseSeq, const int create) {
+    char path[300];
+    segment_path(path, sizeof(path), index);
+
+    const int fd = open(path, create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, 0644);
+    if (fd == -1) {
+        errnoPrint("open %s", path);
+        return NULL;
+    }
+
+    size_t size = segmentSize;
+    if (create) {
+        if (ftruncate(fd, (off_t) size) == -1) {
+            errnoPrint("ftruncate %s", path);
+            close(fd);
+            return NULL;
+        }
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) == -1 || (size_t) st.st_size < SEGMENT_HEADER_SIZE) {
+            errorPrint("Invalid log segment %s", path);
+            close(fd);
+            return NULL;
+        }
+        size = (size_t) st.st_size;
+    }
+
+    unsigned char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); //- Die Abbildung bleibt auch ohne Descriptor bestehen -//
+    if (map == MAP_FAILED) {
+        errnoPrint("mmap %s", path);
+        return NULL;
+    }
+
+    Segment *seg = calloc(1, sizeof(Segment));
+    if (seg == NULL) {
+        munmap(map, size);
+        return NULL;
+    }
+    seg->index = index;
+    seg->map = map;
+    seg->size = size;
+    seg->used = SEGMENT_HEADER_SIZE;
+
+    SegmentHeader *hdr = (SegmentHeader *) map;
+    if (create) {
+        memcpy(hdr->magic, SEGMENT_MAGIC, 8);
+        hdr->baseSeq = baseSeq;
+        seg->baseSeq = baseSeq;
+        return seg;
+    }
+
+    if (memcmp(hdr->magic, SEGMENT_MAGIC, 8) != 0) {
+        errorPrint("Log segment %s has a wrong magic number", path);
+        segment_free(seg);
+        return NULL;
+    }
+    seg->baseSeq = hdr->baseSeq;
+
+    //- Frames sind selbstbeschreibend: Typ 0 (LoginRequest) kommt nie vor und markiert den freien Rest -//
+    while (seg->used + sizeof(Header) <= size) {
+        const Header *frameHdr = (const Header *) (map + seg->used);
+        const size_t frameLen = sizeof(Header) + ntohs(frameHdr->length);
+        if (frameHdr->type == 0 || seg->used + frameLen > size) break;
+        if (offsets_push(seg, (uint32_t) seg->used) == -1) break;
+        seg->used += frameLen;
+    }
+    return seg;
+}
+
+static void segment_table_push(const unsigned long index, const uint64_t baseSeq) {
+    if (segmentTableLen == segmentTableCapacity) {
+        const size_t capacity = segmentTableCapacity ? segmentTableCapacity * 2 : 64;
+        SegmentRef *grown = realloc(segmentTable, capacity * sizeof(SegmentRef));
+        if (grown == NULL) return;
+        segmentTable = grown;
+        segmentTableCapacity = capacity;
+    }
+    segmentTable[segmentTableLen++] = (SegmentRef) {index, baseSeq};
+}
+
+//--- Text eines ServerToClient Frames an den Suchindex geben ---//
+static void index_frame(const uint64_t seq, const unsigned char *frame) {
+    const Header *hdr = (const Header *) frame;
+    const size_t bodyLen = ntohs(hdr->length);
+    if (hdr->type != MT_SERVER_TO_CLIENT || bodyLen < 40) return;
+    searchIndexAdd(seq, (const char *) frame + sizeof(Header) + 40, bodyLen - 40);
+}
+
+//--- Neues Segment hinten anhaengen, ueberzaehlige alte ausblenden (Dateien bleiben als Protokoll erhalten) ---//
+static void segment_link(Segment *seg) {
+    if (newest == NULL) {
+        oldest = seg;
+    } else {
+        newest->next = seg;
+    }
+    newest = seg;
+    mappedSegments++;
+
+    while (mappedSegments > MSGLOG_MAPPED_SEGMENTS) {
+        Segment *old = oldest;
+        oldest = old->next;
+        mappedSegments--;
+        old->retired = 1;
+        if (old->refs == 0) segment_free(old);
+    }
+}
+
+//--- Schreiber Thread: kopiert die Frames in das eingeblendete Segment und rotiert bei Bedarf ---//
+static void *logWriter(void *arg) {
+    (void) arg;
+    debugPrint("Message log writer started");
+
+    while (1) {
+        pthread_mutex_lock(&logLock);
+        while (queueLen == 0) {
+            pthread_cond_wait(&queueCond, &logLock);
+        }
+        const LogEntry entry = queue[queueHead];
+        queueHead = (queueHead + 1) % MSGLOG_QUEUE_SIZE;
+        queueLen--;
+        Segment *seg = newest;
+        pthread_mutex_unlock(&logLock);
+
+        int oldState;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
+
+        const size_t len = entry.frame->len;
+        if (seg == NULL || seg->used + len > seg->size) {
+            //- Anlegen und Einblenden ohne Sperre, der Broadcast Agent soll nicht warten -//
+            Segment *fresh = segment_open(seg ? seg->index + 1 : 0, entry.seq, 1);
+            if (fresh == NULL) {
+                errorPrint("Message log rotation failed, message %ju not logged", (uintmax_t) entry.seq);
+                pthread_mutex_lock(&logLock);
+                statDropped++;
+                written = entry.seq + 1;
+                pthread_cond_broadcast(&writtenCond);
+                pthread_mutex_unlock(&logLock);
+                frameRelease(entry.frame);
+                pthread_setcancelstate(oldState, NULL);
+                continue;
+            }
+            pthread_mutex_lock(&logLock);
+            segment_link(fresh);
+            segment_table_push(fresh->index, fresh->baseSeq);
+            pthread_mutex_unlock(&logLock);
+            seg = fresh;
+        }
+
+        //- Leser sehen nur Bytes unterhalb von used, daher darf ausserhalb der Sperre kopiert werden -//
+        memcpy(seg->map + seg->used, entry.frame->data, len);
+
+        pthread_mutex_lock(&logLock);
+        offsets_push(seg, (uint32_t) seg->used);
+        seg->used += len;
+        written = entry.seq + 1;
+        pthread_cond_broadcast(&writtenCond);
+        pthread_mutex_unlock(&logLock);
+
+        //- Suchindex wird hier gepflegt, so kostet er die Verteilung nichts -//
+        index_frame(entry.seq, entry.frame->data);
+
+        frameRelease(entry.frame);
+        pthread_setcancelstate(oldState, NULL);
+    }
+    return NULL;
+}
+
+//--- Vorhandene Segmente suchen: das neueste wird fortgesetzt, die davor fuer Replay eingeblendet ---//
+static int load_existing(void) {
+    DIR *dir = opendir(logDir);
+    if (dir == NULL) {
+        errnoPrint("opendir %s", logDir);
+        return -1;
+    }
+
+    long last = -1;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        unsigned long index;
+        char tail;
+        if (sscanf(ent->d_name, "chat-%8lu.lo%c", &index, &tail) == 2 && tail == 'g' && (long) index > last) {
+            last = (long) index;
+        }
+    }
+    closedir(dir);
+
+    if (last < 0) return 0;
+
+    long first = last - MSGLOG_MAPPED_SEGMENTS + 1;
+    if (first < 0) first = 0;
+
+    //- Von den aelteren Dateien reicht der Kopf mit der ersten Nummer -//
+    for (long index = 0; index < first; index++) {
+        char path[300];
+        SegmentHeader hdr;
+        segment_path(path, sizeof(path), (unsigned long) index);
+        const int fd = open(path, O_RDONLY);
+        if (fd == -1) continue;
+        if (pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t) sizeof(hdr) && memcmp(hdr.magic, SEGMENT_MAGIC, 8) == 0) {
+            segment_table_push((unsigned long) index, hdr.baseSeq);
+        }
+        close(fd);
+    }
+
+    for (long index = first; index <= last; index++) {
+        Segment *seg = segment_open((unsigned long) index, 0, 0);
+        if (seg == NULL) continue;
+        segment_link(seg);
+        segment_table_push(seg->index, seg->baseSeq);
+
+        //- Eingeblendete Segmente sofort wieder durchsuchbar machen -//
+        for (size_t i = 0; i < seg->count; i++) {
+            index_frame(seg->baseSeq + i, seg->map + seg->offsets[i]);
+        }
+    }
+    if (newest != NULL) {
+        nextSeq = newest->baseSeq + newest->count;
+        written = nextSeq;
+        infoPrint("Message log resumed at segment %lu, %ju messages", newest->index, (uintmax_t) nextSeq);
+    }
+    return 0;
+}
+
+int msglogInit(const char *dir, const size_t size, const unsigned int historyCount) {
+    if (dir == NULL) return 0;
+
+    if (strlen(dir) >= sizeof(logDir)) {
+        errorPrint("Log directory path too long");
+        return -1;
+    }
+    strcpy(logDir, dir);
+    segmentSize = size < MSGLOG_MIN_SEGMENT ? MSGLOG_MIN_SEGMENT : size;
+    replayCount = historyCount;
+
+    if (mkdir(logDir, 0755) == -1 && errno != EEXIST) {
+        errnoPrint("mkdir %s", logDir);
+        return -1;
+    }
+    if (load_existing() == -1) return -1;
+
+    if (pthread_create(&threadId, NULL, logWriter, NULL) != 0) {
+        errnoPrint("Failed to start message log writer");
+        return -1;
+    }
+    enabled = 1;
+    return 0;
+}
+
+void msglogCleanup(void) {
+    if (!enabled) return;
+    pthread_cancel(threadId);
+    pthread_join(threadId, NULL);
+
+    while (queueLen > 0) {
+        frameRelease(queue[queueHead].frame);
+        queueHead = (queueHead + 1) % MSGLOG_QUEUE_SIZE;
+        queueLen--;
+    }
+    while (oldest != NULL) {
+        Segment *next = oldest->next;
+        msync(oldest->map, oldest->used, MS_ASYNC);
+        segment_free(oldest);
+        oldest = next;
+    }
+    newest = NULL;
+    free(segmentTable);
+    segmentTable = NULL;
+    segmentTableLen = 0;
+    segmentTableCapacity = 0;
+    enabled = 0;
+}
+
+int msglogEnabled(void) {
+    return enabled;
+}
+
+int64_t msglogAppend(Frame *frame) {
+    if (!enabled) return -1;
+
+    pthread_mutex_lock(&logLock);
+    if (queueLen == MSGLOG_QUEUE_SIZE) {
+        //- Schreiber kommt nicht hinterher: lieber nicht protokollieren als die Verteilung aufhalten -//
+        statDropped++;
+        pthread_mutex_unlock(&logLock);
+        return -1;
+    }
+    frameRetain(frame);
+    const uint64_t seq = nextSeq++;
+    queue[(queueHead + queueLen) % MSGLOG_QUEUE_SIZE] = (LogEntry) {frame, seq};
+    queueLen++;
+    pthread_cond_signal(&queueCond);
+    pthread_mutex_unlock(&logLock);
+    return (int64_t) seq;
+}
+
+//--- Wartet, bis der Schreiber alle vergebenen Nummern im Segment hat (Hot Restart) ---//
+void msglogFlush(void) {
+    if (!enabled) return;
+    pthread_mutex_lock(&logLock);
+    while (written < nextSeq) {
+        pthread_cond_wait(&writtenCond, &logLock);
+    }
+    pthread_mutex_unlock(&logLock);
+}
+
+uint64_t msglogNextSeq(void) {
+    pthread_mutex_lock(&logLock);
+    const uint64_t seq = nextSeq;
+    pthread_mutex_unlock(&logLock);
+    return seq;
+}
+
+//--- Verlauf fuer einen neuen User: ein iovec pro Segment, die Frames liegen dort schon fertig kodiert ---//
+int msglogReplay(const int fd, const uint64_t endSeq) {
+    if (!enabled || replayCount == 0 || endSeq == 0) return 0;
+
+    struct iovec iov[MSGLOG_MAPPED_SEGMENTS];
+    Segment *used[MSGLOG_MAPPED_SEGMENTS];
+    int iovCount = 0;
+    uint64_t startSeq = endSeq > replayCount ? endSeq - replayCount : 0;
+
+    pthread_mutex_lock(&logLock);
+
+    //- Warten bis der Schreiber alles bis endSeq im Segment hat (hoechstens eine Sekunde) -//
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    while (written < endSeq) {
+        if (pthread_cond_timedwait(&writtenCond, &logLock, &deadline) == ETIMEDOUT) break;
+    }
+    const uint64_t limit = written < endSeq ? written : endSeq;
+
+    for (Segment *seg = oldest; seg != NULL && iovCount < MSGLOG_MAPPED_SEGMENTS; seg = seg->next) {
+        const uint64_t segEnd = seg->baseSeq + seg->count;
+        if (segEnd <= startSeq || seg->baseSeq >= limit) continue;
+
+        const uint64_t from = startSeq > seg->baseSeq ? startSeq : seg->baseSeq;
+        const uint64_t to = limit < segEnd ? limit : segEnd;
+        const size_t begin = seg->offsets[from - seg->baseSeq];
+        const size_t end = to - seg->baseSeq < seg->count ? seg->offsets[to - seg->baseSeq] : seg->used;
+
+        iov[iovCount].iov_base = seg->map + begin;
+        iov[iovCount].iov_len = end - begin;
+        used[iovCount] = seg;
+        seg->refs++;
+        iovCount++;
+        statReplayedFrames += to - from;
+    }
+    statReplays++;
+    pthread_mutex_unlock(&logLock);
+
+    //- Ein writev fuer den ganzen Verlauf; nur bei Teilschreiben wird nachgelegt -//
+    int result = 0;
+    struct iovec *cur = iov;
+    int curCount = iovCount;
+    if (compressActive(fd)) {
+        //- Komprimierter Strom: alle Segmente hinein, ein Flush am Ende -//
+        for (int i = 0; i < iovCount && result == 0; i++) {
+            result = compressSend(fd, iov[i].iov_base, iov[i].iov_len, i == iovCount - 1);
+        }
+        curCount = 0;
+    }
+    while (curCount > 0) {
+        ssize_t res = writev(fd, cur, curCount);
+        if (res == -1) {
+            if (errno == EINTR) continue;
+            result = -1;
+            break;
+        }
+        while (curCount > 0 && (size_t) res >= cur->iov_len) {
+            res -= (ssize_t) cur->iov_len;
+            cur++;
+            curCount--;
+        }
+        if (curCount > 0) {
+            cur->iov_base = (char *) cur->iov_base + res;
+            cur->iov_len -= (size_t) res;
+        }
+    }
+
+    pthread_mutex_lock(&logLock);
+    for (int i = 0; i < iovCount; i++) {
+        if (--used[i]->refs == 0 && used[i]->retired) segment_free(used[i]);
+    }
+    pthread_mutex_unlock(&logLock);
+    return result;
+}
+
+static void frame_extract(const unsigned char *frame, char *sender, char *text, const size_t textSize,
+                          uint64_t *timestamp) {
+    const Header *hdr = (const Header *) frame;
+    const size_t bodyLen = ntohs(hdr->length);
+    size_t textLen = bodyLen >= 40 ? bodyLen - 40 : 0;
+    uint64_t ts;
+
+    memcpy(&ts, frame + sizeof(Header), 8);
+    *timestamp = ntoh64u(ts);
+    memcpy(sender, frame + sizeof(Header) + 8, 32);
+    sender[31] = '\0';
+    if (textLen >= textSize) textLen = textSize - 1;
+    memcpy(text, frame + sizeof(Header) + 40, textLen);
+    text[textLen] = '\0';
+}
+
+//--- Nachricht seq suchen: zuerst in den eingeblendeten Segmenten, sonst kurz die passende Datei einblenden ---//
+int msglogLookup(const uint64_t seq, char *sender, char *text, const size_t textSize, uint64_t *timestamp) {
+    if (!enabled) return -1;
+
+    pthread_mutex_lock(&logLock);
+    for (Segment *seg = oldest; seg != NULL; seg = seg->next) {
+        if (seq >= seg->baseSeq && seq < seg->baseSeq + seg->count) {
+            frame_extract(seg->map + seg->offsets[seq - seg->baseSeq], sender, text, textSize, timestamp);
+            pthread_mutex_unlock(&logLock);
+            return 0;
+        }
+    }
+    long found = -1;
+    for (size_t i = 0; i < segmentTableLen; i++) {
+        if (segmentTable[i].baseSeq <= seq) found = (long) i;
+    }
+    const SegmentRef ref = found >= 0 ? segmentTable[found] : (SegmentRef) {0, 0};
+    pthread_mutex_unlock(&logLock);
+    if (found < 0) return -1;
+
+    char path[300];
+    struct stat st;
+    segment_path(path, sizeof(path), ref.index);
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    const size_t size = (size_t) st.st_size;
+    unsigned char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    int result = -1;
+    size_t pos = SEGMENT_HEADER_SIZE;
+    uint64_t cur = ref.baseSeq;
+    while (pos + sizeof(Header) <= size) {
+        const Header *hdr = (const Header *) (map + pos);
+        const size_t frameLen = sizeof(Header) + ntohs(hdr->length);
+        if (hdr->type == 0 || pos + frameLen > size) break;
+        if (cur == seq) {
+            frame_extract(map + pos, sender, text, textSize, timestamp);
+            result = 0;
+            break;
+        }
+        pos += frameLen;
+        cur++;
+    }
+    munmap(map, size);
+    return result;
+}
+
+void msglogStatsFormat(char *buf, const size_t size) {
+    if (!enabled) {
+        snprintf(buf, size, "log: disabled");
+        return;
+    }
+    pthread_mutex_lock(&logLock);
+    snprintf(buf, size, "log: messages=%ju written=%ju queued=%u dropped=%lu segment=%lu mapped=%u replays=%lu replayed=%lu",
+             (uintmax_t) nextSeq, (uintmax_t) written, queueLen, statDropped,
+             newest ? newest->index : 0UL, mappedSegments, statReplays, statReplayedFrames);
+    pthread_mutex_unlock(&logLock);
+}
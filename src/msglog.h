@@ -0,0 +1,31 @@
+#ifndef MSGLOG_H
+#define MSGLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "network.h"
+
+int msglogInit(const char *dir, size_t segmentSize, unsigned int historyCount);
+
+void msglogCleanup(void);
+
+int msglogEnabled(void);
+
+// Vom Broadcast Agent vor der Verteilung aufgerufen; blockiert nie, liefert die vergebene Nummer oder -1
+int64_t msglogAppend(Frame *frame);
+
+void msglogFlush(void);
+
+// Alle Nachrichten mit kleinerer Nummer wurden vor diesem Zeitpunkt verteilt
+uint64_t msglogNextSeq(void);
+
+// Sendet die letzten Nachrichten vor endSeq mit einem einzigen writev
+int msglogReplay(int fd, uint64_t endSeq);
+
+// Absender (32 Byte), Text und Zeitstempel einer protokollierten Nachricht
+int msglogLookup(uint64_t seq, char *sender, char *text, size_t textSize, uint64_t *timestamp);
+
+void msglogStatsFormat(char *buf, size_t size);
+
+#endif
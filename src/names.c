@@ -0,0 +1,116 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "names.h"
+#include "lockprof.h"
+
+//- Tabelle der Namen, Index = ID; freigegebene IDs werden zuerst wiederverwendet -//
+typedef struct {
+    char name[32];
+    unsigned int refs;
+} NameEntry;
+
+static pthread_mutex_t nameLock = PTHREAD_MUTEX_INITIALIZER;
+static NameEntry *table;
+static uint32_t tableSize; // Hoechste je vergebene ID + 1
+static uint32_t tableCapacity;
+static uint32_t *freeIds;
+static uint32_t freeCount;
+static uint32_t liveCount;
+
+//- Generationen in Seiten, die nie verschoben werden: der Broadcast Agent liest sie ohne nameLock -//
+#define GENERATION_PAGE_BITS 16
+#define GENERATION_PAGE_SIZE (1u << GENERATION_PAGE_BITS)
+#define GENERATION_PAGES 1024 // 64M IDs
+static uint32_t *generations[GENERATION_PAGES];
+
+uint32_t nameIntern(const char *name) {
+    uint32_t id = NAME_ID_NONE;
+
+    lockprofAcquire(&nameLock, &lockStatsName);
+    if (freeCount > 0) {
+        id = freeIds[--freeCount];
+    } else {
+        if ((tableSize >> GENERATION_PAGE_BITS) >= GENERATION_PAGES) {
+            pthread_mutex_unlock(&nameLock);
+            return NAME_ID_NONE;
+        }
+        uint32_t **page = &generations[tableSize >> GENERATION_PAGE_BITS];
+        if (*page == NULL) {
+            uint32_t *fresh = calloc(GENERATION_PAGE_SIZE, sizeof(uint32_t));
+            if (fresh == NULL) {
+                pthread_mutex_unlock(&nameLock);
+                return NAME_ID_NONE;
+            }
+            __atomic_store_n(page, fresh, __ATOMIC_RELEASE);
+        }
+        if (tableSize == tableCapacity) {
+            const uint32_t capacity = tableCapacity ? tableCapacity * 2 : 256;
+            NameEntry *grown = realloc(table, capacity * sizeof(NameEntry));
+            uint32_t *grownFree = grown ? realloc(freeIds, capacity * sizeof(uint32_t)) : NULL;
+            if (grown != NULL) table = grown;
+            if (grownFree == NULL) {
+                pthread_mutex_unlock(&nameLock);
+                return NAME_ID_NONE;
+            }
+            freeIds = grownFree;
+            tableCapacity = capacity;
+        }
+        id = tableSize++;
+    }
+
+    memset(table[id].name, 0, sizeof(table[id].name));
+    strncpy(table[id].name, name, 31);
+    table[id].refs = 1;
+    uint32_t *generation = &generations[id >> GENERATION_PAGE_BITS][id & (GENERATION_PAGE_SIZE - 1)];
+    __atomic_store_n(generation, *generation + 1, __ATOMIC_RELEASE); //- Alte Bits in Ignorierlisten veralten -//
+    liveCount++;
+    pthread_mutex_unlock(&nameLock);
+    return id;
+}
+
+void nameRetain(const uint32_t id) {
+    if (id == NAME_ID_NONE) return;
+    lockprofAcquire(&nameLock, &lockStatsName);
+    table[id].refs++;
+    pthread_mutex_unlock(&nameLock);
+}
+
+void nameRelease(const uint32_t id) {
+    if (id == NAME_ID_NONE) return;
+
+    lockprofAcquire(&nameLock, &lockStatsName);
+    const unsigned int refs = --table[id].refs;
+    pthread_mutex_unlock(&nameLock);
+    if (refs > 0) return;
+
+    //- Ignorierlisten bleiben unberuehrt: die naechste Vergabe erhoeht die Generation, alte Bits gelten dann nicht -//
+    lockprofAcquire(&nameLock, &lockStatsName);
+    freeIds[freeCount++] = id; //- Platz ist da: freeIds waechst mit der Tabelle -//
+    liveCount--;
+    pthread_mutex_unlock(&nameLock);
+}
+
+uint32_t nameGeneration(const uint32_t id) {
+    const uint32_t *page = __atomic_load_n(&generations[id >> GENERATION_PAGE_BITS], __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&page[id & (GENERATION_PAGE_SIZE - 1)], __ATOMIC_ACQUIRE);
+}
+
+size_t nameCopy(const uint32_t id, char *name) {
+    if (id == NAME_ID_NONE) {
+        name[0] = '\0';
+        return 0;
+    }
+    lockprofAcquire(&nameLock, &lockStatsName);
+    strcpy(name, table[id].name);
+    pthread_mutex_unlock(&nameLock);
+    return strlen(name);
+}
+
+void nameStatsFormat(char *buf, const size_t size) {
+    lockprofAcquire(&nameLock, &lockStatsName);
+    snprintf(buf, size, "names: live=%u ids=%u free=%u", liveCount, tableSize, freeCount);
+    pthread_mutex_unlock(&nameLock);
+}
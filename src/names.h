@@ -0,0 +1,25 @@
+#ifndef NAMES_H
+#define NAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NAME_ID_NONE UINT32_MAX // Servernachricht, kein Name
+
+// Vergibt eine neue, dichte ID mit einer Referenz (die des Users); NAME_ID_NONE wenn kein Speicher
+uint32_t nameIntern(const char *name);
+
+// Jede Nachricht in der Broadcast Queue haelt eine Referenz, die ID wird erst danach wiederverwendet
+void nameRetain(uint32_t id);
+
+void nameRelease(uint32_t id);
+
+// Zaehlt bei jeder Vergabe der ID hoch; ohne Sperre lesbar (Ignorierlisten, siehe user_ignores)
+uint32_t nameGeneration(uint32_t id);
+
+// Kopiert den Namen (nullterminiert, max 31 Zeichen) und liefert seine Laenge
+size_t nameCopy(uint32_t id, char *name);
+
+void nameStatsFormat(char *buf, size_t size);
+
+#endif
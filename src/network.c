@@ -1,14 +1,16 @@
 #include <stddef.h>
+#include <stdlib.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include "network.h"
 #include <string.h>
+#include "compress.h"
 #include "util.h"
 #define SERVER_NAME "ChatServer-GROUP27"
 
 //--- Sicherstellen das alle Bytes gesendet werden ---//
-static int sendAll(int fd, const void *data, size_t len) {
+int networkSendRaw(int fd, const void *data, size_t len) {
     size_t sent = 0;
     const char *p = (const char *) data;
     while (sent < len) {
@@ -19,6 +21,90 @@ static int sendAll(int fd, const void *data, size_t len) {
     return 0;
 }
 
+//- Verbindungen mit komprimiertem Strom (compress.h) bekommen jeden Aufruf als eigenen Flush -//
+static int sendAll(int fd, const void *data, size_t len) {
+    if (compressActive(fd)) return compressSend(fd, data, len, 1);
+    return networkSendRaw(fd, data, len);
+}
+
+//- Header und Body in einem Puffer: ein send, und mit Kompression ein Flush statt vier -//
+static int sendPacket(int fd, const Header *hdr, const void *body, size_t bodyLen) {
+    unsigned char packet[sizeof(Header) + sizeof(Server2ClientBody)];
+    memcpy(packet, hdr, sizeof(Header));
+    memcpy(packet + sizeof(Header), body, bodyLen);
+    return sendAll(fd, packet, sizeof(Header) + bodyLen);
+}
+
+//--- Kodiert eine Nachricht aus der Broadcast Queue genau einmal ins Wire Format; name gehoert zu msg->userId ---//
+Frame *frameEncode(const InternalMessage *msg, const char *name) {
+    Header hdr;
+    size_t bodyLen;
+    const size_t nameLen = strnlen(name, 31);
+
+    hdr.type = msg->type;
+    switch (msg->type) {
+        case MT_SERVER_TO_CLIENT:
+            bodyLen = 8 + 32 + strnlen(msg->text, 512);
+            break;
+        case MT_USER_ADDED:
+            bodyLen = 8 + nameLen;
+            break;
+        case MT_USER_REMOVED:
+            bodyLen = 8 + 1 + nameLen;
+            break;
+        default:
+            return NULL;
+    }
+    hdr.length = htons((uint16_t) bodyLen);
+
+    Frame *frame = malloc(sizeof(Frame) + sizeof(Header) + bodyLen);
+    if (frame == NULL) return NULL;
+    frame->refs = 1;
+    frame->len = sizeof(Header) + bodyLen;
+
+    unsigned char *p = frame->data;
+    memcpy(p, &hdr, sizeof(Header));
+    p += sizeof(Header);
+
+    //- Alle Typen beginnen mit dem Timestamp(8) -//
+    const uint64_t timestamp = hton64u(msg->timestamp);
+    memcpy(p, &timestamp, 8);
+
+    switch (msg->type) {
+        case MT_SERVER_TO_CLIENT:
+            //- RFC: Timestamp(8) + OriginalSender(32) + Text(var) -//
+            memset(p + 8, 0, 32);
+            memcpy(p + 8, name, nameLen);
+            memcpy(p + 40, msg->text, bodyLen - 40);
+            break;
+        case MT_USER_ADDED:
+            //- RFC: Timestamp(8) + Name(var) -//
+            memcpy(p + 8, name, nameLen);
+            break;
+        default:
+            //- RFC: Timestamp(8) + Code(1) + Name(var) -//
+            p[8] = msg->code;
+            memcpy(p + 9, name, nameLen);
+            break;
+    }
+    return frame;
+}
+
+void frameRetain(Frame *frame) {
+    __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+}
+
+void frameRelease(Frame *frame) {
+    if (frame != NULL && __atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(frame);
+    }
+}
+
+//- Ein einziger send statt Header und Felder einzeln -//
+int sendFrame(int fd, const Frame *frame) {
+    return sendAll(fd, frame->data, frame->len);
+}
+
 //--- Sicherstellen das alle Bytes empfangen wurden ---//
 int networkReceive(int fd, void *buffer, size_t size) {
     size_t read_total = 0;
@@ -32,14 +118,14 @@ int networkReceive(int fd, void *buffer, size_t size) {
 }
 
 //--- Funktionen für verschiedene Message Typen ---//
-int sendLoginResponse(int fd, uint8_t code) {
+int sendLoginResponse(int fd, uint8_t code, int compressed) {
     //- Ein Body wird zusammengebaut aufgrund des RFC-Protokolls -//
     //- RFC: Header + Magic(4) + Code(1) + ServerName(var) -//
     Header hdr;
     LoginResponseBody body;
 
     hdr.type = MT_LOGIN_RESPONSE;
-    body.magic = htonl(MAGIC_RESPONSE);
+    body.magic = htonl(compressed ? MAGIC_RESPONSE_COMPRESSED : MAGIC_RESPONSE); //- Bestaetigt PROT_FLAG_COMPRESS -//
     body.code = code;
     memset(body.server_name, 0, sizeof(body.server_name));
     strncpy(body.server_name, SERVER_NAME, 31);
@@ -50,10 +136,10 @@ int sendLoginResponse(int fd, uint8_t code) {
     uint16_t total_len = 4 + 1 + name_len;
     hdr.length = htons(total_len);
 
-    //- Header, Body und Servernamen nacheinander senden -//
-    if (sendAll(fd, &hdr, sizeof(hdr)) == -1) return -1;
-    if (sendAll(fd, &body, 5) == -1) return -1; //Body = Magic + Code
-    if (sendAll(fd, body.server_name, name_len) == -1) return -1;
+    //- Header, Body und Servernamen nacheinander senden; die Antwort selbst ist nie komprimiert -//
+    if (networkSendRaw(fd, &hdr, sizeof(hdr)) == -1) return -1;
+    if (networkSendRaw(fd, &body, 5) == -1) return -1; //Body = Magic + Code
+    if (networkSendRaw(fd, body.server_name, name_len) == -1) return -1;
 
     return 0;
 }
@@ -74,13 +160,8 @@ int sendServer2Client(int fd, const char *sender, const char *text, uint64_t tim
     uint16_t total_len = 8 + 32 + text_len;
     hdr.length = htons(total_len);
 
-    //- Header, Timestamp, Sender und Text nacheinander senden -//
-    if (sendAll(fd, &hdr, sizeof(hdr)) == -1) return -1;
-    if (sendAll(fd, &body.timestamp, 8) == -1) return -1;
-    if (sendAll(fd, body.original_sender, 32) == -1) return -1;
-    if (sendAll(fd, body.text, text_len) == -1) return -1;
-
-    return 0;
+    //- Header, Timestamp, Sender und Text; der Body ist packed und liegt schon in Wire Reihenfolge -//
+    return sendPacket(fd, &hdr, &body, total_len);
 }
 
 
@@ -98,12 +179,8 @@ int sendUserAdded(int fd, const char *name, uint64_t timestamp) {
     uint16_t name_len = strnlen(body.name, 31);
     hdr.length = htons(8 + name_len);
 
-    //- Header, Timestamp und Name senden -//
-    if (sendAll(fd, &hdr, sizeof(hdr)) == -1) return -1;
-    if (sendAll(fd, &body.timestamp, 8) == -1) return -1;
-    if (sendAll(fd, body.name, name_len) == -1) return -1;
-
-    return 0;
+    //- Header, Timestamp und Name -//
+    return sendPacket(fd, &hdr, &body, 8 + name_len);
 }
 
 int sendUserRemoved(int fd, const char *name, uint8_t code, uint64_t timestamp) {
@@ -121,11 +198,19 @@ int sendUserRemoved(int fd, const char *name, uint8_t code, uint64_t timestamp)
     uint16_t name_len = strnlen(body.name, 31);
     hdr.length = htons(8 + 1 + name_len);
 
-    //- Header, Timestamp, Code und Name senden -//
-    if (sendAll(fd, &hdr, sizeof(hdr)) == -1) return -1;
-    if (sendAll(fd, &body.timestamp, 8) == -1) return -1;
-    if (sendAll(fd, &body.code, 1) == -1) return -1;
-    if (sendAll(fd, body.name, name_len) == -1) return -1;
+    //- Header, Timestamp, Code und Name -//
+    return sendPacket(fd, &hdr, &body, 8 + 1 + name_len);
+}
 
-    return 0;
+int sendSession(int fd, const unsigned char *token, uint64_t seq) {
+    //- Header + Token(16) + Nummer(8) -//
+    SessionBody body;
+    Header hdr;
+
+    hdr.type = MT_SESSION;
+    hdr.length = htons(sizeof(body));
+    memcpy(body.token, token, sizeof(body.token));
+    body.seq = hton64u(seq);
+
+    return sendPacket(fd, &hdr, &body, sizeof(body));
 }
@@ -1,13 +1,21 @@
 #ifndef CHAT_PROTOCOL_H
 #define CHAT_PROTOCOL_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 // Constants & Magic Numbers out of RFC
 // Dienen der Indentifikation eines Nachrichten Pakets
 #define MAGIC_REQUEST  0x0badf00d //Anfang Login Requests
 #define MAGIC_RESPONSE 0xc001c001 //Anfang Login Response
-#define PROT_VERSION   0 // Protokoll Version 0
+#define MAGIC_RESPONSE_COMPRESSED 0xc001c0de // Login Response: ab dem naechsten Byte kommt ein raw deflate Strom
+#define PROT_VERSION   1 // Hoechste unterstuetzte Version; Clients mit Version 0 bleiben gueltig
+#define PROT_VERSION_BATCH 1 // Ab hier: Batch Frames in beide Richtungen
+#define PROT_FLAG_COMPRESS 0x80 // Bit in LoginRequest.version: Client moechte Server->Client komprimiert
+#define PROT_FLAG_FIREHOSE 0x40 // Bit in LoginRequest.version: Firehose Abo statt Chat (firehose.h)
+#define PROT_FLAG_SESSION 0x20 // Bit in LoginRequest.version: fortsetzbare Sitzung (session.h), nur Version 1
+#define PROT_FLAGS (PROT_FLAG_COMPRESS | PROT_FLAG_FIREHOSE | PROT_FLAG_SESSION) // Bits, die keine Version sind
+#define BATCH_MAX_BYTES (256 * 1024) // Groesster Batch, den ein Client schicken darf
 
 // Message Types
 enum MessageType {
@@ -16,7 +24,12 @@ enum MessageType {
     MT_CLIENT_TO_SERVER = 2,
     MT_SERVER_TO_CLIENT = 3,
     MT_USER_ADDED = 4,
-    MT_USER_REMOVED = 5
+    MT_USER_REMOVED = 5,
+    MT_BATCH = 6, // Nur Version 1: BatchHeader, danach gewoehnliche Frames (Header + Body) hintereinander
+    MT_FIREHOSE = 7, // Nur Firehose: Abo Frame vom Client, Bloecke vom Server (FirehoseHeader)
+    MT_SESSION = 8, // Nur mit PROT_FLAG_SESSION: Token und Nummer nach der LoginResponse (SessionBody)
+    MT_SEQUENCE = 9, // Nur mit PROT_FLAG_SESSION: letzter Eintrag eines Containers, uint64_t naechste Nummer
+    MT_FENCE = 255 // Nur intern: Broadcast Agent meldet, dass alles davor verteilt ist
 };
 
 // Failure Codes for Login Response
@@ -34,18 +47,38 @@ typedef struct __attribute__((packed)) {
     uint16_t length;
 } Header;
 
+//- Container fuer mehrere Frames; ersetzt den Header, die Laenge zaehlt nur die enthaltenen Frames -//
+typedef struct __attribute__((packed)) {
+    uint8_t type; // MT_BATCH
+    uint32_t length;
+} BatchHeader;
+
 typedef struct __attribute__((packed)) {
     uint32_t magic;
     uint8_t version;
     char name[32];
 } LoginRequestBody;
 
+//- Wiederaufnahme: Name mit fester Laenge, danach Token und Nummer aus dem letzten MT_SESSION bzw. MT_SEQUENCE -//
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t version; // Mit PROT_FLAG_SESSION
+    char name[32];
+    unsigned char token[16];
+    uint64_t seq;
+} LoginResumeBody;
+
 typedef struct __attribute__((packed)) {
     uint32_t magic;
     uint8_t code;
     char server_name[32];
 } LoginResponseBody;
 
+typedef struct __attribute__((packed)) {
+    unsigned char token[16];
+    uint64_t seq; // Ab hier fehlt dem Client noch alles
+} SessionBody;
+
 typedef struct __attribute__((packed)) {
     uint64_t timestamp;
     char original_sender[32];
@@ -63,20 +96,43 @@ typedef struct __attribute__((packed)) {
     char name[32];
 } UserRemovedBody;
 
-// Container for internal Broadcast Queue
+// Container for internal Broadcast Queue; Namen nur als ID (names.h), erst frameEncode setzt sie ein
 typedef struct {
     uint8_t type;
-
-    union {
-        Server2ClientBody s2c;
-        UserAddedBody uad;
-        UserRemovedBody urm;
-    } data;
+    uint8_t code; // Nur MT_USER_REMOVED
+    uint8_t releaseName; // Nur MT_USER_REMOVED der Abmeldung: erst danach wird der Name im Worker Register frei
+    int32_t room; // Zielraum oder ROOM_ALL (room.h)
+    uint32_t userId; // Absender (MT_SERVER_TO_CLIENT) bzw. betroffener User; NAME_ID_NONE bei Servernachrichten
+    uint8_t via; // 0 = lokal, VIA_WORKERS (workers.h) oder Index + 1 des Federation Links, ueber den sie kam
+    uint32_t origin; // Knoten, auf dem die Nachricht entstand (0 = dieser)
+    uint64_t originSeq; // Laufende Nummer dort fuer Chat und Praesenz; 0 = ohne (zB Abmeldung nach Linkverlust)
+    uint64_t timestamp;
+    uint64_t traceReceived; // Nur mit --trace: Zeitstempel der Stufen vor der Queue (trace.h)
+    uint64_t traceEnqueued;
+    char text[512]; // Nur MT_SERVER_TO_CLIENT
 } InternalMessage;
 
+// Fertig kodiertes Paket (Header + Body), wird vom Broadcast Agent einmal gebaut und von allen Empfaengern geteilt
+typedef struct {
+    unsigned int refs;
+    size_t len;
+    unsigned char data[];
+} Frame;
+
+Frame *frameEncode(const InternalMessage *msg, const char *name);
+
+void frameRetain(Frame *frame);
+
+void frameRelease(Frame *frame);
+
+int sendFrame(int fd, const Frame *frame);
+
 int networkReceive(int fd, void *buffer, size_t size);
 
-int sendLoginResponse(int fd, uint8_t code);
+// Ohne Kompression, fuer compress.c und die Login Response
+int networkSendRaw(int fd, const void *data, size_t len);
+
+int sendLoginResponse(int fd, uint8_t code, int compressed);
 
 int sendServer2Client(int fd, const char *sender, const char *text, uint64_t timestamp);
 
@@ -84,4 +140,6 @@ int sendUserAdded(int fd, const char *name, uint64_t timestamp);
 
 int sendUserRemoved(int fd, const char *name, uint8_t code, uint64_t timestamp);
 
+int sendSession(int fd, const unsigned char *token, uint64_t seq);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "overload.h"
+#include "broadcastagent.h"
+
+#define THROTTLE_RECHECK_MS 1000 // Rueckfallebene, falls kein Fan-out mehr weckt
+#define QUEUE_HOLD_NS (100 * 1000000ULL) // So lange muss die Queue ueber der Schwelle bleiben
+
+static unsigned int queueHigh = OVERLOAD_DEFAULT_QUEUE;
+static uint64_t lagHighNs = OVERLOAD_DEFAULT_LAG_MS * 1000000ULL;
+
+static int overloaded;
+static uint64_t enteredAt;
+static uint64_t queueHighSince; // Erste Messung ueber der Schwelle, 0 = zuletzt darunter
+static pthread_mutex_t waitLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t waitCond = PTHREAD_COND_INITIALIZER; // Alle gedrosselten Leser, geweckt beim Verlassen
+
+static uint64_t statEpisodes;
+static uint64_t statOverloadedNs; // Abgeschlossene Episoden
+static uint64_t statReadWaits;
+static uint64_t statReadWaitNs;
+static uint64_t statLoginsShed;
+static uint64_t statQueueWaits;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+void overloadSetQueue(const unsigned int depth) {
+    queueHigh = depth;
+}
+
+void overloadSetLag(const unsigned int ms) {
+    lagHighNs = (uint64_t) ms * 1000000ULL;
+}
+
+int overloadEnabled(void) {
+    return queueHigh > 0 || lagHighNs > 0;
+}
+
+int overloadSample(void) {
+    if (!overloadEnabled()) return 0;
+    const size_t depth = broadcastQueueDepth();
+    const uint64_t lag = broadcastLagNs();
+    const int state = __atomic_load_n(&overloaded, __ATOMIC_ACQUIRE);
+
+    //- Eine kurz volle Queue ist unter Last normal und macht die Batches des Agents gross; erst eine dauerhaft -//
+    //- volle zaehlt, sonst drosselt der Schutz genau das Buendeln, das den Durchsatz bringt -//
+    int queueFull = 0;
+    if (queueHigh > 0 && depth >= queueHigh) {
+        const uint64_t now = now_ns();
+        uint64_t since = __atomic_load_n(&queueHighSince, __ATOMIC_RELAXED);
+        if (since == 0) {
+            __atomic_compare_exchange_n(&queueHighSince, &since, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        } else {
+            queueFull = now - since >= QUEUE_HOLD_NS;
+        }
+    } else if (__atomic_load_n(&queueHighSince, __ATOMIC_RELAXED) != 0) {
+        __atomic_store_n(&queueHighSince, 0, __ATOMIC_RELAXED);
+    }
+
+    //- Hysterese: rein ueber der Schwelle, raus erst unter der Haelfte, sonst flattert der Zustand -//
+    if (!state) {
+        if (!queueFull && (lagHighNs == 0 || lag < lagHighNs)) return 0;
+        pthread_mutex_lock(&waitLock);
+        if (!overloaded) {
+            enteredAt = now_ns();
+            statEpisodes++;
+            __atomic_store_n(&overloaded, 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&waitLock);
+        return 1;
+    }
+    if ((queueHigh > 0 && depth > queueHigh / 2) || (lagHighNs > 0 && lag > lagHighNs / 2)) return 1;
+    pthread_mutex_lock(&waitLock);
+    if (overloaded) {
+        statOverloadedNs += now_ns() - enteredAt;
+        __atomic_store_n(&overloaded, 0, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&waitCond);
+    }
+    pthread_mutex_unlock(&waitLock);
+    return 0;
+}
+
+void overloadThrottle(void) {
+    if (!overloadSample()) return;
+
+    const uint64_t start = now_ns();
+    pthread_mutex_lock(&waitLock);
+    statReadWaits++;
+    while (overloaded) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += THROTTLE_RECHECK_MS / 1000;
+        if (pthread_cond_timedwait(&waitCond, &waitLock, &deadline) != 0) {
+            //- Niemand hat geweckt: selbst nachsehen, etwa wenn der Agent nichts mehr zu tun hatte -//
+            pthread_mutex_unlock(&waitLock);
+            overloadSample();
+            pthread_mutex_lock(&waitLock);
+        }
+    }
+    statReadWaitNs += now_ns() - start;
+    pthread_mutex_unlock(&waitLock);
+}
+
+int overloadShedLogin(void) {
+    if (!overloadSample()) return 0;
+    __atomic_add_fetch(&statLoginsShed, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+void overloadQueueWaited(void) {
+    __atomic_add_fetch(&statQueueWaits, 1, __ATOMIC_RELAXED);
+}
+
+void overloadStatsFormat(char *buf, const size_t size) {
+    if (!overloadEnabled()) {
+        snprintf(buf, size, "overload: off");
+        return;
+    }
+    pthread_mutex_lock(&waitLock);
+    const int state = overloaded;
+    const uint64_t total = statOverloadedNs + (state ? now_ns() - enteredAt : 0);
+    const uint64_t episodes = statEpisodes;
+    const uint64_t readWaits = statReadWaits;
+    const uint64_t readWaitNs = statReadWaitNs;
+    pthread_mutex_unlock(&waitLock);
+
+    snprintf(buf, size, "overload: state=%s queue=%zu/%u lag=%.1f/%jums episodes=%ju overloaded=%.1fs "
+             "read_waits=%ju waited=%.1fs logins_shed=%ju queue_waits=%ju",
+             state ? "overloaded" : "normal", broadcastQueueDepth(), queueHigh, (double) broadcastLagNs() / 1e6,
+             (uintmax_t) (lagHighNs / 1000000ULL), (uintmax_t) episodes, (double) total / 1e9, (uintmax_t) readWaits,
+             (double) readWaitNs / 1e9, (uintmax_t) __atomic_load_n(&statLoginsShed, __ATOMIC_RELAXED),
+             (uintmax_t) __atomic_load_n(&statQueueWaits, __ATOMIC_RELAXED));
+}
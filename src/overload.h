@@ -0,0 +1,33 @@
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <stddef.h>
+
+#define OVERLOAD_DEFAULT_QUEUE 8 // Von 10 Plaetzen der Broadcast Queue
+#define OVERLOAD_DEFAULT_LAG_MS 250 // Alter des aeltesten Eintrags im laufenden Fan-out
+
+// Ueberlastschutz fuer den Broadcast Pfad: bewertet Fuellstand der Queue und Verzug des Fan-outs.
+// Ueberlastet lesen die Client Threads keine weiteren Frames (die Clients merken es am TCP Fenster), neue Logins
+// bekommen LC_ERROR und volle Queues werden abgewartet statt verworfen. Verlassen wird der Zustand erst, wenn beide
+// Werte unter die Haelfte ihrer Schwelle fallen. Beide Schwellen 0 = aus.
+void overloadSetQueue(unsigned int depth);
+
+void overloadSetLag(unsigned int ms);
+
+int overloadEnabled(void);
+
+// Neu bewerten: Client Threads vor dem Lesen, der Broadcast Agent nach jedem Fan-out; 1 = ueberlastet
+int overloadSample(void);
+
+// Client Thread vor dem naechsten Frame: wartet, bis die Ueberlast vorbei ist
+void overloadThrottle(void);
+
+// Login Stufe: 1 = ablehnen (zaehlt mit)
+int overloadShedLogin(void);
+
+// broadcastQueueSend: eine Sekunde volle Queue abgewartet statt verworfen
+void overloadQueueWaited(void);
+
+void overloadStatsFormat(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,193 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "room.h"
+#include "lockprof.h"
+#include "msglog.h"
+#include "util.h"
+#include "validate.h"
+
+//- Mitglieder liegen als zusammenhaengendes Array vor, die Verteilung laeuft nur ueber den eigenen Raum -//
+typedef struct {
+    char name[32];
+    int active;
+    User **members;
+    size_t count;
+    size_t capacity;
+} Room;
+
+static pthread_mutex_t roomLock = PTHREAD_MUTEX_INITIALIZER;
+static Room rooms[ROOM_MAX] = {[ROOM_LOBBY] = {.name = "lobby", .active = 1}};
+static unsigned int activeRooms = 1;
+
+static int room_append(Room *room, User *user) {
+    if (room->count == room->capacity) {
+        const size_t capacity = room->capacity ? room->capacity * 2 : 16;
+        User **grown = realloc(room->members, capacity * sizeof(User *));
+        if (grown == NULL) return -1;
+        room->members = grown;
+        room->capacity = capacity;
+    }
+    room->members[room->count++] = user;
+    return 0;
+}
+
+//--- Platz mit dem letzten Mitglied fuellen, so bleibt das Array lueckenlos und das Entfernen O(1) ---//
+static void room_detach(const int id, const size_t slot) {
+    Room *room = &rooms[id];
+    User *last = room->members[--room->count];
+    room->members[slot] = last;
+    last->roomSlot = slot;
+
+    //- Leere Raeume (ausser der Lobby) werden aufgeloest -//
+    if (room->count == 0 && id != ROOM_LOBBY) {
+        free(room->members);
+        memset(room, 0, sizeof(Room));
+        activeRooms--;
+    }
+}
+
+//--- Haelt roomLock: Namen kopieren, damit ein langsamer Empfaenger den Lock nicht haelt ---//
+static int copy_members(const Room *room, const User *skip, RoomNames *out) {
+    out->names = NULL;
+    out->count = 0;
+    if (room->count == 0) return 0;
+    out->names = malloc(room->count * sizeof(*out->names));
+    if (out->names == NULL) return -1;
+    for (size_t i = 0; i < room->count; i++) {
+        if (room->members[i] != skip) memcpy(out->names[out->count++], room->members[i]->name, 32);
+    }
+    return 0;
+}
+
+void room_names_free(RoomNames *names) {
+    free(names->names);
+    names->names = NULL;
+    names->count = 0;
+}
+
+//--- User in einen Raum verschieben (wird bei Bedarf angelegt); liefert die Raumnummer oder -1 ---//
+int room_join(User *user, const char *name, RoomNames *oldMembers, RoomNames *newMembers) {
+    const size_t len = strlen(name);
+    if (oldMembers != NULL) *oldMembers = (RoomNames) {0};
+    if (newMembers != NULL) *newMembers = (RoomNames) {0};
+    if (len == 0 || len > 31 || validateName(name, len) != len) return -1;
+
+    lockprofAcquire(&roomLock, &lockStatsRoom);
+
+    int id = -1;
+    int freeId = -1;
+    for (int i = 0; i < ROOM_MAX; i++) {
+        if (rooms[i].active && strcmp(rooms[i].name, name) == 0) {
+            id = i;
+            break;
+        }
+        if (!rooms[i].active && freeId == -1) freeId = i;
+    }
+
+    if (id != -1 && id == user->room) {
+        pthread_mutex_unlock(&roomLock);
+        return id;
+    }
+    if (id == -1) {
+        if (freeId == -1) {
+            pthread_mutex_unlock(&roomLock);
+            return -1;
+        }
+        id = freeId;
+        strcpy(rooms[id].name, name);
+        rooms[id].active = 1;
+        activeRooms++;
+    }
+
+    RoomNames oldCopy = {0};
+    RoomNames newCopy = {0};
+    if ((oldMembers != NULL && user->room != ROOM_NONE && copy_members(&rooms[user->room], user, &oldCopy) == -1)
+        || (newMembers != NULL && copy_members(&rooms[id], user, &newCopy) == -1)
+        || room_append(&rooms[id], user) == -1) {
+        room_names_free(&oldCopy);
+        room_names_free(&newCopy);
+        if (rooms[id].count == 0 && id != ROOM_LOBBY) {
+            memset(&rooms[id], 0, sizeof(Room));
+            activeRooms--;
+        }
+        pthread_mutex_unlock(&roomLock);
+        return -1;
+    }
+    if (oldMembers != NULL) *oldMembers = oldCopy;
+    if (newMembers != NULL) *newMembers = newCopy;
+
+    if (user->room == ROOM_NONE) {
+        //- Erster Beitritt = ab jetzt erreicht ihn der Broadcast Agent, der nur unter roomLock verteilt -//
+        user->historyEnd = msglogNextSeq();
+    } else {
+        room_detach(user->room, user->roomSlot);
+    }
+    user->room = id;
+    user->roomSlot = rooms[id].count - 1;
+
+    pthread_mutex_unlock(&roomLock);
+    return id;
+}
+
+void room_leave(User *user) {
+    lockprofAcquire(&roomLock, &lockStatsRoom);
+    if (user->room != ROOM_NONE) {
+        room_detach(user->room, user->roomSlot);
+        user->room = ROOM_NONE;
+    }
+    pthread_mutex_unlock(&roomLock);
+}
+
+//--- Funktion fuer jedes Mitglied eines Raums (oder aller Raeume) aufrufen ---//
+void room_iterate(const int room, void (*func)(User *)) {
+    lockprofAcquire(&roomLock, &lockStatsRoom);
+
+    const int first = room == ROOM_ALL ? 0 : room;
+    const int last = room == ROOM_ALL ? ROOM_MAX - 1 : room;
+    for (int id = first; id <= last && id >= 0 && id < ROOM_MAX; id++) {
+        Room *current = &rooms[id];
+        for (size_t i = 0; i < current->count; i++) {
+            func(current->members[i]);
+        }
+    }
+
+    pthread_mutex_unlock(&roomLock);
+}
+
+int room_members(const int room, const User *skip, RoomNames *out) {
+    if (room < 0 || room >= ROOM_MAX) {
+        out->names = NULL;
+        out->count = 0;
+        return -1;
+    }
+    lockprofAcquire(&roomLock, &lockStatsRoom);
+    const int result = copy_members(&rooms[room], skip, out);
+    pthread_mutex_unlock(&roomLock);
+    return result;
+}
+
+int room_name(const int room, char *name) {
+    if (room < 0 || room >= ROOM_MAX) return -1;
+
+    lockprofAcquire(&roomLock, &lockStatsRoom);
+    const int active = rooms[room].active;
+    if (active) strcpy(name, rooms[room].name);
+    pthread_mutex_unlock(&roomLock);
+    return active ? 0 : -1;
+}
+
+void room_stats_format(char *buf, const size_t size) {
+    size_t largest = 0;
+    size_t members = 0;
+
+    lockprofAcquire(&roomLock, &lockStatsRoom);
+    for (int id = 0; id < ROOM_MAX; id++) {
+        members += rooms[id].count;
+        if (rooms[id].count > largest) largest = rooms[id].count;
+    }
+    snprintf(buf, size, "rooms: active=%u/%d members=%zu largest=%zu", activeRooms, ROOM_MAX, members, largest);
+    pthread_mutex_unlock(&roomLock);
+}
@@ -0,0 +1,37 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include <stddef.h>
+
+#include "user.h"
+
+#define ROOM_MAX 256
+#define ROOM_LOBBY 0 // Jeder User startet hier, nur dieser Raum wird protokolliert
+#define ROOM_NONE (-1) // User ist (noch) in keinem Raum
+#define ROOM_ALL (-2) // Nachricht geht an alle Raeume
+
+// Namen der Mitglieder, kopiert unter roomLock; nach Gebrauch room_names_free()
+typedef struct {
+    char (*names)[32];
+    size_t count;
+} RoomNames;
+
+// oldMembers/newMembers (oder NULL): die Mitglieder des verlassenen und des neuen Raums ohne user, im selben
+// Moment kopiert, in dem er wechselt; danach darf der alte Raum schon aufgeloest und neu vergeben sein
+int room_join(User *user, const char *name, RoomNames *oldMembers, RoomNames *newMembers);
+
+void room_leave(User *user);
+
+// Nur fuer kurze Arbeit je Mitglied (zB der Broadcast Agent): func laeuft unter roomLock
+void room_iterate(int room, void (*func)(User *));
+
+// Mitglieder von room ausser skip; -1 wenn der Speicher fehlt
+int room_members(int room, const User *skip, RoomNames *out);
+
+void room_names_free(RoomNames *names);
+
+int room_name(int room, char *name);
+
+void room_stats_format(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,295 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "searchindex.h"
+#include "util.h"
+
+#define SEARCH_TOKEN_MAX 32 // Laengere Woerter werden abgeschnitten (auch in der Anfrage)
+#define SEARCH_TOKEN_MIN 2
+#define SEARCH_QUERY_TERMS 4
+#define SEARCH_INITIAL_CAPACITY 4096
+
+//- Posting Liste: aufsteigende Nachrichtennummern als Varint-kodierte Differenzen -//
+typedef struct {
+    char token[SEARCH_TOKEN_MAX + 1];
+    int used;
+    uint8_t *postings;
+    uint32_t len;
+    uint32_t capacity;
+    uint32_t count;
+    uint64_t lastSeq;
+} IndexEntry;
+
+static pthread_mutex_t indexLock = PTHREAD_MUTEX_INITIALIZER;
+static int enabled = 0;
+static size_t memoryLimit;
+static size_t memoryUsed; // Tabelle plus Posting Puffer
+
+static IndexEntry *table = NULL;
+static size_t tableCapacity; // Zweierpotenz
+static size_t tableUsed;
+
+static uint64_t minSeq; // Aeltere Nummern wurden beim Kuerzen verworfen
+static unsigned long statMessages;
+static unsigned long statPostings;
+static unsigned long statPrunes;
+
+static uint32_t token_hash(const char *token) {
+    uint32_t hash = 2166136261U; //- FNV-1a -//
+    for (const unsigned char *p = (const unsigned char *) token; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static IndexEntry *table_slot(IndexEntry *tab, const size_t capacity, const char *token) {
+    size_t i = token_hash(token) & (capacity - 1);
+    while (tab[i].used && strcmp(tab[i].token, token) != 0) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &tab[i];
+}
+
+static int table_resize(const size_t capacity) {
+    IndexEntry *grown = calloc(capacity, sizeof(IndexEntry));
+    if (grown == NULL) return -1;
+
+    for (size_t i = 0; i < tableCapacity; i++) {
+        if (table[i].used) *table_slot(grown, capacity, table[i].token) = table[i];
+    }
+    memoryUsed += (capacity - tableCapacity) * sizeof(IndexEntry);
+    free(table);
+    table = grown;
+    tableCapacity = capacity;
+    return 0;
+}
+
+static int postings_append(IndexEntry *entry, const uint64_t seq) {
+    if (entry->count > 0 && seq == entry->lastSeq) return 0; //- Wort mehrfach in derselben Nachricht -//
+
+    if (entry->len + 10 > entry->capacity) {
+        const uint32_t capacity = entry->capacity ? entry->capacity * 2 : 8;
+        uint8_t *grown = realloc(entry->postings, capacity);
+        if (grown == NULL) return -1;
+        memoryUsed += capacity - entry->capacity;
+        entry->postings = grown;
+        entry->capacity = capacity;
+    }
+
+    uint64_t delta = entry->count > 0 ? seq - entry->lastSeq : seq;
+    do {
+        uint8_t byte = delta & 0x7f;
+        delta >>= 7;
+        if (delta) byte |= 0x80;
+        entry->postings[entry->len++] = byte;
+    } while (delta);
+
+    entry->lastSeq = seq;
+    entry->count++;
+    statPostings++;
+    return 0;
+}
+
+//--- Dekodiert eine Posting Liste; out muss entry->count Platz haben ---//
+static size_t postings_decode(const IndexEntry *entry, uint64_t *out) {
+    uint64_t seq = 0;
+    size_t n = 0;
+    uint32_t pos = 0;
+    while (pos < entry->len) {
+        uint64_t delta = 0;
+        unsigned int shift = 0;
+        uint8_t byte;
+        do {
+            byte = entry->postings[pos++];
+            delta |= (uint64_t) (byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        seq = n == 0 ? delta : seq + delta;
+        out[n++] = seq;
+    }
+    return n;
+}
+
+//--- Speicherbudget ueberschritten: alle Postings der aelteren Haelfte verwerfen ---//
+static void index_prune(void) {
+    uint64_t newest = minSeq;
+    for (size_t i = 0; i < tableCapacity; i++) {
+        if (table[i].used && table[i].lastSeq > newest) newest = table[i].lastSeq;
+    }
+    const uint64_t cutoff = minSeq + (newest - minSeq) / 2 + 1;
+
+    IndexEntry *fresh = calloc(tableCapacity, sizeof(IndexEntry));
+    if (fresh == NULL) return;
+    memoryUsed = tableCapacity * sizeof(IndexEntry);
+    tableUsed = 0;
+    statPostings = 0;
+
+    for (size_t i = 0; i < tableCapacity; i++) {
+        IndexEntry *old = &table[i];
+        if (!old->used) continue;
+
+        uint64_t *seqs = malloc(old->count * sizeof(uint64_t));
+        if (seqs != NULL) {
+            const size_t n = postings_decode(old, seqs);
+            IndexEntry *entry = NULL;
+            for (size_t k = 0; k < n; k++) {
+                if (seqs[k] < cutoff) continue;
+                if (entry == NULL) {
+                    entry = table_slot(fresh, tableCapacity, old->token);
+                    strcpy(entry->token, old->token);
+                    entry->used = 1;
+                    tableUsed++;
+                }
+                postings_append(entry, seqs[k]);
+            }
+            free(seqs);
+        }
+        free(old->postings);
+    }
+    free(table);
+    table = fresh;
+    minSeq = cutoff;
+    statPrunes++;
+}
+
+//--- Zerlegt Text in Woerter: ASCII Buchstaben/Ziffern (klein) und alle UTF-8 Bytes ---//
+static size_t next_token(const char *text, const size_t len, size_t pos, char *token) {
+    size_t tokenLen;
+    while (1) {
+        while (pos < len) {
+            const unsigned char c = (unsigned char) text[pos];
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 128) break;
+            pos++;
+        }
+        if (pos >= len) return len + 1;
+
+        tokenLen = 0;
+        while (pos < len) {
+            unsigned char c = (unsigned char) text[pos];
+            if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 128)) break;
+            if (c >= 'A' && c <= 'Z') c = (unsigned char) (c - 'A' + 'a');
+            if (tokenLen < SEARCH_TOKEN_MAX) token[tokenLen++] = (char) c;
+            pos++;
+        }
+        token[tokenLen] = '\0';
+        if (tokenLen >= SEARCH_TOKEN_MIN) return pos;
+    }
+}
+
+int searchIndexInit(const size_t limit) {
+    if (limit == 0) return 0;
+
+    table = calloc(SEARCH_INITIAL_CAPACITY, sizeof(IndexEntry));
+    if (table == NULL) {
+        errorPrint("Memory allocation failed for search index");
+        return -1;
+    }
+    tableCapacity = SEARCH_INITIAL_CAPACITY;
+    memoryUsed = tableCapacity * sizeof(IndexEntry);
+    memoryLimit = limit;
+    enabled = 1;
+    return 0;
+}
+
+void searchIndexCleanup(void) {
+    if (!enabled) return;
+    for (size_t i = 0; i < tableCapacity; i++) {
+        free(table[i].postings);
+    }
+    free(table);
+    table = NULL;
+    enabled = 0;
+}
+
+int searchIndexEnabled(void) {
+    return enabled;
+}
+
+//--- Wird vom Schreiber des Nachrichtenlogs aufgerufen, nicht vom Broadcast Agent ---//
+void searchIndexAdd(const uint64_t seq, const char *text, const size_t len) {
+    if (!enabled) return;
+
+    char token[SEARCH_TOKEN_MAX + 1];
+    pthread_mutex_lock(&indexLock);
+    size_t pos = 0;
+    while ((pos = next_token(text, len, pos, token)) <= len) {
+        if ((tableUsed + 1) * 10 > tableCapacity * 7 && table_resize(tableCapacity * 2) == -1) break;
+
+        IndexEntry *entry = table_slot(table, tableCapacity, token);
+        if (!entry->used) {
+            strcpy(entry->token, token);
+            entry->used = 1;
+            tableUsed++;
+        }
+        postings_append(entry, seq);
+    }
+    statMessages++;
+
+    if (memoryUsed > memoryLimit) index_prune();
+    pthread_mutex_unlock(&indexLock);
+}
+
+size_t searchIndexQuery(const char *query, uint64_t *results, const size_t maxResults) {
+    if (!enabled) return 0;
+
+    char token[SEARCH_TOKEN_MAX + 1];
+    uint64_t *lists[SEARCH_QUERY_TERMS];
+    size_t counts[SEARCH_QUERY_TERMS];
+    size_t terms = 0;
+    size_t hits = 0;
+    const size_t len = strlen(query);
+
+    pthread_mutex_lock(&indexLock);
+    size_t pos = 0;
+    while (terms < SEARCH_QUERY_TERMS && (pos = next_token(query, len, pos, token)) <= len) {
+        const IndexEntry *entry = table_slot(table, tableCapacity, token);
+        if (!entry->used || (lists[terms] = malloc(entry->count * sizeof(uint64_t))) == NULL) {
+            pthread_mutex_unlock(&indexLock);
+            goto done;
+        }
+        counts[terms] = postings_decode(entry, lists[terms]);
+        terms++;
+    }
+    pthread_mutex_unlock(&indexLock);
+
+    //- Schnittmenge in die erste Liste schreiben; alle Listen sind aufsteigend sortiert -//
+    if (terms > 0) {
+        hits = counts[0];
+        for (size_t t = 1; t < terms; t++) {
+            size_t a = 0;
+            size_t b = 0;
+            size_t out = 0;
+            while (a < hits && b < counts[t]) {
+                if (lists[0][a] < lists[t][b]) a++;
+                else if (lists[0][a] > lists[t][b]) b++;
+                else {
+                    lists[0][out++] = lists[0][a];
+                    a++;
+                    b++;
+                }
+            }
+            hits = out;
+        }
+        for (size_t i = 0; i < hits && i < maxResults; i++) {
+            results[i] = lists[0][hits - 1 - i]; //- Neueste zuerst -//
+        }
+    }
+
+done:
+    for (size_t t = 0; t < terms; t++) free(lists[t]);
+    return hits;
+}
+
+void searchIndexStatsFormat(char *buf, const size_t size) {
+    if (!enabled) {
+        snprintf(buf, size, "search: disabled");
+        return;
+    }
+    pthread_mutex_lock(&indexLock);
+    snprintf(buf, size, "search: messages=%lu tokens=%zu postings=%lu memory=%zu/%zu prunes=%lu oldest=%ju",
+             statMessages, tableUsed, statPostings, memoryUsed, memoryLimit, statPrunes, (uintmax_t) minSeq);
+    pthread_mutex_unlock(&indexLock);
+}
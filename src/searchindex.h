@@ -0,0 +1,22 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SEARCH_MAX_RESULTS 10
+
+int searchIndexInit(size_t memoryLimit);
+
+void searchIndexCleanup(void);
+
+int searchIndexEnabled(void);
+
+void searchIndexAdd(uint64_t seq, const char *text, size_t len);
+
+// Liefert die Anzahl aller Treffer (UND-Verknuepfung der Woerter), die neuesten stehen in results
+size_t searchIndexQuery(const char *query, uint64_t *results, size_t maxResults);
+
+void searchIndexStatsFormat(char *buf, size_t size);
+
+#endif
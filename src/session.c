@@ -0,0 +1,353 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "session.h"
+#include "capture.h"
+#include "compress.h"
+#include "firehose.h"
+#include "handoff.h"
+#include "lockprof.h"
+#include "names.h"
+#include "room.h"
+#include "user.h"
+#include "util.h"
+#include "zerocopy.h"
+
+#define PARK_RECHECK_MS 1000 // So oft prueft ein wartender Thread, ob ein Hot Restart beginnt
+
+static unsigned int graceMs; // 0 = keine Sitzungen
+
+static uint64_t statStarted;
+static uint64_t statParked;
+static uint64_t statResumed;
+static uint64_t statExpired;
+static uint64_t statTakenOver; // Wiederaufnahme, waehrend die alte Verbindung noch offen war
+static uint64_t statReplayed; // Nachgeholte Nachrichten
+static uint64_t statMissing; // Schon aus dem Puffer verdraengt
+static unsigned int waiting; // Gerade wartende Threads
+
+//- Verpasste Nachrichten als fertige Container, jeder endet mit MT_SEQUENCE -//
+typedef struct {
+    Frame *out;
+    size_t capacity;
+    size_t containerStart; // Offset des offenen BatchHeader
+    uint64_t lastSeq; // Letzte aufgenommene Nachricht, 0 = noch keine im offenen Container
+    char (*ignored)[32]; // Namen statt IDs: im Puffer stehen nur fertige Frames
+    size_t ignoredCount;
+    size_t count;
+    int failed;
+} Delta;
+
+void sessionSetGrace(const unsigned int seconds) {
+    graceMs = seconds * 1000;
+}
+
+void sessionInit(void) {
+    if (graceMs > 0) firehoseRequire();
+}
+
+int sessionEnabled(void) {
+    return graceMs > 0;
+}
+
+static void add_ms(struct timespec *ts, const unsigned int ms) {
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long) (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+void sessionStart(User *user) {
+    SessionState *session = &user->session;
+    unsigned char token[sizeof(session->token)];
+    if (getrandom(token, sizeof(token), 0) != (ssize_t) sizeof(token)) {
+        errnoPrint("getrandom (session token)");
+        return; //- Ohne Token nur eine gewoehnliche Verbindung -//
+    }
+
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    memcpy(session->token, token, sizeof(token));
+    session->pendingFd = -1;
+    pthread_cond_init(&session->resumed, NULL);
+    session->enabled = 1;
+    //- Unter sendLock: jeder spaetere Container traegt eine groessere oder gleiche Nummer -//
+    sendSession(user->sock, session->token, firehoseNextSeq());
+    pthread_mutex_unlock(&user->sendLock);
+    __atomic_add_fetch(&statStarted, 1, __ATOMIC_RELAXED);
+}
+
+//--- Token in konstanter Zeit vergleichen ---//
+static int token_equal(const unsigned char *a, const unsigned char *b) {
+    unsigned char diff = 0;
+    for (size_t i = 0; i < 16; i++) diff |= (unsigned char) (a[i] ^ b[i]);
+    return diff == 0;
+}
+
+User *sessionFind(const char *name, const unsigned char *token) {
+    if (graceMs == 0) return NULL;
+    User *user = user_find(name);
+    if (user == NULL) return NULL;
+
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    const int match = user->session.enabled && !user->session.ended && token_equal(user->session.token, token);
+    pthread_mutex_unlock(&user->sendLock);
+    if (match) return user;
+    user_put(user);
+    return NULL;
+}
+
+int sessionResume(User *user, const int fd, const uint8_t version, const uint64_t from) {
+    SessionState *session = &user->session;
+
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    if (session->ended) {
+        pthread_mutex_unlock(&user->sendLock);
+        return -1;
+    }
+    if (session->pendingFd != -1) close(session->pendingFd); //- Die neueste Verbindung gewinnt -//
+    session->pendingFd = fd;
+    session->pendingVersion = version;
+    session->pendingFrom = from;
+    if (!session->parked) {
+        //- Die alte Verbindung ist fuer den Server noch offen (zB halb offen hinter NAT): trennen, der Thread parkt -//
+        shutdown(user->sock, SHUT_RDWR);
+        __atomic_add_fetch(&statTakenOver, 1, __ATOMIC_RELAXED);
+    }
+    pthread_cond_signal(&session->resumed);
+    pthread_mutex_unlock(&user->sendLock);
+    return 0;
+}
+
+void sessionEnd(User *user) {
+    SessionState *session = &user->session;
+    if (!session->enabled) return;
+    session->ended = 1;
+    pthread_cond_signal(&session->resumed); //- Ein wartender Thread meldet sofort ab -//
+}
+
+//--- Container abschliessen: Laenge eintragen und MT_SEQUENCE anhaengen ---//
+static void delta_close(Delta *delta, const uint64_t seqEnd) {
+    const Header marker = {.type = MT_SEQUENCE, .length = htons(sizeof(uint64_t))};
+    const uint64_t seq = hton64u(seqEnd);
+    unsigned char *p = delta->out->data + delta->out->len;
+    memcpy(p, &marker, sizeof(marker));
+    memcpy(p + sizeof(marker), &seq, sizeof(seq));
+    delta->out->len += sizeof(marker) + sizeof(seq);
+
+    const uint32_t length = htonl((uint32_t) (delta->out->len - delta->containerStart - sizeof(BatchHeader)));
+    delta->out->data[delta->containerStart] = MT_BATCH;
+    memcpy(delta->out->data + delta->containerStart + 1, &length, sizeof(length));
+}
+
+//- Platz fuer len Bytes und einen Abschluss; ein neuer Container beginnt erst, wenn der alte voll ist -//
+static int delta_reserve(Delta *delta, const size_t len) {
+    const size_t tail = sizeof(Header) + sizeof(uint64_t) + sizeof(BatchHeader);
+    if (delta->out != NULL && delta->out->len + len + tail <= delta->capacity) return 0;
+    size_t capacity = delta->capacity ? delta->capacity * 2 : 4096;
+    while (capacity < (delta->out ? delta->out->len : 0) + len + tail) capacity *= 2;
+    Frame *grown = realloc(delta->out, sizeof(Frame) + capacity);
+    if (grown == NULL) return -1;
+    if (delta->out == NULL) {
+        grown->refs = 1;
+        grown->len = sizeof(BatchHeader);
+    }
+    delta->out = grown;
+    delta->capacity = capacity;
+    return 0;
+}
+
+//- Laeuft unter der Sperre des Firehose Puffers: nur kopieren -//
+static void delta_emit(const uint64_t seq, const unsigned char *frame, const size_t len, void *arg) {
+    Delta *delta = arg;
+    if (delta->failed) return;
+    if (frame[0] == MT_SERVER_TO_CLIENT && len >= sizeof(Header) + 40) {
+        const char *sender = (const char *) frame + sizeof(Header) + 8;
+        for (size_t i = 0; i < delta->ignoredCount; i++) {
+            if (strncmp(sender, delta->ignored[i], 32) == 0) return;
+        }
+    }
+
+    //- Container wie vom Client gesendet hoechstens BATCH_MAX_BYTES gross; jeder bringt die Nummer ein Stueck weiter -//
+    if (delta->lastSeq != 0 && delta->out->len - delta->containerStart + len > BATCH_MAX_BYTES) {
+        delta_close(delta, delta->lastSeq + 1);
+        delta->containerStart = delta->out->len;
+        delta->out->len += sizeof(BatchHeader);
+        delta->lastSeq = 0;
+    }
+    if (delta_reserve(delta, len) == -1) {
+        delta->failed = 1;
+        return;
+    }
+    memcpy(delta->out->data + delta->out->len, frame, len);
+    delta->out->len += len;
+    delta->lastSeq = seq;
+    delta->count++;
+}
+
+//--- Ignorierte Namen aus der Kopie der IDs; ohne sendLock, nameCopy sperrt selbst ---//
+static void delta_ignored(Delta *delta, const uint32_t *ids, const size_t count) {
+    if ((delta->ignored = malloc(count * sizeof(*delta->ignored))) == NULL) return;
+    for (size_t i = 0; i < count; i++) nameCopy(ids[i], delta->ignored[delta->ignoredCount++]);
+}
+
+//--- Neue Verbindung uebernehmen, Luecke nachholen; der Aufrufer haelt sendLock ---//
+static void resume_connection(User *user, const int fd, const uint8_t version, const uint64_t from, Delta *delta,
+                              const char *roomName, uint64_t *missing) {
+    SessionState *session = &user->session;
+
+    //- Gleiche Nummer: /kick, Timer und alle anderen, die user->sock kennen, treffen ab jetzt die neue Verbindung -//
+    if (dup2(fd, user->sock) == -1) {
+        errnoPrint("dup2 (session resume)");
+        close(fd);
+        return;
+    }
+    close(fd);
+    const int compressed = (version & PROT_FLAG_COMPRESS) && compressAvailable() && compressAttach(user->sock) == 0;
+    if (!compressed) zerocopyEnable(&user->zc, user->sock);
+    if (user->closeReason != 1) user->closeReason = 0; //- Nur Verbindungsfehler vergessen, nie einen Kick -//
+
+    user_arm_stall_timeout(user);
+    if (sendLoginResponse(user->sock, LC_SUCCESS, compressed) == 0) {
+        //- Erst die Nummer, die der Client schon hat; die Container bringen sie dann bis zum aktuellen Stand -//
+        const uint64_t next = firehoseReplay(from, roomName, delta_emit, delta, missing);
+        if (delta_reserve(delta, 0) == 0) {
+            delta_close(delta, next);
+            sendSession(user->sock, session->token, from + *missing);
+            sendFrame(user->sock, delta->out);
+        }
+        session->replayedTo = next;
+    }
+    user_cancel_stall_timeout(user);
+}
+
+int sessionPark(User *user) {
+    SessionState *session = &user->session;
+    if (graceMs == 0 || !session->enabled) return 0;
+
+    user_cancel_idle_timeout(user);
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    if (user->closeReason == 1 || session->ended) {
+        //- Vom Admin gekickt: die Sitzung endet mit ihm -//
+        session->ended = 1;
+        if (session->pendingFd != -1) close(session->pendingFd);
+        session->pendingFd = -1;
+        pthread_mutex_unlock(&user->sendLock);
+        return 0;
+    }
+    session->parked = 1;
+    compressDetach(user->sock);
+    zerocopyRelease(&user->zc, user->sock);
+    captureClose(user->sock);
+    shutdown(user->sock, SHUT_RDWR); //- Auch nach Protokollfehlern: der Client merkt das Ende sofort -//
+    __atomic_add_fetch(&statParked, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&waiting, 1, __ATOMIC_RELAXED);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    add_ms(&deadline, graceMs);
+    while (session->pendingFd == -1 && !session->ended) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) break;
+        struct timespec step = now;
+        add_ms(&step, PARK_RECHECK_MS);
+        if (step.tv_sec > deadline.tv_sec || (step.tv_sec == deadline.tv_sec && step.tv_nsec > deadline.tv_nsec)) {
+            step = deadline;
+        }
+        if (pthread_cond_timedwait(&session->resumed, &user->sendLock, &step) != ETIMEDOUT) continue;
+
+        //- Ohne sendLock: handoffLock darf nicht darunter genommen werden; ein Hot Restart wartet auf alle Threads -//
+        pthread_mutex_unlock(&user->sendLock);
+        const int handoff = handoffInProgress();
+        lockprofAcquire(&user->sendLock, &lockStatsSend);
+        if (handoff) break;
+    }
+    __atomic_sub_fetch(&waiting, 1, __ATOMIC_RELAXED);
+    if (session->pendingFd == -1 || session->ended) {
+        //- Frist abgelaufen oder gekickt; parked bleibt: der Broadcast Agent schreibt nicht mehr in den toten Socket -//
+        if (!session->ended) __atomic_add_fetch(&statExpired, 1, __ATOMIC_RELAXED);
+        session->ended = 1;
+        if (session->pendingFd != -1) close(session->pendingFd);
+        session->pendingFd = -1;
+        pthread_mutex_unlock(&user->sendLock);
+        return 0;
+    }
+
+    //- Die Kopien entstehen ohne sendLock (roomLock und nameLock kommen vor ihm); der User wartet weiter -//
+    const int fd = session->pendingFd;
+    const uint8_t version = session->pendingVersion;
+    const uint64_t from = session->pendingFrom;
+    session->pendingFd = -1;
+    uint32_t *ids = NULL;
+    size_t idCount = 0;
+    if (user->ignoredCount > 0 && (ids = malloc(user->ignoredCount * sizeof(uint32_t))) != NULL) {
+        idCount = user_ignored_ids(user, ids);
+    }
+    pthread_mutex_unlock(&user->sendLock);
+
+    char roomName[32];
+    if (room_name(user->room, roomName) == -1) roomName[0] = '\0';
+    Delta delta = {0};
+    if (idCount > 0) delta_ignored(&delta, ids, idCount);
+    free(ids);
+
+    uint64_t missing = 0;
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    if (session->ended) {
+        //- Waehrend der Kopien gekickt: die neue Verbindung bekommt nichts mehr -//
+        pthread_mutex_unlock(&user->sendLock);
+        close(fd);
+        free(delta.ignored);
+        return 0;
+    }
+    resume_connection(user, fd, version, from, &delta, roomName, &missing);
+    session->parked = 0;
+    __atomic_add_fetch(&statResumed, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&statReplayed, delta.count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&statMissing, missing, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&user->sendLock);
+    user_arm_idle_timeout(user);
+
+    //- Die Luecke sieht der Client auch an der Nummer, der Mensch davor an dieser Zeile -//
+    if (delta.failed) {
+        user_send_text(user, NULL, "Some messages sent while you were away could not be replayed.", (uint64_t) time(NULL));
+    } else if (missing > 0) {
+        char line[128];
+        snprintf(line, sizeof(line), "%ju messages sent while you were away are no longer available.",
+                 (uintmax_t) missing);
+        user_send_text(user, NULL, line, (uint64_t) time(NULL));
+    }
+    free(delta.out);
+    free(delta.ignored);
+    return 1;
+}
+
+void sessionRelease(SessionState *session) {
+    if (!session->enabled) return;
+    if (session->pendingFd != -1) close(session->pendingFd);
+    pthread_cond_destroy(&session->resumed);
+}
+
+void sessionStatsFormat(char *buf, const size_t size) {
+    if (graceMs == 0) {
+        snprintf(buf, size, "sessions: disabled");
+        return;
+    }
+    snprintf(buf, size, "sessions: grace=%us started=%ju parked=%ju waiting=%u resumed=%ju taken_over=%ju expired=%ju "
+             "replayed=%ju missing=%ju", graceMs / 1000, (uintmax_t) __atomic_load_n(&statStarted, __ATOMIC_RELAXED),
+             (uintmax_t) __atomic_load_n(&statParked, __ATOMIC_RELAXED), __atomic_load_n(&waiting, __ATOMIC_RELAXED),
+             (uintmax_t) __atomic_load_n(&statResumed, __ATOMIC_RELAXED),
+             (uintmax_t) __atomic_load_n(&statTakenOver, __ATOMIC_RELAXED),
+             (uintmax_t) __atomic_load_n(&statExpired, __ATOMIC_RELAXED),
+             (uintmax_t) __atomic_load_n(&statReplayed, __ATOMIC_RELAXED),
+             (uintmax_t) __atomic_load_n(&statMissing, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,59 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "network.h"
+
+// Fortsetzbare Sitzungen (--session-grace SEC): ein v1 Client mit PROT_FLAG_SESSION bekommt nach der LoginResponse
+// MT_SESSION mit Token und Nummer, danach endet jeder Container an ihn mit MT_SEQUENCE. Bricht die Verbindung ab,
+// wartet sein Client Thread bis zu SEC Sekunden; niemand sieht ihn gehen. Meldet er sich mit LoginResumeBody (Name,
+// Token, letzte Nummer) wieder an, bekommt er Namen, Raum und Ignorierliste zurueck und nur die verpassten
+// Nachrichten aus dem Firehose Puffer, ohne Userliste, Verlauf und UserAdded an alle.
+
+// Im User eingebettet, geschuetzt durch user->sendLock
+typedef struct {
+    int enabled; // Login mit PROT_FLAG_SESSION
+    int parked; // Verbindung weg, der Client Thread wartet; der Broadcast Agent ueberspringt ihn
+    int ended; // Frist abgelaufen, keine Wiederaufnahme mehr
+    int pendingFd; // Neue Verbindung fuer den wartenden Thread, -1 = keine
+    uint8_t pendingVersion; // Version der Wiederaufnahme, zB mit PROT_FLAG_COMPRESS
+    uint64_t pendingFrom;
+    uint64_t replayedTo; // Batches mit kleineren Nummern hat die Wiederaufnahme schon nachgeholt
+    unsigned char token[16];
+    pthread_cond_t resumed;
+} SessionState;
+
+struct User;
+
+void sessionSetGrace(unsigned int seconds);
+
+// Nach den Optionen, vor firehoseInit: Sitzungen brauchen dessen Puffer
+void sessionInit(void);
+
+int sessionEnabled(void);
+
+// Login Stufe nach user_add: Token erzeugen und MT_SESSION senden; eine verlorene Verbindung merkt der Client Thread
+void sessionStart(struct User *user);
+
+// Login Stufe: User mit passendem Token und zusaetzlicher Referenz, sonst NULL
+struct User *sessionFind(const char *name, const unsigned char *token);
+
+// Login Stufe: die Verbindung geht an den wartenden Client Thread; eine noch offene alte wird getrennt
+int sessionResume(struct User *user, int fd, uint8_t version, uint64_t from);
+
+// Client Thread nach dem Ende der Verbindung: 1 = wieder aufgenommen (neuer Socket unter derselben Nummer),
+// 0 = Frist abgelaufen oder keine Sitzung, der Thread meldet den User ab
+int sessionPark(struct User *user);
+
+// /kick unter user->sendLock: keine Wiederaufnahme mehr, ein wartender Thread meldet sofort ab
+void sessionEnd(struct User *user);
+
+// Aus user_put
+void sessionRelease(SessionState *session);
+
+void sessionStatsFormat(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,96 @@
+#include <time.h>
+
+#include "stats.h"
+#include "broadcastagent.h"
+#include "capture.h"
+#include "compress.h"
+#include "federation.h"
+#include "firehose.h"
+#include "latency.h"
+#include "lockprof.h"
+#include "loginstage.h"
+#include "memory.h"
+#include "msglog.h"
+#include "names.h"
+#include "network.h"
+#include "overload.h"
+#include "room.h"
+#include "searchindex.h"
+#include "session.h"
+#include "timerwheel.h"
+#include "trace.h"
+#include "user.h"
+#include "workers.h"
+#include "zerocopy.h"
+
+#define STATS_LINE_SIZE 512
+
+//--- Sendet die Statistiken aller Module zeilenweise als Servernachricht ---//
+int statsReport(User *user) {
+    char line[STATS_LINE_SIZE];
+    const uint64_t timestamp = (uint64_t) time(NULL);
+
+    timerWheelStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    loginStageStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    broadcastStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    overloadStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    firehoseStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    sessionStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    room_stats_format(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    nameStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    user_timeout_stats_format(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    msglogStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    searchIndexStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    federationStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    workersStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    zerocopyStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    compressStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    latencyStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    traceStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    captureStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    memoryStatsFormat(line, sizeof(line));
+    if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+
+    //- Eine Zeile je Sperre -//
+    for (unsigned int i = 0; lockprofStatsFormat(i, line, sizeof(line)) == 0; i++) {
+        if (user_send_text(user, NULL, line, timestamp) == -1) return -1;
+    }
+
+    return 0;
+}
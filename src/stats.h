@@ -0,0 +1,9 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "user.h"
+
+// Alle Zeilen ueber user_send_text, also unter seinem sendLock wie jede andere Antwort
+int statsReport(User *user);
+
+#endif
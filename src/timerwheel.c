@@ -0,0 +1,224 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "timerwheel.h"
+#include "util.h"
+
+//- Hierarchisches Rad: Ebene 0 mit 256 Ticks, darueber zwei Ebenen mit je 64 Slots -//
+#define TW_L0_BITS 8
+#define TW_LN_BITS 6
+#define TW_L0_SIZE (1 << TW_L0_BITS)
+#define TW_LN_SIZE (1 << TW_LN_BITS)
+#define TW_L0_MASK (TW_L0_SIZE - 1)
+#define TW_LN_MASK (TW_LN_SIZE - 1)
+#define TW_MAX_DELTA ((uint64_t) 1 << (TW_L0_BITS + 2 * TW_LN_BITS)) // ca. 29 Stunden bei 100ms
+
+static pthread_mutex_t wheelLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t threadId;
+static uint64_t now; // Zuletzt abgearbeiteter Tick, geschrieben unter wheelLock, gelesen auch ohne (timerNow)
+static void (*sweeps[TIMER_SWEEPS_MAX])(uint64_t now); // Fest ab timerWheelInit, daher ohne Sperre gelesen
+static unsigned int sweepCount;
+static struct timespec startTime;
+
+//- Jeder Slot ist ein Wächterknoten einer Ringliste, so geht das Aushaengen in O(1) -//
+static Timer level0[TW_L0_SIZE];
+static Timer level1[TW_LN_SIZE];
+static Timer level2[TW_LN_SIZE];
+
+static unsigned long statActive;
+static unsigned long statArmed;
+static unsigned long statCancelled;
+static unsigned long statExpired;
+
+static void slot_init(Timer *slot) {
+    slot->prev = slot;
+    slot->next = slot;
+}
+
+static void slot_append(Timer *slot, Timer *timer) {
+    timer->prev = slot->prev;
+    timer->next = slot;
+    slot->prev->next = timer;
+    slot->prev = timer;
+}
+
+static void timer_unlink(Timer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+//--- Haengt einen Timer passend zu seiner Restlaufzeit in eine Ebene ein ---//
+static void timer_place(Timer *timer) {
+    uint64_t delta = timer->expires - now;
+
+    if (delta < TW_L0_SIZE) {
+        slot_append(&level0[timer->expires & TW_L0_MASK], timer);
+    } else if (delta < ((uint64_t) 1 << (TW_L0_BITS + TW_LN_BITS))) {
+        slot_append(&level1[(timer->expires >> TW_L0_BITS) & TW_LN_MASK], timer);
+    } else {
+        slot_append(&level2[(timer->expires >> (TW_L0_BITS + TW_LN_BITS)) & TW_LN_MASK], timer);
+    }
+}
+
+//--- Verteilt alle Timer eines hoeheren Slots neu auf die unteren Ebenen ---//
+static void cascade(Timer *slot) {
+    Timer pending;
+    slot_init(&pending);
+
+    //- Erst umhaengen, da timer_place evtl. wieder in denselben Slot einsortiert -//
+    if (slot->next != slot) {
+        pending.next = slot->next;
+        pending.prev = slot->prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        slot_init(slot);
+    }
+
+    while (pending.next != &pending) {
+        Timer *timer = pending.next;
+        timer_unlink(timer);
+        timer_place(timer);
+    }
+}
+
+//--- Einen Tick weiterschalten und abgelaufene Timer ausloesen ---//
+static void tick(void) {
+    __atomic_store_n(&now, now + 1, __ATOMIC_RELAXED);
+
+    if ((now & TW_L0_MASK) == 0) {
+        uint64_t idx1 = (now >> TW_L0_BITS) & TW_LN_MASK;
+        if (idx1 == 0) {
+            cascade(&level2[(now >> (TW_L0_BITS + TW_LN_BITS)) & TW_LN_MASK]);
+        }
+        cascade(&level1[idx1]);
+    }
+
+    Timer *slot = &level0[now & TW_L0_MASK];
+    while (slot->next != slot) {
+        Timer *timer = slot->next;
+        timer_unlink(timer);
+        timer->armed = 0;
+        statActive--;
+        statExpired++;
+        timer->callback(timer->arg);
+    }
+}
+
+static uint64_t elapsed_ticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ms = (uint64_t) (ts.tv_sec - startTime.tv_sec) * 1000
+                  + (uint64_t) (ts.tv_nsec / 1000000) - (uint64_t) (startTime.tv_nsec / 1000000);
+    return ms / TIMER_TICK_MS;
+}
+
+//--- Timer Thread: schlaeft bis zum naechsten Tick und holt verpasste Ticks nach ---//
+static void *timerThread(void *arg) {
+    (void) arg;
+    debugPrint("Timer thread started");
+
+    struct timespec next = startTime;
+    while (1) {
+        next.tv_nsec += TIMER_TICK_MS * 1000000L;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+        }
+
+        uint64_t target = elapsed_ticks();
+
+        int oldState;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
+        pthread_mutex_lock(&wheelLock);
+        while (now < target) {
+            tick();
+        }
+        pthread_mutex_unlock(&wheelLock);
+        for (unsigned int i = 0; i < sweepCount; i++) sweeps[i](target);
+        pthread_setcancelstate(oldState, NULL);
+    }
+    return NULL;
+}
+
+int timerWheelInit(void) {
+    for (int i = 0; i < TW_L0_SIZE; i++) slot_init(&level0[i]);
+    for (int i = 0; i < TW_LN_SIZE; i++) {
+        slot_init(&level1[i]);
+        slot_init(&level2[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    now = 0;
+
+    if (pthread_create(&threadId, NULL, timerThread, NULL) != 0) {
+        errnoPrint("Failed to start timer thread");
+        return -1;
+    }
+    return 0;
+}
+
+void timerWheelCleanup(void) {
+    pthread_cancel(threadId);
+    pthread_join(threadId, NULL);
+}
+
+void timerInit(Timer *timer, void (*callback)(void *arg), void *arg) {
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->armed = 0;
+}
+
+//--- Timer (neu) starten; ein bereits laufender Timer wird verschoben ---//
+void timerArm(Timer *timer, unsigned int ms) {
+    uint64_t ticks = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (ticks == 0) ticks = 1; //- Der aktuelle Tick ist schon abgearbeitet -//
+    if (ticks >= TW_MAX_DELTA) ticks = TW_MAX_DELTA - 1;
+
+    pthread_mutex_lock(&wheelLock);
+    if (timer->armed) {
+        timer_unlink(timer);
+    } else {
+        statActive++;
+    }
+    timer->expires = now + ticks;
+    timer->armed = 1;
+    timer_place(timer);
+    statArmed++;
+    pthread_mutex_unlock(&wheelLock);
+}
+
+void timerCancel(Timer *timer) {
+    pthread_mutex_lock(&wheelLock);
+    if (timer->armed) {
+        timer_unlink(timer);
+        timer->armed = 0;
+        statActive--;
+        statCancelled++;
+    }
+    pthread_mutex_unlock(&wheelLock);
+}
+
+uint64_t timerNow(void) {
+    return __atomic_load_n(&now, __ATOMIC_RELAXED);
+}
+
+int timerAddSweep(void (*sweep)(uint64_t now)) {
+    if (sweepCount == TIMER_SWEEPS_MAX) return -1;
+    sweeps[sweepCount++] = sweep;
+    return 0;
+}
+
+void timerWheelStatsFormat(char *buf, size_t size) {
+    pthread_mutex_lock(&wheelLock);
+    snprintf(buf, size, "timers: active=%lu armed=%lu cancelled=%lu expired=%lu",
+             statActive, statArmed, statCancelled, statExpired);
+    pthread_mutex_unlock(&wheelLock);
+}
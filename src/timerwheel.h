@@ -0,0 +1,41 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_TICK_MS 100 // Aufloesung des Timer Rads
+
+//- Timer werden vom Aufrufer eingebettet (zB im User), das Rad verwaltet nur die Verkettung -//
+typedef struct Timer {
+    struct Timer *prev;
+    struct Timer *next;
+    uint64_t expires; // Tick, in dem der Timer ablaeuft
+    void (*callback)(void *arg);
+    void *arg;
+    int armed;
+} Timer;
+
+int timerWheelInit(void);
+
+void timerWheelCleanup(void);
+
+void timerInit(Timer *timer, void (*callback)(void *arg), void *arg);
+
+// Callbacks laufen im Timer Thread unter der Sperre des Rads: kurz halten, kein timerArm/timerCancel darin!
+void timerArm(Timer *timer, unsigned int ms);
+
+// Nach der Rueckkehr laeuft der Callback garantiert nicht (mehr)
+void timerCancel(Timer *timer);
+
+// Aktueller Tick ohne Sperre, fuer Fristen, die statt eines Timers nur ein Feld setzen
+uint64_t timerNow(void);
+
+#define TIMER_SWEEPS_MAX 4
+
+// Laeuft nach jedem Tick im Timer Thread, ausserhalb der Sperre des Rads; nur vor timerWheelInit, -1 wenn voll
+int timerAddSweep(void (*sweep)(uint64_t now));
+
+void timerWheelStatsFormat(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,113 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+#include "util.h"
+
+//- Nur der Broadcast Agent schreibt, die Sperre ist daher bis auf einen Dump nie umkaempft -//
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static int enabled = 0;
+static TraceRecord *ring;
+static size_t capacity;
+static uint64_t total; // Jemals geschriebene Datensaetze, total % capacity ist der naechste Platz
+static char dumpPath[4096];
+static uint64_t dumps;
+
+int traceInit(const size_t records, const char *path) {
+    if (records == 0) return 0;
+
+    ring = calloc(records, sizeof(TraceRecord));
+    if (ring == NULL) {
+        errnoPrint("calloc (trace ring)");
+        return -1;
+    }
+    capacity = records;
+    snprintf(dumpPath, sizeof(dumpPath), "%s", path);
+    enabled = 1;
+    infoPrint("Latency tracing: %zu records, dump to %s", records, dumpPath);
+    return 0;
+}
+
+void traceCleanup(void) {
+    if (!enabled) return;
+    if (traceDump() == -1) errorPrint("Unable to write trace dump %s", dumpPath);
+    enabled = 0;
+    free(ring);
+    ring = NULL;
+}
+
+int traceEnabled(void) {
+    return enabled;
+}
+
+uint64_t traceNow(void) {
+    if (!enabled) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+void traceRecord(const TraceRecord *record) {
+    if (!enabled) return;
+    pthread_mutex_lock(&traceLock);
+    ring[total % capacity] = *record;
+    total++;
+    pthread_mutex_unlock(&traceLock);
+}
+
+//--- Kopie unter der Sperre, geschrieben wird ohne, damit der Agent nicht auf die Platte wartet ---//
+int64_t traceDump(void) {
+    if (!enabled) return -1;
+
+    TraceRecord *copy = malloc(capacity * sizeof(TraceRecord));
+    if (copy == NULL) return -1;
+
+    pthread_mutex_lock(&traceLock);
+    const size_t count = total < capacity ? (size_t) total : capacity;
+    const size_t first = total < capacity ? 0 : (size_t) (total % capacity);
+    //- Aeltester Datensatz zuerst -//
+    memcpy(copy, ring + first, (count - first) * sizeof(TraceRecord));
+    memcpy(copy + (count - first), ring, first * sizeof(TraceRecord));
+    TraceFileHeader header = {0};
+    header.magic = TRACE_MAGIC;
+    header.recordSize = sizeof(TraceRecord);
+    header.count = count;
+    header.dropped = total - count;
+    pthread_mutex_unlock(&traceLock);
+
+    //- Erst vollstaendig schreiben, dann umbenennen: ein Leser sieht nie einen halben Dump -//
+    char tmpPath[4200];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", dumpPath);
+    FILE *file = fopen(tmpPath, "wb");
+    if (file == NULL) {
+        errnoPrint("fopen %s", tmpPath);
+        free(copy);
+        return -1;
+    }
+    const int ok = fwrite(&header, sizeof(header), 1, file) == 1
+                   && fwrite(copy, sizeof(TraceRecord), count, file) == count;
+    free(copy);
+    if (fclose(file) != 0 || !ok || rename(tmpPath, dumpPath) == -1) {
+        errnoPrint("write %s", dumpPath);
+        return -1;
+    }
+
+    pthread_mutex_lock(&traceLock);
+    dumps++;
+    pthread_mutex_unlock(&traceLock);
+    return (int64_t) count;
+}
+
+void traceStatsFormat(char *buf, const size_t size) {
+    if (!enabled) {
+        snprintf(buf, size, "trace: disabled");
+        return;
+    }
+    pthread_mutex_lock(&traceLock);
+    snprintf(buf, size, "trace: records=%ju capacity=%zu dumps=%ju file=%s", (uintmax_t) total, capacity,
+             (uintmax_t) dumps, dumpPath);
+    pthread_mutex_unlock(&traceLock);
+}
@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x43545231 // "CTR1", Kopf einer Dump Datei
+#define TRACE_DEFAULT_RECORDS 65536
+
+// Ein Datensatz je verteilter Nachricht; alle Zeiten in ns CLOCK_MONOTONIC, 0 = Stufe nicht durchlaufen
+typedef struct __attribute__((packed)) {
+    uint64_t received; // Header vom Client gelesen (nur Chatnachrichten)
+    uint64_t enqueued; // Vor mq_timedsend
+    uint64_t dequeued; // Nach mq_receive im Broadcast Agent
+    uint64_t unpaused; // Nach dem Pause Semaphor
+    uint64_t firstSent; // Erster Empfaenger fertig
+    uint64_t lastSent; // Letzter Empfaenger fertig
+    uint32_t recipients;
+    uint8_t type;
+    uint8_t reserved[3];
+} TraceRecord;
+
+// Dateikopf, danach count Datensaetze in zeitlicher Reihenfolge
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t recordSize;
+    uint64_t count;
+    uint64_t dropped; // Vom Ring ueberschrieben
+} TraceFileHeader;
+
+// records = 0 schaltet das Tracing ab; path ist das Ziel fuer traceDump
+int traceInit(size_t records, const char *path);
+
+void traceCleanup(void);
+
+int traceEnabled(void);
+
+// Monotone Zeit in ns, 0 wenn das Tracing aus ist
+uint64_t traceNow(void);
+
+// Vom Broadcast Agent nach der Verteilung
+void traceRecord(const TraceRecord *record);
+
+// Schreibt den Ring in die Datei; liefert die Anzahl der Datensaetze oder -1
+int64_t traceDump(void);
+
+void traceStatsFormat(char *buf, size_t size);
+
+#endif
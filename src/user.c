@@ -1,16 +1,88 @@
 #include <pthread.h>
 #include "user.h"
+#include "capture.h"
+#include "compress.h"
+#include "lockprof.h"
+#include "memory.h"
+#include "msglog.h"
+#include "names.h"
+#include "network.h"
+#include "room.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/socket.h>
 
 static pthread_mutex_t userLock = PTHREAD_MUTEX_INITIALIZER;
 static User *userFront = NULL;
 static User *userBack = NULL;
 
-//--- Fügt einen neuen User hinzu ---//
-User *user_add(const int client_fd) {
+//- Namensindex: verkettete Buckets ueber hashNext, geschuetzt durch userLock -//
+#define USER_INDEX_SIZE 4096
+static User *nameIndex[USER_INDEX_SIZE];
+
+static size_t name_bucket(const char *name) {
+    uint32_t hash = 2166136261U; //- FNV-1a -//
+    for (const unsigned char *p = (const unsigned char *) name; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619U;
+    }
+    return hash & (USER_INDEX_SIZE - 1);
+}
+
+//- Zeitlimits in Millisekunden, 0 = deaktiviert -//
+static unsigned int idleTimeoutMs = 0;
+static unsigned int stallTimeoutMs = 5000;
+
+static unsigned long idleExpiredCount;
+static unsigned long stallExpiredCount;
+
+//--- Verbindung wegen Zeitueberschreitung trennen; clientthread raeumt danach auf ---//
+//- Laeuft im Timer Thread, der User kann waehrenddessen nicht freigegeben werden (timerCancel in user_remove) -//
+static void user_expire(User *user) {
+    user->closeReason = 2; //- 2 = Communication Error -//
+    shutdown(user->sock, SHUT_RDWR);
+}
+
+static void idle_expired(void *arg) {
+    idleExpiredCount++;
+    user_expire(arg);
+}
+
+//- Nur User mit laufender Sendung stehen in der Liste; eigene Sperre statt wheelLock oder userLock -//
+static pthread_mutex_t stallLock = PTHREAD_MUTEX_INITIALIZER;
+static User *stallHead;
+
+//--- Haelt stallLock ---//
+static void stall_unlink(User *user) {
+    if (user->stallPrev != NULL) user->stallPrev->stallNext = user->stallNext;
+    else stallHead = user->stallNext;
+    if (user->stallNext != NULL) user->stallNext->stallPrev = user->stallPrev;
+    user->stallPrev = NULL;
+    user->stallNext = NULL;
+    user->stallDeadline = 0;
+}
+
+//--- Im Timer Thread nach jedem Tick: O(laufende Sendungen) statt eines Timers je Sendung ---//
+//- Ein eingehaengter User lebt: der Sender haengt ihn aus, bevor er ihn loslaesst -//
+static void stall_sweep(const uint64_t now) {
+    pthread_mutex_lock(&stallLock);
+    User *user = stallHead;
+    while (user != NULL) {
+        User *next = user->stallNext;
+        if (now >= user->stallDeadline) {
+            stall_unlink(user);
+            stallExpiredCount++;
+            user_expire(user);
+        }
+        user = next;
+    }
+    pthread_mutex_unlock(&stallLock);
+}
+
+//--- Fügt einen eingeloggten User hinzu ---//
+User *user_add(const int client_fd, const char *name) {
     User *newUser = calloc(1, sizeof(User)); //- Calloc reinigt den Speicher, verhindert somit Zombieuser
     if (newUser == NULL) {
         fprintf(stderr, "Memory allocation failed for new user\n");
@@ -18,10 +90,34 @@ User *user_add(const int client_fd) {
     }
 
     newUser->sock = client_fd;
+    strncpy(newUser->name, name, 31); //- Vor dem Einhaengen setzen, der Broadcast Agent liest ihn sofort -//
     newUser->prev = NULL;
     newUser->next = NULL;
+    timerInit(&newUser->idleTimer, idle_expired, newUser);
+    //- Ein komprimierter Strom sendet eigene Puffer, Zerocopy auf die geteilten Frames waere dort falsch -//
+    if (!compressActive(client_fd)) zerocopyEnable(&newUser->zc, client_fd);
+    pthread_mutex_init(&newUser->sendLock, NULL);
+    newUser->room = ROOM_NONE;
+    newUser->replaying = 1; //- Ab room_join sammelt er Frames, bis sein Verlauf draussen ist -//
+    newUser->refs = 1;
+    newUser->id = nameIntern(name);
+    if (newUser->id == NAME_ID_NONE) {
+        fprintf(stderr, "Memory allocation failed for user name\n");
+        pthread_mutex_destroy(&newUser->sendLock);
+        free(newUser);
+        return NULL;
+    }
 
-    pthread_mutex_lock(&userLock);
+    //- Jeder beginnt in der Lobby; erst damit erreichen ihn Broadcasts -//
+    if (room_join(newUser, "lobby", NULL, NULL) == -1) {
+        fprintf(stderr, "Memory allocation failed for lobby member\n");
+        nameRelease(newUser->id);
+        pthread_mutex_destroy(&newUser->sendLock);
+        free(newUser);
+        return NULL;
+    }
+
+    lockprofAcquire(&userLock, &lockStatsUser);
 
     if (userBack == NULL) {
         userFront = newUser;
@@ -31,19 +127,24 @@ User *user_add(const int client_fd) {
         newUser->prev = userBack;
         userBack = newUser;
     }
+    User **bucket = &nameIndex[name_bucket(newUser->name)];
+    newUser->hashNext = *bucket;
+    *bucket = newUser;
 
     pthread_mutex_unlock(&userLock);
+    memoryAdd(MEM_USER, sizeof(User));
+    newUser->socketBytes = memoryConnectionOpen(client_fd);
     return newUser;
 }
 
 //--- Loescht einen User ---//
 void user_remove(User *user) {
-    pthread_mutex_lock(&userLock);
+    if (user == NULL) return;
 
-    if (user == NULL) {
-        pthread_mutex_unlock(&userLock);
-        return;
-    }
+    //- Zuerst aus dem Raum, danach verteilt der Broadcast Agent nicht mehr an ihn -//
+    room_leave(user);
+
+    lockprofAcquire(&userLock, &lockStatsUser);
     if (user->prev == NULL) {
         userFront = user->next;
     } else {
@@ -54,14 +155,43 @@ void user_remove(User *user) {
     } else {
         user->next->prev = user->prev;
     }
+    User **link = &nameIndex[name_bucket(user->name)];
+    while (*link != user) link = &(*link)->hashNext;
+    *link = user->hashNext;
 
     pthread_mutex_unlock(&userLock);
+    timerCancel(&user->idleTimer);
+    user_cancel_stall_timeout(user); //- Sollte nie noetig sein: jeder Sender haengt ihn selbst wieder aus -//
+    zerocopyRelease(&user->zc, user->sock); //- Nach dem Aushaengen sendet der Broadcast Agent nicht mehr an ihn -//
+    user_put(user); //- Socket bleibt offen, solange noch jemand (zB /msg, /kick) eine Referenz haelt -//
+}
+
+void user_get(User *user) {
+    __atomic_add_fetch(&user->refs, 1, __ATOMIC_RELAXED);
+}
+
+void user_put(User *user) {
+    if (__atomic_sub_fetch(&user->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    nameRelease(user->id); //- Noch wartende Nachrichten halten eigene Referenzen auf den Namen -//
+    compressDetach(user->sock); //- Vor close, sonst erbt eine neue Verbindung den Strom -//
+    captureClose(user->sock); //- Falls der Client Thread es nicht mehr konnte -//
     close(user->sock);
+    sessionRelease(&user->session); //- Auch eine noch nicht uebernommene Verbindung -//
+    pthread_mutex_destroy(&user->sendLock);
+    memoryConnectionClose(user->socketBytes);
+    memoryAdd(MEM_USER, -(int64_t) (sizeof(User) + user->ignoredWords * sizeof(uint64_t)
+                                    + user->ignoredCapacity * sizeof(IgnoreEntry)));
+    memoryAdd(MEM_BUFFER, -(int64_t) user->rxCapacity);
+    free(user->rxBuffer);
+    free(user->ignored);
+    free(user->ignoredEntries);
+    for (size_t i = 0; i < user->deferredCount; i++) frameRelease(user->deferred[i]);
+    free(user->deferred);
     free(user);
 }
 
 void user_iterate(void (*func)(User *)) {
-    pthread_mutex_lock(&userLock);
+    lockprofAcquire(&userLock, &lockStatsUser);
 
     User *current = userFront;
     while (current != NULL) {
@@ -72,17 +202,208 @@ void user_iterate(void (*func)(User *)) {
     pthread_mutex_unlock(&userLock);
 }
 
-User *user_find(const char *name) {
-    pthread_mutex_lock(&userLock);
+//--- Verlauf aus dem Nachrichtenlog senden, bevor der User selbst im Chat auftaucht ---//
+int user_replay_history(User *user) {
+    //- Ohne sendLock: das Warten auf den Log Schreiber und das writev halten weder Broadcast Agent noch /msg auf. -//
+    //- Solange replaying gesetzt ist, schreibt sonst niemand auf den Socket, alles Neuere wartet in deferred -//
+    user_arm_stall_timeout(user);
+    int result = user->resumed ? 0 : msglogReplay(user->sock, user->historyEnd);
 
-    User *current = userFront;
-    while (current != NULL) {
-        if (strcmp(current->name, name) == 0) {
-            pthread_mutex_unlock(&userLock);
-            return current;
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    for (size_t i = 0; i < user->deferredCount; i++) {
+        if (result == 0) result = sendFrame(user->sock, user->deferred[i]);
+        frameRelease(user->deferred[i]);
+    }
+    free(user->deferred);
+    user->deferred = NULL;
+    user->deferredCount = 0;
+    user->deferredCapacity = 0;
+    user->replaying = 0;
+    user_cancel_stall_timeout(user);
+    pthread_mutex_unlock(&user->sendLock);
+    return result;
+}
+
+int user_defer_frame(User *user, Frame *frame) {
+    if (user->deferredCount == user->deferredCapacity) {
+        const size_t capacity = user->deferredCapacity ? user->deferredCapacity * 2 : 16;
+        Frame **grown = realloc(user->deferred, capacity * sizeof(Frame *));
+        if (grown == NULL) {
+            frameRelease(frame);
+            return -1;
         }
-        current = current->next;
+        user->deferred = grown;
+        user->deferredCapacity = capacity;
+    }
+    user->deferred[user->deferredCount++] = frame;
+    return 0;
+}
+
+User *user_find(const char *name) {
+    lockprofAcquire(&userLock, &lockStatsUser);
+
+    User *current = nameIndex[name_bucket(name)];
+    while (current != NULL && strcmp(current->name, name) != 0) {
+        current = current->hashNext;
     }
+    if (current != NULL) __atomic_add_fetch(&current->refs, 1, __ATOMIC_RELAXED);
+
     pthread_mutex_unlock(&userLock);
-    return NULL;
+    return current;
+}
+
+//--- Der Aufrufer haelt user->sendLock ---//
+static int send_text_locked(User *user, const char *sender, const char *text, const uint64_t timestamp) {
+    if (user->replaying) {
+        //- Sein Verlauf geht gerade ohne sendLock raus: als Frame hinter die anderen zurueckgehaltenen -//
+        InternalMessage msg = {0};
+        msg.type = MT_SERVER_TO_CLIENT;
+        msg.timestamp = timestamp;
+        memcpy(msg.text, text, strnlen(text, sizeof(msg.text)));
+        Frame *frame = frameEncode(&msg, sender != NULL ? sender : "");
+        return frame != NULL ? user_defer_frame(user, frame) : -1;
+    }
+    user_arm_stall_timeout(user);
+    const int result = sendServer2Client(user->sock, sender, text, timestamp);
+    user_cancel_stall_timeout(user);
+    return result;
+}
+
+//--- Direktversand an einen einzelnen User, zB /msg; gleicher Schutz wie beim Broadcast Agent ---//
+int user_send_text(User *user, const char *sender, const char *text, const uint64_t timestamp) {
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    const int result = send_text_locked(user, sender, text, timestamp);
+    pthread_mutex_unlock(&user->sendLock);
+    return result;
+}
+
+int user_send_names(User *user, char (*names)[32], const size_t count, const int added) {
+    int result = 0;
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    user_arm_stall_timeout(user);
+    for (size_t i = 0; i < count && result == 0; i++) {
+        result = added ? sendUserAdded(user->sock, names[i], 0) : sendUserRemoved(user->sock, names[i], 0, 0);
+    }
+    user_cancel_stall_timeout(user);
+    pthread_mutex_unlock(&user->sendLock);
+    return result;
+}
+
+int user_send_private(User *user, const User *sender, const char *text, const uint64_t timestamp) {
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    //- Dieselbe Pruefung wie im Broadcast Agent, unter demselben Lock wie /ignore -//
+    const int result = user_ignores(user, sender->id) ? 1 : send_text_locked(user, sender->name, text, timestamp);
+    pthread_mutex_unlock(&user->sendLock);
+    return result;
+}
+
+int user_ignore_current(const User *user, const uint32_t id) {
+    for (size_t i = 0; i < user->ignoredCount; i++) {
+        if (user->ignoredEntries[i].id == id) return user->ignoredEntries[i].generation == nameGeneration(id);
+    }
+    return 0;
+}
+
+size_t user_ignored_ids(const User *user, uint32_t *ids) {
+    size_t count = 0;
+    for (size_t i = 0; i < user->ignoredCount; i++) {
+        const IgnoreEntry *entry = &user->ignoredEntries[i];
+        if (entry->generation == nameGeneration(entry->id)) ids[count++] = entry->id;
+    }
+    return count;
+}
+
+//--- Eintrag entfernen und sein Bit loeschen; der Aufrufer haelt sendLock ---//
+static void ignore_drop(User *user, const size_t index) {
+    const uint32_t id = user->ignoredEntries[index].id;
+    user->ignored[id / 64] &= ~(UINT64_C(1) << (id % 64));
+    user->ignoredEntries[index] = user->ignoredEntries[--user->ignoredCount];
+}
+
+//--- Bit fuer die ID setzen oder loeschen; die Menge waechst bei Bedarf ---//
+//- Veraltete Eintraege (ID neu vergeben) raeumt erst der naechste Aufruf weg, nicht die Abmeldung des Ignorierten -//
+int user_ignore(User *user, const uint32_t id, const int ignore) {
+    const size_t word = id / 64;
+    int result = 0;
+
+    lockprofAcquire(&user->sendLock, &lockStatsSend);
+    for (size_t i = 0; i < user->ignoredCount;) {
+        const IgnoreEntry *entry = &user->ignoredEntries[i];
+        if (entry->id == id || entry->generation != nameGeneration(entry->id)) ignore_drop(user, i);
+        else i++;
+    }
+    if (ignore && user->ignoredCount == user->ignoredCapacity) {
+        const size_t capacity = user->ignoredCapacity ? user->ignoredCapacity * 2 : 4;
+        IgnoreEntry *grown = realloc(user->ignoredEntries, capacity * sizeof(IgnoreEntry));
+        if (grown == NULL) {
+            result = -1;
+        } else {
+            memoryAdd(MEM_USER, (int64_t) ((capacity - user->ignoredCapacity) * sizeof(IgnoreEntry)));
+            user->ignoredEntries = grown;
+            user->ignoredCapacity = capacity;
+        }
+    }
+    if (ignore && word >= user->ignoredWords) {
+        uint64_t *grown = realloc(user->ignored, (word + 1) * sizeof(uint64_t));
+        if (grown == NULL) {
+            result = -1;
+        } else {
+            memset(grown + user->ignoredWords, 0, (word + 1 - user->ignoredWords) * sizeof(uint64_t));
+            memoryAdd(MEM_USER, (int64_t) ((word + 1 - user->ignoredWords) * sizeof(uint64_t)));
+            user->ignored = grown;
+            user->ignoredWords = word + 1;
+        }
+    }
+    if (result == 0 && ignore && word < user->ignoredWords) {
+        user->ignored[word] |= UINT64_C(1) << (id % 64);
+        user->ignoredEntries[user->ignoredCount].id = id;
+        user->ignoredEntries[user->ignoredCount].generation = nameGeneration(id);
+        user->ignoredCount++;
+    }
+    pthread_mutex_unlock(&user->sendLock);
+    return result;
+}
+
+void user_set_timeouts(const unsigned int idleMs, const unsigned int stallMs) {
+    idleTimeoutMs = idleMs;
+    stallTimeoutMs = stallMs;
+    if (stallMs != 0) timerAddSweep(stall_sweep);
+}
+
+//--- Nach jeder empfangenen Nachricht neu starten ---//
+void user_arm_idle_timeout(User *user) {
+    if (idleTimeoutMs == 0) return;
+    timerArm(&user->idleTimer, idleTimeoutMs);
+}
+
+void user_cancel_idle_timeout(User *user) {
+    timerCancel(&user->idleTimer);
+}
+
+//--- Pro Sendung Frist setzen und in die Liste, ohne die Sperre des Rads; stall_sweep prueft sie jeden Tick ---//
+void user_arm_stall_timeout(User *user) {
+    if (stallTimeoutMs == 0) return;
+    const uint64_t ticks = (stallTimeoutMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    const uint64_t deadline = timerNow() + (ticks ? ticks : 1);
+    pthread_mutex_lock(&stallLock);
+    if (user->stallDeadline == 0) {
+        user->stallPrev = NULL;
+        user->stallNext = stallHead;
+        if (stallHead != NULL) stallHead->stallPrev = user;
+        stallHead = user;
+    }
+    user->stallDeadline = deadline;
+    pthread_mutex_unlock(&stallLock);
+}
+
+void user_cancel_stall_timeout(User *user) {
+    if (stallTimeoutMs == 0) return;
+    pthread_mutex_lock(&stallLock);
+    if (user->stallDeadline != 0) stall_unlink(user); //- Schon abgelaufen: der Sweep hat ihn ausgehaengt -//
+    pthread_mutex_unlock(&stallLock);
+}
+
+void user_timeout_stats_format(char *buf, const size_t size) {
+    snprintf(buf, size, "timeouts: idle=%lu stall=%lu (limits %u/%u ms)",
+             idleExpiredCount, stallExpiredCount, idleTimeoutMs, stallTimeoutMs);
 }
@@ -2,23 +2,110 @@
 #define USER_H
 
 #include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "session.h"
+#include "timerwheel.h"
+#include "zerocopy.h"
+
+typedef struct {
+    uint32_t id;
+    uint32_t generation; //nameGeneration() at /ignore; a different one means the ID now belongs to someone else
+} IgnoreEntry;
 
 typedef struct User {
     struct User *prev;
     struct User *next;
+    struct User *hashNext; //next user in the same bucket of the name index
+    unsigned int refs; //list entry plus every user_find() caller, freed at 0
+    uint32_t id; //interned name ID (names.h), reused once no queued message refers to it
     pthread_t thread; //thread ID of the client thread
     int sock; //socket for client
     int closeReason;
+    uint8_t version; //protocol version from the LoginRequest, 1 = batch frames
+    int resumed; //taken over from the previous process by a hot restart (handoff.c)
+    int handoffState; //0 active, 1 parked for a hot restart, 2 thread finished
+    int handedOver; //sock belongs to the successor of a hot restart, nobody writes to it; protected by sendLock
+    pthread_mutex_t sendLock; //serializes frames written by different threads to sock
+    uint64_t historyEnd; //log sequence number when the user became visible to the broadcast agent
+    int replaying; //set until user_replay_history is done; other writers park their frames in deferred (sendLock)
+    Frame **deferred; //frames for the client that arrived during the history replay, in order
+    size_t deferredCount;
+    size_t deferredCapacity;
+    int room; //current room, see room.h
+    size_t roomSlot; //index in the member array of the room
+    Timer idleTimer; //idle timeout
+    uint64_t stallDeadline; //tick (timerNow) by which the current send must finish, 0 = none (not linked); stallLock
+    struct User *stallPrev; //list of users with a send in flight, the only ones the stall sweep visits; stallLock
+    struct User *stallNext;
+    uint64_t *ignored; //bitset of ignored user IDs, protected by sendLock
+    size_t ignoredWords;
+    IgnoreEntry *ignoredEntries; //one per set bit, protected by sendLock
+    size_t ignoredCount;
+    size_t ignoredCapacity;
+    ZeroCopyState zc; //frames still referenced by MSG_ZEROCOPY sends, only touched by the broadcast agent
+    unsigned char *rxBuffer; //receive buffer of the client thread, allocated on demand and freed when idle
+    size_t rxCapacity;
+    int64_t socketBytes; //socket buffers accounted in memory.h at login
+    SessionState session; //resumable session (session.h), protected by sendLock
 
     char name[32];
 } User;
 
-User *user_add(int client_fd);
+User *user_add(int client_fd, const char *name);
 
 void user_remove(User *user);
 
 void user_iterate(void (*func)(User *));
 
+// Verlauf (ausser nach einem Hot Restart) ohne sendLock senden, dann die zurueckgehaltenen Frames; beendet replaying
+int user_replay_history(User *user);
+
+// Waehrend replaying statt zu senden: der Aufrufer haelt sendLock und gibt seine Referenz auf frame ab
+int user_defer_frame(User *user, Frame *frame);
+
+// Liefert den User mit einer zusaetzlichen Referenz, die mit user_put() freigegeben werden muss
 User *user_find(const char *name);
 
+void user_get(User *user);
+
+void user_put(User *user);
+
+// Schreibt eine ServerToClient Nachricht direkt (unter sendLock) an den User, ohne Broadcast Queue
+int user_send_text(User *user, const char *sender, const char *text, uint64_t timestamp);
+
+// Userliste an den User: UserAdded (added = 1) bzw. UserRemoved mit Timestamp 0 fuer jeden Namen, unter sendLock
+int user_send_names(User *user, char (*names)[32], size_t count, int added);
+
+// Wie user_send_text mit sender als Absender, aber 1 ohne zu senden, wenn user ihn ignoriert (/msg)
+int user_send_private(User *user, const User *sender, const char *text, uint64_t timestamp);
+
+// Nur fuer ein gesetztes Bit: gilt es noch fuer die aktuelle Generation der ID?
+int user_ignore_current(const User *user, uint32_t id);
+
+// Ein Bittest pro Empfaenger, der Aufrufer haelt user->sendLock; veraltete Bits gelten als geloescht
+static inline int user_ignores(const User *user, const uint32_t id) {
+    const size_t word = id / 64;
+    if (word >= user->ignoredWords || !(user->ignored[word] >> (id % 64) & 1)) return 0;
+    return user_ignore_current(user, id);
+}
+
+int user_ignore(User *user, uint32_t id, int ignore);
+
+// Aktuell ignorierte IDs, ids braucht Platz fuer user->ignoredCount; der Aufrufer haelt user->sendLock
+size_t user_ignored_ids(const User *user, uint32_t *ids);
+
+void user_set_timeouts(unsigned int idleMs, unsigned int stallMs);
+
+void user_arm_idle_timeout(User *user);
+
+void user_cancel_idle_timeout(User *user);
+
+void user_arm_stall_timeout(User *user);
+
+void user_cancel_stall_timeout(User *user);
+
+void user_timeout_stats_format(char *buf, size_t size);
+
 #endif
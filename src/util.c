@@ -9,6 +9,8 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include "util.h"
+#include "lockprof.h"
+#include "validate.h"
 
 typedef enum {
     STYLE_NORMAL,
@@ -30,7 +32,7 @@ static int style_enabled = 1;
 static int lockFile(FILE *file) {
     int oldState;
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
-    flockfile(file);
+    lockprofLockFile(file, &lockStatsPrint);
     return oldState;
 }
 
@@ -248,27 +250,9 @@ void vhexdump(const void *ptr, size_t n, const char *fmt, va_list args) {
     unlockFile(stderr, savedCancelState);
 }
 
+//Same rules as before (33-126 without quotes), now one implementation for login, rooms and commands
 size_t nameBytesValidate(const char *input, size_t n) {
-    const unsigned char *s = (const unsigned char *) input;
-    size_t i;
-
-    for (i = 0U; i < n; ++i) {
-        //Reject lower control characters and spaces
-        if (s[i] < 33)
-            return i;
-
-        //Reject quotes: "'`
-        if (s[i] == 34 || s[i] == 39 || s[i] == 96)
-            return i;
-
-        //Reject DEL and above
-        if (s[i] >= 127)
-            return i;
-
-        //Everything else is okay
-    }
-
-    return i;
+    return validateName(input, n);
 }
 
 uint64_t ntoh64u(uint64_t network64u) {
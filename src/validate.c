@@ -0,0 +1,177 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "validate.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define VALIDATE_X86 1
+#endif
+
+#define CLASS_NAME 1
+#define CLASS_TEXT 2
+
+#define CLASS_BOTH (CLASS_NAME | CLASS_TEXT)
+
+//- Eine Tabelle fuer beide Klassen; die Vektorvarianten pruefen dieselben Grenzen mit Vergleichen -//
+static const uint8_t classes[256] = {
+    ['\t'] = CLASS_TEXT, [32] = CLASS_TEXT,
+    [33] = CLASS_BOTH, [34] = CLASS_TEXT, [35 ... 38] = CLASS_BOTH, [39] = CLASS_TEXT,
+    [40 ... 95] = CLASS_BOTH, [96] = CLASS_TEXT, [97 ... 126] = CLASS_BOTH,
+    [128 ... 255] = CLASS_TEXT
+};
+
+static size_t name_scalar(const char *input, size_t n);
+
+static size_t text_scalar(const char *input, size_t n);
+
+static size_t (*nameImpl)(const char *, size_t) = name_scalar;
+static size_t (*textImpl)(const char *, size_t) = text_scalar;
+static const char *implName = "scalar";
+
+static size_t scan_scalar(const char *input, const size_t n, const uint8_t class) {
+    const unsigned char *s = (const unsigned char *) input;
+    for (size_t i = 0; i < n; i++) {
+        if (!(classes[s[i]] & class)) return i;
+    }
+    return n;
+}
+
+static size_t name_scalar(const char *input, const size_t n) {
+    return scan_scalar(input, n, CLASS_NAME);
+}
+
+static size_t text_scalar(const char *input, const size_t n) {
+    return scan_scalar(input, n, CLASS_TEXT);
+}
+
+#ifdef VALIDATE_X86
+//--- SSE2: 16 Bytes je Schritt; Bereichstests ueber vorzeichenlose Minima, da SSE2 nur signed vergleicht ---//
+
+//- Maske der ungueltigen Namensbytes: ausserhalb 33-126 oder eines der drei Anfuehrungszeichen -//
+static inline __m128i name_bad_sse2(const __m128i v) {
+    const __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8(33)); //- 33-126 -> 0-93 -//
+    const __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(93)), shifted);
+    const __m128i quotes = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(34)),
+                                                     _mm_cmpeq_epi8(v, _mm_set1_epi8(39))),
+                                        _mm_cmpeq_epi8(v, _mm_set1_epi8(96)));
+    return _mm_or_si128(_mm_andnot_si128(inRange, _mm_set1_epi8(-1)), quotes);
+}
+
+//- Ungueltige Textbytes: unter 32 ausser Tab, oder DEL -//
+static inline __m128i text_bad_sse2(const __m128i v) {
+    const __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(31)), v);
+    const __m128i tab = _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'));
+    return _mm_or_si128(_mm_andnot_si128(tab, control), _mm_cmpeq_epi8(v, _mm_set1_epi8(127)));
+}
+
+#define SCAN_SSE2(input, n, bad, scalar)                                                                    \
+    do {                                                                                                    \
+        if ((n) < 16) return scalar(input, n);                                                              \
+        size_t i = 0;                                                                                       \
+        for (; i + 16 <= (n); i += 16) {                                                                    \
+            const int mask = _mm_movemask_epi8(bad(_mm_loadu_si128((const __m128i *) ((input) + i))));      \
+            if (mask) return i + (size_t) __builtin_ctz((unsigned int) mask);                               \
+        }                                                                                                   \
+        if (i == (n)) return (n);                                                                           \
+        /*- Rest: letzte 16 Bytes ueberlappend, der schon gepruefte Teil ist gueltig -*/                    \
+        i = (n) - 16;                                                                                       \
+        const int mask = _mm_movemask_epi8(bad(_mm_loadu_si128((const __m128i *) ((input) + i))));          \
+        return mask ? i + (size_t) __builtin_ctz((unsigned int) mask) : (n);                                \
+    } while (0)
+
+static size_t name_sse2(const char *input, const size_t n) {
+    SCAN_SSE2(input, n, name_bad_sse2, name_scalar);
+}
+
+static size_t text_sse2(const char *input, const size_t n) {
+    SCAN_SSE2(input, n, text_bad_sse2, text_scalar);
+}
+
+//--- AVX2: dieselben Tests mit 32 Bytes; nur aufgerufen, wenn die CPU es meldet ---//
+__attribute__((target("avx2")))
+static inline __m256i name_bad_avx2(const __m256i v) {
+    const __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8(33));
+    const __m256i inRange = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(93)), shifted);
+    const __m256i quotes = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(34)),
+                                                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8(39))),
+                                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8(96)));
+    return _mm256_or_si256(_mm256_andnot_si256(inRange, _mm256_set1_epi8(-1)), quotes);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i text_bad_avx2(const __m256i v) {
+    const __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(31)), v);
+    const __m256i tab = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'));
+    return _mm256_or_si256(_mm256_andnot_si256(tab, control), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(127)));
+}
+
+//- Unter 32 Bytes (jeder Name) reicht SSE2 -//
+#define SCAN_AVX2(input, n, bad, shorter)                                                                   \
+    do {                                                                                                    \
+        if ((n) < 32) return shorter(input, n);                                                             \
+        size_t i = 0;                                                                                       \
+        for (; i + 32 <= (n); i += 32) {                                                                    \
+            const unsigned int mask = (unsigned int) _mm256_movemask_epi8(                                  \
+                bad(_mm256_loadu_si256((const __m256i *) ((input) + i))));                                  \
+            if (mask) return i + (size_t) __builtin_ctz(mask);                                              \
+        }                                                                                                   \
+        if (i == (n)) return (n);                                                                           \
+        i = (n) - 32;                                                                                       \
+        const unsigned int mask = (unsigned int) _mm256_movemask_epi8(                                      \
+            bad(_mm256_loadu_si256((const __m256i *) ((input) + i))));                                      \
+        return mask ? i + (size_t) __builtin_ctz(mask) : (n);                                               \
+    } while (0)
+
+__attribute__((target("avx2")))
+static size_t name_avx2(const char *input, const size_t n) {
+    SCAN_AVX2(input, n, name_bad_avx2, name_sse2);
+}
+
+__attribute__((target("avx2")))
+static size_t text_avx2(const char *input, const size_t n) {
+    SCAN_AVX2(input, n, text_bad_avx2, text_sse2);
+}
+#endif
+
+int validateSelect(const char *implementation) {
+    const int best = strcmp(implementation, "auto") == 0;
+#ifdef VALIDATE_X86
+    __builtin_cpu_init();
+    if ((best || strcmp(implementation, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        nameImpl = name_avx2;
+        textImpl = text_avx2;
+        implName = "avx2";
+        return 0;
+    }
+    if (best || strcmp(implementation, "sse2") == 0) {
+        nameImpl = name_sse2; //- Auf x86-64 immer vorhanden -//
+        textImpl = text_sse2;
+        implName = "sse2";
+        return 0;
+    }
+#endif
+    if (best || strcmp(implementation, "scalar") == 0) {
+        nameImpl = name_scalar;
+        textImpl = text_scalar;
+        implName = "scalar";
+        return 0;
+    }
+    return -1;
+}
+
+void validateInit(void) {
+    validateSelect("auto");
+}
+
+const char *validateImplementation(void) {
+    return implName;
+}
+
+size_t validateName(const char *input, const size_t n) {
+    return nameImpl(input, n);
+}
+
+size_t validateText(const char *input, const size_t n) {
+    return textImpl(input, n);
+}
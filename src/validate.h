@@ -0,0 +1,21 @@
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+#include <stddef.h>
+
+// Namen (User, Raum): 33-126 ohne " ' `; Text: ab 32 und Tab, ohne DEL, Bytes ab 128 (UTF-8) erlaubt.
+// Beide liefern den Index des ersten ungueltigen Bytes bzw. n, wenn alles gueltig ist.
+
+// Waehlt die schnellste Variante der CPU (AVX2, SSE2, skalar); vor dem ersten Aufruf, ohne Init laeuft skalar
+void validateInit(void);
+
+// Fuer den Benchmark: "scalar", "sse2", "avx2" oder "auto"; -1 wenn die CPU sie nicht kann
+int validateSelect(const char *implementation);
+
+const char *validateImplementation(void);
+
+size_t validateName(const char *input, size_t n);
+
+size_t validateText(const char *input, size_t n);
+
+#endif
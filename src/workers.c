@@ -0,0 +1,438 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "workers.h"
+#include "broadcastagent.h"
+#include "lockprof.h"
+#include "names.h"
+#include "room.h"
+#include "util.h"
+
+#define WORKER_RING_SIZE 1024 // Nachrichten; wer weiter zurueckliegt, verliert die aeltesten
+#define WORKER_REGISTRY_SIZE 16384 // Zweierpotenz, offene Adressierung
+#define REGISTRY_FREE (-1)
+#define REGISTRY_DELETED (-2)
+
+//- Ein Eintrag im Ring: Namen im Klartext, die IDs aus names.c gelten nur im eigenen Prozess -//
+typedef struct {
+    uint32_t worker;
+    uint8_t type;
+    uint8_t code;
+    uint16_t textLen;
+    uint64_t timestamp;
+    char name[32];
+    char text[512];
+} RingSlot;
+
+typedef struct {
+    int32_t worker; // Index des Workers oder REGISTRY_FREE / REGISTRY_DELETED
+    int32_t lobby; // Gerade in der Lobby, fuer die Liste eines neu gestarteten Workers
+    char name[32];
+} RegistryEntry;
+
+//- Liegt in MAP_SHARED Speicher, der vor dem fork angelegt wird; Lock und Condition sind prozessuebergreifend -//
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t head; // Naechste zu schreibende Nummer
+    uint32_t registryUsed;
+    RegistryEntry registry[WORKER_REGISTRY_SIZE];
+    RingSlot ring[WORKER_RING_SIZE];
+} SharedArea;
+
+typedef struct {
+    uint32_t worker;
+    uint32_t id;
+    char name[32];
+} RemoteUser;
+
+extern volatile sig_atomic_t serverRunning;
+
+static SharedArea *shared = NULL;
+static int enabled = 0;
+static unsigned int workerCount;
+static unsigned int workerIndex;
+static pid_t pids[WORKERS_MAX];
+
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+static RemoteUser *remote; // User der anderen Worker, hier mit eigener ID
+static size_t remoteCount;
+static size_t remoteCapacity;
+static unsigned long statReceived;
+static unsigned long statLost;
+
+//--- Robuster Mutex: stirbt ein Worker mit dem Lock, uebernimmt der naechste ---//
+static void shared_lock(void) {
+    if (pthread_mutex_lock(&shared->lock) == EOWNERDEAD) pthread_mutex_consistent(&shared->lock);
+}
+
+static void shared_wait(void) {
+    if (pthread_cond_wait(&shared->cond, &shared->lock) == EOWNERDEAD) pthread_mutex_consistent(&shared->lock);
+}
+
+static uint32_t registry_hash(const char *name) {
+    uint32_t hash = 2166136261U; //- FNV-1a -//
+    for (const unsigned char *p = (const unsigned char *) name; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+//--- Unter shared->lock: Eintrag zum Namen oder NULL ---//
+static RegistryEntry *registry_find(const char *name) {
+    uint32_t i = registry_hash(name) & (WORKER_REGISTRY_SIZE - 1);
+    for (uint32_t n = 0; n < WORKER_REGISTRY_SIZE; n++, i = (i + 1) & (WORKER_REGISTRY_SIZE - 1)) {
+        RegistryEntry *entry = &shared->registry[i];
+        if (entry->worker == REGISTRY_FREE) return NULL;
+        if (entry->worker >= 0 && strcmp(entry->name, name) == 0) return entry;
+    }
+    return NULL;
+}
+
+//--- Unter shared->lock: Eintrag loeschen; Grabsteine vor einem freien Platz werden wieder frei ---//
+//- Bei linearer Sondierung endet jede Suche, die hier vorbeikaeme, ohnehin am freien Nachfolger -//
+static void registry_delete(RegistryEntry *entry) {
+    uint32_t i = (uint32_t) (entry - shared->registry);
+    entry->worker = REGISTRY_DELETED;
+    shared->registryUsed--;
+    if (shared->registry[(i + 1) & (WORKER_REGISTRY_SIZE - 1)].worker != REGISTRY_FREE) return;
+    for (uint32_t n = 0; n < WORKER_REGISTRY_SIZE && shared->registry[i].worker == REGISTRY_DELETED; n++) {
+        shared->registry[i].worker = REGISTRY_FREE;
+        i = (i - 1) & (WORKER_REGISTRY_SIZE - 1);
+    }
+}
+
+//--- Unter shared->lock: Nachricht an alle Worker, auch an den eigenen Leser (der sie ueberspringt) ---//
+static void ring_push(const uint32_t worker, const uint8_t type, const uint8_t code, const uint64_t timestamp,
+                      const char *name, const char *text, const size_t textLen) {
+    RingSlot *slot = &shared->ring[shared->head % WORKER_RING_SIZE];
+    slot->worker = worker;
+    slot->type = type;
+    slot->code = code;
+    slot->timestamp = timestamp;
+    memset(slot->name, 0, sizeof(slot->name));
+    strncpy(slot->name, name, 31);
+    slot->textLen = (uint16_t) textLen;
+    if (textLen > 0) memcpy(slot->text, text, textLen);
+    shared->head++;
+    pthread_cond_broadcast(&shared->cond);
+}
+
+//--- Im Supervisor: die User eines abgestuerzten Workers abmelden ---//
+static void worker_reap(const unsigned int index) {
+    shared_lock();
+    for (uint32_t i = 0; i < WORKER_REGISTRY_SIZE; i++) {
+        RegistryEntry *entry = &shared->registry[i];
+        if (entry->worker != (int32_t) index) continue;
+        if (entry->lobby) ring_push(index, MT_USER_REMOVED, 2, (uint64_t) time(NULL), entry->name, NULL, 0);
+        registry_delete(entry);
+    }
+    pthread_mutex_unlock(&shared->lock);
+}
+
+static RemoteUser *remote_find(const char *name) {
+    for (size_t i = 0; i < remoteCount; i++) {
+        if (strcmp(remote[i].name, name) == 0) return &remote[i];
+    }
+    return NULL;
+}
+
+//--- Unter cacheLock: User eines anderen Workers eintragen, liefert seine lokale ID ---//
+static uint32_t remote_add(const uint32_t worker, const char *name) {
+    if (remoteCount == remoteCapacity) {
+        const size_t capacity = remoteCapacity ? remoteCapacity * 2 : 64;
+        RemoteUser *grown = realloc(remote, capacity * sizeof(RemoteUser));
+        if (grown == NULL) return NAME_ID_NONE;
+        remote = grown;
+        remoteCapacity = capacity;
+    }
+    const uint32_t id = nameIntern(name);
+    if (id == NAME_ID_NONE) return NAME_ID_NONE;
+
+    RemoteUser *entry = &remote[remoteCount++];
+    entry->worker = worker;
+    entry->id = id;
+    memset(entry->name, 0, sizeof(entry->name));
+    strncpy(entry->name, name, 31);
+    return id;
+}
+
+//--- Nachricht eines anderen Workers in die eigene Broadcast Queue ---//
+static void ring_inject(const RingSlot *slot) {
+    InternalMessage msg = {0};
+    msg.type = slot->type;
+    msg.code = slot->code;
+    msg.room = ROOM_LOBBY;
+    msg.via = VIA_WORKERS;
+    msg.timestamp = slot->timestamp;
+
+    uint32_t dropId = NAME_ID_NONE;
+    pthread_mutex_lock(&cacheLock);
+    RemoteUser *entry = remote_find(slot->name);
+    switch (slot->type) {
+        case MT_SERVER_TO_CLIENT:
+            msg.userId = entry != NULL ? entry->id : remote_add(slot->worker, slot->name);
+            memcpy(msg.text, slot->text, slot->textLen);
+            break;
+        case MT_USER_ADDED:
+            msg.userId = entry == NULL ? remote_add(slot->worker, slot->name) : NAME_ID_NONE;
+            break;
+        case MT_USER_REMOVED:
+            if (entry != NULL) {
+                msg.userId = dropId = entry->id;
+                *entry = remote[--remoteCount];
+            } else {
+                msg.userId = NAME_ID_NONE;
+            }
+            break;
+        default:
+            msg.userId = NAME_ID_NONE;
+            break;
+    }
+    if (msg.userId == NAME_ID_NONE) {
+        pthread_mutex_unlock(&cacheLock);
+        return;
+    }
+    nameRetain(msg.userId);
+    statReceived++;
+    pthread_mutex_unlock(&cacheLock);
+
+    broadcastQueueSend(&msg);
+    nameRelease(msg.userId);
+    nameRelease(dropId);
+}
+
+static void *ringReader(void *arg) {
+    uint64_t cursor = *(uint64_t *) arg;
+    free(arg);
+    RingSlot slot;
+
+    while (1) {
+        shared_lock();
+        while (cursor == shared->head) shared_wait();
+        if (shared->head - cursor > WORKER_RING_SIZE) {
+            //- Zu weit zurueck, die Plaetze sind schon ueberschrieben -//
+            statLost += shared->head - cursor - WORKER_RING_SIZE;
+            cursor = shared->head - WORKER_RING_SIZE;
+        }
+        slot = shared->ring[cursor % WORKER_RING_SIZE];
+        cursor++;
+        pthread_mutex_unlock(&shared->lock);
+
+        if (slot.worker != workerIndex) ring_inject(&slot);
+    }
+    return NULL;
+}
+
+int workersStart(const unsigned int count) {
+    if (count > WORKERS_MAX) {
+        errorPrint("At most %d workers are supported", WORKERS_MAX);
+        return -1;
+    }
+
+    shared = mmap(NULL, sizeof(SharedArea), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        errnoPrint("mmap shared area");
+        return -1;
+    }
+    pthread_mutexattr_t mutexAttr;
+    pthread_mutexattr_init(&mutexAttr);
+    pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutexAttr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&shared->lock, &mutexAttr);
+    pthread_mutexattr_destroy(&mutexAttr);
+
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&shared->cond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    for (uint32_t i = 0; i < WORKER_REGISTRY_SIZE; i++) shared->registry[i].worker = REGISTRY_FREE;
+    workerCount = count;
+    enabled = 1;
+
+    //- Vor dem fork laufen noch keine Threads, jeder Worker startet alle Module selbst -//
+    for (unsigned int i = 0; i < count; i++) {
+        const pid_t pid = fork();
+        if (pid == -1) {
+            errnoPrint("fork");
+            return -1;
+        }
+        if (pid == 0) {
+            workerIndex = i;
+            return (int) i;
+        }
+        pids[i] = pid;
+    }
+    infoPrint("Supervisor started %u workers", count);
+
+    //--- Supervisor: abgestuerzte Worker abmelden und neu starten, bis SIGINT kommt ---//
+    int forwarded = 0;
+    while (1) {
+        int status;
+        const pid_t pid = waitpid(-1, &status, 0);
+        if (pid == -1) {
+            if (errno != EINTR) break; //- ECHILD: alle Worker beendet -//
+            if (!serverRunning && !forwarded) {
+                for (unsigned int i = 0; i < count; i++) {
+                    if (pids[i] > 0) kill(pids[i], SIGINT);
+                }
+                forwarded = 1;
+            }
+            continue;
+        }
+
+        unsigned int index = 0;
+        while (index < count && pids[index] != pid) index++;
+        if (index == count) continue;
+        pids[index] = 0;
+        worker_reap(index);
+
+        //- Nur Abstuerze neu starten, ein normales Ende (zB Startfehler) nicht -//
+        if (serverRunning && WIFSIGNALED(status) && WTERMSIG(status) != SIGINT) {
+            errorPrint("Worker %u died (signal %d), restarting", index, WTERMSIG(status));
+            const pid_t restarted = fork();
+            if (restarted == 0) {
+                workerIndex = index;
+                return (int) index;
+            }
+            if (restarted > 0) pids[index] = restarted;
+        }
+    }
+    return -2;
+}
+
+int workersEnabled(void) {
+    return enabled;
+}
+
+int workersAttach(void) {
+    if (!enabled) return 0;
+
+    uint64_t *cursor = malloc(sizeof(uint64_t));
+    if (cursor == NULL) return -1;
+
+    //- Wer schon in der Lobby eines anderen Workers ist (zB nach einem Neustart dieses Workers) -//
+    shared_lock();
+    *cursor = shared->head;
+    pthread_mutex_lock(&cacheLock);
+    for (uint32_t i = 0; i < WORKER_REGISTRY_SIZE; i++) {
+        const RegistryEntry *entry = &shared->registry[i];
+        if (entry->worker >= 0 && (uint32_t) entry->worker != workerIndex && entry->lobby) {
+            remote_add((uint32_t) entry->worker, entry->name);
+        }
+    }
+    pthread_mutex_unlock(&cacheLock);
+    pthread_mutex_unlock(&shared->lock);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ringReader, cursor) != 0) {
+        errorPrint("Failed to start ring reader thread");
+        free(cursor);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+//--- Unter shared->lock: nur den eigenen Eintrag loeschen ---//
+static void registry_release(const char *name) {
+    RegistryEntry *entry = registry_find(name);
+    if (entry != NULL && entry->worker == (int32_t) workerIndex) registry_delete(entry);
+}
+
+void workersPublish(const InternalMessage *msg, const char *name) {
+    if (!enabled || msg->via != 0 || msg->userId == NAME_ID_NONE) return;
+    const int publish = msg->room == ROOM_LOBBY;
+    //- Erst nach dem UserRemoved im Ring: sonst kaeme das UserAdded eines neuen Besitzers bei den anderen davor an -//
+    const int release = msg->type == MT_USER_REMOVED && msg->releaseName;
+    if (!publish && !release) return;
+
+    shared_lock();
+    if (publish) {
+        if (msg->type == MT_USER_ADDED || msg->type == MT_USER_REMOVED) {
+            RegistryEntry *entry = registry_find(name);
+            if (entry != NULL) entry->lobby = msg->type == MT_USER_ADDED;
+        }
+        const size_t textLen = msg->type == MT_SERVER_TO_CLIENT ? strnlen(msg->text, 512) : 0;
+        ring_push(workerIndex, msg->type, msg->code, msg->timestamp, name, msg->text, textLen);
+    }
+    if (release) registry_release(name);
+    pthread_mutex_unlock(&shared->lock);
+}
+
+int workersClaimName(const char *name) {
+    if (!enabled) return 0;
+
+    shared_lock();
+    if (registry_find(name) != NULL) {
+        pthread_mutex_unlock(&shared->lock);
+        return -1;
+    }
+    //- Erster freier oder geloeschter Platz der Sondierungsfolge -//
+    uint32_t i = registry_hash(name) & (WORKER_REGISTRY_SIZE - 1);
+    for (uint32_t n = 0; n < WORKER_REGISTRY_SIZE; n++, i = (i + 1) & (WORKER_REGISTRY_SIZE - 1)) {
+        RegistryEntry *entry = &shared->registry[i];
+        if (entry->worker < 0) {
+            entry->worker = (int32_t) workerIndex;
+            entry->lobby = 0;
+            memset(entry->name, 0, sizeof(entry->name));
+            strncpy(entry->name, name, 31);
+            shared->registryUsed++;
+            pthread_mutex_unlock(&shared->lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&shared->lock);
+    return -1; //- Registry voll -//
+}
+
+void workersReleaseName(const char *name) {
+    if (!enabled) return;
+
+    shared_lock();
+    registry_release(name);
+    pthread_mutex_unlock(&shared->lock);
+}
+
+void workersSendRoster(User *user, const int added) {
+    if (!enabled) return;
+
+    pthread_mutex_lock(&cacheLock);
+    const size_t count = remoteCount;
+    char (*names)[32] = count > 0 ? malloc(count * 32) : NULL;
+    for (size_t i = 0; names != NULL && i < count; i++) {
+        memcpy(names[i], remote[i].name, 32);
+    }
+    pthread_mutex_unlock(&cacheLock);
+    if (names == NULL) return;
+
+    user_send_names(user, names, count, added);
+    free(names);
+}
+
+void workersStatsFormat(char *buf, const size_t size) {
+    if (!enabled) {
+        snprintf(buf, size, "workers: disabled");
+        return;
+    }
+    shared_lock();
+    const uint32_t used = shared->registryUsed;
+    const uint64_t head = shared->head;
+    pthread_mutex_unlock(&shared->lock);
+
+    pthread_mutex_lock(&cacheLock);
+    snprintf(buf, size, "workers: index=%u/%u registry=%u/%d ring_head=%ju remote_users=%zu received=%lu lost=%lu",
+             workerIndex, workerCount, used, WORKER_REGISTRY_SIZE, (uintmax_t) head, remoteCount, statReceived, statLost);
+    pthread_mutex_unlock(&cacheLock);
+}
@@ -0,0 +1,35 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stddef.h>
+
+#include "network.h"
+#include "user.h"
+
+#define WORKERS_MAX 64
+#define VIA_WORKERS 255 // InternalMessage.via: kam ueber den Ring von einem anderen Worker
+
+// Legt den gemeinsamen Speicher an und startet count Worker Prozesse.
+// Liefert im Worker dessen Index (>= 0), im Supervisor -2 nach dem Ende aller Worker, -1 bei Fehler
+int workersStart(unsigned int count);
+
+int workersEnabled(void);
+
+// Im Worker nach broadcastAgentInit: liest den gemeinsamen Ring und speist ihn in die eigene Queue
+int workersAttach(void);
+
+// Vom Broadcast Agent: lokale Lobby Nachrichten in den Ring der anderen Worker; das UserRemoved einer Abmeldung
+// (releaseName) gibt danach den Namen frei
+void workersPublish(const InternalMessage *msg, const char *name);
+
+// Name prozessuebergreifend reservieren; -1 wenn ein anderer Worker ihn schon hat
+int workersClaimName(const char *name);
+
+// Nur ohne veroeffentlichtes UserAdded, sonst gibt workersPublish den Namen frei
+void workersReleaseName(const char *name);
+
+void workersSendRoster(User *user, int added);
+
+void workersStatsFormat(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,238 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+
+#include "zerocopy.h"
+#include "memory.h"
+#include "timerwheel.h"
+#include "util.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+//- 0 = Zerocopy aus; sonst minimale Framegroesse, ab der sich Pinnen und Completion lohnen -//
+static size_t threshold = 0;
+
+static unsigned long statZeroCopySends;
+static unsigned long statCopySends;
+static unsigned long statCompletions;
+static unsigned long statKernelCopied;
+static unsigned long statDrained; // Sockets, deren Completions erst nach dem Abmelden kamen
+static unsigned long statAborted; // Nach ZC_DRAIN_MS mit RST geschlossen
+
+//- Abgemeldete Sockets mit noch gepinnten Frames: ein eigener fd haelt sie offen, bis der Kernel sie freigibt -//
+typedef struct Drain {
+    struct Drain *next;
+    int fd;
+    uint64_t deadline; // Tick (timerNow), danach wird die Verbindung abgebrochen
+    ZeroCopyState zc;
+} Drain;
+
+static pthread_mutex_t drainLock = PTHREAD_MUTEX_INITIALIZER;
+static Drain *drains;
+static unsigned int drainCount;
+
+static void zc_free(ZeroCopyState *zc);
+static void reap_completions(ZeroCopyState *zc, int fd);
+
+//--- Im Timer Thread nach jedem Tick: fertige Sockets schliessen, ueberfaellige abbrechen ---//
+static void drain_sweep(const uint64_t now) {
+    pthread_mutex_lock(&drainLock);
+    Drain **link = &drains;
+    while (*link != NULL) {
+        Drain *drain = *link;
+        reap_completions(&drain->zc, drain->fd);
+        if (drain->zc.outstanding > 0 && now < drain->deadline) {
+            link = &drain->next;
+            continue;
+        }
+        if (drain->zc.outstanding > 0) {
+            //- Gegenseite nimmt nichts mehr an: RST verwirft die Sendewarteschlange und damit die Pins -//
+            const struct linger abort = {.l_onoff = 1, .l_linger = 0};
+            setsockopt(drain->fd, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+            statAborted++;
+        }
+        close(drain->fd);
+        zc_free(&drain->zc);
+        *link = drain->next;
+        drainCount--;
+        statDrained++;
+        free(drain);
+    }
+    pthread_mutex_unlock(&drainLock);
+}
+
+void zerocopySetThreshold(const size_t bytes) {
+    static int registered = 0;
+    threshold = bytes;
+    if (bytes != 0 && !registered) registered = timerAddSweep(drain_sweep) == 0;
+}
+
+size_t zerocopyThreshold(void) {
+    return threshold;
+}
+
+void zerocopyEnable(ZeroCopyState *zc, const int fd) {
+    memset(zc, 0, sizeof(*zc));
+    if (threshold == 0) return;
+
+    //- MSG_ZEROCOPY gibt es nur fuer TCP; unix: Verbindungen (--listen) senden ohne Versuch kopierend -//
+    struct sockaddr_storage addr;
+    socklen_t addrLen = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *) &addr, &addrLen) == -1
+        || (addr.ss_family != AF_INET && addr.ss_family != AF_INET6)) {
+        return;
+    }
+
+    const int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == -1) {
+        //- zB alter Kernel: dieser Socket sendet dann immer kopierend; gemeldet wird nur der erste -//
+        static int reported = 0;
+        if (!__atomic_exchange_n(&reported, 1, __ATOMIC_RELAXED)) errnoPrint("setsockopt SO_ZEROCOPY");
+        return;
+    }
+    //- Ohne --zerocopy kostet der Ring keinen User etwas -//
+    zc->pending = calloc(ZC_PENDING_MAX, sizeof(Frame *));
+    if (zc->pending == NULL) return;
+    memoryAdd(MEM_ZEROCOPY, ZC_PENDING_MAX * sizeof(Frame *));
+    zc->enabled = 1;
+}
+
+static void release_id(ZeroCopyState *zc, const uint32_t id) {
+    Frame **slot = &zc->pending[id % ZC_PENDING_MAX];
+    if (*slot != NULL) {
+        frameRelease(*slot);
+        *slot = NULL;
+        zc->outstanding--;
+    }
+}
+
+//--- Completions aus der Error Queue holen; erst dann duerfen die Frames wiederverwendet werden ---//
+static void reap_completions(ZeroCopyState *zc, const int fd) {
+    while (zc->outstanding > 0) {
+        char control[128];
+        struct msghdr msg = {0};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) return; //- EAGAIN: nichts fertig -//
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            const struct sock_extended_err *serr = (const struct sock_extended_err *) CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+            //- Bereich [ee_info, ee_data] der Send-Nummern ist abgeschlossen -//
+            for (uint32_t id = serr->ee_info; id != serr->ee_data + 1; id++) {
+                release_id(zc, id);
+                statCompletions++;
+            }
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) statKernelCopied++; //- zB Loopback -//
+        }
+    }
+}
+
+//--- Zerocopy fuer grosse Frames, kopierend fuer kleine oder wenn zu viele Sends ausstehen ---//
+int zerocopySend(ZeroCopyState *zc, const int fd, Frame *frame) {
+    if (!zc->enabled || frame->len < threshold) {
+        statCopySends++;
+        return sendFrame(fd, frame);
+    }
+
+    reap_completions(zc, fd);
+
+    size_t sent = 0;
+    while (sent < frame->len) {
+        if (zc->outstanding >= ZC_PENDING_MAX) {
+            //- Ring voll: Rest kopierend senden statt auf den Kernel zu warten -//
+            statCopySends++;
+            ssize_t res = send(fd, frame->data + sent, frame->len - sent, MSG_NOSIGNAL);
+            if (res == -1) return -1;
+            sent += (size_t) res;
+            continue;
+        }
+
+        ssize_t res = send(fd, frame->data + sent, frame->len - sent, MSG_NOSIGNAL | MSG_ZEROCOPY);
+        if (res == -1) {
+            if (errno == ENOBUFS) { //- optmem Limit erreicht, Kernel kann nicht pinnen -//
+                reap_completions(zc, fd);
+                res = send(fd, frame->data + sent, frame->len - sent, MSG_NOSIGNAL);
+                if (res == -1) return -1;
+                statCopySends++;
+                sent += (size_t) res;
+                continue;
+            }
+            return -1;
+        }
+
+        //- Jeder erfolgreiche Zerocopy Send bekommt vom Kernel die naechste Nummer -//
+        frameRetain(frame);
+        zc->pending[zc->nextId % ZC_PENDING_MAX] = frame;
+        zc->nextId++;
+        zc->outstanding++;
+        statZeroCopySends++;
+        sent += (size_t) res;
+    }
+    return 0;
+}
+
+//- Nur wenn der Kernel keinen der Frames mehr haelt -//
+static void zc_free(ZeroCopyState *zc) {
+    for (unsigned int i = 0; i < ZC_PENDING_MAX; i++) {
+        if (zc->pending[i] != NULL) frameRelease(zc->pending[i]);
+    }
+    free(zc->pending);
+    memoryAdd(MEM_ZEROCOPY, -(int64_t) (ZC_PENDING_MAX * sizeof(Frame *)));
+    memset(zc, 0, sizeof(*zc));
+}
+
+//--- Beim Entfernen oder Parken des Users: was der Kernel noch sendet, darf nicht in den Heap zurueck ---//
+void zerocopyRelease(ZeroCopyState *zc, const int fd) {
+    if (!zc->enabled) return;
+    reap_completions(zc, fd);
+    if (zc->outstanding == 0) {
+        zc_free(zc);
+        return;
+    }
+
+    //- Eigener fd: close() bzw. dup2() auf user->sock schliessen den Socket dann nicht, die Completions kommen weiter -//
+    Drain *drain = malloc(sizeof(Drain));
+    const int keep = drain != NULL ? dup(fd) : -1;
+    if (keep == -1) {
+        //- Lieber die Frames verlieren als Speicher freigeben, den der Kernel noch liest -//
+        errnoPrint("zerocopy drain");
+        free(drain);
+        free(zc->pending);
+        memoryAdd(MEM_ZEROCOPY, -(int64_t) (ZC_PENDING_MAX * sizeof(Frame *)));
+        memset(zc, 0, sizeof(*zc));
+        return;
+    }
+    shutdown(keep, SHUT_RD); //- Schreibseite bleibt offen, bis die Daten bestaetigt sind -//
+    drain->fd = keep;
+    drain->deadline = timerNow() + (ZC_DRAIN_MS + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    drain->zc = *zc;
+    memset(zc, 0, sizeof(*zc));
+
+    pthread_mutex_lock(&drainLock);
+    drain->next = drains;
+    drains = drain;
+    drainCount++;
+    pthread_mutex_unlock(&drainLock);
+}
+
+void zerocopyStatsFormat(char *buf, const size_t size) {
+    pthread_mutex_lock(&drainLock);
+    snprintf(buf, size, "zerocopy: threshold=%zu zerocopy_sends=%lu copy_sends=%lu completions=%lu kernel_copied=%lu "
+             "draining=%u drained=%lu aborted=%lu",
+             threshold, statZeroCopySends, statCopySends, statCompletions, statKernelCopied, drainCount, statDrained,
+             statAborted);
+    pthread_mutex_unlock(&drainLock);
+}
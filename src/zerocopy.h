@@ -0,0 +1,33 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "network.h"
+
+#define ZC_PENDING_MAX 64 // Maximal unbestaetigte Zerocopy Sends pro Socket
+#define ZC_DRAIN_MS 30000 // So lange wartet ein abgemeldeter Socket auf seine Completions, dann RST
+
+//- Frames, die der Kernel noch referenziert, nach Send-Nummer im Ring abgelegt -//
+typedef struct {
+    int enabled;
+    uint32_t nextId; // Nummer, die der Kernel dem naechsten Zerocopy Send gibt
+    unsigned int outstanding;
+    Frame **pending; // ZC_PENDING_MAX Plaetze, erst mit zerocopyEnable angelegt
+} ZeroCopyState;
+
+void zerocopySetThreshold(size_t bytes);
+
+size_t zerocopyThreshold(void);
+
+void zerocopyEnable(ZeroCopyState *zc, int fd);
+
+int zerocopySend(ZeroCopyState *zc, int fd, Frame *frame);
+
+// Frames ohne Completion gehen samt eigenem fd in eine Warteliste, freigegeben erst, wenn der Kernel sie loslaesst
+void zerocopyRelease(ZeroCopyState *zc, int fd);
+
+void zerocopyStatsFormat(char *buf, size_t size);
+
+#endif
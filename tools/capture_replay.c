@@ -0,0 +1,507 @@
+//--- Spielt einen Mitschnitt des Servers (--capture FILE) mit denselben Verbindungen und Abstaenden erneut ab ---//
+//- Aufruf: capture_replay [--speed FAKTOR] [--drain SEK] FILE HOST PORT; --speed 10 = zehnmal schneller, 0 = ohne Pausen. -//
+//- Misst Durchsatz und die Zeit bis der Absender seine eigene Chatnachricht zurueckbekommt. -//
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "../src/capture.h"
+#include "../src/network.h"
+
+#define EVENTS 256
+
+//- Eigene Chatnachricht, auf deren Rueckkehr wir warten -//
+typedef struct {
+    uint64_t sent;
+    size_t len;
+    char text[512];
+} Echo;
+
+typedef struct {
+    int fd; // -1 = nicht (mehr) offen
+    int closing; // CLOSE gelesen: schliessen, sobald alles gesendet und jede eigene Nachricht zurueck ist
+    int writing; // EPOLLOUT angemeldet
+    uint8_t version;
+    char name[32];
+    unsigned char *out;
+    size_t outLen;
+    size_t outCapacity;
+    unsigned char *in;
+    size_t inLen;
+    size_t inCapacity;
+    Echo *echoes; // Warteschlange, ab echoHead gueltig
+    size_t echoHead;
+    size_t echoCount;
+    size_t echoCapacity;
+} Conn;
+
+static int epollFd;
+static struct addrinfo *target;
+
+static uint64_t statOpened;
+static uint64_t statConnectFailed;
+static uint64_t statLogins;
+static uint64_t statRefused;
+static uint64_t statServerClosed;
+static uint64_t statSentFrames;
+static uint64_t statSentChat;
+static uint64_t statSentBytes;
+static uint64_t statReceivedFrames;
+static uint64_t statReceivedBytes;
+static uint64_t statLost; // Spaetere eigene Nachricht kam zuerst zurueck
+static uint64_t statAbandoned; // Beim Schliessen oder Ende noch ohne Echo
+static uint64_t *latencies;
+static size_t latencyCount;
+static size_t latencyCapacity;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+static int compareU64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const uint64_t *sorted, const size_t n, const double p) {
+    size_t index = (size_t) (p * (double) (n - 1) + 0.5);
+    if (index >= n) index = n - 1;
+    return (double) sorted[index] / 1e3;
+}
+
+static int reserve(void **buffer, size_t *capacity, const size_t need, const size_t element) {
+    if (need <= *capacity) return 0;
+    size_t grown = *capacity ? *capacity : 16;
+    while (grown < need) grown *= 2;
+    void *p = realloc(*buffer, grown * element);
+    if (p == NULL) return -1;
+    *buffer = p;
+    *capacity = grown;
+    return 0;
+}
+
+static void conn_close(Conn *c) {
+    if (c->fd == -1) return;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    c->outLen = 0;
+    c->inLen = 0;
+    statAbandoned += c->echoCount - c->echoHead;
+    c->echoHead = c->echoCount = 0;
+}
+
+//- Ohne das Warten auf die Echos wuerde --speed 0 jede Verbindung schliessen, bevor eine Antwort da ist -//
+static int conn_done(const Conn *c) {
+    return c->closing && c->outLen == 0 && c->echoHead == c->echoCount;
+}
+
+static void conn_want_write(Conn *c, const int want) {
+    if (c->writing == want) return;
+    struct epoll_event ev = {.events = EPOLLIN | (want ? EPOLLOUT : 0), .data.ptr = c};
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->writing = want;
+}
+
+//--- So viel senden, wie der Socket nimmt; der Rest wartet auf EPOLLOUT ---//
+static void conn_flush(Conn *c) {
+    size_t sent = 0;
+    while (sent < c->outLen) {
+        const ssize_t res = send(c->fd, c->out + sent, c->outLen - sent, MSG_NOSIGNAL);
+        if (res == -1 && errno == EINTR) continue;
+        if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN)) break;
+        if (res <= 0) {
+            statServerClosed++;
+            conn_close(c);
+            return;
+        }
+        sent += (size_t) res;
+    }
+    memmove(c->out, c->out + sent, c->outLen - sent);
+    c->outLen -= sent;
+    if (conn_done(c)) {
+        conn_close(c);
+        return;
+    }
+    conn_want_write(c, c->outLen > 0);
+}
+
+static void expect_echo(Conn *c, const unsigned char *body, const size_t len, const uint64_t now) {
+    if (len == 0 || body[0] == '/') return; //- Befehle kommen nicht als Chatnachricht zurueck -//
+    if (c->echoHead > 0 && c->echoHead == c->echoCount) c->echoHead = c->echoCount = 0;
+    if (reserve((void **) &c->echoes, &c->echoCapacity, c->echoCount + 1, sizeof(Echo)) == -1) return;
+    Echo *echo = &c->echoes[c->echoCount++];
+    echo->sent = now;
+    echo->len = strnlen((const char *) body, len > 512 ? 512 : len); //- Der Server verteilt bis zum ersten Nullbyte -//
+    memcpy(echo->text, body, echo->len);
+    statSentChat++;
+}
+
+//--- Ein gesendeter Frame: eigene Chatnachrichten vormerken, auch die in einem Batch ---//
+static void note_sent(Conn *c, const unsigned char *data, const size_t len, const uint64_t now) {
+    statSentFrames++;
+    if (len >= sizeof(BatchHeader) && data[0] == MT_BATCH && c->version >= PROT_VERSION_BATCH) {
+        size_t offset = sizeof(BatchHeader);
+        while (offset + sizeof(Header) <= len) {
+            const uint16_t frameLen = (uint16_t) (data[offset + 1] << 8 | data[offset + 2]);
+            if (offset + sizeof(Header) + frameLen > len) break;
+            if (data[offset] == MT_CLIENT_TO_SERVER) expect_echo(c, data + offset + sizeof(Header), frameLen, now);
+            offset += sizeof(Header) + frameLen;
+        }
+        return;
+    }
+    if (len >= sizeof(Header) && data[0] == MT_CLIENT_TO_SERVER) {
+        expect_echo(c, data + sizeof(Header), len - sizeof(Header), now);
+    }
+}
+
+static void note_received(Conn *c, const uint8_t type, const unsigned char *body, const size_t len,
+                          const uint64_t now) {
+    statReceivedFrames++;
+    if (type == MT_LOGIN_RESPONSE && len >= 5) {
+        if (body[4] == LC_SUCCESS) statLogins++;
+        else statRefused++;
+        return;
+    }
+    if (type != MT_SERVER_TO_CLIENT || len < 40 || strncmp((const char *) body + 8, c->name, 32) != 0) return;
+
+    //- Aeltere Eintraege ohne Echo (zB als Steuerzeichen verworfen) zaehlen als verloren -//
+    const size_t textLen = len - 40;
+    for (size_t i = c->echoHead; i < c->echoCount; i++) {
+        const Echo *echo = &c->echoes[i];
+        if (echo->len != textLen || memcmp(echo->text, body + 40, textLen) != 0) continue;
+        statLost += i - c->echoHead;
+        if (reserve((void **) &latencies, &latencyCapacity, latencyCount + 1, sizeof(uint64_t)) == 0) {
+            latencies[latencyCount++] = now - echo->sent;
+        }
+        c->echoHead = i + 1;
+        if (conn_done(c)) conn_close(c);
+        return;
+    }
+}
+
+//--- Liest alles Verfuegbare und zerlegt es in Frames und Batch Container ---//
+static void conn_read(Conn *c, const uint64_t now) {
+    while (1) {
+        if (reserve((void **) &c->in, &c->inCapacity, c->inLen + 65536, 1) == -1) return;
+        const ssize_t res = recv(c->fd, c->in + c->inLen, c->inCapacity - c->inLen, 0);
+        if (res == -1 && errno == EINTR) continue;
+        if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (res <= 0) {
+            statServerClosed++;
+            conn_close(c);
+            return;
+        }
+        c->inLen += (size_t) res;
+        statReceivedBytes += (uint64_t) res;
+    }
+
+    size_t offset = 0;
+    while (c->fd != -1 && c->inLen - offset >= sizeof(Header)) {
+        const unsigned char *p = c->in + offset;
+        if (p[0] == MT_BATCH) {
+            if (c->inLen - offset < sizeof(BatchHeader)) break;
+            const uint32_t batchLen = (uint32_t) p[1] << 24 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 8 | p[4];
+            if (c->inLen - offset < sizeof(BatchHeader) + batchLen) break;
+            size_t inner = sizeof(BatchHeader);
+            while (inner + sizeof(Header) <= sizeof(BatchHeader) + batchLen) {
+                const uint16_t frameLen = (uint16_t) (p[inner + 1] << 8 | p[inner + 2]);
+                note_received(c, p[inner], p + inner + sizeof(Header), frameLen, now);
+                inner += sizeof(Header) + frameLen;
+            }
+            offset += sizeof(BatchHeader) + batchLen;
+            continue;
+        }
+        const uint16_t frameLen = (uint16_t) (p[1] << 8 | p[2]);
+        if (c->inLen - offset < sizeof(Header) + frameLen) break;
+        note_received(c, p[0], p + sizeof(Header), frameLen, now);
+        offset += sizeof(Header) + frameLen;
+    }
+    if (c->fd == -1) return; //- Letztes Echo einer geschlossenen Verbindung -//
+    memmove(c->in, c->in + offset, c->inLen - offset);
+    c->inLen -= offset;
+}
+
+//--- Neue Verbindung mit dem mitgeschnittenen LoginRequest; Kompression wird nie angefragt ---//
+static void conn_open(Conn *c, unsigned char *login, const size_t len) {
+    if (c->fd != -1) conn_close(c);
+    c->fd = socket(target->ai_family, target->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, target->ai_protocol);
+    if (c->fd == -1 || (connect(c->fd, target->ai_addr, target->ai_addrlen) == -1 && errno != EINPROGRESS)) {
+        if (c->fd != -1) close(c->fd);
+        c->fd = -1;
+        statConnectFailed++;
+        return;
+    }
+    const int on = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.ptr = c};
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, c->fd, &ev);
+    c->writing = 1; //- Bis connect fertig ist -//
+    c->closing = 0;
+    statOpened++;
+
+    //- Header(3) + Magic(4) + Version(1) + Name -//
+    memset(c->name, 0, sizeof(c->name));
+    c->version = 0;
+    if (len > sizeof(Header) + 4) {
+        login[sizeof(Header) + 4] &= (unsigned char) ~PROT_FLAG_COMPRESS; //- Der Strom waere sonst deflate -//
+        c->version = login[sizeof(Header) + 4];
+        const size_t nameLen = len - sizeof(Header) - 5;
+        memcpy(c->name, login + sizeof(Header) + 5, nameLen > 31 ? 31 : nameLen);
+    }
+}
+
+static void conn_queue(Conn *c, const unsigned char *data, const size_t len, const uint64_t now) {
+    if (c->fd == -1) return;
+    if (reserve((void **) &c->out, &c->outCapacity, c->outLen + len, 1) == -1) return;
+    memcpy(c->out + c->outLen, data, len);
+    c->outLen += len;
+    statSentBytes += len;
+    note_sent(c, data, len, now);
+    if (!c->writing) conn_flush(c); //- Sonst kommt EPOLLOUT -//
+}
+
+static void arm_timer(const int timerFd, const uint64_t at) {
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = (time_t) (at / 1000000000ULL);
+    spec.it_value.tv_nsec = (long) (at % 1000000000ULL);
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) spec.it_value.tv_nsec = 1; //- 0 wuerde abschalten -//
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+int main(const int argc, char **argv) {
+    static const struct option longOptions[] = {
+        {"speed", required_argument, NULL, 's'},
+        {"drain", required_argument, NULL, 'd'},
+        {NULL, 0, NULL, 0}
+    };
+    double speed = 1.0;
+    double drainSeconds = 2.0; //- Nach dem letzten Datensatz noch auf Echos warten -//
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 's': speed = strtod(optarg, NULL); break;
+            case 'd': drainSeconds = strtod(optarg, NULL); break;
+            default: return EXIT_FAILURE;
+        }
+    }
+    if (optind + 3 != argc || speed < 0) {
+        fprintf(stderr, "Usage: %s [--speed FACTOR] [--drain SEC] CAPTURE_FILE HOST PORT\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    //--- Mitschnitt ganz einlesen, damit die Platte das Timing nicht stoert ---//
+    FILE *file = fopen(argv[optind], "rb");
+    if (file == NULL) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    CaptureFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != CAPTURE_MAGIC
+        || header.recordSize != sizeof(CaptureRecord)) {
+        fprintf(stderr, "%s: not a capture of this server version\n", argv[optind]);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+    unsigned char *data = NULL;
+    size_t dataLen = 0;
+    size_t dataCapacity = 0;
+    while (1) {
+        if (reserve((void **) &data, &dataCapacity, dataLen + 1024 * 1024, 1) == -1) {
+            perror("realloc");
+            return EXIT_FAILURE;
+        }
+        const size_t n = fread(data + dataLen, 1, dataCapacity - dataLen, file);
+        if (n == 0) break;
+        dataLen += n;
+    }
+    fclose(file);
+
+    //- Datensaetze zaehlen; ein abgeschnittener letzter (Server abgestuerzt) wird ignoriert -//
+    size_t count = 0;
+    uint32_t maxConn = 0;
+    size_t offset = 0;
+    while (offset + sizeof(CaptureRecord) <= dataLen) {
+        CaptureRecord record;
+        memcpy(&record, data + offset, sizeof(record));
+        if (offset + sizeof(record) + record.length > dataLen) break;
+        if (record.conn > maxConn) maxConn = record.conn;
+        offset += sizeof(record) + record.length;
+        count++;
+    }
+    unsigned char **records = malloc((count ? count : 1) * sizeof(unsigned char *));
+    Conn *conns = calloc((size_t) maxConn + 1, sizeof(Conn));
+    if (records == NULL || conns == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        CaptureRecord record;
+        memcpy(&record, data + offset, sizeof(record));
+        records[i] = data + offset;
+        offset += sizeof(record) + record.length;
+    }
+    for (uint32_t i = 0; i <= maxConn; i++) conns[i].fd = -1;
+    if (count == 0) {
+        fprintf(stderr, "%s: no records\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    //- Jede mitgeschnittene Verbindung braucht einen Deskriptor -//
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    const struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    const int gai = getaddrinfo(argv[optind + 1], argv[optind + 2], &hints, &target);
+    if (gai != 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind + 1], gai_strerror(gai));
+        return EXIT_FAILURE;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    const int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epollFd == -1 || timerFd == -1) {
+        perror("epoll/timerfd");
+        return EXIT_FAILURE;
+    }
+    struct epoll_event timerEv = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &timerEv);
+
+    //--- Abspielen: faellige Datensaetze senden, dazwischen lesen; der timerfd weckt zum naechsten ---//
+    CaptureRecord first;
+    memcpy(&first, records[0], sizeof(first));
+    const uint64_t start = now_ns();
+    uint64_t lagSum = 0;
+    uint64_t lagMax = 0;
+    uint64_t drainEnd = 0;
+    size_t next = 0;
+    struct epoll_event events[EVENTS];
+    while (1) {
+        uint64_t now = now_ns();
+        uint64_t due = 0;
+        while (next < count) {
+            CaptureRecord record;
+            memcpy(&record, records[next], sizeof(record));
+            due = start + (speed > 0 ? (uint64_t) ((double) (record.time - first.time) / speed) : 0);
+            if (due > now) break;
+
+            const uint64_t lag = now - due; //- Wie weit wir hinter dem Zeitplan sind -//
+            lagSum += lag;
+            if (lag > lagMax) lagMax = lag;
+            Conn *c = &conns[record.conn];
+            unsigned char *payload = records[next] + sizeof(record);
+            switch (record.kind) {
+                case CAPTURE_OPEN:
+                    conn_open(c, payload, record.length);
+                    conn_queue(c, payload, record.length, now);
+                    statSentFrames--; //- Der Login ist kein Nutzframe -//
+                    break;
+                case CAPTURE_DATA:
+                    conn_queue(c, payload, record.length, now);
+                    break;
+                case CAPTURE_CLOSE:
+                    c->closing = 1;
+                    if (conn_done(c)) conn_close(c);
+                    break;
+                default:
+                    break;
+            }
+            next++;
+        }
+
+        if (next == count) {
+            if (drainEnd == 0) drainEnd = now + (uint64_t) (drainSeconds * 1e9);
+            //- Fertig, sobald alles gesendet ist und keine eigene Nachricht mehr aussteht -//
+            int busy = 0;
+            for (uint32_t i = 0; i <= maxConn && !busy; i++) {
+                busy = conns[i].fd != -1 && (conns[i].outLen > 0 || conns[i].echoHead < conns[i].echoCount);
+            }
+            if (!busy || now >= drainEnd) break;
+            due = drainEnd;
+        }
+        arm_timer(timerFd, due);
+
+        const int n = epoll_wait(epollFd, events, EVENTS, -1);
+        if (n == -1 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        now = now_ns();
+        for (int i = 0; i < n; i++) {
+            Conn *c = events[i].data.ptr;
+            if (c == NULL) {
+                uint64_t expirations;
+                if (read(timerFd, &expirations, sizeof(expirations)) == -1) continue;
+                continue;
+            }
+            if (c->fd == -1) continue;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) conn_read(c, now);
+            if (c->fd != -1 && (events[i].events & EPOLLOUT)) conn_flush(c);
+        }
+    }
+    const double elapsed = (double) (now_ns() - start) / 1e9;
+    for (uint32_t i = 0; i <= maxConn; i++) conn_close(&conns[i]);
+
+    //--- Bericht ---//
+    CaptureRecord last;
+    memcpy(&last, records[count - 1], sizeof(last));
+    const double captured = (double) (last.time - first.time) / 1e9;
+    const time_t started = (time_t) header.started;
+    printf("capture: %zu records, %u connections, %.2f s, started %s", count, maxConn, captured, ctime(&started));
+    char speedText[32];
+    if (speed > 0) snprintf(speedText, sizeof(speedText), "%gx", speed);
+    else snprintf(speedText, sizeof(speedText), "unthrottled");
+    printf("replay:  speed %s, %.2f s, schedule lag mean %.1f us max %.1f us\n", speedText, elapsed,
+           (double) lagSum / (double) count / 1e3, (double) lagMax / 1e3);
+    printf("connections: %ju opened, %ju connect failed, %ju logins, %ju refused, %ju closed by server\n",
+           (uintmax_t) statOpened, (uintmax_t) statConnectFailed, (uintmax_t) statLogins, (uintmax_t) statRefused,
+           (uintmax_t) statServerClosed);
+    printf("sent:     %ju frames (%ju chat), %ju bytes, %.0f frames/s\n", (uintmax_t) statSentFrames,
+           (uintmax_t) statSentChat, (uintmax_t) statSentBytes, elapsed > 0 ? (double) statSentFrames / elapsed : 0.0);
+    printf("received: %ju frames, %ju bytes, %.0f frames/s\n", (uintmax_t) statReceivedFrames,
+           (uintmax_t) statReceivedBytes, elapsed > 0 ? (double) statReceivedFrames / elapsed : 0.0);
+    printf("echo: %zu measured, %ju lost, %ju without echo at close or end\n", latencyCount, (uintmax_t) statLost,
+           (uintmax_t) statAbandoned);
+    if (latencyCount > 0) {
+        qsort(latencies, latencyCount, sizeof(uint64_t), compareU64);
+        double sum = 0;
+        for (size_t i = 0; i < latencyCount; i++) sum += (double) latencies[i];
+        printf("\n%-24s %8s %10s %10s %10s %10s %10s\n", "echo latency [us]", "n", "mean", "p50", "p90", "p99", "max");
+        printf("%-24s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f\n", "send -> own echo", latencyCount,
+               sum / (double) latencyCount / 1e3, percentile(latencies, latencyCount, 0.5),
+               percentile(latencies, latencyCount, 0.9), percentile(latencies, latencyCount, 0.99),
+               (double) latencies[latencyCount - 1] / 1e3);
+    }
+
+    freeaddrinfo(target);
+    free(latencies);
+    free(records);
+    free(data);
+    for (uint32_t i = 0; i <= maxConn; i++) {
+        free(conns[i].out);
+        free(conns[i].in);
+        free(conns[i].echoes);
+    }
+    free(conns);
+    return statConnectFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,195 @@
+//--- Lastgenerator auf Basis von libchatclient: viele Clients in einem Thread, jeder mit einem Fenster offener Nachrichten ---//
+//- Aufruf: client_bench [--clients N] [--messages M] [--window W] [--size BYTES] [--version 0|1] [--ignore K] HOST PORT -//
+//- Eine Nachricht gilt als bestaetigt, wenn der Absender sie selbst zurueckbekommt; gemessen wird ab dem Login aller. -//
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chatclient.h"
+
+#define STALL_MS 5000 // So lange ohne Fortschritt: abbrechen
+
+typedef struct {
+    char name[32];
+    unsigned long sent;
+    unsigned long acked; // Eigene Nachricht zurueck
+    unsigned long dropped; // Server meldete "busy", zaehlt als bestaetigt
+    int refused;
+} BenchClient;
+
+static unsigned long deliveries; // Alle empfangenen Chatnachrichten, also die Verteilung an alle
+
+static double now_s(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+static void on_login(ChatClient *client, const uint8_t code, const char *serverName, void *user) {
+    (void) client;
+    (void) serverName;
+    BenchClient *bench = user;
+    if (code != LC_SUCCESS) {
+        fprintf(stderr, "%s: login refused with code %u\n", bench->name, code);
+        bench->refused = 1;
+    }
+}
+
+static void on_message(ChatClient *client, const uint64_t timestamp, const char *sender, const char *text,
+                       const size_t len, void *user) {
+    (void) client;
+    (void) timestamp;
+    (void) len;
+    BenchClient *bench = user;
+    if (sender[0] == '\0') {
+        //- Volle Broadcast Queue: der Server verwirft die Nachricht und sagt es dem Absender -//
+        if (strncmp(text, "Error: Server is busy", 21) == 0) bench->dropped++;
+        return;
+    }
+    deliveries++;
+    if (strcmp(sender, bench->name) == 0) bench->acked++;
+}
+
+int main(const int argc, char **argv) {
+    static const struct option longOptions[] = {
+        {"clients", required_argument, NULL, 'c'},
+        {"messages", required_argument, NULL, 'm'},
+        {"window", required_argument, NULL, 'w'},
+        {"size", required_argument, NULL, 's'},
+        {"version", required_argument, NULL, 'v'},
+        {"ignore", required_argument, NULL, 'i'},
+        {NULL, 0, NULL, 0}
+    };
+    size_t clientCount = 16;
+    unsigned long messages = 2000;
+    unsigned long window = 32; //- Unbestaetigte Nachrichten je Client -//
+    size_t size = 64;
+    unsigned int version = PROT_VERSION;
+    size_t ignore = 0; //- Jeder Client ignoriert die naechsten ignore Clients, fuer den Vergleich der Verteilung -//
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 'c': clientCount = strtoul(optarg, NULL, 10); break;
+            case 'm': messages = strtoul(optarg, NULL, 10); break;
+            case 'w': window = strtoul(optarg, NULL, 10); break;
+            case 's': size = strtoul(optarg, NULL, 10); break;
+            case 'v': version = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'i': ignore = strtoul(optarg, NULL, 10); break;
+            default: return EXIT_FAILURE;
+        }
+    }
+    if (optind + 2 != argc || clientCount == 0 || window == 0 || size == 0 || size > 512 || version > PROT_VERSION ||
+        ignore >= clientCount) {
+        fprintf(stderr, "Usage: %s [--clients N] [--messages M] [--window W] [--size 1-512] [--version 0|1] "
+                "[--ignore 0-(N-1)] HOST PORT\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const ChatClientCallbacks callbacks = {.loginResult = on_login, .message = on_message};
+    ChatClient **clients = calloc(clientCount, sizeof(ChatClient *));
+    BenchClient *benches = calloc(clientCount, sizeof(BenchClient));
+    char *text = malloc(size);
+    if (clients == NULL || benches == NULL || text == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    memset(text, 'x', size);
+
+    for (size_t i = 0; i < clientCount; i++) {
+        snprintf(benches[i].name, sizeof(benches[i].name), "bench%zu_%d", i, (int) getpid());
+        clients[i] = chatClientCreate(&callbacks, &benches[i]);
+        if (clients[i] == NULL || chatClientConnect(clients[i], argv[optind], argv[optind + 1], benches[i].name,
+                                                    (uint8_t) version) == -1) {
+            perror("chatClientConnect");
+            return EXIT_FAILURE;
+        }
+    }
+
+    //--- Erst alle einloggen, damit der Aufbau nicht in die Messung faellt ---//
+    size_t ready = 0;
+    const double loginStart = now_s();
+    while (ready < clientCount && now_s() - loginStart < STALL_MS / 1e3) {
+        if (chatClientPoll(clients, clientCount, 100) == 0) break;
+        ready = 0;
+        for (size_t i = 0; i < clientCount; i++) ready += chatClientReady(clients[i]) != 0;
+    }
+    size_t loggedIn = 0;
+    for (size_t i = 0; i < clientCount; i++) loggedIn += chatClientReady(clients[i]) == 1;
+    if (loggedIn == 0) {
+        fprintf(stderr, "No client could log in\n");
+        return EXIT_FAILURE;
+    }
+    //- Die UserAdded Flut der anderen Logins (und die Antworten auf /ignore) noch abholen -//
+    for (size_t i = 0; i < clientCount; i++) {
+        for (size_t k = 1; k <= ignore && chatClientReady(clients[i]) == 1; k++) {
+            char command[48];
+            const int len = snprintf(command, sizeof(command), "/ignore %s", benches[(i + k) % clientCount].name);
+            chatClientSend(clients[i], command, (size_t) len);
+        }
+    }
+    for (int i = 0; i < 5; i++) chatClientPoll(clients, clientCount, 20);
+    deliveries = 0;
+
+    //--- Jeder Client haelt bis zu window Nachrichten offen; die Bibliothek buendelt sie je Flush ---//
+    const double start = now_s();
+    double lastProgress = start;
+    unsigned long lastDone = 0;
+    while (1) {
+        unsigned long done = 0;
+        for (size_t i = 0; i < clientCount; i++) {
+            BenchClient *bench = &benches[i];
+            if (chatClientReady(clients[i]) != 1) continue;
+            while (bench->sent < messages && bench->sent - bench->acked - bench->dropped < window) {
+                if (chatClientSend(clients[i], text, size) == -1) break;
+                bench->sent++;
+            }
+            done += bench->acked + bench->dropped;
+        }
+        if (done >= messages * loggedIn) break;
+        if (done != lastDone) {
+            lastDone = done;
+            lastProgress = now_s();
+        } else if ((now_s() - lastProgress) * 1e3 > STALL_MS) {
+            fprintf(stderr, "No progress for %d ms, giving up\n", STALL_MS);
+            break;
+        }
+        if (chatClientPoll(clients, clientCount, 100) == 0) break;
+    }
+    const double elapsed = now_s() - start;
+
+    //--- Bericht ---//
+    unsigned long acked = 0;
+    unsigned long dropped = 0;
+    ChatClientStats total = {0};
+    for (size_t i = 0; i < clientCount; i++) {
+        acked += benches[i].acked;
+        dropped += benches[i].dropped;
+        ChatClientStats stats;
+        chatClientGetStats(clients[i], &stats);
+        total.framesSent += stats.framesSent;
+        total.batchesSent += stats.batchesSent;
+        total.bytesSent += stats.bytesSent;
+        total.framesReceived += stats.framesReceived;
+        total.bytesReceived += stats.bytesReceived;
+        total.writes += stats.writes;
+        total.reads += stats.reads;
+        chatClientDestroy(clients[i]);
+    }
+    printf("%zu clients (%zu logged in), version %u, %lu messages of %zu bytes each, window %lu, ignoring %zu\n",
+           clientCount, loggedIn, version, messages, size, window, ignore);
+    printf("%.3f s: %.0f messages/s confirmed, %.0f deliveries/s, %lu dropped as busy\n", elapsed,
+           (double) acked / elapsed, (double) deliveries / elapsed, dropped);
+    printf("sent %ju frames in %ju batches with %ju writes (%.1f frames/write), received %ju frames with %ju reads "
+           "(%.1f frames/read)\n", (uintmax_t) total.framesSent, (uintmax_t) total.batchesSent,
+           (uintmax_t) total.writes, total.writes ? (double) total.framesSent / (double) total.writes : 0.0,
+           (uintmax_t) total.framesReceived, (uintmax_t) total.reads,
+           total.reads ? (double) total.framesReceived / (double) total.reads : 0.0);
+
+    free(clients);
+    free(benches);
+    free(text);
+    return acked + dropped >= messages * loggedIn ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,194 @@
+//--- Liest den Firehose Strom des Servers (--firehose NAME) und gibt ihn zeilenweise aus oder zaehlt nur mit ---//
+//- Aufruf: firehose_tail [--from SEQ] [--quiet] NAME HOST PORT; ohne --from live ab jetzt. -//
+//- Am Ende steht die naechste Nummer auf stderr, mit --from NUMMER geht es nach einem Abbruch luecklos weiter. -//
+#include <getopt.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "../src/firehose.h"
+#include "../src/network.h"
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(const int sig) {
+    (void) sig;
+    stop = 1;
+}
+
+static uint64_t be64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = v << 8 | p[i];
+    return v;
+}
+
+static int read_all(const int fd, void *buffer, const size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        const ssize_t res = recv(fd, (char *) buffer + done, len - done, 0);
+        if (res <= 0) return -1;
+        done += (size_t) res;
+    }
+    return 0;
+}
+
+static int connect_to(const char *host, const char *port) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *list;
+    if (getaddrinfo(host, port, &hints, &list) != 0) return -1;
+    int fd = -1;
+    for (struct addrinfo *ai = list; ai != NULL && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(list);
+    return fd;
+}
+
+//--- Login mit PROT_FLAG_FIREHOSE, danach der Abo Frame mit der Startnummer ---//
+static int subscribe(const int fd, const char *name, const uint64_t from) {
+    unsigned char login[sizeof(Header) + sizeof(LoginRequestBody)];
+    const size_t nameLen = strlen(name);
+    Header hdr = {MT_LOGIN_REQUEST, htons((uint16_t) (5 + nameLen))};
+    LoginRequestBody body = {htonl(MAGIC_REQUEST), PROT_VERSION_BATCH | PROT_FLAG_FIREHOSE, {0}};
+    memcpy(body.name, name, nameLen);
+    memcpy(login, &hdr, sizeof(hdr));
+    memcpy(login + sizeof(hdr), &body, 5 + nameLen);
+    if (send(fd, login, sizeof(hdr) + 5 + nameLen, MSG_NOSIGNAL) == -1) return -1;
+
+    unsigned char response[sizeof(Header) + sizeof(LoginResponseBody)];
+    if (read_all(fd, response, sizeof(Header)) == -1) return -1;
+    const size_t len = (size_t) (response[1] << 8 | response[2]);
+    if (response[0] != MT_LOGIN_RESPONSE || len < 5 || len > sizeof(LoginResponseBody)) return -1;
+    if (read_all(fd, response + sizeof(Header), len) == -1) return -1;
+    if (response[sizeof(Header) + 4] != LC_SUCCESS) {
+        fprintf(stderr, "Login refused (code %u)\n", response[sizeof(Header) + 4]);
+        return -1;
+    }
+
+    unsigned char frame[sizeof(Header) + 8];
+    frame[0] = MT_FIREHOSE;
+    frame[1] = 0;
+    frame[2] = 8;
+    for (int i = 0; i < 8; i++) frame[3 + i] = (unsigned char) (from >> (56 - 8 * i));
+    return send(fd, frame, sizeof(frame), MSG_NOSIGNAL) == (ssize_t) sizeof(frame) ? 0 : -1;
+}
+
+static void print_message(const uint64_t seq, const char *room, const unsigned char *frame, const size_t len) {
+    const uint8_t type = frame[0];
+    const unsigned char *body = frame + sizeof(Header);
+    const size_t bodyLen = len - sizeof(Header);
+    const char *where = room[0] ? room : "*";
+    if (type == MT_SERVER_TO_CLIENT && bodyLen >= 40) {
+        const char *sender = (const char *) body + 8;
+        printf("%ju %s <%.*s> %.*s\n", (uintmax_t) seq, where, (int) strnlen(sender, 32),
+               sender[0] ? sender : "server", (int) (bodyLen - 40), (const char *) body + 40);
+    } else if ((type == MT_USER_ADDED && bodyLen >= 8) || (type == MT_USER_REMOVED && bodyLen >= 9)) {
+        const size_t offset = type == MT_USER_ADDED ? 8 : 9;
+        printf("%ju %s %s %.*s\n", (uintmax_t) seq, where, type == MT_USER_ADDED ? "joined" : "left",
+               (int) (bodyLen - offset), (const char *) body + offset);
+    } else {
+        printf("%ju %s type=%u len=%zu\n", (uintmax_t) seq, where, type, bodyLen);
+    }
+}
+
+int main(int argc, char **argv) {
+    static const struct option longOptions[] = {
+        {"from", required_argument, NULL, 'f'},
+        {"quiet", no_argument, NULL, 'q'},
+        {NULL, 0, NULL, 0}
+    };
+    uint64_t from = 0;
+    int quiet = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 'f': from = strtoull(optarg, NULL, 10); break;
+            case 'q': quiet = 1; break;
+            default: return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 3 || strlen(argv[optind]) == 0 || strlen(argv[optind]) > 31) {
+        fprintf(stderr, "Usage: %s [--from SEQ] [--quiet] NAME HOST PORT\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const int fd = connect_to(argv[optind + 1], argv[optind + 2]);
+    if (fd == -1 || subscribe(fd, argv[optind], from) == -1) {
+        fprintf(stderr, "Unable to subscribe at %s:%s\n", argv[optind + 1], argv[optind + 2]);
+        return EXIT_FAILURE;
+    }
+    //- Ohne SA_RESTART: ein blockiertes recv kehrt mit EINTR zurueck und die Nummer zum Fortsetzen wird ausgegeben -//
+    struct sigaction action = {.sa_handler = on_signal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    unsigned char *block = NULL;
+    size_t capacity = 0;
+    uint64_t next = from; //- Naechste erwartete Nummer, 0 = noch keine gesehen -//
+    uint64_t messages = 0;
+    uint64_t blocks = 0;
+    uint64_t bytes = 0;
+    uint64_t gaps = 0;
+    uint64_t intervalMessages = 0;
+    time_t intervalStart = time(NULL);
+
+    while (!stop) {
+        FirehoseHeader header;
+        if (read_all(fd, &header, sizeof(header)) == -1 || header.type != MT_FIREHOSE) break;
+        const size_t len = ntohl(header.length);
+        if (len > capacity) {
+            unsigned char *grown = realloc(block, len);
+            if (grown == NULL) break;
+            block = grown;
+            capacity = len;
+        }
+        if (read_all(fd, block, len) == -1) break;
+        uint64_t seq = be64((const unsigned char *) &header.firstSeq);
+        const uint32_t count = ntohl(header.count);
+        if (next != 0 && seq > next) gaps += seq - next; //- Zu weit zurueck oder zu langsam: der Server hat verdraengt -//
+        blocks++;
+        bytes += sizeof(header) + len;
+
+        size_t offset = 0;
+        for (uint32_t i = 0; i < count && offset < len; i++, seq++) {
+            const size_t roomLen = block[offset++];
+            char room[32] = "";
+            if (roomLen > 31 || offset + roomLen + sizeof(Header) > len) break;
+            memcpy(room, block + offset, roomLen);
+            offset += roomLen;
+            const size_t frameLen = sizeof(Header) + (size_t) (block[offset + 1] << 8 | block[offset + 2]);
+            if (offset + frameLen > len) break;
+            if (seq >= next) { //- Ein Block kann vor der Startnummer beginnen -//
+                if (!quiet) print_message(seq, room, block + offset, frameLen);
+                messages++;
+                intervalMessages++;
+                next = seq + 1;
+            }
+            offset += frameLen;
+        }
+        if (!quiet) fflush(stdout);
+
+        const time_t now = time(NULL);
+        if (quiet && now != intervalStart) {
+            fprintf(stderr, "%ju msgs/s\n", (uintmax_t) (intervalMessages / (uint64_t) (now - intervalStart)));
+            intervalMessages = 0;
+            intervalStart = now;
+        }
+    }
+
+    fprintf(stderr, "%ju messages in %ju blocks, %ju bytes, %ju skipped; resume with --from %ju\n",
+            (uintmax_t) messages, (uintmax_t) blocks, (uintmax_t) bytes, (uintmax_t) gaps, (uintmax_t) next);
+    free(block);
+    close(fd);
+    return EXIT_SUCCESS;
+}
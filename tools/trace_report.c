@@ -0,0 +1,103 @@
+//--- Wertet einen Latenz Trace des Servers (--trace FILE, /trace) Stufe fuer Stufe aus ---//
+//- Aufruf: trace_report FILE; Zeiten in Mikrosekunden, nur Datensaetze, die beide Stufengrenzen haben. -//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/trace.h"
+
+typedef struct {
+    const char *name;
+    size_t from; // Offset der Felder in TraceRecord
+    size_t to;
+} Stage;
+
+static const Stage stages[] = {
+    {"read -> enqueue", offsetof(TraceRecord, received), offsetof(TraceRecord, enqueued)},
+    {"queue", offsetof(TraceRecord, enqueued), offsetof(TraceRecord, dequeued)},
+    {"pause semaphore", offsetof(TraceRecord, dequeued), offsetof(TraceRecord, unpaused)},
+    {"encode -> first send", offsetof(TraceRecord, unpaused), offsetof(TraceRecord, firstSent)},
+    {"fan-out (first -> last)", offsetof(TraceRecord, firstSent), offsetof(TraceRecord, lastSent)},
+    {"total (read -> last)", offsetof(TraceRecord, received), offsetof(TraceRecord, lastSent)},
+};
+
+static int compareU64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t field(const TraceRecord *record, const size_t offset) {
+    uint64_t value;
+    memcpy(&value, (const unsigned char *) record + offset, sizeof(value));
+    return value;
+}
+
+static double percentile(const uint64_t *sorted, const size_t n, const double p) {
+    size_t index = (size_t) (p * (double) (n - 1) + 0.5);
+    if (index >= n) index = n - 1;
+    return (double) sorted[index] / 1e3;
+}
+
+int main(const int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s TRACE_FILE\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC
+        || header.recordSize != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s: not a trace dump of this server version\n", argv[1]);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    TraceRecord *records = malloc((header.count ? header.count : 1) * sizeof(TraceRecord));
+    uint64_t *values = malloc((header.count ? header.count : 1) * sizeof(uint64_t));
+    if (records == NULL || values == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    const size_t count = fread(records, sizeof(TraceRecord), header.count, file);
+    fclose(file);
+
+    uint64_t recipients = 0;
+    size_t chat = 0;
+    for (size_t i = 0; i < count; i++) {
+        recipients += records[i].recipients;
+        if (records[i].received != 0) chat++;
+    }
+    printf("%zu records (%zu chat messages from clients, %ju overwritten in the ring), %.1f recipients on average\n\n",
+           count, chat, (uintmax_t) header.dropped, count ? (double) recipients / (double) count : 0.0);
+    printf("%-24s %8s %10s %10s %10s %10s %10s\n", "stage [us]", "n", "mean", "p50", "p90", "p99", "max");
+
+    for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+        size_t n = 0;
+        double sum = 0;
+        for (size_t i = 0; i < count; i++) {
+            const uint64_t from = field(&records[i], stages[s].from);
+            const uint64_t to = field(&records[i], stages[s].to);
+            if (from == 0 || to == 0 || to < from) continue; //- Stufe nicht durchlaufen, zB ohne Empfaenger -//
+            values[n++] = to - from;
+            sum += (double) (to - from);
+        }
+        if (n == 0) {
+            printf("%-24s %8zu\n", stages[s].name, n);
+            continue;
+        }
+        qsort(values, n, sizeof(uint64_t), compareU64);
+        printf("%-24s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f\n", stages[s].name, n, sum / (double) n / 1e3,
+               percentile(values, n, 0.5), percentile(values, n, 0.9), percentile(values, n, 0.99),
+               (double) values[n - 1] / 1e3);
+    }
+
+    free(records);
+    free(values);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+//--- Vergleicht die Pruefung von Namen und Texten (validate.c) mit den bisherigen Schleifen ---//
+//- Aufruf: validate_bench [ITERATIONEN]; prueft vorher, dass alle Varianten dasselbe Ergebnis liefern. -//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/validate.h"
+
+#define SAMPLES 1024 // Verschiedene Eingaben, damit die Sprungvorhersage nicht eine einzige auswendig lernt
+
+static const size_t nameLengths[] = {4, 8, 16, 31};
+static const size_t textLengths[] = {16, 64, 128, 256, 512};
+static const char *const implementations[] = {"scalar", "sse2", "avx2"};
+
+//- Bisher in loginstage.c: Leerzeichen erlaubt, sonst wie nameBytesValidate -//
+static size_t legacy_login(const char *input, const size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char c = (unsigned char) input[i];
+        if (c == 34 || c == 39 || c == 96 || c < 32 || c > 126) return i;
+    }
+    return n;
+}
+
+//- Bisher in util.c -//
+static size_t legacy_util(const char *input, const size_t n) {
+    const unsigned char *s = (const unsigned char *) input;
+    size_t i;
+    for (i = 0U; i < n; ++i) {
+        if (s[i] < 33) return i;
+        if (s[i] == 34 || s[i] == 39 || s[i] == 96) return i;
+        if (s[i] >= 127) return i;
+    }
+    return i;
+}
+
+static double now_s(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+//- Gueltige Eingaben, ein Teil in der Mitte ungueltig, damit auch der fruehe Abbruch gemessen wird -//
+static void fill(char *buffer, const size_t len, const int text, const int sample) {
+    static const char nameChars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-.!";
+    static const char textChars[] = "Lorem ipsum dolor sit amet, consectetur adipiscing elit. \xc3\xa4\xc3\xb6";
+    for (size_t i = 0; i < len; i++) {
+        buffer[i] = text ? textChars[rand() % (sizeof(textChars) - 1)] : nameChars[rand() % (sizeof(nameChars) - 1)];
+    }
+    if (sample % 16 == 0) buffer[len / 2] = text ? '\x1b' : '"';
+}
+
+static double run(size_t (*func)(const char *, size_t), char *const *inputs, const size_t len, const long iterations,
+                  size_t *sink) {
+    const double start = now_s();
+    for (long it = 0; it < iterations; it++) {
+        for (int s = 0; s < SAMPLES; s++) *sink += func(inputs[s], len);
+    }
+    return (now_s() - start) * 1e9 / ((double) iterations * SAMPLES);
+}
+
+//--- Zufaellige Bytes aller Klassen: jede Variante muss die skalare bestaetigen ---//
+static int cross_check(void) {
+    static char buffer[600];
+    for (int round = 0; round < 200000; round++) {
+        const size_t len = (size_t) (rand() % 560);
+        for (size_t i = 0; i < len; i++) {
+            //- Meist gueltige Bytes, damit die Fehler ueber die ganze Laenge verteilt liegen -//
+            buffer[i] = (char) (rand() % 64 == 0 ? rand() % 256 : 'a' + rand() % 26);
+        }
+        validateSelect("scalar");
+        const size_t name = validateName(buffer, len);
+        const size_t text = validateText(buffer, len);
+        if (name != legacy_util(buffer, len)) {
+            fprintf(stderr, "scalar name check differs from the util.c loop (len %zu)\n", len);
+            return -1;
+        }
+        for (size_t k = 1; k < sizeof(implementations) / sizeof(implementations[0]); k++) {
+            if (validateSelect(implementations[k]) == -1) continue;
+            if (validateName(buffer, len) != name || validateText(buffer, len) != text) {
+                fprintf(stderr, "%s differs from scalar (len %zu)\n", implementations[k], len);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(const int argc, char **argv) {
+    const long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 2000;
+    srand(42);
+
+    if (cross_check() == -1) return EXIT_FAILURE;
+    validateSelect("auto");
+    printf("cross check passed, runtime selection: %s\n\n", validateImplementation());
+
+    char *inputs[SAMPLES];
+    for (int s = 0; s < SAMPLES; s++) {
+        inputs[s] = malloc(512);
+        if (inputs[s] == NULL) {
+            perror("malloc");
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t sink = 0;
+    printf("%-6s %5s %10s %10s %10s %10s %10s   [ns per call]\n", "kind", "len", "login", "util.c", "scalar", "sse2",
+           "avx2");
+    for (int text = 0; text <= 1; text++) {
+        const size_t *lengths = text ? textLengths : nameLengths;
+        const size_t count = text ? sizeof(textLengths) / sizeof(textLengths[0])
+                                  : sizeof(nameLengths) / sizeof(nameLengths[0]);
+        for (size_t l = 0; l < count; l++) {
+            for (int s = 0; s < SAMPLES; s++) fill(inputs[s], lengths[l], text, s);
+
+            printf("%-6s %5zu", text ? "text" : "name", lengths[l]);
+            //- Texte wurden bisher gar nicht geprueft; die alten Schleifen nur zum Vergleich der Namen -//
+            if (text) {
+                printf(" %10s %10s", "-", "-");
+            } else {
+                printf(" %10.1f %10.1f", run(legacy_login, inputs, lengths[l], iterations, &sink),
+                       run(legacy_util, inputs, lengths[l], iterations, &sink));
+            }
+            for (size_t k = 0; k < sizeof(implementations) / sizeof(implementations[0]); k++) {
+                if (validateSelect(implementations[k]) == -1) {
+                    printf(" %10s", "n/a");
+                    continue;
+                }
+                printf(" %10.1f", run(text ? validateText : validateName, inputs, lengths[l], iterations, &sink));
+            }
+            printf("\n");
+        }
+    }
+
+    for (int s = 0; s < SAMPLES; s++) free(inputs[s]);
+    return sink == 0 ? EXIT_FAILURE : EXIT_SUCCESS; //- sink verhindert, dass der Compiler die Aufrufe streicht -//
+}
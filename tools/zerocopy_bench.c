@@ -0,0 +1,151 @@
+//--- Vergleicht kopierendes Senden mit MSG_ZEROCOPY ueber den Sendepfad des Servers (zerocopySend) ---//
+//- Aufruf: zerocopy_bench [HOST PORT]; ohne Ziel wird ein lokaler Empfaenger auf Loopback gestartet.
+//- Achtung: Auf Loopback kopiert der Kernel trotzdem, aussagekraeftig ist nur ein Ziel auf einem anderen Host. -//
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "network.h"
+#include "util.h"
+#include "zerocopy.h"
+
+#define BENCH_BYTES (256UL * 1024 * 1024) // Pro Messung gesendete Datenmenge
+
+static const size_t frameSizes[] = {64, 128, 256, 555, 1024, 2048, 4096, 8192, 16384, 32768, 65536};
+
+static void *sinkThread(void *arg) {
+    const int listenFd = *(int *) arg;
+    static char buffer[1 << 16];
+
+    while (1) {
+        const int fd = accept(listenFd, NULL, NULL);
+        if (fd == -1) return NULL;
+        while (recv(fd, buffer, sizeof(buffer), 0) > 0) {
+        }
+        close(fd);
+    }
+}
+
+static int startSink(in_port_t *port) {
+    static int listenFd;
+    static pthread_t thread;
+    struct sockaddr_in addr = {0};
+    socklen_t len = sizeof(addr);
+
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listenFd == -1 || bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+        || listen(listenFd, 4) == -1 || getsockname(listenFd, (struct sockaddr *) &addr, &len) == -1) {
+        errnoPrint("sink");
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return pthread_create(&thread, NULL, sinkThread, &listenFd) == 0 ? 0 : -1;
+}
+
+static int connectTo(const char *host, const in_port_t port) {
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        errorPrint("Invalid IPv4 address: %s", host);
+        return -1;
+    }
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        errnoPrint("connect");
+        return -1;
+    }
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+static double seconds(const clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+//--- Sendet BENCH_BYTES in Frames der gegebenen Groesse, liefert CPU Nanosekunden pro Frame ---//
+static double measure(const char *host, const in_port_t port, const size_t frameSize, const size_t threshold,
+                      double *mbPerSec) {
+    const int fd = connectTo(host, port);
+    if (fd == -1) return -1;
+
+    zerocopySetThreshold(threshold);
+    ZeroCopyState zc;
+    zerocopyEnable(&zc, fd);
+
+    Frame *frame = malloc(sizeof(Frame) + frameSize);
+    frame->refs = 1;
+    frame->len = frameSize;
+    memset(frame->data, 'x', frameSize);
+
+    const unsigned long frames = BENCH_BYTES / frameSize;
+    const double wallStart = seconds(CLOCK_MONOTONIC);
+    const double cpuStart = seconds(CLOCK_THREAD_CPUTIME_ID);
+    for (unsigned long i = 0; i < frames; i++) {
+        if (zerocopySend(&zc, fd, frame) == -1) {
+            errnoPrint("send");
+            break;
+        }
+    }
+    const double cpu = seconds(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+    const double wall = seconds(CLOCK_MONOTONIC) - wallStart;
+
+    zerocopyRelease(&zc, fd);
+    frameRelease(frame);
+    close(fd);
+
+    *mbPerSec = (double) (frames * frameSize) / wall / 1e6;
+    return cpu * 1e9 / (double) frames;
+}
+
+int main(int argc, char **argv) {
+    utilInit(argv[0]);
+
+    const char *host = "127.0.0.1";
+    in_port_t port;
+    if (argc == 3) {
+        host = argv[1];
+        port = (in_port_t) atoi(argv[2]);
+    } else if (argc == 1) {
+        if (startSink(&port) == -1) return EXIT_FAILURE;
+        infoPrint("No target given, using local sink on port %u (kernel copies on loopback!)", port);
+    } else {
+        errorPrint("Usage: %s [HOST PORT]", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    normalPrint("%8s %14s %12s %14s %12s", "frame", "copy ns/frame", "copy MB/s", "zc ns/frame", "zc MB/s");
+    size_t crossover = 0;
+    for (size_t i = 0; i < sizeof(frameSizes) / sizeof(frameSizes[0]); i++) {
+        double copyRate;
+        double zcRate;
+        const double copyCpu = measure(host, port, frameSizes[i], 0, &copyRate);
+        const double zcCpu = measure(host, port, frameSizes[i], 1, &zcRate);
+        if (copyCpu < 0 || zcCpu < 0) return EXIT_FAILURE;
+
+        normalPrint("%8zu %14.0f %12.1f %14.0f %12.1f", frameSizes[i], copyCpu, copyRate, zcCpu, zcRate);
+        if (crossover == 0 && zcCpu < copyCpu) crossover = frameSizes[i];
+    }
+
+    if (crossover != 0) {
+        infoPrint("Zerocopy is cheaper from %zu byte frames on, use --zerocopy %zu", crossover, crossover);
+    } else {
+        infoPrint("Zerocopy did not pay off for any frame size, leave it disabled");
+    }
+    char line[256];
+    zerocopyStatsFormat(line, sizeof(line));
+    normalPrint("%s", line);
+    return EXIT_SUCCESS;
+}